@@ -16,13 +16,36 @@ fn main() {
     println!("cargo:rerun-if-changed=src/translator.cpp");
     println!("cargo:rerun-if-changed=src/generator.rs");
     println!("cargo:rerun-if-changed=src/generator.cpp");
+    println!("cargo:rerun-if-changed=src/whisper.rs");
+    println!("cargo:rerun-if-changed=src/whisper.cpp");
+    println!("cargo:rerun-if-changed=src/trace.rs");
+    println!("cargo:rerun-if-changed=src/profiler.rs");
+    println!("cargo:rerun-if-changed=src/profiler.cpp");
+    println!("cargo:rerun-if-changed=src/kernels.rs");
+    println!("cargo:rerun-if-changed=src/kernels.cpp");
+    println!("cargo:rerun-if-changed=src/bench_sampling.cpp");
+    println!("cargo:rerun-if-changed=include/batch_stats.h");
     println!("cargo:rerun-if-changed=include/convert.h");
     println!("cargo:rerun-if-changed=include/translator.h");
     println!("cargo:rerun-if-changed=include/generator.h");
+    println!("cargo:rerun-if-changed=include/model_memory.h");
+    println!("cargo:rerun-if-changed=include/probes.h");
+    println!("cargo:rerun-if-changed=include/step_timer.h");
+    println!("cargo:rerun-if-changed=include/step_callback.h");
+    println!("cargo:rerun-if-changed=include/perf_counters.h");
+    println!("cargo:rerun-if-changed=include/whisper.h");
+    println!("cargo:rerun-if-changed=include/trace.h");
+    println!("cargo:rerun-if-changed=include/profiler.h");
+    println!("cargo:rerun-if-changed=include/kernels.h");
+    println!("cargo:rerun-if-changed=include/bench_sampling.h");
     println!("cargo:rerun-if-changed=CTranslate2");
     println!("cargo:rerun-if-env-changed=LIBRARY_PATH");
 
     let target_os = env::var("CARGO_CFG_TARGET_OS").unwrap();
+    let tracing = env::var("CARGO_FEATURE_TRACING").is_ok();
+    let perf_counters = env::var("CARGO_FEATURE_PERF_COUNTERS").is_ok();
+    let profiling = env::var("CARGO_FEATURE_PROFILING").is_ok();
+    let kernels = env::var("CARGO_FEATURE_KERNELS").is_ok();
 
     let mut cmake = Config::new("CTranslate2");
     cmake
@@ -30,18 +53,24 @@ fn main() {
         .define("BUILD_SHARED_LIBS", "OFF")
         .define("WITH_MKL", "OFF")
         .define("OPENMP_RUNTIME", "NONE");
+    if profiling {
+        cmake.define("ENABLE_PROFILING", "ON");
+    }
 
-    match target_os.as_str() {
+    let gemm_backend = match target_os.as_str() {
         "macos" => {
             println!("cargo:rustc-link-lib=framework=Accelerate");
             cmake.define("WITH_ACCELERATE", "ON");
+            "accelerate"
         }
         "linux" => {
             link_static_library("openblas");
             cmake.define("WITH_OPENBLAS", "ON");
+            "openblas"
         }
-        _ => {}
-    }
+        _ => "none",
+    };
+    println!("cargo:rustc-env=CT2RS_GEMM_BACKEND={gemm_backend}");
 
     let ctranslate2 = cmake.build();
     println!(
@@ -55,12 +84,37 @@ fn main() {
     );
     println!("cargo:rustc-link-lib=static=cpu_features");
 
-    cxx_build::bridges(vec!["src/translator.rs", "src/generator.rs"])
+    let mut bridges = vec!["src/translator.rs", "src/generator.rs", "src/whisper.rs"];
+    if tracing {
+        bridges.push("src/trace.rs");
+    }
+    if profiling {
+        bridges.push("src/profiler.rs");
+    }
+    if kernels {
+        bridges.push("src/kernels.rs");
+    }
+
+    let mut build = cxx_build::bridges(bridges);
+    build
         .file("src/translator.cpp")
         .file("src/generator.cpp")
+        .file("src/whisper.cpp")
         .flag_if_supported("-std=c++17")
-        .include("CTranslate2/include")
-        .compile("ctranslator2");
+        .include("CTranslate2/include");
+    if profiling {
+        build.file("src/profiler.cpp");
+    }
+    if kernels {
+        build.file("src/kernels.cpp").file("src/bench_sampling.cpp");
+    }
+    if tracing {
+        build.define("CT2RS_TRACING", None);
+    }
+    if perf_counters {
+        build.define("CT2RS_PERF_COUNTERS", None);
+    }
+    build.compile("ctranslator2");
 }
 
 fn link_static_library<T: std::fmt::Display>(name: T) -> bool {
@@ -0,0 +1,21 @@
+// build.rs
+//
+// Copyright (c) 2023 Junpei Kawamoto
+//
+// This software is released under the MIT License.
+//
+// http://opensource.org/licenses/mit-license.php
+
+use std::env;
+
+fn main() {
+    println!("cargo:rerun-if-changed=build.rs");
+
+    // The allocs binary interposes malloc, which the shared C++ runtime resolves only if the
+    // binary exports it.
+    if env::var("CARGO_CFG_TARGET_OS").unwrap() == "linux"
+        && env::var("CARGO_CFG_TARGET_ENV").unwrap() == "gnu"
+    {
+        println!("cargo:rustc-link-arg-bin=allocs=-rdynamic");
+    }
+}
@@ -0,0 +1,123 @@
+// alloc.rs
+//
+// Copyright (c) 2023 Junpei Kawamoto
+//
+// This software is released under the MIT License.
+//
+// http://opensource.org/licenses/mit-license.php
+
+//! Heap usage of the process.
+//!
+//! Rust allocations are counted by [`CountingAllocator`] once a binary installs it as the global
+//! allocator:
+//!
+//! ```ignore
+//! #[global_allocator]
+//! static ALLOCATOR: CountingAllocator = CountingAllocator;
+//! ```
+//!
+//! Allocations of the C++ side are not seen by it; [`malloc_stats`] reports the state of the C
+//! allocator shared by both sides.
+
+use std::alloc::{GlobalAlloc, Layout, System};
+use std::sync::atomic::{AtomicUsize, Ordering};
+
+use serde::Serialize;
+
+static ALLOCATIONS: AtomicUsize = AtomicUsize::new(0);
+static DEALLOCATIONS: AtomicUsize = AtomicUsize::new(0);
+static LIVE_BYTES: AtomicUsize = AtomicUsize::new(0);
+
+/// Global allocator counting the allocations of Rust code on top of the system allocator.
+pub struct CountingAllocator;
+
+unsafe impl GlobalAlloc for CountingAllocator {
+    unsafe fn alloc(&self, layout: Layout) -> *mut u8 {
+        let ptr = System.alloc(layout);
+        if !ptr.is_null() {
+            ALLOCATIONS.fetch_add(1, Ordering::Relaxed);
+            LIVE_BYTES.fetch_add(layout.size(), Ordering::Relaxed);
+        }
+        ptr
+    }
+
+    unsafe fn alloc_zeroed(&self, layout: Layout) -> *mut u8 {
+        let ptr = System.alloc_zeroed(layout);
+        if !ptr.is_null() {
+            ALLOCATIONS.fetch_add(1, Ordering::Relaxed);
+            LIVE_BYTES.fetch_add(layout.size(), Ordering::Relaxed);
+        }
+        ptr
+    }
+
+    unsafe fn dealloc(&self, ptr: *mut u8, layout: Layout) {
+        System.dealloc(ptr, layout);
+        DEALLOCATIONS.fetch_add(1, Ordering::Relaxed);
+        LIVE_BYTES.fetch_sub(layout.size(), Ordering::Relaxed);
+    }
+
+    unsafe fn realloc(&self, ptr: *mut u8, layout: Layout, new_size: usize) -> *mut u8 {
+        let new_ptr = System.realloc(ptr, layout, new_size);
+        if !new_ptr.is_null() {
+            // A reallocation is counted as a new allocation replacing the old one.
+            ALLOCATIONS.fetch_add(1, Ordering::Relaxed);
+            DEALLOCATIONS.fetch_add(1, Ordering::Relaxed);
+            LIVE_BYTES.fetch_add(new_size, Ordering::Relaxed);
+            LIVE_BYTES.fetch_sub(layout.size(), Ordering::Relaxed);
+        }
+        new_ptr
+    }
+}
+
+/// Counts of Rust allocations since the process started.
+#[derive(Debug, Clone, Copy, Default, Serialize)]
+pub struct AllocCounts {
+    pub allocations: usize,
+    pub deallocations: usize,
+    /// Bytes requested by the allocations alive now.
+    pub live_bytes: usize,
+}
+
+impl AllocCounts {
+    /// Returns the number of allocations alive now.
+    pub fn live(&self) -> usize {
+        self.allocations.saturating_sub(self.deallocations)
+    }
+}
+
+/// Returns the counts of Rust allocations, all zero unless [`CountingAllocator`] is installed.
+pub fn alloc_counts() -> AllocCounts {
+    AllocCounts {
+        allocations: ALLOCATIONS.load(Ordering::Relaxed),
+        deallocations: DEALLOCATIONS.load(Ordering::Relaxed),
+        live_bytes: LIVE_BYTES.load(Ordering::Relaxed),
+    }
+}
+
+/// State of the C allocator.
+#[derive(Debug, Clone, Copy, Default, Serialize)]
+pub struct MallocStats {
+    /// Bytes of the allocated chunks, including those in mmapped regions.
+    pub in_use_bytes: u64,
+    /// Free bytes the allocator keeps instead of returning to the system.
+    pub cached_bytes: u64,
+    /// Bytes in mmapped regions.
+    pub mmapped_bytes: u64,
+}
+
+/// Returns the state of the C allocator (glibc only).
+#[cfg(all(target_os = "linux", target_env = "gnu"))]
+pub fn malloc_stats() -> Option<MallocStats> {
+    let info = unsafe { libc::mallinfo2() };
+    Some(MallocStats {
+        in_use_bytes: (info.uordblks + info.hblkhd) as u64,
+        cached_bytes: info.fordblks as u64,
+        mmapped_bytes: info.hblkhd as u64,
+    })
+}
+
+/// Returns the state of the C allocator (glibc only).
+#[cfg(not(all(target_os = "linux", target_env = "gnu")))]
+pub fn malloc_stats() -> Option<MallocStats> {
+    None
+}
@@ -0,0 +1,238 @@
+// allocs.rs
+//
+// Copyright (c) 2023 Junpei Kawamoto
+//
+// This software is released under the MIT License.
+//
+// http://opensource.org/licenses/mit-license.php
+
+//! Counts heap allocations per example of a fixed batch through the bridge.
+//!
+//! Rust allocations, which include the `rust::String` and `rust::Vec` values built by the C++
+//! side, are counted by the global allocator. Calls to `malloc`, `calloc`, `realloc`, and the
+//! aligned allocators `posix_memalign`, `aligned_alloc` and `memalign` from any code are counted
+//! by interposing them (glibc only); the C++ allocations are the difference. The
+//! fewest allocations over the iterations are compared with the given bounds and baseline, and
+//! the command fails when any of them is exceeded so that it can gate changes of the conversion
+//! code. Rust allocations are bounded by default, since the bridge allocates one string per output
+//! token and a few vectors per example whatever the model is; the C++ ones depend on the model
+//! and are only checked against `--max-cxx` or a baseline.
+
+use std::fs;
+
+use anyhow::{bail, Result};
+use clap::Parser;
+use serde::{Deserialize, Serialize};
+
+use ctranslate2::config::ComputeType;
+use ctranslate2_example_benchmark::alloc::{alloc_counts, CountingAllocator};
+use ctranslate2_example_benchmark::{synthetic_inputs, ModelArgs, RunOptions};
+
+/// Rust allocations per example allowed by default besides one per output token: the vectors of
+/// the input, the hypotheses and the scores, and the share of the example of those of the batch.
+const RUST_ALLOCATIONS_PER_EXAMPLE: f64 = 16.;
+
+#[global_allocator]
+static ALLOCATOR: CountingAllocator = CountingAllocator;
+
+/// Count heap allocations per example of a fixed batch through the bridge.
+#[derive(Parser, Debug)]
+#[command(author, version, about, long_about = None)]
+struct Args {
+    #[command(flatten)]
+    model: ModelArgs,
+    /// Number of examples in the batch.
+    #[arg(short, long, default_value_t = 16)]
+    batch_size: usize,
+    /// Number of tokens of each example.
+    #[arg(short, long, default_value_t = 16)]
+    length: usize,
+    /// Maximum number of tokens to decode.
+    #[arg(long, default_value_t = 16)]
+    max_decoding_length: usize,
+    /// Number of measured iterations; the fewest allocations are reported.
+    #[arg(short, long, default_value_t = 10)]
+    iterations: usize,
+    /// Token used to build the inputs.
+    #[arg(long, default_value = "a")]
+    token: String,
+    /// Token appended to each input, e.g. `</s>` for most translation models.
+    #[arg(long)]
+    eos: Option<String>,
+    /// Maximum number of Rust allocations per example [default: the maximum decoding length plus
+    /// 16].
+    #[arg(long)]
+    max_rust: Option<f64>,
+    /// Maximum number of C++ allocations per example.
+    #[arg(long)]
+    max_cxx: Option<f64>,
+    /// Path to a result saved by `--save` to compare with.
+    #[arg(long, value_name = "FILE")]
+    baseline: Option<String>,
+    /// Allowed growth over the baseline.
+    #[arg(long, default_value_t = 0.05)]
+    tolerance: f64,
+    /// Path to save the result to.
+    #[arg(long, value_name = "FILE")]
+    save: Option<String>,
+}
+
+/// Allocations per example.
+#[derive(Debug, Serialize, Deserialize)]
+struct Allocations {
+    rust: f64,
+    /// C++ allocations, if the allocator could be interposed.
+    cxx: Option<f64>,
+}
+
+fn main() -> Result<()> {
+    let args = Args::parse();
+    let runner = args.model.load(ComputeType::Default)?;
+    let inputs = synthetic_inputs(
+        &vec![args.length; args.batch_size],
+        &args.token,
+        args.eos.as_deref(),
+    );
+    let options = RunOptions {
+        beam_size: 1,
+        max_decoding_length: args.max_decoding_length,
+        max_batch_size: 0,
+    };
+
+    // Warm up so that one-time allocations such as caches are not counted.
+    runner.run(&inputs, &options)?;
+    let (mut rust, mut cxx) = (usize::MAX, usize::MAX);
+    for _ in 0..args.iterations.max(1) {
+        let (rust_before, total_before) = (alloc_counts().allocations, interpose::calls());
+        runner.run(&inputs, &options)?;
+        let n = alloc_counts().allocations - rust_before;
+        rust = rust.min(n);
+        cxx = cxx.min((interpose::calls() - total_before).saturating_sub(n));
+    }
+    let examples = args.batch_size.max(1) as f64;
+    let res = Allocations {
+        rust: rust as f64 / examples,
+        cxx: interpose::ENABLED.then(|| cxx as f64 / examples),
+    };
+    println!("{}", serde_json::to_string_pretty(&res)?);
+    if let Some(path) = &args.save {
+        fs::write(path, serde_json::to_string_pretty(&res)?)?;
+    }
+
+    let mut violations = Vec::new();
+    let mut check = |name: &str, value: Option<f64>, bound: Option<f64>| {
+        if let (Some(value), Some(bound)) = (value, bound) {
+            if value > bound {
+                violations.push(format!("{name}: {value:.1} > {bound:.1}"));
+            }
+        }
+    };
+    let max_rust = args
+        .max_rust
+        .unwrap_or(args.max_decoding_length as f64 + RUST_ALLOCATIONS_PER_EXAMPLE);
+    check("rust", Some(res.rust), Some(max_rust));
+    check("cxx", res.cxx, args.max_cxx);
+    if let Some(path) = &args.baseline {
+        let baseline: Allocations = serde_json::from_str(&fs::read_to_string(path)?)?;
+        let limit = |v: f64| v * (1. + args.tolerance);
+        check(
+            "rust (baseline)",
+            Some(res.rust),
+            Some(limit(baseline.rust)),
+        );
+        check("cxx (baseline)", res.cxx, baseline.cxx.map(limit));
+    }
+    if !violations.is_empty() {
+        bail!(
+            "too many allocations per example: {}",
+            violations.join(", ")
+        );
+    }
+    Ok(())
+}
+
+/// Interposes the C allocator to count its calls.
+///
+/// The definitions override those of libc in the whole process because build.rs exports them
+/// from this binary.
+#[cfg(all(target_os = "linux", target_env = "gnu"))]
+mod interpose {
+    use std::ffi::c_void;
+    use std::sync::atomic::{AtomicUsize, Ordering};
+
+    pub const ENABLED: bool = true;
+
+    static CALLS: AtomicUsize = AtomicUsize::new(0);
+
+    extern "C" {
+        fn __libc_malloc(size: usize) -> *mut c_void;
+        fn __libc_calloc(n: usize, size: usize) -> *mut c_void;
+        fn __libc_realloc(ptr: *mut c_void, size: usize) -> *mut c_void;
+        fn __libc_memalign(alignment: usize, size: usize) -> *mut c_void;
+    }
+
+    #[no_mangle]
+    pub unsafe extern "C" fn malloc(size: usize) -> *mut c_void {
+        CALLS.fetch_add(1, Ordering::Relaxed);
+        __libc_malloc(size)
+    }
+
+    #[no_mangle]
+    pub unsafe extern "C" fn calloc(n: usize, size: usize) -> *mut c_void {
+        CALLS.fetch_add(1, Ordering::Relaxed);
+        __libc_calloc(n, size)
+    }
+
+    #[no_mangle]
+    pub unsafe extern "C" fn realloc(ptr: *mut c_void, size: usize) -> *mut c_void {
+        CALLS.fetch_add(1, Ordering::Relaxed);
+        __libc_realloc(ptr, size)
+    }
+
+    // glibc does not export the other aligned allocators under a __libc_ name; all of them
+    // allocate with memalign.
+
+    #[no_mangle]
+    pub unsafe extern "C" fn posix_memalign(
+        ptr: *mut *mut c_void,
+        alignment: usize,
+        size: usize,
+    ) -> i32 {
+        CALLS.fetch_add(1, Ordering::Relaxed);
+        if !alignment.is_power_of_two() || alignment < std::mem::size_of::<*mut c_void>() {
+            return libc::EINVAL;
+        }
+        let res = __libc_memalign(alignment, size);
+        if res.is_null() {
+            return libc::ENOMEM;
+        }
+        *ptr = res;
+        0
+    }
+
+    #[no_mangle]
+    pub unsafe extern "C" fn aligned_alloc(alignment: usize, size: usize) -> *mut c_void {
+        CALLS.fetch_add(1, Ordering::Relaxed);
+        __libc_memalign(alignment, size)
+    }
+
+    #[no_mangle]
+    pub unsafe extern "C" fn memalign(alignment: usize, size: usize) -> *mut c_void {
+        CALLS.fetch_add(1, Ordering::Relaxed);
+        __libc_memalign(alignment, size)
+    }
+
+    /// Returns the number of calls to the C allocator since the process started.
+    pub fn calls() -> usize {
+        CALLS.load(Ordering::Relaxed)
+    }
+}
+
+#[cfg(not(all(target_os = "linux", target_env = "gnu")))]
+mod interpose {
+    pub const ENABLED: bool = false;
+
+    pub fn calls() -> usize {
+        0
+    }
+}
@@ -0,0 +1,292 @@
+// coldstart.rs
+//
+// Copyright (c) 2023 Junpei Kawamoto
+//
+// This software is released under the MIT License.
+//
+// http://opensource.org/licenses/mit-license.php
+
+//! Measures the time and memory to load a model from cold and warm page caches.
+//!
+//! Each load runs in a fresh child process so that neither the allocator nor the model of an
+//! earlier load affects it. Before a cold load, the model files are evicted from the page cache
+//! through `/proc/sys/vm/drop_caches` if permitted, falling back to `posix_fadvise` on each file.
+//!
+//! The loader does not expose its phases, so the breakdown is derived from the sweep: the file
+//! read is timed separately by reading the model files, replica creation is the extra load time
+//! per additional replica, and conversion is the extra load time over the `default` compute type,
+//! which keeps the weights as saved.
+
+use std::fs::{self, File};
+use std::io::{self, Read};
+use std::path::Path;
+use std::process::Command;
+use std::time::Instant;
+
+use anyhow::{bail, Result};
+use clap::{Parser, ValueEnum};
+use serde::{Deserialize, Serialize};
+
+use ctranslate2::config::{Config, Device};
+use ctranslate2_example_benchmark::{
+    parse_compute_type, peak_rss, reset_peak_rss, ModelKind, Runner,
+};
+
+#[derive(ValueEnum, Clone, Copy, Debug, PartialEq, Serialize)]
+#[serde(rename_all = "lowercase")]
+enum Cache {
+    Cold,
+    Warm,
+}
+
+/// Benchmark the time and memory to load a model.
+#[derive(Parser, Debug)]
+#[command(author, version, about, long_about = None)]
+struct Args {
+    /// Kind of the model.
+    #[arg(short, long, value_enum, default_value_t = ModelKind::Translator)]
+    model: ModelKind,
+    /// Use CUDA.
+    #[arg(long)]
+    cuda: bool,
+    /// Number of threads per replica (0 to use the default).
+    #[arg(short, long, default_value_t = 0)]
+    threads: usize,
+    /// Compute types to load the model with.
+    #[arg(long, value_delimiter = ',', default_value = "default,int8,float32")]
+    compute_types: Vec<String>,
+    /// Numbers of replicas to create.
+    #[arg(long, value_delimiter = ',', default_value = "1,2,4")]
+    replicas: Vec<usize>,
+    /// Page cache states to load from.
+    #[arg(long, value_enum, value_delimiter = ',', default_value = "cold,warm")]
+    cache: Vec<Cache>,
+    /// Number of loads of each combination; the fastest one is reported.
+    #[arg(short, long, default_value_t = 3)]
+    iterations: usize,
+    /// Print the results in JSON.
+    #[arg(long)]
+    json: bool,
+    /// Load the model once and print the measurement; used by the child processes.
+    #[arg(long, hide = true)]
+    child: bool,
+    /// Path to the directory that contains model.bin.
+    path: String,
+}
+
+/// Measurement of a load reported by a child process.
+#[derive(Debug, Serialize, Deserialize)]
+struct Load {
+    load_secs: f64,
+    peak_rss: Option<u64>,
+}
+
+#[derive(Debug, Serialize)]
+struct Row {
+    cache: Cache,
+    /// How the page cache was dropped before a cold load.
+    eviction: Option<&'static str>,
+    compute_type: String,
+    replicas: usize,
+    /// Time to read the model files.
+    read_secs: f64,
+    /// Time to create the translator or generator.
+    load_secs: f64,
+    /// Extra load time per replica over the fewest replicas measured.
+    replica_secs: Option<f64>,
+    /// Extra load time over the `default` compute type.
+    conversion_secs: Option<f64>,
+    /// Peak resident set size of the child process in bytes; host memory only.
+    peak_rss: Option<u64>,
+}
+
+fn main() -> Result<()> {
+    let args = Args::parse();
+    if args.child {
+        return child(&args);
+    }
+
+    let mut rows = Vec::new();
+    for &cache in &args.cache {
+        for compute_type in &args.compute_types {
+            parse_compute_type(compute_type)?;
+            for &replicas in &args.replicas {
+                let mut best: Option<Row> = None;
+                for _ in 0..args.iterations.max(1) {
+                    let eviction = if cache == Cache::Cold {
+                        evict(&args.path)?
+                    } else {
+                        None
+                    };
+                    let read_secs = read_files(&args.path)?;
+                    if cache == Cache::Cold {
+                        evict(&args.path)?;
+                    }
+                    let load = spawn_child(&args, compute_type, replicas)?;
+                    if !best.as_ref().is_some_and(|b| b.load_secs <= load.load_secs) {
+                        best = Some(Row {
+                            cache,
+                            eviction,
+                            compute_type: compute_type.clone(),
+                            replicas,
+                            read_secs,
+                            load_secs: load.load_secs,
+                            replica_secs: None,
+                            conversion_secs: None,
+                            peak_rss: load.peak_rss,
+                        });
+                    }
+                }
+                let row = best.unwrap();
+                eprintln!(
+                    "{:?} {} replicas={}: {:.3}s",
+                    row.cache, row.compute_type, row.replicas, row.load_secs
+                );
+                rows.push(row);
+            }
+        }
+    }
+
+    for i in 0..rows.len() {
+        let r = &rows[i];
+        let base = rows
+            .iter()
+            .filter(|b| b.cache == r.cache && b.compute_type == r.compute_type)
+            .min_by_key(|b| b.replicas)
+            .filter(|b| b.replicas < r.replicas)
+            .map(|b| (r.load_secs - b.load_secs) / (r.replicas - b.replicas) as f64);
+        let conversion = rows
+            .iter()
+            .find(|b| b.cache == r.cache && b.compute_type == "default" && b.replicas == r.replicas)
+            .filter(|_| r.compute_type != "default")
+            .map(|b| r.load_secs - b.load_secs);
+        rows[i].replica_secs = base;
+        rows[i].conversion_secs = conversion;
+    }
+
+    if args.json {
+        println!("{}", serde_json::to_string_pretty(&rows)?);
+        return Ok(());
+    }
+    let opt = |v: Option<f64>| v.map_or("-".to_string(), |v| format!("{v:.3}"));
+    println!(
+        "{:<5} {:<13} {:>8} {:>9} {:>9} {:>12} {:>15} {:>12}  eviction",
+        "cache",
+        "compute_type",
+        "replicas",
+        "read(s)",
+        "load(s)",
+        "replica(s)",
+        "conversion(s)",
+        "peak_rss(MB)"
+    );
+    for r in &rows {
+        println!(
+            "{:<5} {:<13} {:>8} {:>9.3} {:>9.3} {:>12} {:>15} {:>12}  {}",
+            format!("{:?}", r.cache).to_lowercase(),
+            r.compute_type,
+            r.replicas,
+            r.read_secs,
+            r.load_secs,
+            opt(r.replica_secs),
+            opt(r.conversion_secs),
+            r.peak_rss
+                .map_or("-".to_string(), |v| format!("{:.1}", v as f64 / 1048576.)),
+            r.eviction.unwrap_or("-")
+        );
+    }
+    Ok(())
+}
+
+/// Loads the model once in this process and prints the measurement.
+fn child(args: &Args) -> Result<()> {
+    let (Some(compute_type), Some(&replicas)) = (args.compute_types.first(), args.replicas.first())
+    else {
+        bail!("a compute type and a number of replicas are required");
+    };
+    reset_peak_rss();
+    let start = Instant::now();
+    let runner = Runner::load(
+        args.model,
+        &args.path,
+        if args.cuda { Device::CUDA } else { Device::CPU },
+        Config {
+            compute_type: parse_compute_type(compute_type)?,
+            device_indices: vec![0; replicas],
+            num_threads_per_replica: args.threads,
+            ..Config::default()
+        },
+    )?;
+    let load = Load {
+        load_secs: start.elapsed().as_secs_f64(),
+        peak_rss: peak_rss(),
+    };
+    drop(runner);
+    println!("{}", serde_json::to_string(&load)?);
+    Ok(())
+}
+
+/// Runs a child process loading the model with the given compute type and number of replicas.
+fn spawn_child(args: &Args, compute_type: &str, replicas: usize) -> Result<Load> {
+    let mut cmd = Command::new(std::env::current_exe()?);
+    cmd.arg("--child")
+        .args(["--model", &format!("{:?}", args.model).to_lowercase()])
+        .args(["--threads", &args.threads.to_string()])
+        .args(["--compute-types", compute_type])
+        .args(["--replicas", &replicas.to_string()]);
+    if args.cuda {
+        cmd.arg("--cuda");
+    }
+    let output = cmd.arg(&args.path).output()?;
+    if !output.status.success() {
+        bail!(
+            "failed to load the model: {}",
+            String::from_utf8_lossy(&output.stderr)
+        );
+    }
+    Ok(serde_json::from_slice(&output.stdout)?)
+}
+
+/// Reads every file of the model directory and returns the elapsed time in seconds.
+fn read_files<T: AsRef<Path>>(dir: T) -> Result<f64> {
+    let mut buf = vec![0u8; 1 << 20];
+    let start = Instant::now();
+    for entry in fs::read_dir(dir)? {
+        let path = entry?.path();
+        if path.is_file() {
+            let mut f = File::open(path)?;
+            while f.read(&mut buf)? > 0 {}
+        }
+    }
+    Ok(start.elapsed().as_secs_f64())
+}
+
+/// Drops the model files from the page cache and returns the method used, if any succeeded.
+fn evict<T: AsRef<Path>>(dir: T) -> Result<Option<&'static str>> {
+    if Command::new("sync").status().is_ok() && fs::write("/proc/sys/vm/drop_caches", "1").is_ok() {
+        return Ok(Some("drop_caches"));
+    }
+    let mut evicted = false;
+    for entry in fs::read_dir(dir)? {
+        let path = entry?.path();
+        if path.is_file() {
+            evicted |= fadvise_dont_need(&File::open(path)?).is_ok();
+        }
+    }
+    Ok(evicted.then_some("fadvise"))
+}
+
+#[cfg(target_os = "linux")]
+fn fadvise_dont_need(f: &File) -> io::Result<()> {
+    use std::os::unix::io::AsRawFd;
+
+    match unsafe { libc::posix_fadvise(f.as_raw_fd(), 0, 0, libc::POSIX_FADV_DONTNEED) } {
+        0 => Ok(()),
+        errno => Err(io::Error::from_raw_os_error(errno)),
+    }
+}
+
+#[cfg(not(target_os = "linux"))]
+fn fadvise_dont_need(_f: &File) -> io::Result<()> {
+    Err(io::ErrorKind::Unsupported.into())
+}
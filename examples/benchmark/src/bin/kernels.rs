@@ -0,0 +1,230 @@
+// kernels.rs
+//
+// Copyright (c) 2023 Junpei Kawamoto
+//
+// This software is released under the MIT License.
+//
+// http://opensource.org/licenses/mit-license.php
+
+//! Microbenchmarks of the CTranslate2 primitives at the shapes of a model.
+//!
+//! The shapes are taken from the variables of the loaded model: GEMM for each linear layer,
+//! gather for the embeddings, layer norm for each normalization, and softmax over the output
+//! vocabulary and the attention weights, each for the given numbers of tokens in a batch.
+//! Build with different backends, or set `CT2_FORCE_CPU_ISA`, to compare them. A kernel which
+//! fails, e.g. int8 GEMM on a backend without it, is reported and the others still run.
+
+use std::collections::BTreeSet;
+use std::time::Duration;
+
+use anyhow::{bail, Result};
+use clap::Parser;
+use serde::Serialize;
+
+use ctranslate2::config::ComputeType;
+use ctranslate2::kernels::{self, GEMM_BACKEND};
+use ctranslate2_example_benchmark::{detect_isa, parse_compute_type, ModelArgs};
+
+/// Benchmark the CTranslate2 primitives at the shapes of a model.
+#[derive(Parser, Debug)]
+#[command(author, version, about, long_about = None)]
+struct Args {
+    #[command(flatten)]
+    model: ModelArgs,
+    /// Compute type to load the model with, which decides the dtype of the GEMM benchmarks.
+    ///
+    /// Defaults to float32, which every backend and ISA supports.
+    #[arg(short, long, default_value = "float32")]
+    compute_type: String,
+    /// Numbers of tokens in a batch, i.e. the rows of the activations.
+    #[arg(long, value_delimiter = ',', default_value = "1,16,128")]
+    tokens: Vec<usize>,
+    /// Number of iterations of each benchmark.
+    #[arg(short, long, default_value_t = 20)]
+    iterations: usize,
+    /// Print the results in JSON.
+    #[arg(long)]
+    json: bool,
+}
+
+#[derive(Debug, Clone, PartialEq, Eq, PartialOrd, Ord)]
+enum Kernel {
+    Gemm {
+        m: usize,
+        n: usize,
+        k: usize,
+        int8: bool,
+    },
+    Softmax {
+        rows: usize,
+        cols: usize,
+    },
+    LayerNorm {
+        rows: usize,
+        cols: usize,
+    },
+    Gather {
+        vocabulary_size: usize,
+        dim: usize,
+        num_ids: usize,
+    },
+}
+
+impl Kernel {
+    fn run(&self, args: &Args) -> Result<Duration> {
+        let (device, n) = (args.model.device(), args.iterations);
+        match *self {
+            Kernel::Gemm {
+                m,
+                n: cols,
+                k,
+                int8,
+            } => kernels::gemm(m, cols, k, int8, device, n),
+            Kernel::Softmax { rows, cols } => kernels::softmax(rows, cols, device, n),
+            Kernel::LayerNorm { rows, cols } => kernels::layer_norm(rows, cols, device, n),
+            Kernel::Gather {
+                vocabulary_size,
+                dim,
+                num_ids,
+            } => kernels::gather(vocabulary_size, dim, num_ids, device, n),
+        }
+    }
+
+    /// Name and shape of the kernel.
+    fn describe(&self) -> (&'static str, String) {
+        match *self {
+            Kernel::Gemm { m, n, k, int8 } => (
+                if int8 { "gemm_int8" } else { "gemm_float32" },
+                format!("{m}x{k} * {k}x{n}"),
+            ),
+            Kernel::Softmax { rows, cols } => ("softmax", format!("{rows}x{cols}")),
+            Kernel::LayerNorm { rows, cols } => ("layer_norm", format!("{rows}x{cols}")),
+            Kernel::Gather {
+                vocabulary_size,
+                dim,
+                num_ids,
+            } => ("gather", format!("{num_ids} of {vocabulary_size}x{dim}")),
+        }
+    }
+
+    /// Number of floating point or integer operations.
+    fn flops(&self) -> Option<f64> {
+        match *self {
+            Kernel::Gemm { m, n, k, .. } => Some(2. * m as f64 * n as f64 * k as f64),
+            _ => None,
+        }
+    }
+
+    /// Minimum number of bytes read and written.
+    fn bytes(&self) -> f64 {
+        let bytes = match *self {
+            Kernel::Gemm { m, n, k, int8 } => {
+                let input = if int8 { 1 } else { 4 };
+                (m * k + n * k) * input + m * n * 4
+            }
+            Kernel::Softmax { rows, cols } => 2 * rows * cols * 4,
+            Kernel::LayerNorm { rows, cols } => 2 * rows * cols * 4 + 2 * cols * 4,
+            Kernel::Gather { dim, num_ids, .. } => 2 * num_ids * dim * 4 + num_ids * 4,
+        };
+        bytes as f64
+    }
+}
+
+#[derive(Debug, Serialize)]
+struct Row {
+    backend: &'static str,
+    isa: String,
+    kernel: &'static str,
+    shape: String,
+    micros: Option<f64>,
+    gflops: Option<f64>,
+    gb_per_sec: Option<f64>,
+    /// Error of the kernel if it failed.
+    error: Option<String>,
+}
+
+fn main() -> Result<()> {
+    let args = Args::parse();
+    let compute_type = parse_compute_type(&args.compute_type)?;
+    let int8 = matches!(compute_type, ComputeType::Int8 | ComputeType::Int8Float16);
+    let report = args.model.load(compute_type)?.memory_report();
+
+    let mut kernels = BTreeSet::new();
+    for v in &report.variables {
+        let (rows, cols) = match v.shape[..] {
+            [rows, cols] => (rows as usize, cols as usize),
+            [cols] => (1, cols as usize),
+            _ => continue,
+        };
+        for &m in &args.tokens {
+            if v.name.contains("embeddings") && v.name.ends_with("weight") {
+                kernels.insert(Kernel::Gather {
+                    vocabulary_size: rows,
+                    dim: cols,
+                    num_ids: m,
+                });
+            } else if v.name.ends_with("weight") && v.shape.len() == 2 {
+                kernels.insert(Kernel::Gemm {
+                    m,
+                    n: rows,
+                    k: cols,
+                    int8: int8 && v.dtype == "int8",
+                });
+                if v.name.ends_with("projection/weight") {
+                    kernels.insert(Kernel::Softmax {
+                        rows: m,
+                        cols: rows,
+                    });
+                }
+            } else if v.name.ends_with("gamma") {
+                kernels.insert(Kernel::LayerNorm { rows: m, cols });
+            }
+        }
+    }
+    for &m in &args.tokens {
+        kernels.insert(Kernel::Softmax { rows: m, cols: m });
+    }
+
+    let isa = std::env::var("CT2_FORCE_CPU_ISA").unwrap_or_else(|_| detect_isa().to_string());
+    let mut rows = Vec::new();
+    for kernel in kernels {
+        let (name, shape) = kernel.describe();
+        let elapsed = kernel.run(&args).map(|d| d.as_secs_f64());
+        let seconds = elapsed.as_ref().ok().copied();
+        let row = Row {
+            backend: GEMM_BACKEND,
+            isa: isa.clone(),
+            kernel: name,
+            shape,
+            micros: seconds.map(|t| t * 1e6),
+            gflops: seconds.and_then(|t| kernel.flops().map(|f| f / t / 1e9)),
+            gb_per_sec: seconds.map(|t| kernel.bytes() / t / 1e9),
+            error: elapsed.err().map(|err| format!("{err:#}")),
+        };
+        if !args.json {
+            match &row.error {
+                None => println!(
+                    "{:<13} {:<28} {:>10.1}us {:>9} GFLOP/s {:>8.2} GB/s",
+                    row.kernel,
+                    row.shape,
+                    row.micros.unwrap_or_default(),
+                    row.gflops.map_or("-".to_string(), |g| format!("{g:.1}")),
+                    row.gb_per_sec.unwrap_or_default()
+                ),
+                Some(err) => println!("{:<13} {:<28} failed: {err}", row.kernel, row.shape),
+            }
+        }
+        rows.push(row);
+    }
+
+    if args.json {
+        println!("{}", serde_json::to_string_pretty(&rows)?);
+    } else {
+        println!("backend: {GEMM_BACKEND}, isa: {isa}");
+    }
+    let failed = rows.iter().filter(|row| row.error.is_some()).count();
+    if failed > 0 {
+        bail!("{failed} of {} kernels failed", rows.len());
+    }
+    Ok(())
+}
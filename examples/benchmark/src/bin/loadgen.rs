@@ -0,0 +1,202 @@
+// loadgen.rs
+//
+// Copyright (c) 2023 Junpei Kawamoto
+//
+// This software is released under the MIT License.
+//
+// http://opensource.org/licenses/mit-license.php
+
+//! Replays a recorded trace of requests in open loop.
+//!
+//! Each line of the trace is a JSON object such as
+//!
+//! ```json
+//! {"timestamp_ms": 1687000000123, "source_lengths": [12, 31], "options": {"beam_size": 2}}
+//! ```
+//!
+//! Requests are sent at their recorded times divided by the speed-up factor, whether or not
+//! earlier requests have completed, so that a slow model builds up a queue as it would in
+//! production. A fixed pool of workers runs them; requests arriving while every worker is busy
+//! wait in a queue. Latencies are measured from the scheduled send time to avoid coordinated
+//! omission, so that wait counts.
+
+use std::fs::File;
+use std::io::{BufRead, BufReader};
+use std::sync::{mpsc, Mutex};
+use std::thread;
+use std::time::{Duration, Instant};
+
+use anyhow::Result;
+use clap::Parser;
+use serde::{Deserialize, Serialize};
+
+use ctranslate2::config::ComputeType;
+use ctranslate2_example_benchmark::{synthetic_inputs, LatencySummary, ModelArgs, RunOptions};
+
+/// Replay a recorded trace of requests against a model in open loop.
+#[derive(Parser, Debug)]
+#[command(author, version, about, long_about = None)]
+struct Args {
+    #[command(flatten)]
+    model: ModelArgs,
+    /// Path to the trace in the JSON Lines format.
+    #[arg(long, value_name = "FILE")]
+    trace: String,
+    /// Speed-up factor applied to the inter-arrival times of the trace.
+    #[arg(short, long, default_value_t = 1., value_parser = parse_speedup)]
+    speedup: f64,
+    /// Maximum number of requests in flight; the others wait for a free worker.
+    #[arg(short, long, default_value_t = 64)]
+    concurrency: usize,
+    /// Token used to build inputs of the recorded lengths.
+    #[arg(long, default_value = "a")]
+    token: String,
+    /// Token appended to each input, e.g. `</s>` for most translation models.
+    #[arg(long)]
+    eos: Option<String>,
+    /// Print the report in JSON.
+    #[arg(long)]
+    json: bool,
+}
+
+/// A request of the trace.
+#[derive(Debug, Deserialize)]
+struct TraceRecord {
+    /// Arrival time in milliseconds.
+    timestamp_ms: u64,
+    /// Number of tokens of each input in the request.
+    source_lengths: Vec<usize>,
+    /// Options of the request.
+    #[serde(default)]
+    options: RunOptions,
+}
+
+#[derive(Debug, Serialize)]
+struct Report {
+    requests: usize,
+    errors: usize,
+    duration_secs: f64,
+    requests_per_sec: f64,
+    examples_per_sec: f64,
+    output_tokens_per_sec: f64,
+    max_send_lag_ms: f64,
+    latency: LatencySummary,
+}
+
+/// A request to run at its scheduled time.
+struct Job<'a> {
+    record: &'a TraceRecord,
+    scheduled: Instant,
+    inputs: Vec<Vec<String>>,
+}
+
+struct Outcome {
+    latency: Duration,
+    examples: usize,
+    output_tokens: Option<usize>,
+}
+
+fn main() -> Result<()> {
+    let args = Args::parse();
+    let runner = args.model.load(ComputeType::Default)?;
+
+    let mut trace = BufReader::new(File::open(&args.trace)?)
+        .lines()
+        .filter(|line| !matches!(line, Ok(l) if l.trim().is_empty()))
+        .map(|line| Ok(serde_json::from_str::<TraceRecord>(&line?)?))
+        .collect::<Result<Vec<_>>>()?;
+    // Records are sent in order of arrival, which a merged trace may not be in.
+    trace.sort_by_key(|r| r.timestamp_ms);
+    let origin = trace.first().map_or(0, |r| r.timestamp_ms);
+
+    let (tx, rx) = mpsc::channel();
+    let (job_tx, job_rx) = mpsc::channel::<Job>();
+    let job_rx = Mutex::new(job_rx);
+    let mut max_send_lag = Duration::ZERO;
+    let start = Instant::now();
+    thread::scope(|s| {
+        for _ in 0..args.concurrency.max(1) {
+            let (runner, job_rx, tx) = (&runner, &job_rx, tx.clone());
+            s.spawn(move || loop {
+                let Ok(job) = job_rx.lock().unwrap().recv() else {
+                    break;
+                };
+                let res = runner.run(&job.inputs, &job.record.options);
+                let _ = tx.send(Outcome {
+                    latency: job.scheduled.elapsed(),
+                    examples: job.inputs.len(),
+                    output_tokens: res.ok().map(|r| r.iter().map(Vec::len).sum()),
+                });
+            });
+        }
+
+        for record in &trace {
+            let scheduled = start
+                + Duration::from_secs_f64(
+                    (record.timestamp_ms - origin) as f64 / 1000. / args.speedup,
+                );
+            let now = Instant::now();
+            if scheduled > now {
+                thread::sleep(scheduled - now);
+            } else {
+                max_send_lag = max_send_lag.max(now - scheduled);
+            }
+
+            let inputs = synthetic_inputs(&record.source_lengths, &args.token, args.eos.as_deref());
+            let _ = job_tx.send(Job {
+                record,
+                scheduled,
+                inputs,
+            });
+        }
+        // Workers stop once the queue is drained.
+        drop(job_tx);
+    });
+    let elapsed = start.elapsed().as_secs_f64();
+    drop(tx);
+
+    let outcomes = rx.into_iter().collect::<Vec<_>>();
+    let succeeded = outcomes
+        .iter()
+        .filter(|o| o.output_tokens.is_some())
+        .collect::<Vec<_>>();
+    let report = Report {
+        requests: outcomes.len(),
+        errors: outcomes.len() - succeeded.len(),
+        duration_secs: elapsed,
+        requests_per_sec: succeeded.len() as f64 / elapsed,
+        examples_per_sec: succeeded.iter().map(|o| o.examples).sum::<usize>() as f64 / elapsed,
+        output_tokens_per_sec: succeeded
+            .iter()
+            .filter_map(|o| o.output_tokens)
+            .sum::<usize>() as f64
+            / elapsed,
+        max_send_lag_ms: max_send_lag.as_secs_f64() * 1000.,
+        latency: LatencySummary::new(&succeeded.iter().map(|o| o.latency).collect::<Vec<_>>()),
+    };
+
+    if args.json {
+        println!("{}", serde_json::to_string_pretty(&report)?);
+    } else {
+        println!(
+            "requests: {} ({} errors) in {:.1}s",
+            report.requests, report.errors, report.duration_secs
+        );
+        println!(
+            "throughput: {:.2} req/s, {:.2} examples/s, {:.1} tokens/s",
+            report.requests_per_sec, report.examples_per_sec, report.output_tokens_per_sec
+        );
+        println!("latency: {}", report.latency);
+        println!("max send lag: {:.1}ms", report.max_send_lag_ms);
+    }
+    Ok(())
+}
+
+/// Parses a speed-up factor, which must be positive and finite.
+fn parse_speedup(s: &str) -> Result<f64, String> {
+    match s.parse::<f64>() {
+        Ok(v) if v > 0. && v.is_finite() => Ok(v),
+        Ok(_) => Err("must be positive and finite".to_string()),
+        Err(err) => Err(err.to_string()),
+    }
+}
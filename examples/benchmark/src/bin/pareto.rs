@@ -0,0 +1,299 @@
+// pareto.rs
+//
+// Copyright (c) 2023 Junpei Kawamoto
+//
+// This software is released under the MIT License.
+//
+// http://opensource.org/licenses/mit-license.php
+
+//! Measures speed and quality of a model across compute types and beam sizes.
+//!
+//! Every combination of the given compute types and beam sizes translates the whole test set.
+//! Quality is measured by BLEU and chrF against the reference if given, and by the ratio of
+//! outputs identical to the float32 output of the same beam size. A configuration which fails,
+//! e.g. a compute type the device does not support, is recorded with its error while the sweep
+//! continues.
+
+use std::fs::File;
+use std::io::{stdout, BufWriter, Write};
+use std::time::Instant;
+
+use anyhow::{ensure, Result};
+use clap::{Parser, ValueEnum};
+use serde::Serialize;
+
+use ctranslate2_example_benchmark::quality::{bleu, chrf, exact_match};
+use ctranslate2_example_benchmark::{
+    parse_compute_type, peak_rss, read_tokens, reset_peak_rss, LatencySummary, ModelArgs,
+    RunOptions, Runner,
+};
+
+#[derive(ValueEnum, Clone, Copy, Debug)]
+enum Format {
+    Json,
+    Csv,
+}
+
+/// Benchmark speed and quality of a model across compute types and beam sizes.
+#[derive(Parser, Debug)]
+#[command(author, version, about, long_about = None)]
+struct Args {
+    #[command(flatten)]
+    model: ModelArgs,
+    /// Path to the tokenized test set, one example per line.
+    #[arg(long, value_name = "FILE")]
+    source: String,
+    /// Path to the tokenized references, one example per line.
+    #[arg(long, value_name = "FILE")]
+    reference: Option<String>,
+    /// Compute types to benchmark.
+    #[arg(
+        long,
+        value_delimiter = ',',
+        default_value = "float32,int8,int8_float16,int16,float16"
+    )]
+    compute_types: Vec<String>,
+    /// Beam sizes to benchmark.
+    #[arg(long, value_delimiter = ',', default_value = "1,2,3,4,5")]
+    beam_sizes: Vec<usize>,
+    /// Number of examples in a request.
+    #[arg(short, long, default_value_t = 32)]
+    batch_size: usize,
+    /// Maximum number of tokens to decode.
+    #[arg(long, default_value_t = 256)]
+    max_decoding_length: usize,
+    /// Output format.
+    #[arg(short, long, value_enum, default_value_t = Format::Json)]
+    format: Format,
+    /// Path to the output file. If not specified, output to stdout.
+    #[arg(short, long, value_name = "FILE")]
+    output: Option<String>,
+}
+
+#[derive(Debug, Serialize)]
+struct Row {
+    compute_type: String,
+    beam_size: usize,
+    load_secs: Option<f64>,
+    tokens_per_sec: Option<f64>,
+    examples_per_sec: Option<f64>,
+    latency_p50_ms: Option<f64>,
+    latency_p99_ms: Option<f64>,
+    /// Peak resident set size in bytes while running the test set; host memory only.
+    peak_rss: Option<u64>,
+    bleu: Option<f64>,
+    chrf: Option<f64>,
+    /// Ratio of outputs identical to the float32 output of the same beam size.
+    exact_match: Option<f64>,
+    /// Whether no other row is both faster and of higher quality.
+    pareto: bool,
+    /// Error of the configuration if it failed.
+    error: Option<String>,
+}
+
+impl Row {
+    /// Row of a configuration which failed with the given error.
+    fn failed(compute_type: &str, beam_size: usize, load_secs: Option<f64>, error: String) -> Self {
+        eprintln!("{compute_type} beam={beam_size}: {error}");
+        Row {
+            compute_type: compute_type.to_string(),
+            beam_size,
+            load_secs,
+            tokens_per_sec: None,
+            examples_per_sec: None,
+            latency_p50_ms: None,
+            latency_p99_ms: None,
+            peak_rss: None,
+            bleu: None,
+            chrf: None,
+            exact_match: None,
+            pareto: false,
+            error: Some(error),
+        }
+    }
+
+    /// Quality used to find the Pareto front.
+    fn quality(&self) -> f64 {
+        self.bleu.or(self.exact_match).unwrap_or(0.)
+    }
+}
+
+/// Measurements of one configuration over the test set.
+struct Measurement {
+    outputs: Vec<Vec<String>>,
+    tokens_per_sec: f64,
+    examples_per_sec: f64,
+    latency: LatencySummary,
+    peak_rss: Option<u64>,
+    bleu: Option<f64>,
+    chrf: Option<f64>,
+    exact_match: Option<f64>,
+}
+
+/// Translates the test set with the given beam size and scores the outputs.
+fn measure(
+    runner: &Runner,
+    args: &Args,
+    source: &[Vec<String>],
+    reference: Option<&[Vec<String>]>,
+    baseline: Option<&[Vec<String>]>,
+    beam_size: usize,
+) -> Result<Measurement> {
+    let options = RunOptions {
+        beam_size,
+        max_decoding_length: args.max_decoding_length,
+        ..RunOptions::default()
+    };
+    let mut outputs = Vec::with_capacity(source.len());
+    let mut latencies = Vec::new();
+    reset_peak_rss();
+    let start = Instant::now();
+    for batch in source.chunks(args.batch_size.max(1)) {
+        let batch_start = Instant::now();
+        outputs.extend(runner.run(batch, &options)?);
+        latencies.push(batch_start.elapsed());
+    }
+    let elapsed = start.elapsed().as_secs_f64();
+    let peak_rss = peak_rss();
+
+    Ok(Measurement {
+        tokens_per_sec: outputs.iter().map(Vec::len).sum::<usize>() as f64 / elapsed,
+        examples_per_sec: outputs.len() as f64 / elapsed,
+        latency: LatencySummary::new(&latencies),
+        peak_rss,
+        bleu: reference.map(|r| bleu(&outputs, r)).transpose()?,
+        chrf: reference.map(|r| chrf(&outputs, r)).transpose()?,
+        exact_match: baseline.map(|b| exact_match(&outputs, b)).transpose()?,
+        outputs,
+    })
+}
+
+fn main() -> Result<()> {
+    let args = Args::parse();
+    let source = read_tokens(&args.source)?;
+    let reference = args.reference.as_ref().map(read_tokens).transpose()?;
+    if let Some(reference) = &reference {
+        ensure!(
+            reference.len() == source.len(),
+            "{} references for {} source lines",
+            reference.len(),
+            source.len()
+        );
+    }
+
+    // Run float32 first so that the other compute types can be compared with its outputs.
+    let mut compute_types = args.compute_types.clone();
+    compute_types.sort_by_key(|c| c != "float32");
+
+    let mut rows = Vec::new();
+    let mut baselines: Vec<(usize, Vec<Vec<String>>)> = Vec::new();
+    for name in &compute_types {
+        let start = Instant::now();
+        let runner = match parse_compute_type(name).and_then(|c| args.model.load(c)) {
+            Ok(runner) => runner,
+            Err(err) => {
+                for &beam_size in &args.beam_sizes {
+                    rows.push(Row::failed(name, beam_size, None, format!("{err:#}")));
+                }
+                continue;
+            }
+        };
+        let load_secs = start.elapsed().as_secs_f64();
+
+        for &beam_size in &args.beam_sizes {
+            let baseline = baselines
+                .iter()
+                .find(|(b, _)| *b == beam_size)
+                .map(|(_, outputs)| outputs.as_slice());
+            let m = match measure(
+                &runner,
+                &args,
+                &source,
+                reference.as_deref(),
+                baseline,
+                beam_size,
+            ) {
+                Ok(m) => m,
+                Err(err) => {
+                    let error = format!("{err:#}");
+                    rows.push(Row::failed(name, beam_size, Some(load_secs), error));
+                    continue;
+                }
+            };
+            eprintln!("{name} beam={beam_size}: {:.1} tokens/s", m.tokens_per_sec);
+            rows.push(Row {
+                compute_type: name.clone(),
+                beam_size,
+                load_secs: Some(load_secs),
+                tokens_per_sec: Some(m.tokens_per_sec),
+                examples_per_sec: Some(m.examples_per_sec),
+                latency_p50_ms: Some(m.latency.p50),
+                latency_p99_ms: Some(m.latency.p99),
+                peak_rss: m.peak_rss,
+                bleu: m.bleu,
+                chrf: m.chrf,
+                // float32 is the baseline itself, so its outputs all match.
+                exact_match: if name == "float32" {
+                    Some(1.)
+                } else {
+                    m.exact_match
+                },
+                pareto: false,
+                error: None,
+            });
+            if name == "float32" {
+                baselines.push((beam_size, m.outputs));
+            }
+        }
+    }
+
+    // Failed rows have no throughput, so they neither belong to nor dominate the front.
+    for i in 0..rows.len() {
+        let Some(speed) = rows[i].tokens_per_sec else {
+            continue;
+        };
+        let quality = rows[i].quality();
+        rows[i].pareto = !rows.iter().any(|other| {
+            other.tokens_per_sec.is_some_and(|s| {
+                s >= speed && other.quality() >= quality && (s > speed || other.quality() > quality)
+            })
+        });
+    }
+
+    let mut out: BufWriter<Box<dyn Write>> = BufWriter::new(match &args.output {
+        None => Box::new(stdout()),
+        Some(p) => Box::new(File::create(p)?),
+    });
+    match args.format {
+        Format::Json => writeln!(out, "{}", serde_json::to_string_pretty(&rows)?)?,
+        Format::Csv => {
+            writeln!(out, "compute_type,beam_size,load_secs,tokens_per_sec,examples_per_sec,latency_p50_ms,latency_p99_ms,peak_rss,bleu,chrf,exact_match,pareto,error")?;
+            let opt = |v: Option<f64>, precision: usize| {
+                v.map_or(String::new(), |v| format!("{v:.precision$}"))
+            };
+            for r in &rows {
+                writeln!(
+                    out,
+                    "{},{},{},{},{},{},{},{},{},{},{},{},{}",
+                    r.compute_type,
+                    r.beam_size,
+                    opt(r.load_secs, 3),
+                    opt(r.tokens_per_sec, 2),
+                    opt(r.examples_per_sec, 2),
+                    opt(r.latency_p50_ms, 2),
+                    opt(r.latency_p99_ms, 2),
+                    r.peak_rss.map_or(String::new(), |v| v.to_string()),
+                    opt(r.bleu, 4),
+                    opt(r.chrf, 4),
+                    opt(r.exact_match, 4),
+                    r.pareto,
+                    // Quote the error since it may contain commas.
+                    r.error
+                        .as_ref()
+                        .map_or(String::new(), |e| format!("\"{}\"", e.replace('"', "\"\""))),
+                )?;
+            }
+        }
+    }
+    Ok(())
+}
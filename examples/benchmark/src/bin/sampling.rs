@@ -0,0 +1,150 @@
+// sampling.rs
+//
+// Copyright (c) 2023 Junpei Kawamoto
+//
+// This software is released under the MIT License.
+//
+// http://opensource.org/licenses/mit-license.php
+
+//! Microbenchmarks of the logits processing and the candidate selection of sampling on CPU.
+//!
+//! For each vocabulary size and batch size, the operators random sampling runs at each step,
+//! `TopK` or `TopPMask` followed by softmax, are compared with the vectorized selection, which
+//! avoids sorting the vocabulary. The logits are drawn from a normal distribution, so the nucleus
+//! of top-p spans thousands of tokens of a large vocabulary.
+//!
+//! The logits processing enables `temperature`, `repetition_penalty`, `no_repeat_ngram_size`,
+//! `disable_unk`, and `suppress_sequences` one after another, and compares the logits processors of
+//! CTranslate2 with the fused pass.
+
+use anyhow::Result;
+use clap::Parser;
+use serde::Serialize;
+
+use ctranslate2::kernels;
+use ctranslate2_example_benchmark::detect_isa;
+
+/// Benchmark the logits processing and the candidate selection of sampling against the current
+/// implementations.
+#[derive(Parser, Debug)]
+#[command(author, version, about, long_about = None)]
+struct Args {
+    /// Vocabulary sizes, i.e. the number of logits of each row.
+    #[arg(long, value_delimiter = ',', default_value = "32000,128000,256000")]
+    vocabulary_sizes: Vec<usize>,
+    /// Batch sizes, i.e. the number of rows.
+    #[arg(long, value_delimiter = ',', default_value = "1,4,16")]
+    batch_sizes: Vec<usize>,
+    /// Values of sampling_topk to benchmark.
+    #[arg(long, value_delimiter = ',', default_value = "10,50")]
+    topk: Vec<usize>,
+    /// Values of sampling_topp to benchmark.
+    #[arg(long, value_delimiter = ',', default_value = "0.9,0.95")]
+    topp: Vec<f32>,
+    /// Number of previous tokens of each sequence for the logits processing.
+    #[arg(long, default_value_t = 256)]
+    history: usize,
+    /// Number of iterations of each benchmark.
+    #[arg(short, long, default_value_t = 20)]
+    iterations: usize,
+    /// Print the results in JSON.
+    #[arg(long)]
+    json: bool,
+}
+
+/// Number of options of the logits processing.
+const NUM_LOGITS_OPTIONS: usize = 5;
+
+#[derive(Debug, Serialize)]
+struct Row {
+    isa: String,
+    kernel: String,
+    vocabulary_size: usize,
+    batch_size: usize,
+    current_micros: f64,
+    vectorized_micros: f64,
+    speedup: f64,
+}
+
+fn main() -> Result<()> {
+    let args = Args::parse();
+    let isa = std::env::var("CT2_FORCE_CPU_ISA").unwrap_or_else(|_| detect_isa().to_string());
+
+    let mut rows = Vec::new();
+    for &cols in &args.vocabulary_sizes {
+        for &batch_size in &args.batch_sizes {
+            for num_options in 0..=NUM_LOGITS_OPTIONS {
+                let run = |fused| {
+                    kernels::logits_processing(
+                        batch_size,
+                        cols,
+                        args.history,
+                        num_options,
+                        fused,
+                        args.iterations,
+                    )
+                };
+                let kernel = format!("options={num_options}");
+                rows.push(row(&isa, kernel, cols, batch_size, run)?);
+            }
+            for &k in &args.topk {
+                let run = |vectorized| {
+                    kernels::sampling_topk(batch_size, cols, k, vectorized, args.iterations)
+                };
+                rows.push(row(&isa, format!("top_k={k}"), cols, batch_size, run)?);
+            }
+            for &p in &args.topp {
+                let run = |vectorized| {
+                    kernels::sampling_topp(batch_size, cols, p, vectorized, args.iterations)
+                };
+                rows.push(row(&isa, format!("top_p={p}"), cols, batch_size, run)?);
+            }
+        }
+    }
+
+    if args.json {
+        println!("{}", serde_json::to_string_pretty(&rows)?);
+        return Ok(());
+    }
+    println!(
+        "{:<12} {:>10} {:>6} {:>14} {:>14} {:>8}",
+        "kernel", "vocabulary", "batch", "current", "vectorized", "speedup"
+    );
+    for row in &rows {
+        println!(
+            "{:<12} {:>10} {:>6} {:>12.1}us {:>12.1}us {:>7.1}x",
+            row.kernel,
+            row.vocabulary_size,
+            row.batch_size,
+            row.current_micros,
+            row.vectorized_micros,
+            row.speedup
+        );
+    }
+    println!("isa: {isa}");
+    Ok(())
+}
+
+/// Runs the current and the vectorized implementations.
+fn row<F>(
+    isa: &str,
+    kernel: String,
+    vocabulary_size: usize,
+    batch_size: usize,
+    run: F,
+) -> Result<Row>
+where
+    F: Fn(bool) -> Result<std::time::Duration>,
+{
+    let current = run(false)?.as_secs_f64();
+    let vectorized = run(true)?.as_secs_f64();
+    Ok(Row {
+        isa: isa.to_string(),
+        kernel,
+        vocabulary_size,
+        batch_size,
+        current_micros: current * 1e6,
+        vectorized_micros: vectorized * 1e6,
+        speedup: current / vectorized,
+    })
+}
@@ -0,0 +1,218 @@
+// scaling.rs
+//
+// Copyright (c) 2023 Junpei Kawamoto
+//
+// This software is released under the MIT License.
+//
+// http://opensource.org/licenses/mit-license.php
+
+//! Sweeps replica and thread placements for a fixed workload.
+//!
+//! Every combination of the numbers of replicas, threads per replica and CPU core offsets runs
+//! the same synthetic workload from concurrent clients. Throughput and p99 latency are charted
+//! against the total number of cores, and the knee, the smallest number of cores reaching the
+//! given fraction of the best throughput, is flagged.
+
+use std::sync::atomic::{AtomicUsize, Ordering};
+use std::sync::Mutex;
+use std::thread;
+use std::time::Instant;
+
+use anyhow::Result;
+use clap::Parser;
+use serde::Serialize;
+
+use ctranslate2::config::{Config, Device};
+use ctranslate2_example_benchmark::{
+    parse_compute_type, synthetic_inputs, LatencySummary, ModelKind, RunOptions, Runner,
+};
+
+/// Sweep replica and thread placements for a fixed workload.
+#[derive(Parser, Debug)]
+#[command(author, version, about, long_about = None)]
+struct Args {
+    /// Kind of the model.
+    #[arg(short, long, value_enum, default_value_t = ModelKind::Translator)]
+    model: ModelKind,
+    /// Compute type of the model.
+    #[arg(short, long, default_value = "default")]
+    compute_type: String,
+    /// Numbers of replicas to sweep.
+    #[arg(long, value_delimiter = ',', default_value = "1,2,4")]
+    replicas: Vec<usize>,
+    /// Numbers of threads per replica to sweep.
+    #[arg(long, value_delimiter = ',', default_value = "1,2,4")]
+    threads: Vec<usize>,
+    /// CPU core offsets to sweep (-1 to leave the threads unpinned).
+    #[arg(
+        long,
+        value_delimiter = ',',
+        allow_negative_numbers = true,
+        default_value = "-1"
+    )]
+    core_offsets: Vec<i32>,
+    /// Number of requests of the workload.
+    #[arg(long, default_value_t = 200)]
+    requests: usize,
+    /// Number of examples in a request.
+    #[arg(short, long, default_value_t = 8)]
+    batch_size: usize,
+    /// Number of tokens of each example.
+    #[arg(short, long, default_value_t = 32)]
+    length: usize,
+    /// Maximum number of tokens to decode.
+    #[arg(long, default_value_t = 32)]
+    max_decoding_length: usize,
+    /// Number of concurrent clients per replica.
+    #[arg(long, default_value_t = 2)]
+    clients_per_replica: usize,
+    /// Token used to build the inputs.
+    #[arg(long, default_value = "a")]
+    token: String,
+    /// Token appended to each input, e.g. `</s>` for most translation models.
+    #[arg(long)]
+    eos: Option<String>,
+    /// Fraction of the best throughput which defines the knee.
+    #[arg(long, default_value_t = 0.9)]
+    knee: f64,
+    /// Print the results in JSON.
+    #[arg(long)]
+    json: bool,
+    /// Path to the directory that contains model.bin.
+    path: String,
+}
+
+#[derive(Debug, Serialize)]
+struct Row {
+    replicas: usize,
+    threads_per_replica: usize,
+    cpu_core_offset: i32,
+    total_cores: usize,
+    examples_per_sec: f64,
+    tokens_per_sec: f64,
+    latency: LatencySummary,
+    knee: bool,
+}
+
+fn main() -> Result<()> {
+    let args = Args::parse();
+    let inputs = synthetic_inputs(
+        &vec![args.length; args.batch_size],
+        &args.token,
+        args.eos.as_deref(),
+    );
+    let options = RunOptions {
+        max_decoding_length: args.max_decoding_length,
+        ..RunOptions::default()
+    };
+
+    let mut rows = Vec::new();
+    for &replicas in &args.replicas {
+        for &threads in &args.threads {
+            for &offset in &args.core_offsets {
+                let runner = Runner::load(
+                    args.model,
+                    &args.path,
+                    Device::CPU,
+                    Config {
+                        compute_type: parse_compute_type(&args.compute_type)?,
+                        device_indices: vec![0; replicas],
+                        num_threads_per_replica: threads,
+                        cpu_core_offset: offset,
+                        ..Config::default()
+                    },
+                )?;
+                // Warm up every replica before measuring.
+                thread::scope(|s| {
+                    for _ in 0..replicas {
+                        s.spawn(|| runner.run(&inputs, &options));
+                    }
+                });
+
+                let remaining = AtomicUsize::new(args.requests);
+                let latencies = Mutex::new(Vec::with_capacity(args.requests));
+                let output_tokens = AtomicUsize::new(0);
+                let start = Instant::now();
+                thread::scope(|s| {
+                    let clients = (0..replicas * args.clients_per_replica.max(1))
+                        .map(|_| {
+                            s.spawn(|| -> Result<()> {
+                                while remaining
+                                    .fetch_update(Ordering::Relaxed, Ordering::Relaxed, |n| {
+                                        n.checked_sub(1)
+                                    })
+                                    .is_ok()
+                                {
+                                    let request_start = Instant::now();
+                                    let res = runner.run(&inputs, &options)?;
+                                    latencies.lock().unwrap().push(request_start.elapsed());
+                                    output_tokens.fetch_add(
+                                        res.iter().map(Vec::len).sum(),
+                                        Ordering::Relaxed,
+                                    );
+                                }
+                                Ok(())
+                            })
+                        })
+                        .collect::<Vec<_>>();
+                    clients
+                        .into_iter()
+                        .try_for_each(|c| c.join().expect("client panicked"))
+                })?;
+                let elapsed = start.elapsed().as_secs_f64();
+
+                let row = Row {
+                    replicas,
+                    threads_per_replica: threads,
+                    cpu_core_offset: offset,
+                    total_cores: replicas * threads,
+                    examples_per_sec: (args.requests * args.batch_size) as f64 / elapsed,
+                    tokens_per_sec: output_tokens.into_inner() as f64 / elapsed,
+                    latency: LatencySummary::new(&latencies.into_inner().unwrap()),
+                    knee: false,
+                };
+                eprintln!(
+                    "replicas={replicas} threads={threads} offset={offset}: {:.1} examples/s, p99 {:.1}ms",
+                    row.examples_per_sec, row.latency.p99
+                );
+                rows.push(row);
+            }
+        }
+    }
+
+    rows.sort_by_key(|r| (r.total_cores, r.replicas, r.cpu_core_offset));
+    let best = rows.iter().map(|r| r.examples_per_sec).fold(0., f64::max);
+    if let Some(knee) = rows
+        .iter_mut()
+        .find(|r| r.examples_per_sec >= best * args.knee)
+    {
+        knee.knee = true;
+    }
+
+    if args.json {
+        println!("{}", serde_json::to_string_pretty(&rows)?);
+        return Ok(());
+    }
+    const WIDTH: f64 = 40.;
+    let max_p99 = rows.iter().map(|r| r.latency.p99).fold(0., f64::max);
+    println!(
+        "{:>5} {:>8} {:>7} {:>6}  {:<40} {:>12}  {:<40} {:>10}",
+        "cores", "replicas", "threads", "offset", "throughput", "examples/s", "p99 latency", "ms"
+    );
+    for r in &rows {
+        let bar = |v: f64, max: f64| "#".repeat((v / max * WIDTH).round() as usize);
+        println!(
+            "{:>5} {:>8} {:>7} {:>6}  {:<40} {:>12.1}  {:<40} {:>10.1}{}",
+            r.total_cores,
+            r.replicas,
+            r.threads_per_replica,
+            r.cpu_core_offset,
+            bar(r.examples_per_sec, best),
+            r.examples_per_sec,
+            bar(r.latency.p99, max_p99),
+            r.latency.p99,
+            if r.knee { "  <- knee" } else { "" }
+        );
+    }
+    Ok(())
+}
@@ -0,0 +1,284 @@
+// soak.rs
+//
+// Copyright (c) 2023 Junpei Kawamoto
+//
+// This software is released under the MIT License.
+//
+// http://opensource.org/licenses/mit-license.php
+
+//! Runs mixed traffic for a long time and checks that memory usage plateaus.
+//!
+//! Clients send requests of random batch sizes, lengths and beam sizes to a translator, a
+//! generator, or both, chosen at random. The resident set size, the state of the C allocator and
+//! the live Rust allocations are sampled periodically and written as JSON Lines. After the warm-up,
+//! the samples are split into halves, and the run fails if the peak of a metric in the second half
+//! exceeds its peak in the first half by more than the tolerance, i.e. memory keeps growing instead
+//! of reaching a plateau. The run also fails if any request fails.
+
+use std::fs::File;
+use std::io::{stdout, BufWriter, Write};
+use std::sync::atomic::{AtomicBool, AtomicUsize, Ordering};
+use std::thread;
+use std::time::{Duration, Instant};
+
+use anyhow::{bail, Result};
+use clap::Parser;
+use serde::Serialize;
+
+use ctranslate2::config::{ComputeType, Config, Device};
+use ctranslate2_example_benchmark::alloc::{alloc_counts, malloc_stats, CountingAllocator};
+use ctranslate2_example_benchmark::{rss, ModelKind, RunOptions, Runner};
+
+#[global_allocator]
+static ALLOCATOR: CountingAllocator = CountingAllocator;
+
+/// Run mixed traffic for a long time and check that memory usage plateaus.
+#[derive(Parser, Debug)]
+#[command(author, version, about, long_about = None)]
+struct Args {
+    /// Path to the directory that contains the translation model.
+    #[arg(long, value_name = "PATH")]
+    translator: Option<String>,
+    /// Path to the directory that contains the generation model.
+    #[arg(long, value_name = "PATH")]
+    generator: Option<String>,
+    /// Use CUDA.
+    #[arg(long)]
+    cuda: bool,
+    /// Number of threads per replica (0 to use the default).
+    #[arg(short, long, default_value_t = 0)]
+    threads: usize,
+    /// Number of replicas of each model.
+    #[arg(short, long, default_value_t = 1)]
+    replicas: usize,
+    /// Number of concurrent clients.
+    #[arg(short, long, default_value_t = 4)]
+    clients: usize,
+    /// Duration of the run in minutes.
+    #[arg(short, long, default_value_t = 240)]
+    duration: u64,
+    /// Minutes from the start during which samples are not checked.
+    #[arg(long, default_value_t = 10)]
+    warmup: u64,
+    /// Interval of the samples in seconds.
+    #[arg(short, long, default_value_t = 30)]
+    interval: u64,
+    /// Allowed growth of the peak of a metric between the halves of the run.
+    #[arg(long, default_value_t = 0.05)]
+    tolerance: f64,
+    /// Maximum number of examples in a request.
+    #[arg(long, default_value_t = 16)]
+    max_batch_size: usize,
+    /// Maximum number of tokens of an example.
+    #[arg(long, default_value_t = 64)]
+    max_length: usize,
+    /// Maximum beam size.
+    #[arg(long, default_value_t = 4)]
+    max_beam_size: usize,
+    /// Maximum number of tokens to decode.
+    #[arg(long, default_value_t = 64)]
+    max_decoding_length: usize,
+    /// Tokens to build the inputs from.
+    #[arg(long, value_delimiter = ',', default_value = "a")]
+    tokens: Vec<String>,
+    /// Token appended to each translation input, e.g. `</s>` for most translation models.
+    #[arg(long)]
+    eos: Option<String>,
+    /// Seed of the random shapes.
+    #[arg(long, default_value_t = 0)]
+    seed: u64,
+    /// Path to the output file of the samples. If not specified, output to stdout.
+    #[arg(short, long, value_name = "FILE")]
+    output: Option<String>,
+}
+
+#[derive(Debug, Serialize)]
+struct Sample {
+    elapsed_secs: f64,
+    requests: usize,
+    errors: usize,
+    rss: Option<u64>,
+    malloc_in_use: Option<u64>,
+    malloc_cached: Option<u64>,
+    rust_live_allocations: usize,
+    rust_live_bytes: usize,
+}
+
+impl Sample {
+    /// Names of the metrics checked for the plateau.
+    const METRICS: [&'static str; 5] = [
+        "rss",
+        "malloc_in_use",
+        "malloc_cached",
+        "rust_live_allocations",
+        "rust_live_bytes",
+    ];
+
+    /// Returns the values of the metrics named in [`Sample::METRICS`].
+    fn metrics(&self) -> [Option<u64>; 5] {
+        [
+            self.rss,
+            self.malloc_in_use,
+            self.malloc_cached,
+            Some(self.rust_live_allocations as u64),
+            Some(self.rust_live_bytes as u64),
+        ]
+    }
+}
+
+fn main() -> Result<()> {
+    let args = Args::parse();
+    let config = || Config {
+        compute_type: ComputeType::Default,
+        device_indices: vec![0; args.replicas],
+        num_threads_per_replica: args.threads,
+        ..Config::default()
+    };
+    let device = || if args.cuda { Device::CUDA } else { Device::CPU };
+    let mut runners = Vec::new();
+    if let Some(path) = &args.translator {
+        runners.push(Runner::load(
+            ModelKind::Translator,
+            path,
+            device(),
+            config(),
+        )?);
+    }
+    if let Some(path) = &args.generator {
+        runners.push(Runner::load(
+            ModelKind::Generator,
+            path,
+            device(),
+            config(),
+        )?);
+    }
+    if runners.is_empty() {
+        bail!("either --translator or --generator is required");
+    }
+
+    let mut out: BufWriter<Box<dyn Write>> = BufWriter::new(match &args.output {
+        None => Box::new(stdout()),
+        Some(p) => Box::new(File::create(p)?),
+    });
+    let requests = AtomicUsize::new(0);
+    let errors = AtomicUsize::new(0);
+    let done = AtomicBool::new(false);
+    let mut samples = Vec::new();
+    let start = Instant::now();
+    let deadline = start + Duration::from_secs(args.duration * 60);
+
+    thread::scope(|s| -> Result<()> {
+        for client in 0..args.clients.max(1) {
+            let (runners, requests, errors, done, args) =
+                (&runners, &requests, &errors, &done, &args);
+            s.spawn(move || {
+                let mut rng = SplitMix64(args.seed.wrapping_add(client as u64));
+                while !done.load(Ordering::Relaxed) {
+                    let runner = &runners[rng.below(runners.len())];
+                    let eos = match runner {
+                        Runner::Translator(_) => args.eos.as_deref(),
+                        Runner::Generator(_) => None,
+                    };
+                    let inputs = (0..1 + rng.below(args.max_batch_size.max(1)))
+                        .map(|_| {
+                            (0..1 + rng.below(args.max_length.max(1)))
+                                .map(|_| args.tokens[rng.below(args.tokens.len())].as_str())
+                                .chain(eos)
+                                .map(String::from)
+                                .collect()
+                        })
+                        .collect::<Vec<Vec<String>>>();
+                    let options = RunOptions {
+                        beam_size: 1 + rng.below(args.max_beam_size.max(1)),
+                        max_decoding_length: 1 + rng.below(args.max_decoding_length.max(1)),
+                        max_batch_size: 0,
+                    };
+                    if runner.run(&inputs, &options).is_err() {
+                        errors.fetch_add(1, Ordering::Relaxed);
+                    }
+                    requests.fetch_add(1, Ordering::Relaxed);
+                }
+            });
+        }
+
+        let interval = Duration::from_secs(args.interval.max(1));
+        let res = (|| -> Result<()> {
+            while Instant::now() < deadline {
+                thread::sleep(interval.min(deadline.saturating_duration_since(Instant::now())));
+                let malloc = malloc_stats();
+                let counts = alloc_counts();
+                let sample = Sample {
+                    elapsed_secs: start.elapsed().as_secs_f64(),
+                    requests: requests.load(Ordering::Relaxed),
+                    errors: errors.load(Ordering::Relaxed),
+                    rss: rss(),
+                    malloc_in_use: malloc.map(|m| m.in_use_bytes),
+                    malloc_cached: malloc.map(|m| m.cached_bytes),
+                    rust_live_allocations: counts.live(),
+                    rust_live_bytes: counts.live_bytes,
+                };
+                writeln!(out, "{}", serde_json::to_string(&sample)?)?;
+                out.flush()?;
+                samples.push(sample);
+            }
+            Ok(())
+        })();
+        done.store(true, Ordering::Relaxed);
+        res
+    })?;
+
+    let checked = samples
+        .iter()
+        .filter(|s| s.elapsed_secs >= (args.warmup * 60) as f64)
+        .collect::<Vec<_>>();
+    if checked.len() < 4 {
+        bail!("too few samples after the warm-up to check the plateau");
+    }
+    let (first, second) = checked.split_at(checked.len() / 2);
+    let mut growing = Vec::new();
+    for (i, name) in Sample::METRICS.iter().enumerate() {
+        let peak = |samples: &[&Sample]| samples.iter().filter_map(|s| s.metrics()[i]).max();
+        if let (Some(before), Some(after)) = (peak(first), peak(second)) {
+            let growth = after as f64 / before.max(1) as f64 - 1.;
+            eprintln!("{name}: peak {before} -> {after} ({:+.1}%)", growth * 100.);
+            if growth > args.tolerance {
+                growing.push(*name);
+            }
+        }
+    }
+    // The clients have stopped, so the counts include the requests after the last sample.
+    let errors = errors.load(Ordering::Relaxed);
+    eprintln!(
+        "{} requests, {errors} errors",
+        requests.load(Ordering::Relaxed)
+    );
+    let mut failures = Vec::new();
+    if !growing.is_empty() {
+        failures.push(format!("memory does not plateau: {}", growing.join(", ")));
+    }
+    if errors > 0 {
+        failures.push(format!("{errors} requests failed"));
+    }
+    if !failures.is_empty() {
+        bail!("{}", failures.join("; "));
+    }
+    Ok(())
+}
+
+/// Small pseudo-random number generator for the shapes of the requests.
+struct SplitMix64(u64);
+
+impl SplitMix64 {
+    fn next(&mut self) -> u64 {
+        self.0 = self.0.wrapping_add(0x9e3779b97f4a7c15);
+        let mut z = self.0;
+        z = (z ^ (z >> 30)).wrapping_mul(0xbf58476d1ce4e5b9);
+        z = (z ^ (z >> 27)).wrapping_mul(0x94d049bb133111eb);
+        z ^ (z >> 31)
+    }
+
+    /// Returns a number in `0..n`.
+    fn below(&mut self, n: usize) -> usize {
+        (self.next() % n as u64) as usize
+    }
+}
@@ -0,0 +1,302 @@
+// lib.rs
+//
+// Copyright (c) 2023 Junpei Kawamoto
+//
+// This software is released under the MIT License.
+//
+// http://opensource.org/licenses/mit-license.php
+
+//! Helpers shared by the benchmarks.
+
+use std::fs::{self, File};
+use std::io::{BufRead, BufReader};
+use std::path::Path;
+use std::time::Duration;
+
+use anyhow::{bail, Result};
+use clap::{Args, ValueEnum};
+use serde::{Deserialize, Serialize};
+
+use ctranslate2::config::{ComputeType, Config, Device};
+use ctranslate2::generator::{GenerationOptions, Generator};
+use ctranslate2::memory::MemoryReport;
+use ctranslate2::translator::{TranslationOptions, Translator};
+
+pub mod alloc;
+pub mod quality;
+
+/// Kind of a model.
+#[derive(ValueEnum, Clone, Copy, Debug)]
+pub enum ModelKind {
+    Translator,
+    Generator,
+}
+
+/// Arguments to load a model.
+#[derive(Args, Debug)]
+pub struct ModelArgs {
+    /// Kind of the model.
+    #[arg(short, long, value_enum, default_value_t = ModelKind::Translator)]
+    pub model: ModelKind,
+    /// Use CUDA.
+    #[arg(long)]
+    pub cuda: bool,
+    /// Number of threads per replica (0 to use the default).
+    #[arg(short, long, default_value_t = 0)]
+    pub threads: usize,
+    /// Number of replicas, placed on the same device.
+    #[arg(short, long, default_value_t = 1)]
+    pub replicas: usize,
+    /// Path to the directory that contains model.bin.
+    pub path: String,
+}
+
+impl ModelArgs {
+    /// Returns the device to use.
+    pub fn device(&self) -> Device {
+        if self.cuda {
+            Device::CUDA
+        } else {
+            Device::CPU
+        }
+    }
+
+    /// Returns the config with the given compute type.
+    pub fn config(&self, compute_type: ComputeType) -> Config {
+        Config {
+            compute_type,
+            device_indices: vec![0; self.replicas],
+            num_threads_per_replica: self.threads,
+            ..Config::default()
+        }
+    }
+
+    /// Loads the model with the given compute type.
+    pub fn load(&self, compute_type: ComputeType) -> Result<Runner> {
+        Runner::load(
+            self.model,
+            &self.path,
+            self.device(),
+            self.config(compute_type),
+        )
+    }
+}
+
+/// Parses the name of a compute type, e.g. `int8_float16`.
+pub fn parse_compute_type(name: &str) -> Result<ComputeType> {
+    Ok(match name {
+        "default" => ComputeType::Default,
+        "auto" => ComputeType::Auto,
+        "float32" => ComputeType::Float32,
+        "int8" => ComputeType::Int8,
+        "int8_float16" => ComputeType::Int8Float16,
+        "int16" => ComputeType::Int16,
+        "float16" => ComputeType::Float16,
+        _ => bail!("unknown compute type: {name}"),
+    })
+}
+
+/// Returns the best instruction set CTranslate2 dispatches to on this CPU.
+pub fn detect_isa() -> &'static str {
+    #[cfg(target_arch = "x86_64")]
+    {
+        if is_x86_feature_detected!("avx512f") {
+            return "AVX512";
+        } else if is_x86_feature_detected!("avx2") {
+            return "AVX2";
+        } else if is_x86_feature_detected!("avx") {
+            return "AVX";
+        }
+    }
+    #[cfg(target_arch = "aarch64")]
+    {
+        return "NEON";
+    }
+    #[allow(unreachable_code)]
+    "GENERIC"
+}
+
+/// Options of a request.
+#[derive(Debug, Clone, Serialize, Deserialize)]
+#[serde(default)]
+pub struct RunOptions {
+    /// Beam size (1 for greedy search).
+    pub beam_size: usize,
+    /// Maximum number of tokens to decode.
+    pub max_decoding_length: usize,
+    /// Maximum number of examples in a batch (0 for no limit).
+    pub max_batch_size: usize,
+}
+
+impl Default for RunOptions {
+    fn default() -> Self {
+        Self {
+            beam_size: 1,
+            max_decoding_length: 256,
+            max_batch_size: 0,
+        }
+    }
+}
+
+/// A translator or generator taking tokens.
+pub enum Runner {
+    Translator(Translator),
+    Generator(Generator),
+}
+
+impl Runner {
+    /// Loads a model.
+    pub fn load(kind: ModelKind, path: &str, device: Device, config: Config) -> Result<Runner> {
+        Ok(match kind {
+            ModelKind::Translator => Runner::Translator(Translator::new(path, device, config)?),
+            ModelKind::Generator => Runner::Generator(Generator::new(path, device, config)?),
+        })
+    }
+
+    /// Runs a batch of inputs and returns the best output of each input.
+    pub fn run(&self, inputs: &[Vec<String>], options: &RunOptions) -> Result<Vec<Vec<String>>> {
+        Ok(match self {
+            Runner::Translator(t) => t
+                .translate_batch(
+                    inputs,
+                    &Vec::<Vec<String>>::new(),
+                    &TranslationOptions {
+                        beam_size: options.beam_size,
+                        max_decoding_length: options.max_decoding_length,
+                        max_batch_size: options.max_batch_size,
+                        ..TranslationOptions::default()
+                    },
+                )?
+                .into_iter()
+                .map(|r| r.hypotheses.into_iter().next().unwrap_or_default())
+                .collect(),
+            Runner::Generator(g) => g
+                .generate_batch(
+                    inputs,
+                    &GenerationOptions {
+                        beam_size: options.beam_size,
+                        max_length: options.max_decoding_length,
+                        max_batch_size: options.max_batch_size,
+                        include_prompt_in_result: false,
+                        ..GenerationOptions::default()
+                    },
+                )?
+                .into_iter()
+                .map(|r| r.sequences.into_iter().next().unwrap_or_default())
+                .collect(),
+        })
+    }
+
+    /// Number of parallel replicas.
+    pub fn num_replicas(&self) -> usize {
+        match self {
+            Runner::Translator(t) => t.num_replicas(),
+            Runner::Generator(g) => g.num_replicas(),
+        }
+    }
+
+    /// Reports the memory used by the variables of the model.
+    pub fn memory_report(&self) -> MemoryReport {
+        match self {
+            Runner::Translator(t) => t.memory_report(),
+            Runner::Generator(g) => g.memory_report(),
+        }
+    }
+}
+
+/// Builds inputs of the given lengths by repeating a token, followed by the end token if given.
+pub fn synthetic_inputs(lengths: &[usize], token: &str, eos: Option<&str>) -> Vec<Vec<String>> {
+    lengths
+        .iter()
+        .map(|n| {
+            std::iter::repeat(token)
+                .take(*n)
+                .chain(eos)
+                .map(String::from)
+                .collect()
+        })
+        .collect()
+}
+
+/// Reads a tokenized file which has one example per line with tokens separated by spaces.
+pub fn read_tokens<T: AsRef<Path>>(path: T) -> Result<Vec<Vec<String>>> {
+    BufReader::new(File::open(path)?)
+        .lines()
+        .map(|line| Ok(line?.split_whitespace().map(String::from).collect()))
+        .collect()
+}
+
+/// Resets the peak resident set size of this process (Linux only).
+pub fn reset_peak_rss() {
+    let _ = fs::write("/proc/self/clear_refs", "5");
+}
+
+/// Returns the peak resident set size of this process in bytes (Linux only).
+pub fn peak_rss() -> Option<u64> {
+    status_bytes("VmHWM:")
+}
+
+/// Returns the resident set size of this process in bytes (Linux only).
+pub fn rss() -> Option<u64> {
+    status_bytes("VmRSS:")
+}
+
+fn status_bytes(field: &str) -> Option<u64> {
+    fs::read_to_string("/proc/self/status")
+        .ok()?
+        .lines()
+        .find_map(|line| line.strip_prefix(field))?
+        .trim()
+        .strip_suffix("kB")?
+        .trim()
+        .parse::<u64>()
+        .ok()
+        .map(|kb| kb * 1024)
+}
+
+/// Summary of latencies in milliseconds.
+#[derive(Debug, Clone, Default, Serialize)]
+pub struct LatencySummary {
+    pub count: usize,
+    pub mean: f64,
+    pub p50: f64,
+    pub p90: f64,
+    pub p99: f64,
+    pub p999: f64,
+    pub max: f64,
+}
+
+impl LatencySummary {
+    /// Summarizes the given latencies.
+    pub fn new(latencies: &[Duration]) -> Self {
+        if latencies.is_empty() {
+            return Self::default();
+        }
+        let mut ms = latencies
+            .iter()
+            .map(|d| d.as_secs_f64() * 1000.)
+            .collect::<Vec<_>>();
+        ms.sort_by(f64::total_cmp);
+        let percentile =
+            |p: f64| ms[((ms.len() as f64 * p).ceil() as usize).clamp(1, ms.len()) - 1];
+        Self {
+            count: ms.len(),
+            mean: ms.iter().sum::<f64>() / ms.len() as f64,
+            p50: percentile(0.5),
+            p90: percentile(0.9),
+            p99: percentile(0.99),
+            p999: percentile(0.999),
+            max: ms[ms.len() - 1],
+        }
+    }
+}
+
+impl std::fmt::Display for LatencySummary {
+    fn fmt(&self, f: &mut std::fmt::Formatter<'_>) -> std::fmt::Result {
+        write!(
+            f,
+            "n={} mean={:.1}ms p50={:.1}ms p90={:.1}ms p99={:.1}ms p99.9={:.1}ms max={:.1}ms",
+            self.count, self.mean, self.p50, self.p90, self.p99, self.p999, self.max
+        )
+    }
+}
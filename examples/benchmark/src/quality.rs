@@ -0,0 +1,139 @@
+// quality.rs
+//
+// Copyright (c) 2023 Junpei Kawamoto
+//
+// This software is released under the MIT License.
+//
+// http://opensource.org/licenses/mit-license.php
+
+//! Corpus-level quality metrics over tokenized outputs.
+
+use std::collections::HashMap;
+use std::hash::Hash;
+
+use anyhow::{ensure, Result};
+
+/// Computes the corpus BLEU score (0–100) of the hypotheses over the tokens as given.
+///
+/// Fails if the numbers of hypotheses and references differ.
+pub fn bleu(hypotheses: &[Vec<String>], references: &[Vec<String>]) -> Result<f64> {
+    check_lengths(hypotheses, references)?;
+    const MAX_ORDER: usize = 4;
+    let mut matches = [0usize; MAX_ORDER];
+    let mut totals = [0usize; MAX_ORDER];
+    let (mut hyp_len, mut ref_len) = (0, 0);
+    for (hyp, reference) in hypotheses.iter().zip(references) {
+        hyp_len += hyp.len();
+        ref_len += reference.len();
+        for n in 1..=MAX_ORDER {
+            let (m, t) = overlap(&ngrams(hyp, n), &ngrams(reference, n));
+            matches[n - 1] += m;
+            totals[n - 1] += t;
+        }
+    }
+    if hyp_len == 0 || matches.contains(&0) {
+        return Ok(0.);
+    }
+
+    let log_precision = matches
+        .iter()
+        .zip(totals)
+        .map(|(m, t)| (*m as f64 / t as f64).ln())
+        .sum::<f64>()
+        / MAX_ORDER as f64;
+    let brevity_penalty = if hyp_len < ref_len {
+        (1. - ref_len as f64 / hyp_len as f64).exp()
+    } else {
+        1.
+    };
+    Ok(100. * brevity_penalty * log_precision.exp())
+}
+
+/// Computes the corpus chrF score (0–100) of the hypotheses on the characters of the tokens,
+/// ignoring whitespace and the SentencePiece word boundary marker.
+///
+/// Fails if the numbers of hypotheses and references differ.
+pub fn chrf(hypotheses: &[Vec<String>], references: &[Vec<String>]) -> Result<f64> {
+    check_lengths(hypotheses, references)?;
+    const MAX_ORDER: usize = 6;
+    const BETA: f64 = 2.;
+    let chars = |tokens: &Vec<String>| {
+        tokens
+            .iter()
+            .flat_map(|t| t.chars())
+            .filter(|c| !c.is_whitespace() && *c != '▁')
+            .collect::<Vec<_>>()
+    };
+
+    let mut stats = [(0usize, 0usize, 0usize); MAX_ORDER];
+    for (hyp, reference) in hypotheses.iter().zip(references) {
+        let (hyp, reference) = (chars(hyp), chars(reference));
+        for n in 1..=MAX_ORDER {
+            let (h, r) = (ngrams(&hyp, n), ngrams(&reference, n));
+            let (m, t) = overlap(&h, &r);
+            stats[n - 1].0 += m;
+            stats[n - 1].1 += t;
+            stats[n - 1].2 += r.values().sum::<usize>();
+        }
+    }
+
+    let (mut precision, mut recall) = (0., 0.);
+    for (m, h, r) in stats {
+        precision += if h == 0 { 0. } else { m as f64 / h as f64 };
+        recall += if r == 0 { 0. } else { m as f64 / r as f64 };
+    }
+    precision /= MAX_ORDER as f64;
+    recall /= MAX_ORDER as f64;
+    if precision + recall == 0. {
+        return Ok(0.);
+    }
+    let beta2 = BETA * BETA;
+    Ok(100. * (1. + beta2) * precision * recall / (beta2 * precision + recall))
+}
+
+/// Returns the ratio of hypotheses identical to the references.
+///
+/// Fails if the numbers of hypotheses and references differ.
+pub fn exact_match(hypotheses: &[Vec<String>], references: &[Vec<String>]) -> Result<f64> {
+    check_lengths(hypotheses, references)?;
+    if hypotheses.is_empty() {
+        return Ok(0.);
+    }
+    Ok(hypotheses
+        .iter()
+        .zip(references)
+        .filter(|(h, r)| h == r)
+        .count() as f64
+        / hypotheses.len() as f64)
+}
+
+/// Ensures every hypothesis has a reference, since zipping would silently drop the rest.
+fn check_lengths(hypotheses: &[Vec<String>], references: &[Vec<String>]) -> Result<()> {
+    ensure!(
+        hypotheses.len() == references.len(),
+        "{} hypotheses for {} references",
+        hypotheses.len(),
+        references.len()
+    );
+    Ok(())
+}
+
+fn ngrams<T: Eq + Hash>(tokens: &[T], n: usize) -> HashMap<&[T], usize> {
+    let mut res = HashMap::new();
+    for w in tokens.windows(n) {
+        *res.entry(w).or_insert(0) += 1;
+    }
+    res
+}
+
+/// Returns the clipped number of matching n-grams and the number of n-grams of the hypothesis.
+fn overlap<T: Eq + Hash>(
+    hyp: &HashMap<&[T], usize>,
+    reference: &HashMap<&[T], usize>,
+) -> (usize, usize) {
+    let matches = hyp
+        .iter()
+        .map(|(g, c)| (*c).min(reference.get(g).copied().unwrap_or(0)))
+        .sum();
+    (matches, hyp.values().sum())
+}
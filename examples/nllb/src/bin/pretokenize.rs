@@ -0,0 +1,62 @@
+// pretokenize.rs
+//
+// Copyright (c) 2023 Junpei Kawamoto
+//
+// This software is released under the MIT License.
+//
+// http://opensource.org/licenses/mit-license.php
+
+use std::fs::File;
+use std::io::BufWriter;
+use std::path::Path;
+
+use anyhow::{anyhow, Result};
+use clap::Parser;
+use tokenizers::Tokenizer;
+
+use ctranslate2::corpus::{pretokenize, CorpusWriter, Vocabulary, DEFAULT_CHUNK_SEQUENCES};
+use ctranslate2_example_nllb::stream;
+
+/// Convert a text file into a corpus of token ids, which the translator reads without tokenizing
+/// it again.
+#[derive(Parser, Debug)]
+#[command(author, version, about, long_about = None)]
+struct Args {
+    /// Path to the output file.
+    #[arg(short, long, value_name = "FILE")]
+    output: String,
+    /// Path to the file contains prompts.
+    #[arg(short, long, value_name = "FILE", default_value = "prompt.txt")]
+    prompt: String,
+    /// Number of sequences of each chunk.
+    #[arg(long, value_name = "NUM", default_value_t = DEFAULT_CHUNK_SEQUENCES)]
+    chunk_sequences: usize,
+    /// Compresses the chunks with zstd at the given level.
+    #[arg(short, long, value_name = "LEVEL")]
+    zstd: Option<i32>,
+    /// Number of threads decompressing the prompts.
+    #[arg(long, value_name = "NUM", default_value_t = stream::default_threads())]
+    threads: usize,
+    /// Path to the directory that contains tokenizer.json.
+    path: String,
+}
+
+fn main() -> Result<()> {
+    let args = Args::parse();
+    let tokenizer = Tokenizer::from_file(Path::new(&args.path).join("tokenizer.json"))
+        .map_err(|err| anyhow!("failed to load a tokenizer: {err}"))?;
+
+    let writer = CorpusWriter::new(
+        BufWriter::new(File::create(&args.output)?),
+        Vocabulary::from_tokenizer(&tokenizer).fingerprint(),
+        args.chunk_sequences,
+        args.zstd,
+    )?;
+    pretokenize(
+        &tokenizer,
+        stream::open(&args.prompt, args.threads)?,
+        writer,
+    )?;
+
+    Ok(())
+}
@@ -6,17 +6,19 @@
 //
 // http://opensource.org/licenses/mit-license.php
 
-use std::fs::File;
-use std::io;
-use std::io::{stdout, BufRead, BufReader, BufWriter, Write};
+use std::io::{self, BufRead, Write};
 
 use anyhow::Result;
 use clap::Parser;
 
 use ctranslate2::config::{Config, Device};
+use ctranslate2::corpus::Corpus;
 use ctranslate2::Translator;
+use ctranslate2_example_nllb::stream;
 
 /// Translate a file using NLLB.
+///
+/// Files whose names end with `.gz` or `.zst` are decompressed and compressed in background threads.
 #[derive(Parser, Debug)]
 #[command(author, version, about, long_about = None)]
 struct Args {
@@ -29,6 +31,18 @@ struct Args {
     /// Target language.
     #[arg(short, long, value_name = "LANG", default_value = "jpn_Jpan")]
     target: String,
+    /// Path to a corpus converted by pretokenize, translated instead of the prompts.
+    #[arg(short, long, value_name = "FILE")]
+    corpus: Option<String>,
+    /// Number of lines translated at a time.
+    #[arg(short, long, value_name = "NUM", default_value_t = 32)]
+    batch_size: usize,
+    /// Number of threads (de)compressing files.
+    #[arg(long, value_name = "NUM", default_value_t = stream::default_threads())]
+    threads: usize,
+    /// Compression level of the output.
+    #[arg(short, long, value_name = "LEVEL")]
+    level: Option<i32>,
     /// Path to the directory that contains model.bin.
     path: String,
 }
@@ -36,20 +50,35 @@ struct Args {
 fn main() -> Result<()> {
     let args = Args::parse();
     let t = Translator::new(args.path, Device::CPU, Config::default())?;
+    let mut out = stream::create(args.output.as_deref(), args.threads, args.level)?;
+
+    if let Some(corpus) = args.corpus {
+        let corpus = Corpus::open(corpus)?;
+        t.translate_corpus(
+            &corpus,
+            &[args.target],
+            &Default::default(),
+            args.batch_size,
+            |r, _| Ok(writeln!(out, "{r}")?),
+        )?;
+        return Ok(out.finish()?);
+    }
 
-    let sources = BufReader::new(File::open(args.prompt)?)
-        .lines()
-        .collect::<Result<Vec<String>, io::Error>>()?;
-    let target_prefixes = vec![vec![args.target]; sources.len()];
-
-    let res = t.translate_batch(sources, target_prefixes, &Default::default())?;
-    let mut out: BufWriter<Box<dyn Write>> = BufWriter::new(match args.output {
-        None => Box::new(stdout()),
-        Some(p) => Box::new(File::create(p)?),
-    });
-    for (r, _) in res {
-        writeln!(out, "{r}")?;
+    // The next lines are decompressed and the last translations compressed while translating.
+    let mut lines = stream::open(args.prompt, args.threads)?.lines();
+    loop {
+        let sources = lines
+            .by_ref()
+            .take(args.batch_size.max(1))
+            .collect::<Result<Vec<String>, io::Error>>()?;
+        if sources.is_empty() {
+            break;
+        }
+        let target_prefixes = vec![vec![args.target.clone()]; sources.len()];
+        for (r, _) in t.translate_batch(sources, target_prefixes, &Default::default())? {
+            writeln!(out, "{r}")?;
+        }
     }
 
-    Ok(())
+    Ok(out.finish()?)
 }
@@ -0,0 +1,464 @@
+// stream.rs
+//
+// Copyright (c) 2023 Junpei Kawamoto
+//
+// This software is released under the MIT License.
+//
+// http://opensource.org/licenses/mit-license.php
+
+//! Files compressed with gzip or zstd, (de)compressed in background threads while the translator
+//! runs.
+//!
+//! The compressed data are cut into independent blocks processed by a pool of threads and put back
+//! in order. On read, a block is a group of zstd frames or of gzip members carrying their size in
+//! a BGZF `BC` extra field, as written by `bgzip` and by [`create`]. A stream which cannot be cut
+//! this way, e.g. a file compressed by `gzip` or `zstd` into a single member or frame, is
+//! decompressed by one background thread instead. On write, every block becomes a zstd frame or a
+//! series of BGZF members, so that the output is read back in parallel and by the usual tools.
+
+use std::collections::BTreeMap;
+use std::fs::File;
+use std::io::{self, stdout, BufRead, BufReader, BufWriter, Cursor, Read, Write};
+use std::mem;
+use std::path::Path;
+use std::sync::mpsc::{sync_channel, Receiver, SyncSender};
+use std::sync::{Arc, Mutex};
+use std::thread::{self, JoinHandle};
+
+use flate2::read::MultiGzDecoder;
+use flate2::write::DeflateEncoder;
+use flate2::{Compression, Crc};
+
+/// Size of the uncompressed data of a block, and roughly of the compressed data of a block read.
+const BLOCK_SIZE: usize = 1 << 20;
+/// Size from which a zstd frame is decompressed by one thread, instead of read whole.
+const MAX_FRAME_SIZE: usize = 16 << 20;
+/// Size of the uncompressed data of a BGZF member, which keeps the member below 64 KiB.
+const BGZF_DATA_SIZE: usize = 0xff00;
+/// Empty BGZF member marking the end of a file.
+const BGZF_EOF: [u8; 28] = [
+    0x1f, 0x8b, 8, 4, 0, 0, 0, 0, 0, 0xff, 6, 0, b'B', b'C', 2, 0, 0x1b, 0, 3, 0, 0, 0, 0, 0, 0, 0,
+    0, 0,
+];
+const ZSTD_MAGIC: u32 = 0xfd2f_b528;
+
+/// Compression of a file.
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+pub enum Format {
+    Plain,
+    Gzip,
+    Zstd,
+}
+
+impl Format {
+    /// Returns the format of the given path from its extension.
+    pub fn from_path<P: AsRef<Path>>(path: P) -> Self {
+        match path.as_ref().extension().and_then(|e| e.to_str()) {
+            Some("gz") => Format::Gzip,
+            Some("zst") => Format::Zstd,
+            _ => Format::Plain,
+        }
+    }
+}
+
+/// Returns the number of threads used by default.
+pub fn default_threads() -> usize {
+    thread::available_parallelism().map_or(1, usize::from)
+}
+
+/// Opens the given file, decompressing it with `threads` threads if its extension is `.gz` or
+/// `.zst`.
+pub fn open<P: AsRef<Path>>(path: P, threads: usize) -> io::Result<Box<dyn BufRead + Send>> {
+    let format = Format::from_path(&path);
+    let file = BufReader::with_capacity(BLOCK_SIZE, File::open(path)?);
+    if format == Format::Plain {
+        return Ok(Box::new(file));
+    }
+
+    let (tx, rx) = sync_channel(threads);
+    thread::spawn(move || split(file, format, tx));
+    Ok(Box::new(Blocks {
+        rx: ordered(threads.max(1), rx, decompress),
+        buf: Vec::new(),
+        pos: 0,
+    }))
+}
+
+/// A block read from a compressed file.
+enum Block {
+    Gzip(Vec<u8>),
+    Zstd(Vec<u8>),
+    /// Data already decompressed by the thread reading the file.
+    Plain(Vec<u8>),
+}
+
+fn decompress(block: io::Result<Block>) -> io::Result<Vec<u8>> {
+    match block? {
+        Block::Gzip(data) => {
+            let mut res = Vec::with_capacity(4 * data.len());
+            MultiGzDecoder::new(&data[..]).read_to_end(&mut res)?;
+            Ok(res)
+        }
+        Block::Zstd(data) => zstd::stream::decode_all(&data[..]),
+        Block::Plain(data) => Ok(data),
+    }
+}
+
+/// Cuts the given compressed stream into blocks, falling back to decompressing it in this thread
+/// from the first member or frame which cannot be cut.
+fn split<R: BufRead + Send + 'static>(mut r: R, format: Format, tx: SyncSender<io::Result<Block>>) {
+    let block = |data| match format {
+        Format::Gzip => Block::Gzip(data),
+        _ => Block::Zstd(data),
+    };
+    let res = (|| -> io::Result<()> {
+        let mut data = Vec::new();
+        while !r.fill_buf()?.is_empty() {
+            let start = data.len();
+            let complete = match format {
+                Format::Gzip => read_bgzf_member(&mut r, &mut data)?,
+                _ => read_zstd_frame(&mut r, &mut data)?,
+            };
+            if !complete {
+                let rest = Cursor::new(data.split_off(start)).chain(r);
+                if !data.is_empty() && tx.send(Ok(block(data))).is_err() {
+                    return Ok(());
+                }
+                let mut decoder: Box<dyn Read> = match format {
+                    Format::Gzip => Box::new(MultiGzDecoder::new(rest)),
+                    _ => Box::new(zstd::stream::read::Decoder::new(rest)?),
+                };
+                loop {
+                    let mut buf = Vec::with_capacity(BLOCK_SIZE);
+                    (&mut decoder)
+                        .take(BLOCK_SIZE as u64)
+                        .read_to_end(&mut buf)?;
+                    if buf.is_empty() || tx.send(Ok(Block::Plain(buf))).is_err() {
+                        return Ok(());
+                    }
+                }
+            }
+            if data.len() >= BLOCK_SIZE && tx.send(Ok(block(mem::take(&mut data)))).is_err() {
+                return Ok(());
+            }
+        }
+        if !data.is_empty() {
+            let _ = tx.send(Ok(block(data)));
+        }
+        Ok(())
+    })();
+    if let Err(err) = res {
+        let _ = tx.send(Err(err));
+    }
+}
+
+/// Reads `n` bytes appended to `data` and returns them.
+fn read_into<'a, R: Read>(r: &mut R, data: &'a mut Vec<u8>, n: usize) -> io::Result<&'a [u8]> {
+    let start = data.len();
+    data.resize(start + n, 0);
+    r.read_exact(&mut data[start..])?;
+    Ok(&data[start..])
+}
+
+/// Reads a gzip member appended to `data`, and returns false if its size is unknown, leaving the
+/// rest of it in the reader.
+fn read_bgzf_member<R: Read>(r: &mut R, data: &mut Vec<u8>) -> io::Result<bool> {
+    let header = read_into(r, data, 12)?;
+    if header[..3] != [0x1f, 0x8b, 8] || header[3] & 4 == 0 {
+        return Ok(false);
+    }
+    let xlen = u16::from_le_bytes([header[10], header[11]]) as usize;
+    let mut extra = read_into(r, data, xlen)?;
+    let mut size = None;
+    while extra.len() >= 4 {
+        let len = u16::from_le_bytes([extra[2], extra[3]]) as usize;
+        let Some(field) = extra.get(4..4 + len) else {
+            break;
+        };
+        if extra[..2] == *b"BC" && len == 2 {
+            size = Some(u16::from_le_bytes([field[0], field[1]]) as usize + 1);
+        }
+        extra = &extra[4 + len..];
+    }
+    match size {
+        Some(size) if size >= 12 + xlen => {
+            read_into(r, data, size - 12 - xlen)?;
+            Ok(true)
+        }
+        _ => Ok(false),
+    }
+}
+
+/// Reads a zstd frame appended to `data` by walking its block headers, and returns false if it is
+/// not a frame or larger than [`MAX_FRAME_SIZE`], leaving the rest of it in the reader.
+fn read_zstd_frame<R: Read>(r: &mut R, data: &mut Vec<u8>) -> io::Result<bool> {
+    let start = data.len();
+    let magic = u32::from_le_bytes(read_into(r, data, 4)?.try_into().unwrap());
+    if magic & 0xffff_fff0 == 0x184d_2a50 {
+        // A skippable frame.
+        let size = u32::from_le_bytes(read_into(r, data, 4)?.try_into().unwrap());
+        read_into(r, data, size as usize)?;
+        return Ok(true);
+    }
+    if magic != ZSTD_MAGIC {
+        return Ok(false);
+    }
+    let descriptor = read_into(r, data, 1)?[0];
+    let single_segment = descriptor & 0x20 != 0;
+    let content_size = match descriptor >> 6 {
+        0 => single_segment as usize,
+        1 => 2,
+        2 => 4,
+        _ => 8,
+    };
+    let dictionary_id = [0, 1, 2, 4][(descriptor & 3) as usize];
+    read_into(
+        r,
+        data,
+        !single_segment as usize + dictionary_id + content_size,
+    )?;
+    loop {
+        let header = read_into(r, data, 3)?;
+        let header = u32::from_le_bytes([header[0], header[1], header[2], 0]);
+        let size = match (header >> 1) & 3 {
+            // An RLE block holds a single byte.
+            1 => 1,
+            3 => {
+                return Err(io::Error::new(
+                    io::ErrorKind::InvalidData,
+                    "invalid zstd block",
+                ))
+            }
+            _ => (header >> 3) as usize,
+        };
+        read_into(r, data, size)?;
+        if header & 1 != 0 {
+            break;
+        }
+        if data.len() - start > MAX_FRAME_SIZE {
+            return Ok(false);
+        }
+    }
+    if descriptor & 4 != 0 {
+        // Checksum of the content.
+        read_into(r, data, 4)?;
+    }
+    Ok(true)
+}
+
+/// Reader over the decompressed blocks.
+struct Blocks {
+    rx: Receiver<io::Result<Vec<u8>>>,
+    buf: Vec<u8>,
+    pos: usize,
+}
+
+impl Read for Blocks {
+    fn read(&mut self, buf: &mut [u8]) -> io::Result<usize> {
+        let n = self.fill_buf()?.read(buf)?;
+        self.consume(n);
+        Ok(n)
+    }
+}
+
+impl BufRead for Blocks {
+    fn fill_buf(&mut self) -> io::Result<&[u8]> {
+        while self.pos == self.buf.len() {
+            match self.rx.recv() {
+                Ok(block) => {
+                    self.buf = block?;
+                    self.pos = 0;
+                }
+                Err(_) => break,
+            }
+        }
+        Ok(&self.buf[self.pos..])
+    }
+
+    fn consume(&mut self, amt: usize) {
+        self.pos = (self.pos + amt).min(self.buf.len());
+    }
+}
+
+/// Runs `f` on the jobs received from `jobs` in `threads` threads, and returns a receiver of the
+/// results in the order of the jobs.
+fn ordered<I, O, F>(threads: usize, jobs: Receiver<I>, f: F) -> Receiver<O>
+where
+    I: Send + 'static,
+    O: Send + 'static,
+    F: Fn(I) -> O + Send + Sync + 'static,
+{
+    let jobs = Arc::new(Mutex::new(jobs.into_iter().enumerate()));
+    let f = Arc::new(f);
+    let (tx, rx) = sync_channel(threads);
+    for _ in 0..threads {
+        let (jobs, f, tx) = (jobs.clone(), f.clone(), tx.clone());
+        thread::spawn(move || loop {
+            let Some((i, job)) = jobs.lock().unwrap().next() else {
+                break;
+            };
+            if tx.send((i, f(job))).is_err() {
+                break;
+            }
+        });
+    }
+    drop(tx);
+
+    let (out, res) = sync_channel(threads);
+    thread::spawn(move || {
+        let mut pending = BTreeMap::new();
+        let mut next = 0;
+        for (i, result) in rx {
+            pending.insert(i, result);
+            while let Some(result) = pending.remove(&next) {
+                if out.send(result).is_err() {
+                    return;
+                }
+                next += 1;
+            }
+        }
+    });
+    res
+}
+
+/// Creates the given file, or writes to stdout if it is `None`, compressing the output with
+/// `threads` threads if its extension is `.gz` or `.zst`.
+///
+/// `level` is the compression level, 0-9 for gzip and 1-22 for zstd. [`Output::finish`] must be
+/// called to write the end of the output.
+pub fn create(path: Option<&str>, threads: usize, level: Option<i32>) -> io::Result<Output> {
+    let Some(path) = path else {
+        return Ok(Output::Plain(BufWriter::new(Box::new(stdout()))));
+    };
+    let format = Format::from_path(path);
+    let file = File::create(path)?;
+    if format == Format::Plain {
+        return Ok(Output::Plain(BufWriter::new(Box::new(file))));
+    }
+
+    let (tx, rx) = sync_channel::<Vec<u8>>(threads);
+    let blocks = ordered(threads.max(1), rx, move |block| {
+        compress(format, level, &block)
+    });
+    let thread = thread::spawn(move || {
+        let mut out = BufWriter::new(file);
+        for block in blocks {
+            out.write_all(&block?)?;
+        }
+        if format == Format::Gzip {
+            out.write_all(&BGZF_EOF)?;
+        }
+        out.flush()
+    });
+    Ok(Output::Compressed {
+        block: Vec::with_capacity(BLOCK_SIZE),
+        tx: Some(tx),
+        sent: false,
+        thread,
+    })
+}
+
+fn compress(format: Format, level: Option<i32>, block: &[u8]) -> io::Result<Vec<u8>> {
+    if format == Format::Zstd {
+        return zstd::bulk::compress(block, level.unwrap_or(zstd::DEFAULT_COMPRESSION_LEVEL));
+    }
+    let level = level.map_or(Compression::default(), |l| {
+        Compression::new(l.clamp(0, 9) as u32)
+    });
+    let mut res = Vec::with_capacity(block.len() / 2);
+    for data in block.chunks(BGZF_DATA_SIZE) {
+        let mut deflated = deflate(data, level)?;
+        if 18 + deflated.len() + 8 > 0x10000 {
+            // Stored blocks always fit.
+            deflated = deflate(data, Compression::none())?;
+        }
+        let mut crc = Crc::new();
+        crc.update(data);
+        res.extend_from_slice(&[
+            0x1f, 0x8b, 8, 4, 0, 0, 0, 0, 0, 0xff, 6, 0, b'B', b'C', 2, 0,
+        ]);
+        res.extend_from_slice(&((18 + deflated.len() + 8 - 1) as u16).to_le_bytes());
+        res.extend_from_slice(&deflated);
+        res.extend_from_slice(&crc.sum().to_le_bytes());
+        res.extend_from_slice(&(data.len() as u32).to_le_bytes());
+    }
+    Ok(res)
+}
+
+fn deflate(data: &[u8], level: Compression) -> io::Result<Vec<u8>> {
+    let mut encoder = DeflateEncoder::new(Vec::with_capacity(data.len()), level);
+    encoder.write_all(data)?;
+    encoder.finish()
+}
+
+/// An output file, or stdout.
+pub enum Output {
+    Plain(BufWriter<Box<dyn Write + Send>>),
+    Compressed {
+        /// Data of the next block.
+        block: Vec<u8>,
+        tx: Option<SyncSender<Vec<u8>>>,
+        /// True if a block has been sent.
+        sent: bool,
+        thread: JoinHandle<io::Result<()>>,
+    },
+}
+
+impl Output {
+    /// Writes the rest of the output, and waits for the compressed data to be written.
+    pub fn finish(self) -> io::Result<()> {
+        match self {
+            Output::Plain(mut out) => out.flush(),
+            Output::Compressed {
+                block,
+                tx,
+                sent,
+                thread,
+            } => {
+                // An empty zstd output still has a frame.
+                if !block.is_empty() || !sent {
+                    if let Some(tx) = &tx {
+                        let _ = tx.send(block);
+                    }
+                }
+                drop(tx);
+                thread
+                    .join()
+                    .map_err(|_| io::Error::other("the writer thread panicked"))?
+            }
+        }
+    }
+}
+
+impl Write for Output {
+    fn write(&mut self, buf: &[u8]) -> io::Result<usize> {
+        match self {
+            Output::Plain(out) => out.write(buf),
+            Output::Compressed {
+                block, tx, sent, ..
+            } => {
+                block.extend_from_slice(buf);
+                if block.len() >= BLOCK_SIZE {
+                    let full = mem::replace(block, Vec::with_capacity(BLOCK_SIZE));
+                    let sender = tx.as_ref().ok_or(io::ErrorKind::BrokenPipe)?;
+                    if sender.send(full).is_err() {
+                        // The writer thread has stopped; finish returns its error.
+                        *tx = None;
+                        return Err(io::ErrorKind::BrokenPipe.into());
+                    }
+                    *sent = true;
+                }
+                Ok(buf.len())
+            }
+        }
+    }
+
+    /// Flushes stdout or a plain file. Compressed data are written in blocks, the last of which is
+    /// written by [`Output::finish`].
+    fn flush(&mut self) -> io::Result<()> {
+        match self {
+            Output::Plain(out) => out.flush(),
+            Output::Compressed { .. } => Ok(()),
+        }
+    }
+}
@@ -0,0 +1,126 @@
+// main.rs
+//
+// Copyright (c) 2023 Junpei Kawamoto
+//
+// This software is released under the MIT License.
+//
+// http://opensource.org/licenses/mit-license.php
+
+use std::thread;
+use std::time::Instant;
+
+use anyhow::{bail, Result};
+use clap::{Parser, ValueEnum};
+
+use ctranslate2::capture::{read_captures, CapturedInput};
+use ctranslate2::config::{Config, Device};
+use ctranslate2::generator::Generator;
+use ctranslate2::profiler::{dump_profiling, init_profiling};
+use ctranslate2::translator::Translator;
+
+#[derive(ValueEnum, Clone, Copy, Debug)]
+enum Model {
+    Translator,
+    Generator,
+}
+
+/// Replay captured slow requests with the operator profiler.
+#[derive(Parser, Debug)]
+#[command(author, version, about, long_about = None)]
+struct Args {
+    /// Kind of the model.
+    #[arg(short, long, value_enum, default_value_t = Model::Translator)]
+    model: Model,
+    /// Use CUDA.
+    #[arg(long)]
+    cuda: bool,
+    /// Number of threads per replica (0 to use the default of OpenMP, i.e. `OMP_NUM_THREADS` or
+    /// the number of CPUs).
+    #[arg(short, long, default_value_t = 0)]
+    threads: usize,
+    /// Path to the directory that contains model.bin.
+    path: String,
+    /// Path to the file the requests were captured to.
+    captures: String,
+}
+
+enum Runner {
+    Translator(Translator),
+    Generator(Generator),
+}
+
+impl Runner {
+    fn run(&self, input: &CapturedInput) -> Result<()> {
+        match (self, input) {
+            (
+                Runner::Translator(t),
+                CapturedInput::Translation {
+                    source,
+                    target_prefix,
+                    ..
+                },
+            ) => {
+                let options = input.translation_options()?.unwrap();
+                t.translate_batch(source, target_prefix, &options)?;
+            }
+            (Runner::Generator(g), CapturedInput::Generation { start_tokens, .. }) => {
+                let options = input.generation_options()?.unwrap();
+                g.generate_batch(start_tokens, &options)?;
+            }
+            _ => bail!("the captured request does not match the model kind"),
+        }
+        Ok(())
+    }
+
+    fn num_replicas(&self) -> usize {
+        match self {
+            Runner::Translator(t) => t.num_replicas(),
+            Runner::Generator(g) => g.num_replicas(),
+        }
+    }
+}
+
+fn main() -> Result<()> {
+    let args = Args::parse();
+    let device = || if args.cuda { Device::CUDA } else { Device::CPU };
+    // The profiler needs the actual number of threads, so the default is resolved here and set
+    // explicitly rather than left to CTranslate2.
+    let threads = threads_per_replica(args.threads);
+    let config = || Config {
+        num_threads_per_replica: threads,
+        ..Config::default()
+    };
+    let runner = match args.model {
+        Model::Translator => Runner::Translator(Translator::new(&args.path, device(), config())?),
+        Model::Generator => Runner::Generator(Generator::new(&args.path, device(), config())?),
+    };
+
+    let captures = read_captures(&args.captures)?;
+    init_profiling(device(), runner.num_replicas() * threads);
+    for (i, req) in captures.iter().enumerate() {
+        let start = Instant::now();
+        runner.run(&req.input)?;
+        let elapsed = start.elapsed();
+        println!(
+            "request {i}: captured {:.1} ms, replayed {:.1} ms ({} batches)",
+            req.elapsed.as_secs_f64() * 1000.,
+            elapsed.as_secs_f64() * 1000.,
+            req.batches.len(),
+        );
+    }
+    println!("{}", dump_profiling());
+
+    Ok(())
+}
+
+/// Returns the given number of threads per replica, or the default of OpenMP if it is 0.
+fn threads_per_replica(threads: usize) -> usize {
+    if threads > 0 {
+        return threads;
+    }
+    std::env::var("OMP_NUM_THREADS")
+        .ok()
+        .and_then(|v| v.split(',').next()?.trim().parse().ok())
+        .filter(|&n| n > 0)
+        .unwrap_or_else(|| thread::available_parallelism().map_or(1, usize::from))
+}
@@ -0,0 +1,288 @@
+// api.rs
+//
+// Copyright (c) 2023 Junpei Kawamoto
+//
+// This software is released under the MIT License.
+//
+// http://opensource.org/licenses/mit-license.php
+
+//! Bodies of the endpoints and the batch functions behind them.
+
+use std::sync::mpsc::Sender;
+
+use anyhow::{bail, Result};
+use serde::{Deserialize, Serialize};
+
+use ctranslate2::{GenerationOptions, Generator, TranslationOptions, Translator};
+
+/// A string or a list of strings.
+#[derive(Debug, Deserialize)]
+#[serde(untagged)]
+pub enum OneOrMany {
+    One(String),
+    Many(Vec<String>),
+}
+
+impl OneOrMany {
+    pub fn into_vec(self) -> Vec<String> {
+        match self {
+            OneOrMany::One(s) => vec![s],
+            OneOrMany::Many(v) => v,
+        }
+    }
+}
+
+/// Body of `POST /v1/translations`.
+#[derive(Debug, Deserialize)]
+pub struct TranslationRequest {
+    /// Texts to translate.
+    pub text: OneOrMany,
+    /// Tokens which start every translation, e.g. the target language of NLLB.
+    #[serde(default)]
+    pub target_prefix: Vec<String>,
+    #[serde(default = "default_beam_size")]
+    pub beam_size: usize,
+    #[serde(default = "default_max_decoding_length")]
+    pub max_decoding_length: usize,
+}
+
+fn default_beam_size() -> usize {
+    2
+}
+
+fn default_max_decoding_length() -> usize {
+    256
+}
+
+/// Response of `POST /v1/translations`.
+#[derive(Debug, Serialize)]
+pub struct TranslationResponse {
+    pub translations: Vec<Translation>,
+}
+
+#[derive(Debug, Serialize)]
+pub struct Translation {
+    pub text: String,
+    pub score: Option<f32>,
+}
+
+/// Options which translations in a batch must share.
+#[derive(Debug, PartialEq)]
+pub struct TranslationKey {
+    pub beam_size: usize,
+    pub max_decoding_length: usize,
+}
+
+/// A text to translate and its target prefix.
+pub type TranslationItem = (String, Vec<String>);
+
+/// Translates a batch.
+pub fn translate(
+    translator: &Translator,
+    key: &TranslationKey,
+    items: Vec<TranslationItem>,
+) -> Result<Vec<Translation>> {
+    let (sources, target_prefixes): (Vec<_>, Vec<_>) = items.into_iter().unzip();
+    let options = TranslationOptions {
+        beam_size: key.beam_size,
+        max_decoding_length: key.max_decoding_length,
+        return_scores: true,
+        ..TranslationOptions::default()
+    };
+    Ok(translator
+        .translate_batch(sources, target_prefixes, &options)?
+        .into_iter()
+        .map(|(text, score)| Translation { text, score })
+        .collect())
+}
+
+/// Body of `POST /v1/completions`, compatible with the completions API of OpenAI.
+#[derive(Debug, Deserialize)]
+pub struct CompletionRequest {
+    pub model: Option<String>,
+    pub prompt: OneOrMany,
+    #[serde(default = "default_max_tokens")]
+    pub max_tokens: usize,
+    #[serde(default = "default_one")]
+    pub temperature: f32,
+    #[serde(default = "default_one")]
+    pub top_p: f32,
+    /// Sample from the top K candidates (0 for the full distribution); not in the OpenAI API.
+    #[serde(default)]
+    pub top_k: usize,
+    #[serde(default = "default_n")]
+    pub n: usize,
+    #[serde(default)]
+    pub stream: bool,
+}
+
+fn default_max_tokens() -> usize {
+    16
+}
+
+fn default_one() -> f32 {
+    1.
+}
+
+fn default_n() -> usize {
+    1
+}
+
+impl CompletionRequest {
+    /// Returns the options of this request, which completions in a batch must share.
+    pub fn key(&self) -> Result<GenerationKey> {
+        if self.n != 1 {
+            bail!("only n = 1 is supported");
+        }
+        if self.max_tokens == 0 {
+            bail!("max_tokens must be positive");
+        }
+        Ok(GenerationKey {
+            max_length: self.max_tokens,
+            // Temperature 0 means greedy search as in the OpenAI API.
+            sampling_topk: if self.temperature == 0. {
+                1
+            } else {
+                self.top_k
+            },
+            sampling_topp: self.top_p,
+            sampling_temperature: if self.temperature == 0. {
+                1.
+            } else {
+                self.temperature
+            },
+        })
+    }
+}
+
+/// Options which completions in a batch must share.
+#[derive(Debug, PartialEq)]
+pub struct GenerationKey {
+    pub max_length: usize,
+    pub sampling_topk: usize,
+    pub sampling_topp: f32,
+    pub sampling_temperature: f32,
+}
+
+/// A prompt to complete.
+pub struct GenerationItem {
+    pub prompt: String,
+    /// Index of the prompt in its request.
+    pub index: usize,
+    /// Receiver of the text as it is generated, if streaming.
+    pub stream: Option<Sender<Piece>>,
+}
+
+/// Text generated for a prompt.
+#[derive(Debug)]
+pub struct Piece {
+    pub index: usize,
+    pub text: String,
+}
+
+/// A completed prompt.
+#[derive(Debug)]
+pub struct Completion {
+    pub text: String,
+    pub completion_tokens: usize,
+    pub finish_reason: &'static str,
+}
+
+/// Completes a batch of prompts, streaming the text of those which ask for it.
+///
+/// Decoding of a streamed prompt stops once its receiver is dropped, e.g. the client has
+/// disconnected.
+pub fn complete(
+    generator: &Generator,
+    key: &GenerationKey,
+    items: Vec<GenerationItem>,
+) -> Result<Vec<Completion>> {
+    let options = GenerationOptions {
+        max_length: key.max_length,
+        sampling_topk: key.sampling_topk,
+        sampling_topp: key.sampling_topp,
+        sampling_temperature: key.sampling_temperature,
+        include_prompt_in_result: false,
+        ..GenerationOptions::default()
+    };
+    let mut num_tokens = vec![0; items.len()];
+    let res = generator.generate_batch_with_callback(
+        items.iter().map(|item| item.prompt.as_str()).collect(),
+        &options,
+        &mut |step, text| {
+            num_tokens[step.batch_id] += 1;
+            match &items[step.batch_id].stream {
+                Some(tx) if !text.is_empty() => tx
+                    .send(Piece {
+                        index: items[step.batch_id].index,
+                        text: text.to_string(),
+                    })
+                    .is_err(),
+                _ => false,
+            }
+        },
+    )?;
+    Ok(res
+        .into_iter()
+        .zip(num_tokens)
+        .map(|((sequences, _), n)| Completion {
+            text: sequences.into_iter().next().unwrap_or_default(),
+            completion_tokens: n,
+            finish_reason: if n >= key.max_length {
+                "length"
+            } else {
+                "stop"
+            },
+        })
+        .collect())
+}
+
+/// Response of `POST /v1/completions`, or a chunk of it if streaming.
+#[derive(Debug, Serialize)]
+pub struct CompletionResponse<'a> {
+    pub id: &'a str,
+    pub object: &'static str,
+    pub created: u64,
+    pub model: &'a str,
+    pub choices: Vec<Choice>,
+    #[serde(skip_serializing_if = "Option::is_none")]
+    pub usage: Option<Usage>,
+}
+
+#[derive(Debug, Serialize)]
+pub struct Choice {
+    pub text: String,
+    pub index: usize,
+    pub logprobs: Option<()>,
+    pub finish_reason: Option<&'static str>,
+}
+
+/// Numbers of tokens; the prompt tokens are not counted by the generator.
+#[derive(Debug, Serialize)]
+pub struct Usage {
+    pub completion_tokens: usize,
+}
+
+/// Body of an error response.
+#[derive(Debug, Serialize)]
+pub struct ErrorResponse {
+    pub error: ErrorBody,
+}
+
+#[derive(Debug, Serialize)]
+pub struct ErrorBody {
+    pub message: String,
+    #[serde(rename = "type")]
+    pub kind: &'static str,
+}
+
+impl ErrorResponse {
+    pub fn new<T: ToString>(kind: &'static str, message: T) -> Self {
+        Self {
+            error: ErrorBody {
+                message: message.to_string(),
+                kind,
+            },
+        }
+    }
+}
@@ -0,0 +1,223 @@
+// batcher.rs
+//
+// Copyright (c) 2023 Junpei Kawamoto
+//
+// This software is released under the MIT License.
+//
+// http://opensource.org/licenses/mit-license.php
+
+//! Dynamic batching of concurrent requests.
+//!
+//! A collector thread takes the first waiting request and keeps adding requests until the batch
+//! has `max_batch_size` examples or `timeout` has passed since the first one. Requests can share a
+//! batch only if their options are equal, so the collected requests are grouped by their keys.
+//! Workers run the batches, one per replica so that batches do not wait behind each other in the
+//! queue of the model, and return the outputs to the requests in order.
+
+use std::fmt::Write as _;
+use std::sync::atomic::{AtomicU64, Ordering};
+use std::sync::mpsc::{self, Receiver, RecvTimeoutError, SyncSender};
+use std::sync::{Arc, Mutex};
+use std::thread;
+use std::time::{Duration, Instant};
+
+use anyhow::{anyhow, Result};
+
+/// A request waiting for a batch.
+struct Job<K, I, O> {
+    key: K,
+    request: Request<I, O>,
+}
+
+/// Items of a request and where to send their outputs.
+struct Request<I, O> {
+    items: Vec<I>,
+    reply: mpsc::Sender<Result<Vec<O>>>,
+}
+
+/// Requests of the same key run in one batch.
+type Batch<K, I, O> = (K, Vec<Request<I, O>>);
+
+/// Counters of the batches run by a batcher.
+#[derive(Default)]
+pub struct BatcherMetrics {
+    requests: AtomicU64,
+    batches: AtomicU64,
+    examples: AtomicU64,
+    errors: AtomicU64,
+}
+
+/// Name, help and counter of a family of batcher metrics.
+type Family = (
+    &'static str,
+    &'static str,
+    fn(&BatcherMetrics) -> &AtomicU64,
+);
+
+const FAMILIES: &[Family] = &[
+    ("requests", "Requests batched", |m| &m.requests),
+    ("batches", "Batches run", |m| &m.batches),
+    ("examples", "Examples in the batches", |m| &m.examples),
+    ("errors", "Batches which failed", |m| &m.errors),
+];
+
+impl BatcherMetrics {
+    /// Renders the counters of the given models in the Prometheus text format, each family once
+    /// with a sample per model label.
+    pub fn render(models: &[(&str, &BatcherMetrics)], out: &mut String) {
+        if models.is_empty() {
+            return;
+        }
+        for (name, help, get) in FAMILIES {
+            let _ = writeln!(out, "# HELP ct2_server_batcher_{name}_total {help}.");
+            let _ = writeln!(out, "# TYPE ct2_server_batcher_{name}_total counter");
+            for (model, metrics) in models {
+                let _ = writeln!(
+                    out,
+                    "ct2_server_batcher_{name}_total{{model=\"{model}\"}} {}",
+                    get(metrics).load(Ordering::Relaxed)
+                );
+            }
+        }
+    }
+}
+
+/// Batches the requests to a model.
+pub struct Batcher<K, I, O> {
+    tx: SyncSender<Job<K, I, O>>,
+    metrics: Arc<BatcherMetrics>,
+}
+
+impl<K, I, O> Batcher<K, I, O>
+where
+    K: PartialEq + Send + 'static,
+    I: Send + 'static,
+    O: Send + 'static,
+{
+    /// Starts the collector and `workers` worker threads running batches with `run`, which
+    /// returns an output for each item.
+    ///
+    /// At most `queue_size` requests wait for a batch; further requests block until one is taken.
+    pub fn new<F>(
+        max_batch_size: usize,
+        timeout: Duration,
+        workers: usize,
+        queue_size: usize,
+        run: F,
+    ) -> Self
+    where
+        F: Fn(&K, Vec<I>) -> Result<Vec<O>> + Send + Sync + 'static,
+    {
+        let (tx, rx) = mpsc::sync_channel(queue_size);
+        let (batch_tx, batch_rx) = mpsc::sync_channel::<Batch<K, I, O>>(workers.max(1));
+        let metrics = Arc::new(BatcherMetrics::default());
+
+        let batch_rx = Arc::new(Mutex::new(batch_rx));
+        let run = Arc::new(run);
+        for _ in 0..workers.max(1) {
+            let (batch_rx, run, metrics) = (batch_rx.clone(), run.clone(), metrics.clone());
+            thread::spawn(move || loop {
+                let Ok((key, requests)) = batch_rx.lock().unwrap().recv() else {
+                    return;
+                };
+                run_batch(&key, requests, run.as_ref(), &metrics);
+            });
+        }
+
+        let collector_metrics = metrics.clone();
+        thread::spawn(move || collect(rx, batch_tx, max_batch_size, timeout, &collector_metrics));
+        Self { tx, metrics }
+    }
+
+    /// Runs the given items in a batch with other requests of the same key and returns their
+    /// outputs.
+    pub fn submit(&self, key: K, items: Vec<I>) -> Result<Vec<O>> {
+        let (reply, rx) = mpsc::channel();
+        self.tx
+            .send(Job {
+                key,
+                request: Request { items, reply },
+            })
+            .map_err(|_| anyhow!("the batcher has stopped"))?;
+        rx.recv().map_err(|_| anyhow!("the batch was dropped"))?
+    }
+
+    /// Returns the counters of this batcher.
+    pub fn metrics(&self) -> &BatcherMetrics {
+        &self.metrics
+    }
+}
+
+/// Collects requests into batches until the senders are dropped.
+fn collect<K: PartialEq, I, O>(
+    rx: Receiver<Job<K, I, O>>,
+    batch_tx: SyncSender<Batch<K, I, O>>,
+    max_batch_size: usize,
+    timeout: Duration,
+    metrics: &BatcherMetrics,
+) {
+    while let Ok(first) = rx.recv() {
+        let deadline = Instant::now() + timeout;
+        let mut size = first.request.items.len();
+        let mut jobs = vec![first];
+        while size < max_batch_size {
+            match rx.recv_timeout(deadline.saturating_duration_since(Instant::now())) {
+                Ok(job) => {
+                    size += job.request.items.len();
+                    jobs.push(job);
+                }
+                Err(RecvTimeoutError::Timeout) => break,
+                Err(RecvTimeoutError::Disconnected) => break,
+            }
+        }
+        metrics
+            .requests
+            .fetch_add(jobs.len() as u64, Ordering::Relaxed);
+
+        let mut groups: Vec<Batch<K, I, O>> = Vec::new();
+        for job in jobs {
+            match groups.iter_mut().find(|(key, _)| *key == job.key) {
+                Some((_, group)) => group.push(job.request),
+                None => groups.push((job.key, vec![job.request])),
+            }
+        }
+        for group in groups {
+            if batch_tx.send(group).is_err() {
+                return;
+            }
+        }
+    }
+}
+
+/// Runs a batch of requests and replies to each of them.
+fn run_batch<K, I, O, F>(key: &K, requests: Vec<Request<I, O>>, run: &F, metrics: &BatcherMetrics)
+where
+    F: Fn(&K, Vec<I>) -> Result<Vec<O>>,
+{
+    let mut replies = Vec::with_capacity(requests.len());
+    let mut items = Vec::new();
+    for request in requests {
+        replies.push((request.reply, request.items.len()));
+        items.extend(request.items);
+    }
+    metrics.batches.fetch_add(1, Ordering::Relaxed);
+    metrics
+        .examples
+        .fetch_add(items.len() as u64, Ordering::Relaxed);
+
+    match run(key, items) {
+        Ok(outputs) => {
+            let mut outputs = outputs.into_iter();
+            for (reply, n) in replies {
+                let _ = reply.send(Ok(outputs.by_ref().take(n).collect()));
+            }
+        }
+        Err(err) => {
+            metrics.errors.fetch_add(1, Ordering::Relaxed);
+            let msg = format!("{err:#}");
+            for (reply, _) in replies {
+                let _ = reply.send(Err(anyhow!("{msg}")));
+            }
+        }
+    }
+}
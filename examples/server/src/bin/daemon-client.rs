@@ -0,0 +1,93 @@
+// daemon-client.rs
+//
+// Copyright (c) 2023 Junpei Kawamoto
+//
+// This software is released under the MIT License.
+//
+// http://opensource.org/licenses/mit-license.php
+
+//! Send tokenized lines of the standard input to the daemon.
+
+#[cfg(unix)]
+fn main() -> anyhow::Result<()> {
+    unix::main()
+}
+
+#[cfg(not(unix))]
+fn main() {
+    eprintln!("the daemon requires Unix domain sockets");
+    std::process::exit(1);
+}
+
+#[cfg(unix)]
+mod unix {
+    use std::io::{self, BufRead, Write};
+    use std::path::PathBuf;
+
+    use anyhow::Result;
+    use clap::{Parser, ValueEnum};
+
+    use ctranslate2_example_server::ipc::{Client, Options};
+
+    #[derive(Clone, Copy, Debug, ValueEnum)]
+    enum Model {
+        Translator,
+        Generator,
+    }
+
+    /// Send lines of space-separated tokens to the daemon, and print the output tokens.
+    #[derive(Parser, Debug)]
+    #[command(author, version, about, long_about = None)]
+    struct Args {
+        /// Path to the Unix socket of the daemon.
+        #[arg(short, long, default_value = "/tmp/ct2d.sock")]
+        socket: PathBuf,
+        /// Model to run.
+        #[arg(short, long, value_enum, default_value_t = Model::Translator)]
+        model: Model,
+        /// Tokens which start every translation, separated by spaces.
+        #[arg(long, default_value = "")]
+        target_prefix: String,
+        /// Number of lines sent in a request.
+        #[arg(long, default_value_t = 16)]
+        batch_size: usize,
+        /// Beam size.
+        #[arg(long, default_value_t = 1)]
+        beam_size: u32,
+        /// Maximum number of output tokens.
+        #[arg(long, default_value_t = 256)]
+        max_length: u32,
+    }
+
+    pub fn main() -> Result<()> {
+        let args = Args::parse();
+        let mut client = Client::connect(&args.socket)?;
+        let options = Options {
+            beam_size: args.beam_size,
+            max_length: args.max_length,
+            ..Options::default()
+        };
+        let target_prefix = args.target_prefix.split_whitespace().collect::<Vec<_>>();
+
+        let lines = io::stdin().lock().lines().collect::<io::Result<Vec<_>>>()?;
+        let mut stdout = io::stdout().lock();
+        for chunk in lines.chunks(args.batch_size.max(1)) {
+            let tokens = chunk
+                .iter()
+                .map(|line| line.split_whitespace().collect::<Vec<_>>())
+                .collect::<Vec<_>>();
+            let outputs = match args.model {
+                Model::Translator => client.translate(
+                    &tokens,
+                    &vec![target_prefix.clone(); tokens.len()],
+                    &options,
+                )?,
+                Model::Generator => client.generate(&tokens, &options)?,
+            };
+            for output in outputs {
+                writeln!(stdout, "{}", output.tokens.join(" "))?;
+            }
+        }
+        Ok(())
+    }
+}
@@ -0,0 +1,116 @@
+// daemon.rs
+//
+// Copyright (c) 2023 Junpei Kawamoto
+//
+// This software is released under the MIT License.
+//
+// http://opensource.org/licenses/mit-license.php
+
+//! Host models once for local processes, which send tokens through shared memory.
+
+#[cfg(unix)]
+fn main() -> anyhow::Result<()> {
+    unix::main()
+}
+
+#[cfg(not(unix))]
+fn main() {
+    eprintln!("the daemon requires Unix domain sockets");
+    std::process::exit(1);
+}
+
+#[cfg(unix)]
+mod unix {
+    use std::fs;
+    use std::os::unix::net::{UnixListener, UnixStream};
+    use std::path::PathBuf;
+    use std::time::Duration;
+
+    use anyhow::{anyhow, Result};
+    use clap::Parser;
+
+    use ctranslate2::config::{Config, Device};
+    use ctranslate2::generator::Generator;
+    use ctranslate2::translator::Translator;
+    use ctranslate2_example_server::daemon::{BatchConfig, Daemon};
+
+    /// Host a translator and a generator for local processes.
+    #[derive(Parser, Debug)]
+    #[command(author, version, about, long_about = None)]
+    struct Args {
+        /// Path to the Unix socket to listen on.
+        #[arg(short, long, default_value = "/tmp/ct2d.sock")]
+        socket: PathBuf,
+        /// Path to the directory that contains the translation model.
+        #[arg(long, value_name = "PATH")]
+        translator: Option<String>,
+        /// Path to the directory that contains the generation model.
+        #[arg(long, value_name = "PATH")]
+        generator: Option<String>,
+        /// Use CUDA.
+        #[arg(long)]
+        cuda: bool,
+        /// Number of threads per replica (0 to use the default).
+        #[arg(short, long, default_value_t = 0)]
+        threads: usize,
+        /// Number of replicas of each model.
+        #[arg(short, long, default_value_t = 1)]
+        replicas: usize,
+        /// Maximum number of examples in a batch.
+        #[arg(long, default_value_t = 32)]
+        max_batch_size: usize,
+        /// Maximum time in milliseconds to wait for more requests to fill a batch.
+        #[arg(long, default_value_t = 5)]
+        batch_timeout: u64,
+        /// Maximum number of requests waiting for a batch of each model.
+        #[arg(long, default_value_t = 1024)]
+        queue_size: usize,
+        /// Size of each ring of the shared memory of a client in KiB.
+        #[arg(long, default_value_t = 4096)]
+        ring_size: usize,
+        /// Directory to create the shared memory in.
+        #[arg(long, default_value = "/dev/shm")]
+        shm_dir: PathBuf,
+    }
+
+    pub fn main() -> Result<()> {
+        let args = Args::parse();
+        let config = || Config {
+            device_indices: vec![0; args.replicas],
+            num_threads_per_replica: args.threads,
+            ..Config::default()
+        };
+        let device = || if args.cuda { Device::CUDA } else { Device::CPU };
+        let translator = args
+            .translator
+            .as_ref()
+            .map(|path| Translator::new(path, device(), config()))
+            .transpose()?;
+        let generator = args
+            .generator
+            .as_ref()
+            .map(|path| Generator::new(path, device(), config()))
+            .transpose()?;
+        let daemon = Daemon::new(
+            translator,
+            generator,
+            BatchConfig {
+                max_batch_size: args.max_batch_size,
+                timeout: Duration::from_millis(args.batch_timeout),
+                workers: args.replicas,
+                queue_size: args.queue_size,
+            },
+            args.shm_dir,
+            args.ring_size * 1024,
+        )?;
+
+        // A socket left by a daemon which has exited is removed, but not that of a running one.
+        if UnixStream::connect(&args.socket).is_ok() {
+            return Err(anyhow!("a daemon is listening on {:?}", args.socket));
+        }
+        let _ = fs::remove_file(&args.socket);
+        let listener = UnixListener::bind(&args.socket)?;
+        eprintln!("listening on {}", args.socket.display());
+        daemon.serve(listener)
+    }
+}
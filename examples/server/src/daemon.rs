@@ -0,0 +1,306 @@
+// daemon.rs
+//
+// Copyright (c) 2023 Junpei Kawamoto
+//
+// This software is released under the MIT License.
+//
+// http://opensource.org/licenses/mit-license.php
+
+//! Daemon hosting models for the local processes connecting to its Unix socket.
+//!
+//! Each connection gets its own shared-memory region, and a thread which takes the requests out
+//! of it and submits them to the batcher of their model, so that requests of all the clients are
+//! batched together. See [`crate::ipc`] for the protocol.
+
+use std::fs;
+use std::io::{self, Write};
+use std::iter;
+use std::os::unix::net::{UnixListener, UnixStream};
+use std::path::PathBuf;
+use std::process;
+use std::sync::Arc;
+use std::thread;
+use std::time::Duration;
+
+use anyhow::{anyhow, bail, Result};
+
+use ctranslate2::generator::Generator;
+use ctranslate2::translator::Translator;
+use ctranslate2::{GenerationOptions, TranslationOptions};
+
+use crate::batcher::Batcher;
+use crate::ipc::{
+    response_size, write_response, Frame, Model, Op, Options, Output, Request, Response, Span,
+    RING_TIMEOUT, VERSION,
+};
+use crate::shm::Region;
+
+/// An example of a request, whose tokens stay in the region of its client until it completes.
+pub struct Example {
+    region: Arc<Region>,
+    /// Source for the translator, or start tokens for the generator.
+    source: Vec<Span>,
+    /// Target prefix for the translator.
+    target_prefix: Vec<Span>,
+}
+
+impl Example {
+    fn source(&self) -> Vec<&str> {
+        self.source.iter().map(|s| s.get(&self.region)).collect()
+    }
+
+    fn target_prefix(&self) -> Vec<&str> {
+        self.target_prefix
+            .iter()
+            .map(|s| s.get(&self.region))
+            .collect()
+    }
+}
+
+/// Batching parameters shared by the models.
+#[derive(Clone, Copy, Debug)]
+pub struct BatchConfig {
+    pub max_batch_size: usize,
+    pub timeout: Duration,
+    /// Number of batches run at the same time, usually the number of replicas.
+    pub workers: usize,
+    pub queue_size: usize,
+}
+
+impl BatchConfig {
+    fn start<F>(self, run: F) -> ModelBatcher
+    where
+        F: Fn(&Options, Vec<Example>) -> Result<Vec<Output>> + Send + Sync + 'static,
+    {
+        Batcher::new(
+            self.max_batch_size,
+            self.timeout,
+            self.workers,
+            self.queue_size,
+            run,
+        )
+    }
+}
+
+type ModelBatcher = Batcher<Options, Example, Output>;
+
+/// Models served by the daemon.
+pub struct Daemon {
+    translator: Option<ModelBatcher>,
+    generator: Option<ModelBatcher>,
+    /// Directory where the regions are created.
+    shm_dir: PathBuf,
+    /// Size of each ring of a region.
+    ring_size: usize,
+}
+
+impl Daemon {
+    /// Creates a daemon serving the given models, at least one of which must be given.
+    pub fn new(
+        translator: Option<Translator>,
+        generator: Option<Generator>,
+        batch: BatchConfig,
+        shm_dir: PathBuf,
+        ring_size: usize,
+    ) -> Result<Self> {
+        if translator.is_none() && generator.is_none() {
+            bail!("no model to serve");
+        }
+        Ok(Self {
+            translator: translator.map(|t| batch.start(move |o, e| translate(&t, o, e))),
+            generator: generator.map(|g| batch.start(move |o, e| generate(&g, o, e))),
+            shm_dir,
+            ring_size,
+        })
+    }
+
+    /// Serves the clients connecting to the given listener.
+    pub fn serve(self, listener: UnixListener) -> Result<()> {
+        let daemon = Arc::new(self);
+        for (id, conn) in listener.incoming().enumerate() {
+            let conn = match conn {
+                Ok(conn) => conn,
+                Err(err) => {
+                    eprintln!("failed to accept a connection: {err}");
+                    continue;
+                }
+            };
+            let daemon = daemon.clone();
+            thread::spawn(move || {
+                if let Err(err) = daemon.serve_connection(conn, id) {
+                    eprintln!("connection {id}: {err:#}");
+                }
+            });
+        }
+        Ok(())
+    }
+
+    fn serve_connection(&self, mut conn: UnixStream, id: usize) -> Result<()> {
+        let path = self.shm_dir.join(format!("ct2d-{}-{id}", process::id()));
+        let mut file = ShmFile(Some(path.clone()));
+        let region = Arc::new(Region::create(&path, self.ring_size)?);
+        let path = path
+            .to_str()
+            .ok_or_else(|| anyhow!("invalid path: {path:?}"))?;
+        Frame {
+            op: Op::Hello,
+            status: VERSION,
+            id: path.len() as u64,
+        }
+        .write(&mut conn)?;
+        conn.write_all(path.as_bytes())?;
+
+        while let Some(frame) = Frame::read(&mut conn)? {
+            // The client has mapped the region.
+            file.remove();
+            if frame.op != Op::Submit {
+                bail!("unexpected frame: {frame:?}");
+            }
+            let requests = region.requests();
+            let record = requests
+                .peek()?
+                .ok_or_else(|| anyhow!("no request in the ring"))?;
+            let response = match Request::parse(&region, record) {
+                Ok(req) if req.id != frame.id => {
+                    Err(format!("request {} submitted as {}", req.id, frame.id))
+                }
+                Ok(req) => self.run(&region, req).map_err(|err| format!("{err:#}")),
+                Err(err) => Err(err.to_string()),
+            };
+            let status = send_response(&region, frame.id, response)?;
+            requests.release(record);
+            Frame {
+                op: Op::Done,
+                status,
+                id: frame.id,
+            }
+            .write(&mut conn)?;
+        }
+        Ok(())
+    }
+
+    /// Runs a request in a batch with the requests of the other clients.
+    fn run(&self, region: &Arc<Region>, req: Request) -> Result<Vec<Output>> {
+        let mut sequences = req.sequences.into_iter();
+        match req.model {
+            Model::Translator => {
+                let Some(batcher) = &self.translator else {
+                    bail!("no translator is loaded");
+                };
+                let examples = iter::from_fn(|| {
+                    Some(Example {
+                        region: region.clone(),
+                        source: sequences.next()?,
+                        target_prefix: sequences.next()?,
+                    })
+                })
+                .collect();
+                batcher.submit(req.options, examples)
+            }
+            Model::Generator => {
+                let Some(batcher) = &self.generator else {
+                    bail!("no generator is loaded");
+                };
+                let examples = sequences
+                    .map(|source| Example {
+                        region: region.clone(),
+                        source,
+                        target_prefix: Vec::new(),
+                    })
+                    .collect();
+                batcher.submit(req.options, examples)
+            }
+        }
+    }
+}
+
+/// Writes a response to the response ring and returns its status, replacing it with an error if
+/// it does not fit in the ring.
+fn send_response(region: &Region, id: u64, response: Response) -> io::Result<u32> {
+    let responses = region.responses();
+    let res = responses.write(response_size(&response), RING_TIMEOUT, |buf| {
+        write_response(buf, id, &response)
+    });
+    match res {
+        Ok(()) => Ok(response.is_err() as u32),
+        Err(err) if err.kind() == io::ErrorKind::InvalidInput => {
+            let response = Err("response larger than the ring".to_string());
+            responses.write(response_size(&response), RING_TIMEOUT, |buf| {
+                write_response(buf, id, &response)
+            })?;
+            Ok(1)
+        }
+        Err(err) => Err(err),
+    }
+}
+
+/// The file of a region, removed once the client has mapped it or the connection is closed.
+struct ShmFile(Option<PathBuf>);
+
+impl ShmFile {
+    fn remove(&mut self) {
+        if let Some(path) = self.0.take() {
+            let _ = fs::remove_file(path);
+        }
+    }
+}
+
+impl Drop for ShmFile {
+    fn drop(&mut self) {
+        self.remove();
+    }
+}
+
+fn translate(
+    translator: &Translator,
+    options: &Options,
+    examples: Vec<Example>,
+) -> Result<Vec<Output>> {
+    // The tokens are borrowed from the regions of the clients.
+    let source = examples.iter().map(Example::source).collect::<Vec<_>>();
+    let target_prefix = examples
+        .iter()
+        .map(Example::target_prefix)
+        .collect::<Vec<_>>();
+    let options = TranslationOptions {
+        beam_size: options.beam_size as usize,
+        max_decoding_length: options.max_length as usize,
+        sampling_topk: options.sampling_topk as usize,
+        sampling_temperature: options.sampling_temperature,
+        return_scores: true,
+        ..TranslationOptions::default()
+    };
+    Ok(translator
+        .translate_batch(&source, &target_prefix, &options)?
+        .into_iter()
+        .map(|r| Output {
+            score: r.score(),
+            tokens: r.hypotheses.into_iter().next().unwrap_or_default(),
+        })
+        .collect())
+}
+
+fn generate(
+    generator: &Generator,
+    options: &Options,
+    examples: Vec<Example>,
+) -> Result<Vec<Output>> {
+    let start_tokens = examples.iter().map(Example::source).collect::<Vec<_>>();
+    let options = GenerationOptions {
+        beam_size: options.beam_size as usize,
+        max_length: options.max_length as usize,
+        sampling_topk: options.sampling_topk as usize,
+        sampling_temperature: options.sampling_temperature,
+        return_scores: true,
+        include_prompt_in_result: false,
+        ..GenerationOptions::default()
+    };
+    Ok(generator
+        .generate_batch(&start_tokens, &options)?
+        .into_iter()
+        .map(|r| Output {
+            score: r.scores.first().copied(),
+            tokens: r.sequences.into_iter().next().unwrap_or_default(),
+        })
+        .collect())
+}
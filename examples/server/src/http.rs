@@ -0,0 +1,170 @@
+// http.rs
+//
+// Copyright (c) 2023 Junpei Kawamoto
+//
+// This software is released under the MIT License.
+//
+// http://opensource.org/licenses/mit-license.php
+
+//! Minimal HTTP/1.1 on top of a TCP stream.
+//!
+//! Requests must give their body with `Content-Length`. Responses have a fixed length, or are
+//! streamed as server-sent events in the chunked transfer encoding.
+
+use std::io::{self, BufRead, Write};
+
+/// Maximum size of the request line and headers.
+const MAX_HEADER_SIZE: usize = 64 * 1024;
+/// Maximum size of a request body.
+const MAX_BODY_SIZE: usize = 16 * 1024 * 1024;
+
+/// An HTTP request.
+#[derive(Debug)]
+pub struct Request {
+    pub method: String,
+    pub path: String,
+    pub version: String,
+    pub headers: Vec<(String, String)>,
+    pub body: Vec<u8>,
+}
+
+impl Request {
+    /// Returns the value of the given header, compared case-insensitively.
+    pub fn header(&self, name: &str) -> Option<&str> {
+        self.headers
+            .iter()
+            .find(|(k, _)| k.eq_ignore_ascii_case(name))
+            .map(|(_, v)| v.as_str())
+    }
+
+    /// Returns whether the connection stays open after this request.
+    pub fn keep_alive(&self) -> bool {
+        match self.header("connection") {
+            Some(v) if v.eq_ignore_ascii_case("close") => false,
+            Some(v) if v.eq_ignore_ascii_case("keep-alive") => true,
+            _ => self.version == "HTTP/1.1",
+        }
+    }
+}
+
+/// Reads a request, or returns `None` if the connection is closed before it starts.
+pub fn read_request<R: BufRead>(r: &mut R) -> io::Result<Option<Request>> {
+    let mut line = String::new();
+    let mut header_size = r.read_line(&mut line)?;
+    if header_size == 0 {
+        return Ok(None);
+    }
+    let mut parts = line.split_whitespace();
+    let (Some(method), Some(path), Some(version)) = (parts.next(), parts.next(), parts.next())
+    else {
+        return Err(invalid("malformed request line"));
+    };
+    let (method, path, version) = (method.to_string(), path.to_string(), version.to_string());
+
+    let mut headers = Vec::new();
+    loop {
+        line.clear();
+        header_size += r.read_line(&mut line)?;
+        if header_size > MAX_HEADER_SIZE {
+            return Err(invalid("headers too large"));
+        }
+        let line = line.trim_end();
+        if line.is_empty() {
+            break;
+        }
+        let Some((name, value)) = line.split_once(':') else {
+            return Err(invalid("malformed header"));
+        };
+        headers.push((name.trim().to_string(), value.trim().to_string()));
+    }
+
+    let mut req = Request {
+        method,
+        path,
+        version,
+        headers,
+        body: Vec::new(),
+    };
+    if req.header("transfer-encoding").is_some() {
+        return Err(invalid("chunked request bodies are not supported"));
+    }
+    let length = match req.header("content-length") {
+        None => 0,
+        Some(v) => v
+            .parse::<usize>()
+            .map_err(|_| invalid("invalid content length"))?,
+    };
+    if length > MAX_BODY_SIZE {
+        return Err(invalid("body too large"));
+    }
+    req.body.resize(length, 0);
+    r.read_exact(&mut req.body)?;
+    Ok(Some(req))
+}
+
+fn invalid(msg: &str) -> io::Error {
+    io::Error::new(io::ErrorKind::InvalidData, msg)
+}
+
+/// Returns the reason phrase of a status code.
+fn reason(status: u16) -> &'static str {
+    match status {
+        200 => "OK",
+        400 => "Bad Request",
+        404 => "Not Found",
+        405 => "Method Not Allowed",
+        500 => "Internal Server Error",
+        503 => "Service Unavailable",
+        _ => "",
+    }
+}
+
+/// Writes a response with the given body.
+pub fn write_response<W: Write>(
+    w: &mut W,
+    status: u16,
+    content_type: &str,
+    body: &[u8],
+    keep_alive: bool,
+) -> io::Result<()> {
+    write!(
+        w,
+        "HTTP/1.1 {status} {}\r\nContent-Type: {content_type}\r\nContent-Length: {}\r\nConnection: {}\r\n\r\n",
+        reason(status),
+        body.len(),
+        if keep_alive { "keep-alive" } else { "close" }
+    )?;
+    w.write_all(body)?;
+    w.flush()
+}
+
+/// A response streaming server-sent events.
+pub struct EventStream<'a, W: Write> {
+    w: &'a mut W,
+}
+
+impl<'a, W: Write> EventStream<'a, W> {
+    /// Writes the headers of the response.
+    pub fn start(w: &'a mut W, keep_alive: bool) -> io::Result<Self> {
+        write!(
+            w,
+            "HTTP/1.1 200 OK\r\nContent-Type: text/event-stream\r\nCache-Control: no-cache\r\nTransfer-Encoding: chunked\r\nConnection: {}\r\n\r\n",
+            if keep_alive { "keep-alive" } else { "close" }
+        )?;
+        w.flush()?;
+        Ok(Self { w })
+    }
+
+    /// Sends an event with the given data, which must not contain newlines.
+    pub fn send(&mut self, data: &str) -> io::Result<()> {
+        let event = format!("data: {data}\n\n");
+        write!(self.w, "{:x}\r\n{event}\r\n", event.len())?;
+        self.w.flush()
+    }
+
+    /// Ends the response.
+    pub fn finish(self) -> io::Result<()> {
+        self.w.write_all(b"0\r\n\r\n")?;
+        self.w.flush()
+    }
+}
@@ -0,0 +1,677 @@
+// ipc.rs
+//
+// Copyright (c) 2023 Junpei Kawamoto
+//
+// This software is released under the MIT License.
+//
+// http://opensource.org/licenses/mit-license.php
+
+//! Protocol between the model daemon and its clients.
+//!
+//! A client connects to the Unix socket of the daemon, which replies with a [`Frame`] of
+//! [`Op::Hello`] whose `id` is the length of the path of a [shared-memory region](crate::shm)
+//! following it. The client maps the region before sending any frame, and the daemon removes the
+//! file once the first frame arrives, so that the region disappears with the connection.
+//!
+//! To run a request, the client writes it to the request ring and sends [`Op::Submit`] with its
+//! ID. The daemon batches it with the requests of the other clients, writes the response to the
+//! response ring, releases the request, and sends [`Op::Done`]. A connection runs one request at
+//! a time; a process issuing requests from several threads opens a connection per thread.
+//!
+//! Tokens travel packed in the rings and the daemon passes them to the model in place. All
+//! integers are little-endian. A request is
+//!
+//! ```text
+//! u64 id
+//! u32 model                  0 for the translator, 1 for the generator
+//! u32 num_examples
+//! u32 beam_size
+//! u32 max_length
+//! u32 sampling_topk
+//! f32 sampling_temperature
+//! sequences                  source and target prefix of each example for the translator,
+//!                            start tokens of each example for the generator
+//! ```
+//!
+//! and a response is
+//!
+//! ```text
+//! u64 id
+//! u32 status                 0 if succeeded, 1 if failed
+//! u32 num_examples           0 if failed
+//! f32 scores[num_examples]   NaN if unavailable
+//! sequences                  output of each example, or the error message if failed
+//! ```
+//!
+//! where `n` sequences are packed as
+//!
+//! ```text
+//! u32 num_tokens[n]
+//! u32 token_lengths[sum of num_tokens]
+//! u8  tokens[sum of token_lengths]       UTF-8
+//! ```
+
+use std::io::{self, Read, Write};
+use std::os::unix::net::UnixStream;
+use std::path::{Path, PathBuf};
+use std::time::Duration;
+
+use crate::shm::{Record, Region};
+
+/// Version of the protocol sent in [`Op::Hello`].
+pub const VERSION: u32 = 1;
+/// How long a side waits for the other to free space in a ring.
+pub const RING_TIMEOUT: Duration = Duration::from_secs(10);
+
+const REQUEST_HEADER_SIZE: usize = 32;
+const RESPONSE_HEADER_SIZE: usize = 16;
+
+/// Operation of a frame.
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+#[repr(u32)]
+pub enum Op {
+    /// The daemon gives the path of the region.
+    Hello = 0,
+    /// The client has written a request.
+    Submit = 1,
+    /// The daemon has written a response.
+    Done = 2,
+}
+
+/// A control message on the socket, 16 bytes of `u32 op`, `u32 status` and `u64 id`.
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+pub struct Frame {
+    pub op: Op,
+    pub status: u32,
+    pub id: u64,
+}
+
+impl Frame {
+    pub const SIZE: usize = 16;
+
+    /// Reads a frame, or returns `None` if the peer has closed the connection.
+    pub fn read<R: Read>(r: &mut R) -> io::Result<Option<Self>> {
+        let mut buf = [0; Self::SIZE];
+        match r.read_exact(&mut buf) {
+            Ok(()) => {}
+            Err(err) if err.kind() == io::ErrorKind::UnexpectedEof => return Ok(None),
+            Err(err) => return Err(err),
+        }
+        let op = match u32::from_le_bytes(buf[..4].try_into().unwrap()) {
+            0 => Op::Hello,
+            1 => Op::Submit,
+            2 => Op::Done,
+            _ => return Err(invalid("unknown operation")),
+        };
+        Ok(Some(Self {
+            op,
+            status: u32::from_le_bytes(buf[4..8].try_into().unwrap()),
+            id: u64::from_le_bytes(buf[8..].try_into().unwrap()),
+        }))
+    }
+
+    pub fn write<W: Write>(&self, w: &mut W) -> io::Result<()> {
+        let mut buf = [0; Self::SIZE];
+        buf[..4].copy_from_slice(&(self.op as u32).to_le_bytes());
+        buf[4..8].copy_from_slice(&self.status.to_le_bytes());
+        buf[8..].copy_from_slice(&self.id.to_le_bytes());
+        w.write_all(&buf)
+    }
+}
+
+/// Model a request runs on.
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+pub enum Model {
+    Translator,
+    Generator,
+}
+
+/// Options of a request, which requests in a batch must share.
+#[derive(Clone, Copy, Debug, PartialEq)]
+pub struct Options {
+    pub beam_size: u32,
+    pub max_length: u32,
+    pub sampling_topk: u32,
+    pub sampling_temperature: f32,
+}
+
+impl Default for Options {
+    fn default() -> Self {
+        Self {
+            beam_size: 1,
+            max_length: 256,
+            sampling_topk: 1,
+            sampling_temperature: 1.,
+        }
+    }
+}
+
+/// A token in a region.
+#[derive(Clone, Copy, Debug)]
+pub struct Span {
+    pub offset: usize,
+    pub len: usize,
+}
+
+impl Span {
+    /// Returns the token in the given region.
+    ///
+    /// Tokens are validated when the request is parsed; one modified by the client afterwards
+    /// reads as empty.
+    pub fn get(self, region: &Region) -> &str {
+        std::str::from_utf8(region.bytes(self.offset, self.len)).unwrap_or_default()
+    }
+}
+
+/// A request read from a region.
+#[derive(Debug)]
+pub struct Request {
+    pub id: u64,
+    pub model: Model,
+    pub options: Options,
+    /// Source and target prefix of each example for the translator, or start tokens of each
+    /// example for the generator.
+    pub sequences: Vec<Vec<Span>>,
+}
+
+impl Request {
+    /// Parses the request in the given record.
+    pub fn parse(region: &Region, record: Record) -> io::Result<Self> {
+        let mut r = Reader::new(region, record);
+        let id = r.u64()?;
+        let model = match r.u32()? {
+            0 => Model::Translator,
+            1 => Model::Generator,
+            _ => return Err(invalid("unknown model")),
+        };
+        let num_examples = r.u32()? as usize;
+        let options = Options {
+            beam_size: r.u32()?,
+            max_length: r.u32()?,
+            sampling_topk: r.u32()?,
+            sampling_temperature: r.f32()?,
+        };
+        let num_sequences = match model {
+            Model::Translator => num_examples.checked_mul(2),
+            Model::Generator => Some(num_examples),
+        };
+        let sequences = r.sequences(num_sequences.ok_or_else(|| invalid("too many examples"))?)?;
+        Ok(Self {
+            id,
+            model,
+            options,
+            sequences,
+        })
+    }
+
+    /// Returns the size of a request of the given sequences.
+    pub fn size<T: AsRef<str>>(sequences: &[&[T]]) -> usize {
+        REQUEST_HEADER_SIZE + packed_size(sequences)
+    }
+
+    /// Writes a request of the given sequences to `buf` of [`Request::size`] bytes.
+    pub fn write<T: AsRef<str>>(
+        buf: &mut [u8],
+        id: u64,
+        model: Model,
+        num_examples: usize,
+        options: &Options,
+        sequences: &[&[T]],
+    ) {
+        let mut w = Writer { buf, pos: 0 };
+        w.u64(id);
+        w.u32(model as u32);
+        w.u32(num_examples as u32);
+        w.u32(options.beam_size);
+        w.u32(options.max_length);
+        w.u32(options.sampling_topk);
+        w.f32(options.sampling_temperature);
+        w.sequences(sequences);
+    }
+}
+
+/// Output of an example.
+#[derive(Clone, Debug, Default, PartialEq)]
+pub struct Output {
+    pub tokens: Vec<String>,
+    pub score: Option<f32>,
+}
+
+/// A response, which is the outputs of the examples of a request or an error message.
+pub type Response = Result<Vec<Output>, String>;
+
+/// Returns the size of the given response.
+pub fn response_size(response: &Response) -> usize {
+    RESPONSE_HEADER_SIZE
+        + match response {
+            Ok(outputs) => {
+                4 * outputs.len()
+                    + packed_size(
+                        &outputs
+                            .iter()
+                            .map(|o| o.tokens.as_slice())
+                            .collect::<Vec<_>>(),
+                    )
+            }
+            Err(msg) => msg.len(),
+        }
+}
+
+/// Writes the response to the request of the given ID to `buf` of [`response_size`] bytes.
+pub fn write_response(buf: &mut [u8], id: u64, response: &Response) {
+    let mut w = Writer { buf, pos: 0 };
+    w.u64(id);
+    match response {
+        Ok(outputs) => {
+            w.u32(0);
+            w.u32(outputs.len() as u32);
+            for output in outputs {
+                w.f32(output.score.unwrap_or(f32::NAN));
+            }
+            w.sequences(
+                &outputs
+                    .iter()
+                    .map(|o| o.tokens.as_slice())
+                    .collect::<Vec<_>>(),
+            );
+        }
+        Err(msg) => {
+            w.u32(1);
+            w.u32(0);
+            w.bytes(msg.as_bytes());
+        }
+    }
+}
+
+/// Reads the response in the given record, returning its ID.
+pub fn read_response(region: &Region, record: Record) -> io::Result<(u64, Response)> {
+    let mut r = Reader::new(region, record);
+    let id = r.u64()?;
+    let status = r.u32()?;
+    let num_examples = r.u32()? as usize;
+    if status != 0 {
+        let msg = r.take(r.remaining())?;
+        return Ok((id, Err(String::from_utf8_lossy(msg).into_owned())));
+    }
+    r.check(num_examples, 4)?;
+    let scores = (0..num_examples)
+        .map(|_| r.f32())
+        .collect::<io::Result<Vec<_>>>()?;
+    let outputs = r
+        .sequences(num_examples)?
+        .into_iter()
+        .zip(scores)
+        .map(|(spans, score)| Output {
+            tokens: spans
+                .into_iter()
+                .map(|s| s.get(region).to_string())
+                .collect(),
+            score: (!score.is_nan()).then_some(score),
+        })
+        .collect();
+    Ok((id, Ok(outputs)))
+}
+
+fn packed_size<T: AsRef<str>>(sequences: &[&[T]]) -> usize {
+    sequences
+        .iter()
+        .map(|s| 4 + s.iter().map(|t| 4 + t.as_ref().len()).sum::<usize>())
+        .sum()
+}
+
+fn invalid(msg: &str) -> io::Error {
+    io::Error::new(io::ErrorKind::InvalidData, msg)
+}
+
+struct Writer<'a> {
+    buf: &'a mut [u8],
+    pos: usize,
+}
+
+impl Writer<'_> {
+    fn bytes(&mut self, b: &[u8]) {
+        self.buf[self.pos..self.pos + b.len()].copy_from_slice(b);
+        self.pos += b.len();
+    }
+
+    fn u32(&mut self, v: u32) {
+        self.bytes(&v.to_le_bytes());
+    }
+
+    fn u64(&mut self, v: u64) {
+        self.bytes(&v.to_le_bytes());
+    }
+
+    fn f32(&mut self, v: f32) {
+        self.bytes(&v.to_le_bytes());
+    }
+
+    fn sequences<T: AsRef<str>>(&mut self, sequences: &[&[T]]) {
+        for s in sequences {
+            self.u32(s.len() as u32);
+        }
+        for t in sequences.iter().flat_map(|s| s.iter()) {
+            self.u32(t.as_ref().len() as u32);
+        }
+        for t in sequences.iter().flat_map(|s| s.iter()) {
+            self.bytes(t.as_ref().as_bytes());
+        }
+    }
+}
+
+/// Reads the payload of a record in place, checking every length against it.
+struct Reader<'a> {
+    buf: &'a [u8],
+    /// Offset of the payload in the region.
+    base: usize,
+    pos: usize,
+}
+
+impl<'a> Reader<'a> {
+    fn new(region: &'a Region, record: Record) -> Self {
+        Self {
+            buf: region.bytes(record.offset, record.len),
+            base: record.offset,
+            pos: 0,
+        }
+    }
+
+    fn remaining(&self) -> usize {
+        self.buf.len() - self.pos
+    }
+
+    /// Fails unless `n` items of `size` bytes remain.
+    fn check(&self, n: usize, size: usize) -> io::Result<()> {
+        match n.checked_mul(size) {
+            Some(len) if len <= self.remaining() => Ok(()),
+            _ => Err(invalid("truncated message")),
+        }
+    }
+
+    fn take(&mut self, len: usize) -> io::Result<&'a [u8]> {
+        self.check(len, 1)?;
+        let b = &self.buf[self.pos..self.pos + len];
+        self.pos += len;
+        Ok(b)
+    }
+
+    fn u32(&mut self) -> io::Result<u32> {
+        Ok(u32::from_le_bytes(self.take(4)?.try_into().unwrap()))
+    }
+
+    fn u64(&mut self) -> io::Result<u64> {
+        Ok(u64::from_le_bytes(self.take(8)?.try_into().unwrap()))
+    }
+
+    fn f32(&mut self) -> io::Result<f32> {
+        Ok(f32::from_le_bytes(self.take(4)?.try_into().unwrap()))
+    }
+
+    fn sequences(&mut self, n: usize) -> io::Result<Vec<Vec<Span>>> {
+        self.check(n, 4)?;
+        let num_tokens = (0..n)
+            .map(|_| self.u32().map(|v| v as usize))
+            .collect::<io::Result<Vec<_>>>()?;
+        let total = num_tokens
+            .iter()
+            .try_fold(0usize, |acc, &n| acc.checked_add(n))
+            .ok_or_else(|| invalid("too many tokens"))?;
+        self.check(total, 4)?;
+        let lengths = (0..total)
+            .map(|_| self.u32().map(|v| v as usize))
+            .collect::<io::Result<Vec<_>>>()?;
+
+        let mut lengths = lengths.into_iter();
+        let mut sequences = Vec::with_capacity(n);
+        for n in num_tokens {
+            let mut spans = Vec::with_capacity(n);
+            for len in lengths.by_ref().take(n) {
+                let offset = self.base + self.pos;
+                std::str::from_utf8(self.take(len)?).map_err(|_| invalid("token not in UTF-8"))?;
+                spans.push(Span { offset, len });
+            }
+            sequences.push(spans);
+        }
+        Ok(sequences)
+    }
+}
+
+/// A client of the daemon.
+pub struct Client {
+    socket: UnixStream,
+    region: Region,
+    next_id: u64,
+}
+
+impl Client {
+    /// Connects to the daemon listening on the given socket.
+    pub fn connect<P: AsRef<Path>>(socket: P) -> io::Result<Self> {
+        let mut socket = UnixStream::connect(socket)?;
+        let hello =
+            Frame::read(&mut socket)?.ok_or_else(|| invalid("the daemon closed the connection"))?;
+        if hello.op != Op::Hello || hello.status != VERSION {
+            return Err(invalid("unsupported daemon"));
+        }
+        let mut path = vec![0; hello.id as usize];
+        socket.read_exact(&mut path)?;
+        let path = PathBuf::from(String::from_utf8(path).map_err(|_| invalid("invalid path"))?);
+        Ok(Self {
+            region: Region::open(path)?,
+            socket,
+            next_id: 0,
+        })
+    }
+
+    /// Translates a batch of tokens with the translator of the daemon.
+    pub fn translate<T: AsRef<str>, U: AsRef<str>>(
+        &mut self,
+        source: &[Vec<T>],
+        target_prefix: &[Vec<U>],
+        options: &Options,
+    ) -> io::Result<Vec<Output>> {
+        let mut sequences = Vec::with_capacity(2 * source.len());
+        for (i, s) in source.iter().enumerate() {
+            sequences.push(s.iter().map(T::as_ref).collect::<Vec<_>>());
+            sequences.push(
+                target_prefix
+                    .get(i)
+                    .map(|p| p.iter().map(U::as_ref).collect())
+                    .unwrap_or_default(),
+            );
+        }
+        self.request(Model::Translator, source.len(), options, &sequences)
+    }
+
+    /// Generates from a batch of start tokens with the generator of the daemon. The outputs do
+    /// not include the start tokens.
+    pub fn generate<T: AsRef<str>>(
+        &mut self,
+        start_tokens: &[Vec<T>],
+        options: &Options,
+    ) -> io::Result<Vec<Output>> {
+        let sequences = start_tokens
+            .iter()
+            .map(|s| s.iter().map(T::as_ref).collect::<Vec<_>>())
+            .collect::<Vec<_>>();
+        self.request(Model::Generator, start_tokens.len(), options, &sequences)
+    }
+
+    fn request(
+        &mut self,
+        model: Model,
+        num_examples: usize,
+        options: &Options,
+        sequences: &[Vec<&str>],
+    ) -> io::Result<Vec<Output>> {
+        let id = self.next_id;
+        self.next_id += 1;
+        let sequences = sequences.iter().map(Vec::as_slice).collect::<Vec<_>>();
+        self.region
+            .requests()
+            .write(Request::size(&sequences), RING_TIMEOUT, |buf| {
+                Request::write(buf, id, model, num_examples, options, &sequences)
+            })?;
+        Frame {
+            op: Op::Submit,
+            status: 0,
+            id,
+        }
+        .write(&mut self.socket)?;
+
+        let done = Frame::read(&mut self.socket)?
+            .ok_or_else(|| invalid("the daemon closed the connection"))?;
+        if done.op != Op::Done || done.id != id {
+            return Err(invalid("unexpected frame"));
+        }
+        let responses = self.region.responses();
+        let record = responses
+            .peek()?
+            .ok_or_else(|| invalid("no response in the ring"))?;
+        let (response_id, response) = read_response(&self.region, record)?;
+        responses.release(record);
+        if response_id != id {
+            return Err(invalid("response to another request"));
+        }
+        response.map_err(io::Error::other)
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use std::io::Cursor;
+
+    use super::*;
+    use crate::shm::tests::TempPath;
+
+    #[test]
+    fn frame_round_trip() {
+        let frames = [
+            Frame {
+                op: Op::Hello,
+                status: VERSION,
+                id: 42,
+            },
+            Frame {
+                op: Op::Submit,
+                status: 0,
+                id: u64::MAX,
+            },
+            Frame {
+                op: Op::Done,
+                status: 1,
+                id: 7,
+            },
+        ];
+        let mut buf = Vec::new();
+        for frame in &frames {
+            frame.write(&mut buf).unwrap();
+        }
+        assert_eq!(buf.len(), frames.len() * Frame::SIZE);
+
+        let mut r = Cursor::new(buf);
+        for frame in frames {
+            assert_eq!(Frame::read(&mut r).unwrap(), Some(frame));
+        }
+        assert_eq!(Frame::read(&mut r).unwrap(), None);
+    }
+
+    #[test]
+    fn frame_with_unknown_operation() {
+        let mut buf = [0; Frame::SIZE];
+        buf[0] = 3;
+        let err = Frame::read(&mut Cursor::new(buf)).unwrap_err();
+        assert_eq!(err.kind(), io::ErrorKind::InvalidData);
+    }
+
+    #[test]
+    fn request_round_trip() {
+        let path = TempPath::new();
+        let region = Region::create(&path.0, 1024).unwrap();
+        let ring = region.requests();
+        let options = Options {
+            beam_size: 4,
+            ..Default::default()
+        };
+        let sequences: [&[&str]; 4] = [&["▁Hello", "▁world"], &["deu_Latn"], &[], &["fra_Latn"]];
+
+        let size = Request::size(&sequences);
+        ring.write(size, RING_TIMEOUT, |buf| {
+            Request::write(buf, 9, Model::Translator, 2, &options, &sequences)
+        })
+        .unwrap();
+        let record = ring.peek().unwrap().unwrap();
+        assert_eq!(record.len, size);
+
+        let request = Request::parse(&region, record).unwrap();
+        assert_eq!(request.id, 9);
+        assert_eq!(request.model, Model::Translator);
+        assert_eq!(request.options, options);
+        let tokens = request
+            .sequences
+            .iter()
+            .map(|s| s.iter().map(|t| t.get(&region)).collect::<Vec<_>>())
+            .collect::<Vec<_>>();
+        assert_eq!(tokens, sequences);
+    }
+
+    #[test]
+    fn truncated_request() {
+        let path = TempPath::new();
+        let region = Region::create(&path.0, 1024).unwrap();
+        let ring = region.requests();
+        let sequences: [&[&str]; 1] = [&["a", "b"]];
+
+        let size = Request::size(&sequences);
+        ring.write(size - 1, RING_TIMEOUT, |buf| {
+            let mut full = vec![0; size];
+            Request::write(
+                &mut full,
+                1,
+                Model::Generator,
+                1,
+                &Options::default(),
+                &sequences,
+            );
+            buf.copy_from_slice(&full[..size - 1]);
+        })
+        .unwrap();
+        let record = ring.peek().unwrap().unwrap();
+        let err = Request::parse(&region, record).unwrap_err();
+        assert_eq!(err.kind(), io::ErrorKind::InvalidData);
+    }
+
+    #[test]
+    fn response_round_trip() {
+        let path = TempPath::new();
+        let region = Region::create(&path.0, 1024).unwrap();
+        let ring = region.responses();
+        let responses: [Response; 2] = [
+            Ok(vec![
+                Output {
+                    tokens: vec!["▁Hallo".to_string(), "▁Welt".to_string()],
+                    score: Some(-0.5),
+                },
+                Output {
+                    tokens: vec![],
+                    score: None,
+                },
+            ]),
+            Err("failed to translate".to_string()),
+        ];
+
+        for (id, response) in responses.iter().enumerate() {
+            ring.write(response_size(response), RING_TIMEOUT, |buf| {
+                write_response(buf, id as u64, response)
+            })
+            .unwrap();
+        }
+        for (id, response) in responses.into_iter().enumerate() {
+            let record = ring.peek().unwrap().unwrap();
+            assert_eq!(
+                read_response(&region, record).unwrap(),
+                (id as u64, response)
+            );
+            ring.release(record);
+        }
+    }
+}
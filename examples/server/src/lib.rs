@@ -0,0 +1,17 @@
+// lib.rs
+//
+// Copyright (c) 2023 Junpei Kawamoto
+//
+// This software is released under the MIT License.
+//
+// http://opensource.org/licenses/mit-license.php
+
+//! Serving models to other processes: over HTTP, or to local processes through shared memory.
+
+pub mod batcher;
+#[cfg(unix)]
+pub mod daemon;
+#[cfg(unix)]
+pub mod ipc;
+#[cfg(unix)]
+pub mod shm;
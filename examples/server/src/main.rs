@@ -0,0 +1,458 @@
+// main.rs
+//
+// Copyright (c) 2023 Junpei Kawamoto
+//
+// This software is released under the MIT License.
+//
+// http://opensource.org/licenses/mit-license.php
+
+//! HTTP inference server with dynamic batching.
+
+use std::fmt::Write as _;
+use std::io::{BufReader, Write};
+use std::net::{TcpListener, TcpStream};
+use std::path::Path;
+use std::sync::atomic::{AtomicU64, Ordering};
+use std::sync::{mpsc, Arc};
+use std::thread;
+use std::time::{Duration, SystemTime, UNIX_EPOCH};
+
+use anyhow::{anyhow, Result};
+use clap::Parser;
+use serde::Serialize;
+
+use ctranslate2::config::{Config, Device};
+use ctranslate2::metrics::{self, Metrics};
+use ctranslate2::{Generator, Translator};
+use ctranslate2_example_server::batcher::{Batcher, BatcherMetrics};
+
+use crate::api::{
+    Choice, Completion, CompletionRequest, CompletionResponse, ErrorResponse, GenerationItem,
+    GenerationKey, Piece, Translation, TranslationItem, TranslationKey, TranslationRequest,
+    TranslationResponse, Usage,
+};
+use crate::http::{read_request, write_response, EventStream, Request};
+
+mod api;
+mod http;
+
+/// Serve a translator and a generator over HTTP.
+#[derive(Parser, Debug)]
+#[command(author, version, about, long_about = None)]
+struct Args {
+    /// Path to the directory that contains the translation model.
+    #[arg(long, value_name = "PATH")]
+    translator: Option<String>,
+    /// Path to the directory that contains the generation model.
+    #[arg(long, value_name = "PATH")]
+    generator: Option<String>,
+    /// Address to listen on.
+    #[arg(short, long, default_value = "127.0.0.1:8080")]
+    addr: String,
+    /// Use CUDA.
+    #[arg(long)]
+    cuda: bool,
+    /// Number of threads per replica (0 to use the default).
+    #[arg(short, long, default_value_t = 0)]
+    threads: usize,
+    /// Number of replicas of each model.
+    #[arg(short, long, default_value_t = 1)]
+    replicas: usize,
+    /// Maximum number of examples in a batch.
+    #[arg(long, default_value_t = 32)]
+    max_batch_size: usize,
+    /// Maximum time in milliseconds to wait for more requests to fill a batch.
+    #[arg(long, default_value_t = 5)]
+    batch_timeout: u64,
+    /// Maximum number of requests waiting for a batch of each model.
+    #[arg(long, default_value_t = 1024)]
+    queue_size: usize,
+    /// Seconds to keep an idle connection open.
+    #[arg(long, default_value_t = 60)]
+    keep_alive: u64,
+}
+
+type TranslationBatcher = Batcher<TranslationKey, TranslationItem, Translation>;
+type GenerationBatcher = Batcher<GenerationKey, GenerationItem, Completion>;
+
+struct Server {
+    translator: Option<(String, TranslationBatcher)>,
+    generator: Option<(String, GenerationBatcher)>,
+    /// Responses by status code.
+    responses: [(u16, AtomicU64); 5],
+    next_id: AtomicU64,
+}
+
+fn main() -> Result<()> {
+    let args = Args::parse();
+    if args.translator.is_none() && args.generator.is_none() {
+        return Err(anyhow!("either --translator or --generator is required"));
+    }
+    let config = || Config {
+        device_indices: vec![0; args.replicas],
+        num_threads_per_replica: args.threads,
+        ..Config::default()
+    };
+    let device = || if args.cuda { Device::CUDA } else { Device::CPU };
+    let batcher_options = (
+        args.max_batch_size,
+        Duration::from_millis(args.batch_timeout),
+        args.replicas,
+        args.queue_size,
+    );
+
+    let translator = match &args.translator {
+        None => None,
+        Some(path) => {
+            let name = model_name(path);
+            let mut t = Translator::new(path, device(), config())?;
+            t.set_metrics(Metrics::register(&name));
+            let t = Arc::new(t);
+            let (size, timeout, workers, queue) = batcher_options;
+            Some((
+                name,
+                Batcher::new(size, timeout, workers, queue, move |key, items| {
+                    api::translate(&t, key, items)
+                }),
+            ))
+        }
+    };
+    let generator = match &args.generator {
+        None => None,
+        Some(path) => {
+            let name = model_name(path);
+            let mut g = Generator::new(path, device(), config())?;
+            g.set_metrics(Metrics::register(&name));
+            let g = Arc::new(g);
+            let (size, timeout, workers, queue) = batcher_options;
+            Some((
+                name,
+                Batcher::new(size, timeout, workers, queue, move |key, items| {
+                    api::complete(&g, key, items)
+                }),
+            ))
+        }
+    };
+
+    let server = Arc::new(Server {
+        translator,
+        generator,
+        responses: [200, 400, 404, 405, 500].map(|code| (code, AtomicU64::new(0))),
+        next_id: AtomicU64::new(0),
+    });
+    let listener = TcpListener::bind(&args.addr)?;
+    eprintln!("listening on http://{}", listener.local_addr()?);
+    for stream in listener.incoming() {
+        let stream = match stream {
+            Ok(stream) => stream,
+            Err(err) => {
+                eprintln!("failed to accept a connection: {err}");
+                continue;
+            }
+        };
+        let server = server.clone();
+        let keep_alive = Duration::from_secs(args.keep_alive);
+        thread::spawn(move || {
+            let _ = server.serve_connection(stream, keep_alive);
+        });
+    }
+    Ok(())
+}
+
+/// Returns the name of the model in the given directory.
+fn model_name(path: &str) -> String {
+    Path::new(path)
+        .file_name()
+        .map_or(path.to_string(), |n| n.to_string_lossy().into_owned())
+}
+
+impl Server {
+    fn serve_connection(&self, stream: TcpStream, keep_alive: Duration) -> Result<()> {
+        stream.set_read_timeout(Some(keep_alive))?;
+        stream.set_nodelay(true)?;
+        let mut reader = BufReader::new(stream.try_clone()?);
+        let mut writer = stream;
+        while let Some(req) = read_request(&mut reader)? {
+            let keep_alive = req.keep_alive();
+            let status = self.handle(&req, &mut writer, keep_alive)?;
+            if let Some((_, n)) = self.responses.iter().find(|(code, _)| *code == status) {
+                n.fetch_add(1, Ordering::Relaxed);
+            }
+            if !keep_alive {
+                break;
+            }
+        }
+        Ok(())
+    }
+
+    /// Handles a request and returns the status code of the response.
+    fn handle<W: Write>(&self, req: &Request, w: &mut W, keep_alive: bool) -> Result<u16> {
+        let res = match (req.method.as_str(), req.path.as_str()) {
+            ("GET", "/health") => (200, "text/plain", b"ok".to_vec()),
+            ("GET", "/metrics") => (
+                200,
+                "text/plain; version=0.0.4",
+                self.render_metrics().into_bytes(),
+            ),
+            ("GET", "/v1/models") => json(200, &self.models()),
+            ("POST", "/v1/translations") => self.translate(req),
+            ("POST", "/v1/completions") => return self.complete(req, w, keep_alive),
+            (_, "/health" | "/metrics" | "/v1/models" | "/v1/translations" | "/v1/completions") => {
+                error(405, "invalid_request_error", "method not allowed")
+            }
+            _ => error(404, "invalid_request_error", "not found"),
+        };
+        write_response(w, res.0, res.1, &res.2, keep_alive)?;
+        Ok(res.0)
+    }
+
+    fn models(&self) -> serde_json::Value {
+        let data = [
+            &self.translator.as_ref().map(|(n, _)| n),
+            &self.generator.as_ref().map(|(n, _)| n),
+        ]
+        .into_iter()
+        .flatten()
+        .map(|name| serde_json::json!({"id": name, "object": "model", "owned_by": "ctranslate2"}))
+        .collect::<Vec<_>>();
+        serde_json::json!({"object": "list", "data": data})
+    }
+
+    fn translate(&self, req: &Request) -> (u16, &'static str, Vec<u8>) {
+        let Some((_, batcher)) = &self.translator else {
+            return error(
+                404,
+                "invalid_request_error",
+                "no translation model is loaded",
+            );
+        };
+        let body: TranslationRequest = match serde_json::from_slice(&req.body) {
+            Ok(body) => body,
+            Err(err) => return error(400, "invalid_request_error", err),
+        };
+        let key = TranslationKey {
+            beam_size: body.beam_size,
+            max_decoding_length: body.max_decoding_length,
+        };
+        let items = body
+            .text
+            .into_vec()
+            .into_iter()
+            .map(|text| (text, body.target_prefix.clone()))
+            .collect();
+        match batcher.submit(key, items) {
+            Ok(translations) => json(200, &TranslationResponse { translations }),
+            Err(err) => error(500, "server_error", format!("{err:#}")),
+        }
+    }
+
+    fn complete<W: Write>(&self, req: &Request, w: &mut W, keep_alive: bool) -> Result<u16> {
+        let res = match self.parse_completion(req) {
+            Ok((body, key)) if body.stream => return self.stream(body, key, w, keep_alive),
+            Ok((body, key)) => {
+                let id = self.next_id();
+                let items = body
+                    .prompt
+                    .into_vec()
+                    .into_iter()
+                    .enumerate()
+                    .map(|(index, prompt)| GenerationItem {
+                        prompt,
+                        index,
+                        stream: None,
+                    })
+                    .collect();
+                match self.generator.as_ref().unwrap().1.submit(key, items) {
+                    Ok(completions) => {
+                        let usage = Usage {
+                            completion_tokens: completions
+                                .iter()
+                                .map(|c| c.completion_tokens)
+                                .sum(),
+                        };
+                        json(
+                            200,
+                            &self.completion_response(
+                                &id,
+                                completions
+                                    .into_iter()
+                                    .enumerate()
+                                    .map(|(index, c)| Choice {
+                                        text: c.text,
+                                        index,
+                                        logprobs: None,
+                                        finish_reason: Some(c.finish_reason),
+                                    })
+                                    .collect(),
+                                Some(usage),
+                            ),
+                        )
+                    }
+                    Err(err) => error(500, "server_error", format!("{err:#}")),
+                }
+            }
+            Err(res) => res,
+        };
+        write_response(w, res.0, res.1, &res.2, keep_alive)?;
+        Ok(res.0)
+    }
+
+    /// Parses a completion request, or returns the error response.
+    #[allow(clippy::result_large_err)]
+    fn parse_completion(
+        &self,
+        req: &Request,
+    ) -> Result<(CompletionRequest, GenerationKey), (u16, &'static str, Vec<u8>)> {
+        let Some((name, _)) = &self.generator else {
+            return Err(error(
+                404,
+                "invalid_request_error",
+                "no generation model is loaded",
+            ));
+        };
+        let body: CompletionRequest = serde_json::from_slice(&req.body)
+            .map_err(|err| error(400, "invalid_request_error", err))?;
+        if matches!(&body.model, Some(model) if model != name) {
+            return Err(error(
+                404,
+                "invalid_request_error",
+                format!("unknown model: {}", body.model.unwrap()),
+            ));
+        }
+        let key = body
+            .key()
+            .map_err(|err| error(400, "invalid_request_error", err))?;
+        Ok((body, key))
+    }
+
+    /// Streams a completion as server-sent events while its batch runs.
+    fn stream<W: Write>(
+        &self,
+        body: CompletionRequest,
+        key: GenerationKey,
+        w: &mut W,
+        keep_alive: bool,
+    ) -> Result<u16> {
+        let id = self.next_id();
+        let (tx, rx) = mpsc::channel::<Piece>();
+        let items = body
+            .prompt
+            .into_vec()
+            .into_iter()
+            .enumerate()
+            .map(|(index, prompt)| GenerationItem {
+                prompt,
+                index,
+                stream: Some(tx.clone()),
+            })
+            .collect::<Vec<_>>();
+        drop(tx);
+
+        let batcher = &self.generator.as_ref().unwrap().1;
+        thread::scope(|s| -> Result<u16> {
+            let batch = s.spawn(|| batcher.submit(key, items));
+            let mut events = EventStream::start(w, keep_alive)?;
+            // The receiver is disconnected once the batch has dropped the items.
+            for piece in rx {
+                let chunk = self.completion_response(
+                    &id,
+                    vec![Choice {
+                        text: piece.text,
+                        index: piece.index,
+                        logprobs: None,
+                        finish_reason: None,
+                    }],
+                    None,
+                );
+                events.send(&serde_json::to_string(&chunk)?)?;
+            }
+            match batch.join().expect("the batch panicked") {
+                Ok(completions) => {
+                    for (index, c) in completions.into_iter().enumerate() {
+                        let chunk = self.completion_response(
+                            &id,
+                            vec![Choice {
+                                text: String::new(),
+                                index,
+                                logprobs: None,
+                                finish_reason: Some(c.finish_reason),
+                            }],
+                            None,
+                        );
+                        events.send(&serde_json::to_string(&chunk)?)?;
+                    }
+                }
+                Err(err) => {
+                    let body = ErrorResponse::new("server_error", format!("{err:#}"));
+                    events.send(&serde_json::to_string(&body)?)?;
+                }
+            }
+            events.send("[DONE]")?;
+            events.finish()?;
+            Ok(200)
+        })
+    }
+
+    fn completion_response<'a>(
+        &'a self,
+        id: &'a str,
+        choices: Vec<Choice>,
+        usage: Option<Usage>,
+    ) -> CompletionResponse<'a> {
+        CompletionResponse {
+            id,
+            object: "text_completion",
+            created: SystemTime::now()
+                .duration_since(UNIX_EPOCH)
+                .map_or(0, |d| d.as_secs()),
+            model: self.generator.as_ref().map_or("", |(name, _)| name),
+            choices,
+            usage,
+        }
+    }
+
+    fn next_id(&self) -> String {
+        format!("cmpl-{}", self.next_id.fetch_add(1, Ordering::Relaxed))
+    }
+
+    /// Renders the metrics of the models followed by those of the server.
+    fn render_metrics(&self) -> String {
+        let mut out = metrics::render();
+        let mut models = Vec::new();
+        if let Some((name, batcher)) = &self.translator {
+            models.push((name.as_str(), batcher.metrics()));
+        }
+        if let Some((name, batcher)) = &self.generator {
+            models.push((name.as_str(), batcher.metrics()));
+        }
+        BatcherMetrics::render(&models, &mut out);
+        let _ = writeln!(
+            out,
+            "# HELP ct2_server_http_responses_total HTTP responses by status code."
+        );
+        let _ = writeln!(out, "# TYPE ct2_server_http_responses_total counter");
+        for (code, n) in &self.responses {
+            let _ = writeln!(
+                out,
+                "ct2_server_http_responses_total{{code=\"{code}\"}} {}",
+                n.load(Ordering::Relaxed)
+            );
+        }
+        out
+    }
+}
+
+fn json<T: Serialize>(status: u16, body: &T) -> (u16, &'static str, Vec<u8>) {
+    match serde_json::to_vec(body) {
+        Ok(body) => (status, "application/json", body),
+        Err(err) => error(500, "server_error", err),
+    }
+}
+
+fn error<T: ToString>(status: u16, kind: &'static str, message: T) -> (u16, &'static str, Vec<u8>) {
+    (
+        status,
+        "application/json",
+        serde_json::to_vec(&ErrorResponse::new(kind, message)).unwrap_or_default(),
+    )
+}
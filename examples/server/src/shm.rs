@@ -0,0 +1,449 @@
+// shm.rs
+//
+// Copyright (c) 2023 Junpei Kawamoto
+//
+// This software is released under the MIT License.
+//
+// http://opensource.org/licenses/mit-license.php
+
+//! Shared-memory regions holding a pair of single-producer single-consumer rings.
+//!
+//! A region is a file, usually in `/dev/shm`, mapped by the daemon and one client. All integers
+//! are little-endian:
+//!
+//! | Offset                | Size        | Content                                  |
+//! |-----------------------|-------------|------------------------------------------|
+//! | 0                     | 8           | Magic `CT2SHM\0\x01`                     |
+//! | 8                     | 8           | Size of the data of each ring in bytes   |
+//! | 64                    | 8           | Head of the request ring                 |
+//! | 128                   | 8           | Tail of the request ring                 |
+//! | 192                   | 8           | Head of the response ring                |
+//! | 256                   | 8           | Tail of the response ring                |
+//! | 320                   | ring size   | Data of the request ring                 |
+//! | 320 + ring size       | ring size   | Data of the response ring                |
+//!
+//! Heads and tails are byte positions which only increase; the producer owns the head and the
+//! consumer the tail. A ring holds records aligned to 8 bytes, each of which is a `u32` length, a
+//! `u32` flag, and the payload padded to 8 bytes. A record never wraps around the end of the data:
+//! the producer fills the rest of the data with a record flagged [`WRAP`] instead, so that every
+//! payload can be read in place.
+
+use std::fs::{File, OpenOptions};
+use std::io;
+use std::os::unix::fs::OpenOptionsExt;
+use std::os::unix::io::AsRawFd;
+use std::path::Path;
+use std::sync::atomic::{AtomicU64, Ordering};
+use std::thread;
+use std::time::{Duration, Instant};
+
+/// Magic number at the start of a region.
+pub const MAGIC: [u8; 8] = *b"CT2SHM\0\x01";
+/// Flag of a record which only skips to the start of the data.
+pub const WRAP: u32 = 1;
+
+/// Offset of the first ring header.
+const RINGS_OFFSET: usize = 64;
+/// Size of a ring header, which puts the head and the tail on separate cache lines.
+const RING_HEADER_SIZE: usize = 128;
+/// Offset of the data of the first ring.
+const DATA_OFFSET: usize = RINGS_OFFSET + 2 * RING_HEADER_SIZE;
+const RECORD_HEADER_SIZE: usize = 8;
+
+/// A mapped region.
+pub struct Region {
+    ptr: *mut u8,
+    len: usize,
+    ring_size: usize,
+}
+
+// The region only hands out the rings, whose positions are atomic, and payloads which the
+// protocol gives to one side at a time.
+unsafe impl Send for Region {}
+unsafe impl Sync for Region {}
+
+impl Region {
+    /// Creates a region at the given path with rings of at least `ring_size` bytes each.
+    ///
+    /// The file must not exist, and is readable and writable by the current user only.
+    pub fn create<P: AsRef<Path>>(path: P, ring_size: usize) -> io::Result<Self> {
+        let ring_size = align(ring_size.max(RECORD_HEADER_SIZE));
+        let len = DATA_OFFSET + 2 * ring_size;
+        let file = OpenOptions::new()
+            .read(true)
+            .write(true)
+            .create_new(true)
+            .mode(0o600)
+            .open(path)?;
+        file.set_len(len as u64)?;
+        let region = Self {
+            ptr: map(&file, len)?,
+            len,
+            ring_size,
+        };
+        // The file is zero-filled, so both rings start empty.
+        unsafe {
+            std::ptr::copy_nonoverlapping(MAGIC.as_ptr(), region.ptr, MAGIC.len());
+            std::ptr::copy_nonoverlapping(
+                (ring_size as u64).to_le_bytes().as_ptr(),
+                region.ptr.add(8),
+                8,
+            );
+        }
+        Ok(region)
+    }
+
+    /// Maps the region at the given path created by another process.
+    pub fn open<P: AsRef<Path>>(path: P) -> io::Result<Self> {
+        let file = OpenOptions::new().read(true).write(true).open(path)?;
+        let len = file.metadata()?.len() as usize;
+        if len < DATA_OFFSET {
+            return Err(invalid("region too small"));
+        }
+        let mut region = Self {
+            ptr: map(&file, len)?,
+            len,
+            ring_size: 0,
+        };
+        let header = region.bytes(0, 16);
+        if header[..8] != MAGIC {
+            return Err(invalid("not a region of the daemon"));
+        }
+        let ring_size = u64::from_le_bytes(header[8..16].try_into().unwrap()) as usize;
+        if align(ring_size) != ring_size || DATA_OFFSET + 2 * ring_size != len {
+            return Err(invalid("invalid ring size"));
+        }
+        region.ring_size = ring_size;
+        Ok(region)
+    }
+
+    /// Returns the ring carrying requests from the client to the daemon.
+    pub fn requests(&self) -> Ring<'_> {
+        self.ring(0)
+    }
+
+    /// Returns the ring carrying responses from the daemon to the client.
+    pub fn responses(&self) -> Ring<'_> {
+        self.ring(1)
+    }
+
+    fn ring(&self, i: usize) -> Ring<'_> {
+        let header = RINGS_OFFSET + i * RING_HEADER_SIZE;
+        unsafe {
+            Ring {
+                region: self,
+                head: &*(self.ptr.add(header) as *const AtomicU64),
+                tail: &*(self.ptr.add(header + 64) as *const AtomicU64),
+                data: DATA_OFFSET + i * self.ring_size,
+                capacity: self.ring_size,
+            }
+        }
+    }
+
+    /// Returns the bytes at the given offset of the region.
+    ///
+    /// Panics if they are out of the region.
+    pub fn bytes(&self, offset: usize, len: usize) -> &[u8] {
+        assert!(offset <= self.len && len <= self.len - offset);
+        unsafe { std::slice::from_raw_parts(self.ptr.add(offset), len) }
+    }
+
+    /// Returns the bytes at the given offset of the region to write.
+    ///
+    /// # Safety
+    /// The bytes must not be accessed by another reference while the returned one is alive.
+    #[allow(clippy::mut_from_ref)]
+    unsafe fn bytes_mut(&self, offset: usize, len: usize) -> &mut [u8] {
+        assert!(offset <= self.len && len <= self.len - offset);
+        std::slice::from_raw_parts_mut(self.ptr.add(offset), len)
+    }
+}
+
+impl Drop for Region {
+    fn drop(&mut self) {
+        unsafe {
+            libc::munmap(self.ptr as *mut libc::c_void, self.len);
+        }
+    }
+}
+
+fn map(file: &File, len: usize) -> io::Result<*mut u8> {
+    let ptr = unsafe {
+        libc::mmap(
+            std::ptr::null_mut(),
+            len,
+            libc::PROT_READ | libc::PROT_WRITE,
+            libc::MAP_SHARED,
+            file.as_raw_fd(),
+            0,
+        )
+    };
+    if ptr == libc::MAP_FAILED {
+        return Err(io::Error::last_os_error());
+    }
+    Ok(ptr as *mut u8)
+}
+
+fn align(n: usize) -> usize {
+    (n + 7) & !7
+}
+
+fn invalid(msg: &str) -> io::Error {
+    io::Error::new(io::ErrorKind::InvalidData, msg)
+}
+
+/// A record read from a ring.
+#[derive(Clone, Copy, Debug)]
+pub struct Record {
+    /// Offset of the payload in the region.
+    pub offset: usize,
+    /// Length of the payload.
+    pub len: usize,
+    /// Position of the ring after this record.
+    next: u64,
+}
+
+/// A ring in a region.
+pub struct Ring<'a> {
+    region: &'a Region,
+    head: &'a AtomicU64,
+    tail: &'a AtomicU64,
+    /// Offset of the data in the region.
+    data: usize,
+    capacity: usize,
+}
+
+impl Ring<'_> {
+    /// Writes a record of `len` bytes filled by `fill`, waiting up to `timeout` for the consumer to
+    /// free enough space. Fails with [`io::ErrorKind::InvalidData`] if the positions of the ring
+    /// are inconsistent.
+    ///
+    /// Must be called by the producer only.
+    pub fn write<F: FnOnce(&mut [u8])>(
+        &self,
+        len: usize,
+        timeout: Duration,
+        fill: F,
+    ) -> io::Result<()> {
+        let size = RECORD_HEADER_SIZE + align(len);
+        if size > self.capacity {
+            return Err(io::Error::new(
+                io::ErrorKind::InvalidInput,
+                "record larger than the ring",
+            ));
+        }
+        let start = Instant::now();
+        loop {
+            let mut head = self.head.load(Ordering::Relaxed);
+            let tail = self.tail.load(Ordering::Acquire);
+            // The positions live in memory shared with the other process.
+            if tail > head || head - tail > self.capacity as u64 {
+                return Err(invalid("corrupted ring"));
+            }
+            let to_end = self.capacity - (head % self.capacity as u64) as usize;
+            let needed = if size > to_end { to_end + size } else { size };
+            if self.capacity - (head - tail) as usize >= needed {
+                if size > to_end {
+                    self.write_header(head, 0, WRAP);
+                    head += to_end as u64;
+                }
+                self.write_header(head, len as u32, 0);
+                let at = self.data + (head % self.capacity as u64) as usize + RECORD_HEADER_SIZE;
+                fill(unsafe { self.region.bytes_mut(at, len) });
+                self.head.store(head + size as u64, Ordering::Release);
+                return Ok(());
+            }
+            if start.elapsed() >= timeout {
+                return Err(io::Error::new(io::ErrorKind::TimedOut, "the ring is full"));
+            }
+            thread::sleep(Duration::from_micros(100));
+        }
+    }
+
+    fn write_header(&self, pos: u64, len: u32, flags: u32) {
+        let at = self.data + (pos % self.capacity as u64) as usize;
+        let header = unsafe { self.region.bytes_mut(at, RECORD_HEADER_SIZE) };
+        header[..4].copy_from_slice(&len.to_le_bytes());
+        header[4..].copy_from_slice(&flags.to_le_bytes());
+    }
+
+    /// Returns the oldest record, or `None` if the ring is empty.
+    ///
+    /// The payload stays valid until the record is released. Must be called by the consumer only.
+    pub fn peek(&self) -> io::Result<Option<Record>> {
+        loop {
+            let tail = self.tail.load(Ordering::Relaxed);
+            let head = self.head.load(Ordering::Acquire);
+            if head == tail {
+                return Ok(None);
+            }
+            let used = head.wrapping_sub(tail) as usize;
+            let at = (tail % self.capacity as u64) as usize;
+            let to_end = self.capacity - at;
+            if used > self.capacity || used < RECORD_HEADER_SIZE {
+                return Err(invalid("corrupted ring"));
+            }
+            let header = self.region.bytes(self.data + at, RECORD_HEADER_SIZE);
+            let len = u32::from_le_bytes(header[..4].try_into().unwrap()) as usize;
+            let flags = u32::from_le_bytes(header[4..].try_into().unwrap());
+            if flags == WRAP {
+                if to_end > used {
+                    return Err(invalid("corrupted ring"));
+                }
+                self.tail.store(tail + to_end as u64, Ordering::Release);
+                continue;
+            }
+            let size = RECORD_HEADER_SIZE + align(len);
+            if size > to_end || size > used {
+                return Err(invalid("corrupted ring"));
+            }
+            return Ok(Some(Record {
+                offset: self.data + at + RECORD_HEADER_SIZE,
+                len,
+                next: tail + size as u64,
+            }));
+        }
+    }
+
+    /// Frees the space of the given record, which must be the one returned by the last peek.
+    pub fn release(&self, record: Record) {
+        self.tail.store(record.next, Ordering::Release);
+    }
+}
+
+#[cfg(test)]
+pub(crate) mod tests {
+    use std::path::PathBuf;
+    use std::sync::atomic::AtomicUsize;
+
+    use super::*;
+
+    /// Path of a region removed when dropped.
+    pub(crate) struct TempPath(pub PathBuf);
+
+    impl TempPath {
+        pub(crate) fn new() -> Self {
+            static COUNTER: AtomicUsize = AtomicUsize::new(0);
+            Self(std::env::temp_dir().join(format!(
+                "ct2shm-test-{}-{}",
+                std::process::id(),
+                COUNTER.fetch_add(1, Ordering::Relaxed)
+            )))
+        }
+    }
+
+    impl Drop for TempPath {
+        fn drop(&mut self) {
+            let _ = std::fs::remove_file(&self.0);
+        }
+    }
+
+    fn write(ring: &Ring, payload: &[u8]) -> io::Result<()> {
+        ring.write(payload.len(), Duration::ZERO, |buf| {
+            buf.copy_from_slice(payload)
+        })
+    }
+
+    fn read(region: &Region, ring: &Ring) -> Option<Vec<u8>> {
+        let record = ring.peek().unwrap()?;
+        let payload = region.bytes(record.offset, record.len).to_vec();
+        ring.release(record);
+        Some(payload)
+    }
+
+    #[test]
+    fn round_trip() {
+        let path = TempPath::new();
+        let region = Region::create(&path.0, 1024).unwrap();
+        let opened = Region::open(&path.0).unwrap();
+
+        let payloads = [&b""[..], b"a", b"12345678", b"a payload of 25 bytes long"];
+        for payload in payloads {
+            write(&region.requests(), payload).unwrap();
+        }
+        write(&opened.responses(), b"response").unwrap();
+
+        for payload in payloads {
+            assert_eq!(read(&opened, &opened.requests()).unwrap(), payload);
+        }
+        assert_eq!(read(&opened, &opened.requests()), None);
+        assert_eq!(read(&region, &region.responses()).unwrap(), b"response");
+        assert_eq!(read(&region, &region.responses()), None);
+    }
+
+    #[test]
+    fn wrap_around() {
+        let path = TempPath::new();
+        let region = Region::create(&path.0, 64).unwrap();
+        let ring = region.requests();
+
+        // The third record of 24 bytes does not fit in the 16 bytes left at the end of the data,
+        // which are skipped by a WRAP record, and so on at each lap.
+        for i in 0..20u8 {
+            let payload = [i; 13];
+            write(&ring, &payload).unwrap();
+            assert_eq!(read(&region, &ring).unwrap(), payload);
+        }
+        assert_eq!(read(&region, &ring), None);
+        assert_eq!(
+            ring.head.load(Ordering::Relaxed),
+            ring.tail.load(Ordering::Relaxed)
+        );
+    }
+
+    #[test]
+    fn wrap_record() {
+        let path = TempPath::new();
+        let region = Region::create(&path.0, 64).unwrap();
+        let ring = region.requests();
+
+        write(&ring, &[1; 32]).unwrap();
+        assert_eq!(read(&region, &ring).unwrap(), [1; 32]);
+        // 24 bytes remain at the end, so a record of 32 bytes starts at the beginning of the data.
+        write(&ring, &[2; 24]).unwrap();
+        let header = region.bytes(ring.data + 40, RECORD_HEADER_SIZE);
+        assert_eq!(u32::from_le_bytes(header[4..].try_into().unwrap()), WRAP);
+        assert_eq!(ring.head.load(Ordering::Relaxed), 64 + 32);
+        assert_eq!(read(&region, &ring).unwrap(), [2; 24]);
+    }
+
+    #[test]
+    fn full_ring() {
+        let path = TempPath::new();
+        let region = Region::create(&path.0, 64).unwrap();
+        let ring = region.requests();
+
+        write(&ring, &[0; 24]).unwrap();
+        write(&ring, &[0; 24]).unwrap();
+        assert_eq!(
+            write(&ring, &[0; 1]).unwrap_err().kind(),
+            io::ErrorKind::TimedOut
+        );
+        assert_eq!(
+            write(&ring, &[0; 64]).unwrap_err().kind(),
+            io::ErrorKind::InvalidInput
+        );
+    }
+
+    #[test]
+    fn corrupted_positions() {
+        let path = TempPath::new();
+        let region = Region::create(&path.0, 64).unwrap();
+        let ring = region.requests();
+
+        ring.tail.store(8, Ordering::Relaxed);
+        assert_eq!(
+            write(&ring, b"x").unwrap_err().kind(),
+            io::ErrorKind::InvalidData
+        );
+        assert_eq!(ring.peek().unwrap_err().kind(), io::ErrorKind::InvalidData);
+
+        ring.tail.store(0, Ordering::Relaxed);
+        ring.head.store(72, Ordering::Relaxed);
+        assert_eq!(
+            write(&ring, b"x").unwrap_err().kind(),
+            io::ErrorKind::InvalidData
+        );
+        assert_eq!(ring.peek().unwrap_err().kind(), io::ErrorKind::InvalidData);
+    }
+}
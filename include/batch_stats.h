@@ -0,0 +1,127 @@
+// batch_stats.h
+//
+// Copyright (c) 2023 Junpei Kawamoto
+//
+// This software is released under the MIT License.
+//
+// http://opensource.org/licenses/mit-license.php
+
+#pragma once
+
+#include "ctranslate2/include/perf_counters.h"
+#include "ctranslate2/include/probes.h"
+#include "rust/cxx.h"
+
+#include <algorithm>
+#include <chrono>
+#include <ctranslate2/batch_reader.h>
+#include <ctranslate2/generation.h>
+#include <ctranslate2/translation.h>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+// Number of tokens of the best hypothesis.
+inline size_t output_length(const ctranslate2::TranslationResult &result) {
+  return result.hypotheses.empty() ? 0 : result.hypotheses[0].size();
+}
+
+inline size_t output_length(const ctranslate2::GenerationResult &result) {
+  return result.sequences.empty() ? 0 : result.sequences[0].size();
+}
+
+// Number of tokens decoded for the best hypothesis, excluding the tokens of
+// the given stream of the example the result starts with, i.e. the target
+// prefix of a translation or the prompt of a generation with
+// include_prompt_in_result set.
+template <typename Result>
+size_t decoded_length(const Result &result,
+                      const ctranslate2::Example &example,
+                      std::optional<size_t> prefix_stream) {
+  const size_t length = output_length(result);
+  if (!prefix_stream || *prefix_stream >= example.streams.size()) {
+    return length;
+  }
+  return length - std::min(length, example.streams[*prefix_stream].size());
+}
+
+// Collects statistics of the batches run for one request.
+//
+// Stats is a shared struct with the fields num_examples, num_tokens,
+// max_length, num_output_tokens, max_output_length, queue_wait_us,
+// execution_us, has_counters, cycles, instructions, llc_misses and dtlb_misses
+// in this order.
+template <typename Stats> class BatchStatsCollector {
+private:
+  using clock = std::chrono::steady_clock;
+
+  const clock::time_point submitted;
+  const std::optional<size_t> prefix_stream;
+  std::mutex mutex;
+  std::vector<Stats> stats;
+
+  static uint64_t elapsed_us(clock::time_point from, clock::time_point to) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(to - from)
+        .count();
+  }
+
+public:
+  // prefix_stream is the index of the stream of the examples the results
+  // start with, if any, so that its tokens are not counted as output tokens.
+  explicit BatchStatsCollector(
+      std::optional<size_t> prefix_stream = std::nullopt)
+      : submitted(clock::now()), prefix_stream(prefix_stream) {}
+
+  // Runs the given function on the current replica thread and records the
+  // shape, timings and hardware counters of the batch.
+  template <typename Func>
+  auto run(const ctranslate2::Batch &batch, const Func &func) {
+    size_t num_tokens = 0;
+    size_t max_length = 0;
+    for (const auto &example : batch.examples) {
+      num_tokens += example.length();
+      max_length = std::max(max_length, example.length());
+    }
+
+    CT2RS_PROBE3(batch__start, batch.examples.size(), num_tokens, max_length);
+    HardwareCounters counters;
+    const auto start = clock::now();
+    auto res = sample_counters(func, counters);
+    const auto end = clock::now();
+    CT2RS_PROBE3(batch__end, batch.examples.size(), num_tokens,
+                 elapsed_us(start, end));
+
+    // The decoder runs until the longest output of the batch is finished, so
+    // the maximum output length is the number of decoding steps. Each example
+    // is reported complete here, on the replica thread, rather than when the
+    // caller collects its future in the order of the request.
+    size_t num_output_tokens = 0;
+    size_t max_output_length = 0;
+    for (size_t i = 0; i < res.size() && i < batch.examples.size(); ++i) {
+      const size_t length =
+          decoded_length(res[i], batch.examples[i], prefix_stream);
+      CT2RS_PROBE2(future__complete, batch.example_index[i], length);
+      num_output_tokens += length;
+      max_output_length = std::max(max_output_length, length);
+    }
+
+    const std::lock_guard<std::mutex> lock(mutex);
+    stats.push_back(Stats{batch.examples.size(), num_tokens, max_length,
+                          num_output_tokens, max_output_length,
+                          elapsed_us(submitted, start), elapsed_us(start, end),
+                          counters.enabled, counters.cycles,
+                          counters.instructions, counters.llc_misses,
+                          counters.dtlb_misses});
+    return res;
+  }
+
+  // Moves the collected statistics to the given vector. Must be called after
+  // all batches have completed.
+  void drain(rust::Vec<Stats> &out) {
+    const std::lock_guard<std::mutex> lock(mutex);
+    for (auto &item : stats) {
+      out.push_back(std::move(item));
+    }
+    stats.clear();
+  }
+};
@@ -0,0 +1,114 @@
+// bench_sampling.h
+//
+// Copyright (c) 2023 Junpei Kawamoto
+//
+// This software is released under the MIT License.
+//
+// http://opensource.org/licenses/mit-license.php
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+// Prototypes of the candidate selection and the logits processing of sampling,
+// benchmarked by the kernels feature against the operators CTranslate2 runs
+// at each decoding step. They are not used by decoding, whose samplers and
+// logits processors live in CTranslate2.
+namespace bench {
+
+// Selects the candidates of top-k and top-p (nucleus) sampling from a row of
+// logits without sorting the vocabulary.
+//
+// Top-k scans the logits in vectorized blocks against the k-th largest logit
+// seen so far, so that only the few logits above it are collected, and keeps
+// the k largest of them whenever k + max(k, 64) are collected.
+//
+// Top-p bins the logits by their distance to the maximum, in bins of 1/8 nat
+// up to 32 nats, and sums their probabilities per bin in the same pass. The
+// bin crossing p is found from the histogram, and only the logits around that
+// bin are sorted; the logits of the bins above it are all in the nucleus.
+//
+// AVX2 is used on x86-64 CPUs supporting it. Buffers are reused between calls,
+// so a selector should be kept for the rows of a batch. The logits must not be
+// NaN.
+class CandidateSelector {
+public:
+  static constexpr size_t num_bins = 256;
+  static constexpr float bins_per_nat = 8;
+
+  // Selects the k largest logits in descending order, with their
+  // probabilities renormalized over them.
+  void top_k(const float *logits, size_t size, size_t k);
+
+  // Selects the most probable tokens whose cumulative probability reaches p,
+  // including the token crossing p, with their probabilities renormalized
+  // over them. The candidates are not ordered. All tokens are selected if p is
+  // 1 or more.
+  void top_p(const float *logits, size_t size, float p);
+
+  // Token ids of the candidates selected by the last call.
+  const std::vector<int32_t> &ids() const { return selected_ids; }
+
+  // Probabilities of the candidates selected by the last call.
+  const std::vector<float> &probs() const { return selected_probs; }
+
+private:
+  std::array<float, num_bins> masses;
+  std::vector<int32_t> selected_ids;
+  std::vector<float> selected_probs;
+};
+
+// Options of the logits processing of a decoding step, which mirror those of
+// ctranslate2::GenerationOptions with token ids.
+struct LogitsOptions {
+  float repetition_penalty = 1;
+  size_t no_repeat_ngram_size = 0;
+  // Id of the unknown token if disable_unk is set, or -1.
+  int32_t unk_id = -1;
+  std::vector<std::vector<int32_t>> suppress_sequences;
+  float temperature = 1;
+};
+
+// Processes the logits of a sequence at each decoding step in one vectorized
+// pass over the vocabulary.
+//
+// The repetition penalty, the n-gram bans, the unknown token and the
+// suppressed sequences only change the logits of a few tokens, so they are
+// applied to those tokens alone: the distinct previous tokens, the tokens
+// completing an n-gram found in an index of the n-grams updated as tokens are
+// pushed, and the last token of a suppressed sequence whose other tokens end
+// the sequence. The only pass over the vocabulary scales the logits by the
+// inverse of the temperature and finds their maximum for the softmax, so its
+// cost does not grow with the number of options.
+class LogitsProcessor {
+public:
+  // Throws std::invalid_argument if unk_id or a suppressed token is out of
+  // the vocabulary.
+  LogitsProcessor(size_t vocabulary_size, LogitsOptions options);
+
+  // Appends a token of the sequence, e.g. of the prompt or a decoded one.
+  // Throws std::out_of_range if the token is out of the vocabulary.
+  void push(int32_t token);
+
+  // Processes the logits of the next token in place and returns their
+  // maximum.
+  float apply(float *logits) const;
+
+private:
+  const size_t vocabulary_size;
+  const LogitsOptions options;
+  std::vector<int32_t> tokens;
+  std::vector<bool> seen;
+  std::vector<int32_t> distinct_tokens;
+  // Start positions of the n-grams by the hash of their first n - 1 tokens.
+  std::unordered_map<uint64_t, std::vector<size_t>> ngrams;
+
+  bool in_vocabulary(int32_t token) const;
+  uint64_t hash_prefix(size_t start) const;
+};
+
+} // namespace bench
@@ -34,6 +34,26 @@ from_rust(const rust::Vec<VecStr> &v) {
   return res;
 }
 
+// Unpacks a shared struct of packed tokens: the bytes of all tokens in data,
+// the byte length of each token in token_lengths, and the number of tokens of
+// each sequence in lengths.
+template <typename Packed>
+inline std::vector<std::vector<std::string>> from_packed(const Packed &v) {
+  std::vector<std::vector<std::string>> res;
+  res.reserve(v.lengths.size());
+  const char *data = v.data.data();
+  auto token_length = v.token_lengths.begin();
+  for (const auto length : v.lengths) {
+    auto &sequence = res.emplace_back();
+    sequence.reserve(length);
+    for (size_t i = 0; i < length; ++i, ++token_length) {
+      sequence.emplace_back(data, *token_length);
+      data += *token_length;
+    }
+  }
+  return res;
+}
+
 inline std::vector<int> from_rust(const rust::Vec<int> &v) {
   std::vector<int> res;
   for (const auto &item : v) {
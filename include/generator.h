@@ -8,6 +8,7 @@
 
 #pragma once
 
+#include "ctranslate2/include/model_memory.h"
 #include "rust/cxx.h"
 
 #include <ctranslate2/generator.h>
@@ -17,16 +18,46 @@ struct GenVecStr;
 struct GeneratorConfig;
 struct GenerationOptions;
 struct GenerationResult;
+struct GenBatchStats;
+struct GenStepStats;
+struct GenVariableInfo;
+struct GenerationStepResult;
+struct GenerationCallbackBox;
+
+// ctranslate2::Generator which exposes its batch-level entry point so that
+// each batch can be observed on the replica thread running it.
+class GeneratorPool : public ctranslate2::Generator {
+public:
+  using ctranslate2::Generator::Generator;
+  using ctranslate2::Generator::post_examples;
+};
 
 class Generator {
 private:
-  std::shared_ptr<ctranslate2::Generator> impl;
+  std::shared_ptr<GeneratorPool> impl;
 
 public:
-  Generator(std::shared_ptr<ctranslate2::Generator> impl) : impl(impl) {}
+  Generator(std::shared_ptr<GeneratorPool> impl) : impl(impl) {}
+
+  rust::Vec<GenerationResult>
+  generate_batch(rust::Vec<GenVecStr> start_tokens, GenerationOptions options,
+                 bool record_steps, bool has_callback,
+                 GenerationCallbackBox &callback,
+                 rust::Vec<GenBatchStats> &stats,
+                 rust::Vec<GenStepStats> &steps) const;
+
+  size_t num_queued_batches() const { return this->impl->num_queued_batches(); }
+
+  size_t num_active_batches() const { return this->impl->num_active_batches(); }
+
+  size_t num_replicas() const { return this->impl->num_replicas(); }
 
-  rust::Vec<GenerationResult> generate_batch(rust::Vec<GenVecStr> start_tokens,
-                                             GenerationOptions options) const;
+  // Variables of the model loaded by the first replica. Replicas placed on the
+  // same device share the same model.
+  rust::Vec<GenVariableInfo> model_variables() const {
+    return list_variables<GenVariableInfo>(
+        *this->impl->get_first_replica().model());
+  }
 };
 
 std::unique_ptr<Generator> new_generator(rust::Str model_path, bool cuda,
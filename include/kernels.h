@@ -0,0 +1,34 @@
+// kernels.h
+//
+// Copyright (c) 2023 Junpei Kawamoto
+//
+// This software is released under the MIT License.
+//
+// http://opensource.org/licenses/mit-license.php
+
+#pragma once
+
+#include "rust/cxx.h"
+
+#include <cstddef>
+
+double bench_gemm(size_t m, size_t n, size_t k, bool int8, bool cuda,
+                  size_t iterations);
+
+double bench_softmax(size_t rows, size_t cols, bool cuda, size_t iterations);
+
+double bench_layer_norm(size_t rows, size_t cols, bool cuda,
+                        size_t iterations);
+
+double bench_gather(size_t vocabulary_size, size_t dim, size_t num_ids,
+                    bool cuda, size_t iterations);
+
+double bench_sampling_topk(size_t rows, size_t cols, size_t k, bool vectorized,
+                           size_t iterations);
+
+double bench_sampling_topp(size_t rows, size_t cols, float p, bool vectorized,
+                           size_t iterations);
+
+double bench_logits_processing(size_t rows, size_t cols, size_t history,
+                               size_t num_options, bool fused,
+                               size_t iterations);
@@ -0,0 +1,51 @@
+// model_memory.h
+//
+// Copyright (c) 2023 Junpei Kawamoto
+//
+// This software is released under the MIT License.
+//
+// http://opensource.org/licenses/mit-license.php
+
+#pragma once
+
+#include "rust/cxx.h"
+
+#include <ctranslate2/models/model.h>
+#include <string>
+#include <unordered_map>
+
+// Lists the variables of a loaded model.
+//
+// Info is a shared struct with the fields name, dtype, shape and bytes in this
+// order. Shared and tied weights are registered under several names pointing
+// to the same storage; their bytes are counted for the first name in the
+// lexicographical order, and the other names are listed with 0 bytes.
+template <typename Info>
+rust::Vec<Info> list_variables(const ctranslate2::models::Model &model) {
+  const auto &variables = model.get_variables();
+  std::unordered_map<const ctranslate2::StorageView *, const std::string *>
+      owners;
+  for (const auto &[name, variable] : variables) {
+    const auto [it, inserted] = owners.emplace(variable.get(), &name);
+    if (!inserted && name < *it->second) {
+      it->second = &name;
+    }
+  }
+
+  rust::Vec<Info> res;
+  for (const auto &[name, variable] : variables) {
+    rust::Vec<int64_t> shape;
+    for (const auto dim : variable->shape()) {
+      shape.push_back(dim);
+    }
+    res.push_back(Info{
+        name,
+        ctranslate2::dtype_name(variable->dtype()),
+        std::move(shape),
+        owners[variable.get()] == &name
+            ? static_cast<size_t>(variable->size()) * variable->item_size()
+            : 0,
+    });
+  }
+  return res;
+}
@@ -0,0 +1,149 @@
+// perf_counters.h
+//
+// Copyright (c) 2023 Junpei Kawamoto
+//
+// This software is released under the MIT License.
+//
+// http://opensource.org/licenses/mit-license.php
+
+#pragma once
+
+#include <cstdint>
+
+#if defined(CT2RS_PERF_COUNTERS) && defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// Hardware counters sampled around a batch.
+struct HardwareCounters {
+  bool enabled = false;
+  uint64_t cycles = 0;
+  uint64_t instructions = 0;
+  uint64_t llc_misses = 0;
+  uint64_t dtlb_misses = 0;
+};
+
+#if defined(CT2RS_PERF_COUNTERS) && defined(__linux__)
+
+// A group of perf events counting the calling thread in user space.
+//
+// The intra-op worker threads of the replica are not counted. They are
+// spawned before the events are opened, so inheriting the events would not
+// reach them, and counting the whole process would mix the batches running
+// concurrently on the other replicas.
+//
+// Cycles are required; the other events are skipped when the host does not
+// support them (e.g. in some virtual machines), in which case they read 0.
+class PerfEventGroup {
+private:
+  enum Event { Cycles, Instructions, LLCMisses, DTLBMisses, NumEvents };
+
+  int fds[NumEvents] = {-1, -1, -1, -1};
+  // Position of each event in the group read, or -1 if not opened.
+  int positions[NumEvents] = {-1, -1, -1, -1};
+  uint64_t num_opened = 0;
+
+  static int open_event(uint32_t type, uint64_t config, int group) {
+    perf_event_attr attr{};
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = group == -1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP;
+    return static_cast<int>(
+        syscall(SYS_perf_event_open, &attr, 0, -1, group, 0));
+  }
+
+  static constexpr uint64_t cache_miss(uint64_t cache) {
+    return cache | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+           (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+  }
+
+  void add(Event event, uint32_t type, uint64_t config) {
+    fds[event] = open_event(type, config, event == Cycles ? -1 : fds[Cycles]);
+    if (fds[event] >= 0) {
+      positions[event] = static_cast<int>(num_opened++);
+    }
+  }
+
+public:
+  PerfEventGroup() {
+    add(Cycles, PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+    if (fds[Cycles] < 0) {
+      return;
+    }
+    add(Instructions, PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+    add(LLCMisses, PERF_TYPE_HW_CACHE, cache_miss(PERF_COUNT_HW_CACHE_LL));
+    add(DTLBMisses, PERF_TYPE_HW_CACHE, cache_miss(PERF_COUNT_HW_CACHE_DTLB));
+  }
+
+  PerfEventGroup(const PerfEventGroup &) = delete;
+  PerfEventGroup &operator=(const PerfEventGroup &) = delete;
+
+  ~PerfEventGroup() {
+    for (int i = NumEvents - 1; i >= 0; --i) {
+      if (fds[i] >= 0) {
+        close(fds[i]);
+      }
+    }
+  }
+
+  bool valid() const { return fds[Cycles] >= 0; }
+
+  void start() {
+    ioctl(fds[Cycles], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(fds[Cycles], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+  }
+
+  HardwareCounters stop() {
+    ioctl(fds[Cycles], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+
+    struct {
+      uint64_t nr;
+      uint64_t values[NumEvents];
+    } data{};
+    HardwareCounters res;
+    if (read(fds[Cycles], &data, sizeof(data)) < 0 || data.nr != num_opened) {
+      return res;
+    }
+
+    const auto value = [&](Event event) -> uint64_t {
+      return positions[event] < 0 ? 0 : data.values[positions[event]];
+    };
+    res.enabled = true;
+    res.cycles = value(Cycles);
+    res.instructions = value(Instructions);
+    res.llc_misses = value(LLCMisses);
+    res.dtlb_misses = value(DTLBMisses);
+    return res;
+  }
+};
+
+// Runs the given function and samples the hardware counters of the calling
+// thread. The events are opened once per replica thread.
+template <typename Func>
+auto sample_counters(const Func &func, HardwareCounters &counters) {
+  thread_local PerfEventGroup group;
+  if (!group.valid()) {
+    return func();
+  }
+
+  group.start();
+  auto res = func();
+  counters = group.stop();
+  return res;
+}
+
+#else
+
+template <typename Func>
+auto sample_counters(const Func &func, HardwareCounters &) {
+  return func();
+}
+
+#endif
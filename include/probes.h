@@ -0,0 +1,40 @@
+// probes.h
+//
+// Copyright (c) 2023 Junpei Kawamoto
+//
+// This software is released under the MIT License.
+//
+// http://opensource.org/licenses/mit-license.php
+
+#pragma once
+
+// Statically defined tracepoints of the bridge under the ctranslate2 provider.
+// A probe is a single nop until a tracer such as bpftrace or perf attaches to
+// it. The probes are compiled out when <sys/sdt.h> is not available.
+//
+//   marshal_in__start(batch_size)
+//   marshal_in__end(batch_size)
+//   batch__start(num_examples, num_tokens, max_length)
+//   batch__end(num_examples, num_tokens, execution_us)
+//   future__complete(index, num_tokens)
+//     fired for each example of a batch as soon as the batch finishes, with the
+//     index of the example in the request and its number of output tokens
+//   marshal_out__start(batch_size)
+//   marshal_out__end(batch_size)
+
+#if defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define CT2RS_HAS_SDT
+#endif
+#endif
+
+#ifdef CT2RS_HAS_SDT
+#define CT2RS_PROBE1(name, a) DTRACE_PROBE1(ctranslate2, name, a)
+#define CT2RS_PROBE2(name, a, b) DTRACE_PROBE2(ctranslate2, name, a, b)
+#define CT2RS_PROBE3(name, a, b, c) DTRACE_PROBE3(ctranslate2, name, a, b, c)
+#else
+#define CT2RS_PROBE1(name, a)
+#define CT2RS_PROBE2(name, a, b)
+#define CT2RS_PROBE3(name, a, b, c)
+#endif
@@ -0,0 +1,15 @@
+// profiler.h
+//
+// Copyright (c) 2023 Junpei Kawamoto
+//
+// This software is released under the MIT License.
+//
+// http://opensource.org/licenses/mit-license.php
+
+#pragma once
+
+#include "rust/cxx.h"
+
+void init_profiling(bool cuda, size_t num_threads);
+
+rust::String dump_profiling();
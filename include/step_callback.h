@@ -0,0 +1,94 @@
+// step_callback.h
+//
+// Copyright (c) 2023 Junpei Kawamoto
+//
+// This software is released under the MIT License.
+//
+// http://opensource.org/licenses/mit-license.php
+
+#pragma once
+
+#include "rust/cxx.h"
+
+#include <ctranslate2/batch_reader.h>
+#include <ctranslate2/generation.h>
+#include <memory>
+#include <mutex>
+
+// Forwards the tokens generated for a request to a Rust callback.
+//
+// Callback is an opaque Rust type with the method execute(Step), and Step is a
+// shared struct with the fields step, batch_id, token_id, token, has_log_prob,
+// log_prob and is_last in this order. Batches of a request may run on several
+// replicas, so the callback is called by one thread at a time.
+template <typename Callback, typename Step> class StepCallback {
+private:
+  std::mutex mutex;
+  Callback *callback;
+
+public:
+  explicit StepCallback(Callback &callback) : callback(&callback) {}
+
+  // Calls the callback with a token of the example at the given index of the
+  // request. Returns true to stop decoding the example.
+  bool operator()(const ctranslate2::GenerationStepResult &step,
+                  size_t example) {
+    const std::lock_guard<std::mutex> lock(mutex);
+    if (!callback) {
+      return true;
+    }
+    return callback->execute(Step{
+        step.step,
+        example,
+        step.token_id,
+        rust::String(step.token),
+        step.log_prob.has_value(),
+        step.log_prob.value_or(0),
+        step.is_last,
+    });
+  }
+
+  // Stops forwarding tokens. Must be called before the request returns since
+  // the callback does not outlive it, even if a batch is still running.
+  void close() {
+    const std::lock_guard<std::mutex> lock(mutex);
+    callback = nullptr;
+  }
+};
+
+// Passes the tokens of a batch to the callback of its request.
+//
+// The stream does nothing without a callback, so the options are passed
+// through unchanged.
+template <typename Callback, typename Step> class StepStream {
+private:
+  const std::shared_ptr<StepCallback<Callback, Step>> callback;
+  const ctranslate2::Batch &batch;
+  ctranslate2::GenerationOptions options;
+
+public:
+  StepStream(std::shared_ptr<StepCallback<Callback, Step>> callback,
+             const ctranslate2::Batch &batch)
+      : callback(std::move(callback)), batch(batch) {}
+
+  StepStream(const StepStream &) = delete;
+  StepStream &operator=(const StepStream &) = delete;
+
+  // Returns the given options with a callback forwarding each token with the
+  // index of its example in the request. The returned reference is valid while
+  // this stream is alive.
+  const ctranslate2::GenerationOptions &
+  attach(const ctranslate2::GenerationOptions &opts) {
+    if (!callback) {
+      return opts;
+    }
+    options = opts;
+    options.callback = [this](ctranslate2::GenerationStepResult step) {
+      const auto example = batch.example_index.empty()
+                               ? step.batch_id
+                               : batch.example_index[step.batch_id];
+      return (*callback)(step, example);
+    };
+    return options;
+  }
+};
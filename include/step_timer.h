@@ -0,0 +1,125 @@
+// step_timer.h
+//
+// Copyright (c) 2023 Junpei Kawamoto
+//
+// This software is released under the MIT License.
+//
+// http://opensource.org/licenses/mit-license.php
+
+#pragma once
+
+#include "rust/cxx.h"
+
+#include <chrono>
+#include <ctranslate2/generation.h>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// Collects the token timings of the examples of one request.
+//
+// Stats is a shared struct with the fields num_tokens, ttft_us and tpot_us in
+// this order.
+template <typename Stats> class StepStatsCollector {
+private:
+  using clock = std::chrono::steady_clock;
+
+  const clock::time_point submitted;
+  std::mutex mutex;
+  std::vector<Stats> stats;
+
+public:
+  StepStatsCollector() : submitted(clock::now()) {}
+
+  clock::time_point submitted_at() const { return submitted; }
+
+  void push(Stats item) {
+    const std::lock_guard<std::mutex> lock(mutex);
+    stats.push_back(std::move(item));
+  }
+
+  // Moves the collected statistics to the given vector. Must be called after
+  // all batches have completed.
+  void drain(rust::Vec<Stats> &out) {
+    const std::lock_guard<std::mutex> lock(mutex);
+    for (auto &item : stats) {
+      out.push_back(std::move(item));
+    }
+    stats.clear();
+  }
+};
+
+// Times the tokens of a batch through the step callback of the decoder.
+//
+// The timer does nothing without a collector, or when several hypotheses are
+// returned for each example, whose tokens would all be reported under the
+// example. The options are then passed through unchanged.
+template <typename Stats> class StepTimer {
+private:
+  using clock = std::chrono::steady_clock;
+
+  struct Example {
+    size_t num_tokens = 0;
+    clock::time_point first;
+    clock::time_point last;
+  };
+
+  const std::shared_ptr<StepStatsCollector<Stats>> collector;
+  std::vector<Example> examples;
+  ctranslate2::GenerationOptions options;
+
+  static uint64_t elapsed_us(clock::time_point from, clock::time_point to) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(to - from)
+        .count();
+  }
+
+public:
+  StepTimer(std::shared_ptr<StepStatsCollector<Stats>> collector,
+            size_t batch_size)
+      : collector(std::move(collector)),
+        examples(this->collector ? batch_size : 0) {}
+
+  StepTimer(const StepTimer &) = delete;
+  StepTimer &operator=(const StepTimer &) = delete;
+
+  // Returns the given options with a callback recording the time of each
+  // token before calling the callback of the given options, if any. The
+  // returned reference is valid while this timer is alive.
+  const ctranslate2::GenerationOptions &
+  attach(const ctranslate2::GenerationOptions &opts) {
+    if (!collector || opts.num_hypotheses > 1) {
+      return opts;
+    }
+    options = opts;
+    options.callback = [this, next = opts.callback](
+                           ctranslate2::GenerationStepResult step) {
+      const auto now = clock::now();
+      auto &example = examples[step.batch_id];
+      if (example.num_tokens++ == 0) {
+        example.first = now;
+      }
+      example.last = now;
+      return next ? next(std::move(step)) : false;
+    };
+    return options;
+  }
+
+  // Pushes the timings of the examples to the collector.
+  void finish() {
+    if (!collector) {
+      return;
+    }
+    for (const auto &example : examples) {
+      if (example.num_tokens == 0) {
+        continue;
+      }
+      collector->push(Stats{
+          example.num_tokens,
+          elapsed_us(collector->submitted_at(), example.first),
+          example.num_tokens > 1 ? elapsed_us(example.first, example.last) /
+                                       (example.num_tokens - 1)
+                                 : 0,
+      });
+    }
+  }
+};
@@ -0,0 +1,145 @@
+// trace.h
+//
+// Copyright (c) 2023 Junpei Kawamoto
+//
+// This software is released under the MIT License.
+//
+// http://opensource.org/licenses/mit-license.php
+
+#pragma once
+
+#include "rust/cxx.h"
+
+#include <ctranslate2/generator.h>
+#include <ctranslate2/translator.h>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#ifdef CT2RS_TRACING
+#include "ctranslate2/src/trace.rs.h"
+#include <mutex>
+#include <optional>
+#else
+enum class TracePhase : uint8_t { MarshalIn, QueueWait, Execute, MarshalOut };
+#endif
+
+template <typename T> inline size_t batch_size(const rust::Vec<T> &batch) {
+  return batch.size();
+}
+
+template <typename T> inline size_t num_tokens(const rust::Vec<T> &batch) {
+  size_t res = 0;
+  for (const auto &item : batch) {
+    res += item.v.size();
+  }
+  return res;
+}
+
+// Size of a batch of packed tokens.
+struct PackedSize {
+  size_t num_sequences;
+  size_t num_tokens;
+};
+
+inline size_t batch_size(const PackedSize &batch) {
+  return batch.num_sequences;
+}
+
+inline size_t num_tokens(const PackedSize &batch) { return batch.num_tokens; }
+
+inline size_t batch_size(const ctranslate2::Batch &batch) {
+  return batch.examples.size();
+}
+
+inline size_t num_tokens(const ctranslate2::Batch &batch) {
+  size_t res = 0;
+  for (const auto &example : batch.examples) {
+    res += example.length();
+  }
+  return res;
+}
+
+template <typename Result>
+inline size_t batch_size(const std::vector<Result> &batch) {
+  return batch.size();
+}
+
+inline size_t
+num_tokens(const std::vector<ctranslate2::TranslationResult> &batch) {
+  size_t res = 0;
+  for (const auto &item : batch) {
+    for (const auto &hypothesis : item.hypotheses) {
+      res += hypothesis.size();
+    }
+  }
+  return res;
+}
+
+inline size_t
+num_tokens(const std::vector<ctranslate2::GenerationResult> &batch) {
+  size_t res = 0;
+  for (const auto &item : batch) {
+    for (const auto &sequence : item.sequences) {
+      res += sequence.size();
+    }
+  }
+  return res;
+}
+
+// Span of the calling thread, captured before a batch is posted so that
+// spans opened on replica threads are attached to the caller's trace.
+//
+// Without the tracing feature, TraceContext and TraceSpan are empty and
+// calls to them compile to nothing.
+class TraceContext {
+#ifdef CT2RS_TRACING
+private:
+  std::shared_ptr<rust::Box<SpanHandle>> parent;
+
+public:
+  TraceContext()
+      : parent(std::make_shared<rust::Box<SpanHandle>>(current_span())) {}
+
+  rust::Box<SpanHandle> open(TracePhase phase, size_t batch_size,
+                             size_t num_tokens) const {
+    return new_span(**parent, phase, batch_size, num_tokens);
+  }
+#endif
+};
+
+// A span which is closed by close() or when the last copy is destroyed.
+class TraceSpan {
+#ifdef CT2RS_TRACING
+private:
+  struct State {
+    std::once_flag closed;
+    std::optional<rust::Box<SpanHandle>> span;
+  };
+  std::shared_ptr<State> state;
+
+public:
+  template <typename Tokens>
+  TraceSpan(const TraceContext &context, TracePhase phase,
+            const Tokens &tokens)
+      : state(std::make_shared<State>()) {
+    state->span.emplace(
+        context.open(phase, batch_size(tokens), num_tokens(tokens)));
+  }
+
+  // Closes the span. It is safe to call from several replica threads; only
+  // the first call has an effect. The queue_wait span of a request split into
+  // several batches therefore ends when its first batch starts; the wait of
+  // the later batches is only reported in the queue_wait of their BatchStats.
+  void close() const {
+    auto &s = *state;
+    std::call_once(s.closed, [&s] { s.span.reset(); });
+  }
+#else
+public:
+  template <typename Tokens>
+  TraceSpan(const TraceContext &, TracePhase, const Tokens &) {}
+
+  void close() const {}
+#endif
+};
@@ -8,6 +8,7 @@
 
 #pragma once
 
+#include "ctranslate2/include/model_memory.h"
 #include "rust/cxx.h"
 
 #include <ctranslate2/translator.h>
@@ -17,17 +18,48 @@ struct VecStr;
 struct TranslatorConfig;
 struct TranslationOptions;
 struct TranslationResult;
+struct PackedTokens;
+struct PackedTranslations;
+struct BatchStats;
+struct VariableInfo;
+
+// ctranslate2::Translator which exposes its batch-level entry point so that
+// each batch can be observed on the replica thread running it.
+class TranslatorPool : public ctranslate2::Translator {
+public:
+  using ctranslate2::Translator::Translator;
+  using ctranslate2::Translator::post_examples;
+};
 
 class Translator {
 private:
-  std::shared_ptr<ctranslate2::Translator> impl;
+  std::shared_ptr<TranslatorPool> impl;
 
 public:
-  Translator(std::shared_ptr<ctranslate2::Translator> impl) : impl(impl) {}
+  Translator(std::shared_ptr<TranslatorPool> impl) : impl(impl) {}
 
   rust::Vec<TranslationResult>
   translate_batch(rust::Vec<VecStr> source, rust::Vec<VecStr> target_prefix,
-                  TranslationOptions options) const;
+                  TranslationOptions options,
+                  rust::Vec<BatchStats> &stats) const;
+
+  PackedTranslations translate_packed(PackedTokens source,
+                                      PackedTokens target_prefix,
+                                      TranslationOptions options,
+                                      rust::Vec<BatchStats> &stats) const;
+
+  size_t num_queued_batches() const { return this->impl->num_queued_batches(); }
+
+  size_t num_active_batches() const { return this->impl->num_active_batches(); }
+
+  size_t num_replicas() const { return this->impl->num_replicas(); }
+
+  // Variables of the model loaded by the first replica. Replicas placed on the
+  // same device share the same model.
+  rust::Vec<VariableInfo> model_variables() const {
+    return list_variables<VariableInfo>(
+        *this->impl->get_first_replica().model());
+  }
 };
 
 std::unique_ptr<Translator> new_translator(rust::Str model_path, bool cuda,
@@ -0,0 +1,59 @@
+// whisper.h
+//
+// Copyright (c) 2023 Junpei Kawamoto
+//
+// This software is released under the MIT License.
+//
+// http://opensource.org/licenses/mit-license.php
+
+#pragma once
+
+#include "rust/cxx.h"
+
+#include <ctranslate2/models/whisper.h>
+#include <memory>
+
+struct WhisperVecStr;
+struct WhisperConfig;
+struct WhisperOptions;
+struct WhisperGenerationResult;
+struct WhisperVecLanguage;
+
+class WhisperFeatures {
+private:
+  ctranslate2::StorageView impl;
+
+public:
+  WhisperFeatures(ctranslate2::StorageView impl) : impl(std::move(impl)) {}
+
+  const ctranslate2::StorageView &get() const { return impl; }
+};
+
+class Whisper {
+private:
+  std::shared_ptr<ctranslate2::models::Whisper> impl;
+  bool encode_to_cpu;
+
+public:
+  Whisper(std::shared_ptr<ctranslate2::models::Whisper> impl,
+          bool encode_to_cpu)
+      : impl(impl), encode_to_cpu(encode_to_cpu) {}
+
+  bool is_multilingual() const;
+
+  size_t n_mels() const;
+
+  std::unique_ptr<WhisperFeatures>
+  encode(rust::Slice<const float> features,
+         rust::Slice<const size_t> shape) const;
+
+  rust::Vec<WhisperVecLanguage>
+  detect_language(const WhisperFeatures &features) const;
+
+  rust::Vec<WhisperGenerationResult>
+  generate(const WhisperFeatures &features, rust::Vec<WhisperVecStr> prompts,
+           WhisperOptions options) const;
+};
+
+std::unique_ptr<Whisper> new_whisper(rust::Str model_path, bool cuda,
+                                     WhisperConfig config);
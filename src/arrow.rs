@@ -0,0 +1,96 @@
+// arrow.rs
+//
+// Copyright (c) 2023 Junpei Kawamoto
+//
+// This software is released under the MIT License.
+//
+// http://opensource.org/licenses/mit-license.php
+
+//! Translation of Arrow string arrays.
+
+use anyhow::{bail, Result};
+use arrow_array::builder::GenericStringBuilder;
+use arrow_array::{Array, GenericStringArray, OffsetSizeTrait};
+
+use crate::packed::PackedTokens;
+use crate::{encode_one, TranslationOptions, Translator};
+
+impl Translator {
+    /// Translates the strings of an Arrow array, e.g. a column read from Parquet, and returns the
+    /// translations as an array of the same type. Null rows stay null.
+    ///
+    /// Rows are translated `batch_size` at a time. Each row is read in place from the values
+    /// buffer of `source`, its tokens are packed into buffers reused across batches, and its
+    /// translation is appended to the values buffer of the output, so that the only allocations
+    /// made for each row are those of the tokenizer, which an encoding cache also saves.
+    /// `target_prefix` starts every translation, e.g. the target language of NLLB.
+    #[cfg_attr(
+        feature = "tracing",
+        tracing::instrument(name = "translate_array", skip_all, fields(num_rows = source.len()))
+    )]
+    pub fn translate_array<O, U, V>(
+        &self,
+        source: &GenericStringArray<O>,
+        target_prefix: &[U],
+        options: &TranslationOptions<V>,
+        batch_size: usize,
+    ) -> Result<GenericStringArray<O>>
+    where
+        O: OffsetSizeTrait,
+        U: AsRef<str>,
+        V: AsRef<str>,
+    {
+        let batch_size = batch_size.max(1);
+        let mut output =
+            GenericStringBuilder::<O>::with_capacity(source.len(), source.value_data().len());
+        let mut tokens = PackedTokens::new();
+        let mut prefixes = PackedTokens::new();
+
+        for start in (0..source.len()).step_by(batch_size) {
+            let rows = start..(start + batch_size).min(source.len());
+            tokens.clear();
+            prefixes.clear();
+            for i in rows.clone().filter(|&i| source.is_valid(i)) {
+                let encoding = encode_one(
+                    &self.tokenizer,
+                    self.cache.as_deref(),
+                    self.translator.metrics(),
+                    source.value(i).into(),
+                    true,
+                )?;
+                tokens.push(encoding.iter());
+                if !target_prefix.is_empty() {
+                    prefixes.push(target_prefix);
+                }
+            }
+
+            let translations = if tokens.is_empty() {
+                None
+            } else {
+                Some(
+                    self.translator
+                        .translate_packed(&tokens, &prefixes, options)?,
+                )
+            };
+            let mut hypotheses = translations.iter().flat_map(|t| t.tokens.iter());
+            for i in rows {
+                if source.is_null(i) {
+                    output.append_null();
+                    continue;
+                }
+                let Some(hypothesis) = hypotheses.next() else {
+                    bail!("no results are returned");
+                };
+                output.append_value(
+                    self.tokenizer.decode(
+                        hypothesis
+                            .skip(target_prefix.len())
+                            .map(str::to_string)
+                            .collect(),
+                    )?,
+                );
+            }
+        }
+        Ok(output.finish())
+    }
+}
@@ -0,0 +1,464 @@
+// bench_sampling.cpp
+//
+// Copyright (c) 2023 Junpei Kawamoto
+//
+// This software is released under the MIT License.
+//
+// http://opensource.org/licenses/mit-license.php
+
+#include "ctranslate2/include/bench_sampling.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+#include <utility>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define CT2RS_SAMPLING_AVX2
+#include <immintrin.h>
+#endif
+
+namespace bench {
+namespace {
+
+constexpr float last_bin = CandidateSelector::num_bins - 1;
+
+// Orders token ids by descending logit, breaking ties by the id as a stable
+// sort would.
+struct Greater {
+  const float *logits;
+
+  bool operator()(int32_t a, int32_t b) const {
+    return logits[a] > logits[b] || (logits[a] == logits[b] && a < b);
+  }
+};
+
+// Keeps the ids of the k largest logits, and returns the smallest of them.
+float keep_largest(const float *x, size_t k, std::vector<int32_t> &ids) {
+  std::nth_element(ids.begin(), ids.begin() + (k - 1), ids.end(), Greater{x});
+  ids.resize(k);
+  return x[ids[k - 1]];
+}
+
+// Bin of a logit. NaN distances, e.g. of -inf logits when the maximum is also
+// -inf, fall into the last bin.
+inline uint32_t bin_of(float logit, float max) {
+  const float distance = (max - logit) * CandidateSelector::bins_per_nat;
+  return static_cast<uint32_t>(distance < last_bin ? distance : last_bin);
+}
+
+// Collects the ids of the logits greater than the threshold, keeping the k
+// largest once capacity ids are collected, and returns the threshold. Ids are
+// scanned in ascending order, so a logit equal to the threshold never wins the
+// tie.
+float scan_scalar(const float *x, size_t begin, size_t size, size_t k,
+                  size_t capacity, float threshold,
+                  std::vector<int32_t> &ids) {
+  for (size_t i = begin; i < size; ++i) {
+    if (x[i] > threshold) {
+      ids.push_back(static_cast<int32_t>(i));
+      if (ids.size() >= capacity) {
+        threshold = keep_largest(x, k, ids);
+      }
+    }
+  }
+  return threshold;
+}
+
+float max_scalar(const float *x, size_t begin, size_t size, float max) {
+  for (size_t i = begin; i < size; ++i) {
+    max = std::max(max, x[i]);
+  }
+  return max;
+}
+
+float scale_max_scalar(float *x, size_t begin, size_t size, float scale,
+                       float max) {
+  for (size_t i = begin; i < size; ++i) {
+    x[i] *= scale;
+    max = std::max(max, x[i]);
+  }
+  return max;
+}
+
+void weigh_scalar(const float *x, size_t begin, size_t size, float max,
+                  float *masses) {
+  for (size_t i = begin; i < size; ++i) {
+    masses[bin_of(x[i], max)] += std::exp(x[i] - max);
+  }
+}
+
+void collect_scalar(const float *x, size_t begin, size_t size,
+                    float threshold, std::vector<int32_t> &ids) {
+  for (size_t i = begin; i < size; ++i) {
+    if (x[i] >= threshold) {
+      ids.push_back(static_cast<int32_t>(i));
+    }
+  }
+}
+
+#ifdef CT2RS_SAMPLING_AVX2
+
+#define CT2RS_AVX2 __attribute__((target("avx2,fma")))
+
+bool has_avx2() {
+  static const bool supported =
+      __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+  return supported;
+}
+
+CT2RS_AVX2 inline __m256i bins_avx2(__m256 x, __m256 max) {
+  const __m256 distance = _mm256_mul_ps(
+      _mm256_sub_ps(max, x), _mm256_set1_ps(CandidateSelector::bins_per_nat));
+  // minps returns its second operand for NaN, as bin_of does.
+  return _mm256_cvttps_epi32(
+      _mm256_min_ps(distance, _mm256_set1_ps(last_bin)));
+}
+
+// exp of non-positive inputs, zero below the smallest normal result.
+CT2RS_AVX2 inline __m256 exp_avx2(__m256 x) {
+  const __m256 lower = _mm256_set1_ps(-87.33654f);
+  const __m256 underflow = _mm256_cmp_ps(x, lower, _CMP_GE_OQ);
+  x = _mm256_max_ps(x, lower);
+
+  const __m256 n = _mm256_floor_ps(_mm256_fmadd_ps(
+      x, _mm256_set1_ps(1.44269504088896341f), _mm256_set1_ps(0.5f)));
+  x = _mm256_fnmadd_ps(n, _mm256_set1_ps(0.693359375f), x);
+  x = _mm256_fnmadd_ps(n, _mm256_set1_ps(-2.12194440e-4f), x);
+
+  __m256 y = _mm256_set1_ps(1.9875691500e-4f);
+  y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(1.3981999507e-3f));
+  y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(8.3334519073e-3f));
+  y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(4.1665795894e-2f));
+  y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(1.6666665459e-1f));
+  y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(5.0000001201e-1f));
+  y = _mm256_fmadd_ps(y, _mm256_mul_ps(x, x),
+                      _mm256_add_ps(x, _mm256_set1_ps(1.f)));
+
+  const __m256i exponent = _mm256_slli_epi32(
+      _mm256_add_epi32(_mm256_cvtps_epi32(n), _mm256_set1_epi32(127)), 23);
+  return _mm256_and_ps(_mm256_mul_ps(y, _mm256_castsi256_ps(exponent)),
+                       underflow);
+}
+
+CT2RS_AVX2 float scan_avx2(const float *x, size_t begin, size_t size,
+                           size_t k, size_t capacity, float threshold,
+                           std::vector<int32_t> &ids) {
+  const size_t end = begin + (size - begin) / 8 * 8;
+  __m256 vthreshold = _mm256_set1_ps(threshold);
+  for (size_t i = begin; i < end; i += 8) {
+    auto mask = _mm256_movemask_ps(
+        _mm256_cmp_ps(_mm256_loadu_ps(x + i), vthreshold, _CMP_GT_OQ));
+    if (!mask) {
+      continue;
+    }
+    while (mask) {
+      ids.push_back(static_cast<int32_t>(i + __builtin_ctz(mask)));
+      mask &= mask - 1;
+    }
+    if (ids.size() >= capacity) {
+      threshold = keep_largest(x, k, ids);
+      vthreshold = _mm256_set1_ps(threshold);
+    }
+  }
+  return scan_scalar(x, end, size, k, capacity, threshold, ids);
+}
+
+CT2RS_AVX2 float max_avx2(const float *x, size_t size) {
+  const size_t end = size - size % 8;
+  __m256 max = _mm256_set1_ps(-std::numeric_limits<float>::infinity());
+  for (size_t i = 0; i < end; i += 8) {
+    max = _mm256_max_ps(max, _mm256_loadu_ps(x + i));
+  }
+  alignas(32) float lanes[8];
+  _mm256_store_ps(lanes, max);
+  return max_scalar(x, end, size, *std::max_element(lanes, lanes + 8));
+}
+
+CT2RS_AVX2 float scale_max_avx2(float *x, size_t size, float scale) {
+  const size_t end = size - size % 8;
+  const __m256 vscale = _mm256_set1_ps(scale);
+  __m256 max = _mm256_set1_ps(-std::numeric_limits<float>::infinity());
+  for (size_t i = 0; i < end; i += 8) {
+    const __m256 logits = _mm256_mul_ps(_mm256_loadu_ps(x + i), vscale);
+    _mm256_storeu_ps(x + i, logits);
+    max = _mm256_max_ps(max, logits);
+  }
+  alignas(32) float lanes[8];
+  _mm256_store_ps(lanes, max);
+  return scale_max_scalar(x, end, size, scale,
+                          *std::max_element(lanes, lanes + 8));
+}
+
+CT2RS_AVX2 void weigh_avx2(const float *x, size_t size, float max,
+                           float *masses) {
+  const size_t end = size - size % 8;
+  const __m256 vmax = _mm256_set1_ps(max);
+  alignas(32) float weights[8];
+  for (size_t i = 0; i < end; i += 8) {
+    const __m256 logits = _mm256_loadu_ps(x + i);
+    _mm256_store_ps(weights, exp_avx2(_mm256_sub_ps(logits, vmax)));
+    // Extracting the bins is faster than reloading them from a store, which
+    // cannot be forwarded to narrower loads.
+    const __m256i bins = bins_avx2(logits, vmax);
+    const __m128i low = _mm256_castsi256_si128(bins);
+    const __m128i high = _mm256_extracti128_si256(bins, 1);
+    masses[_mm_cvtsi128_si32(low)] += weights[0];
+    masses[_mm_extract_epi32(low, 1)] += weights[1];
+    masses[_mm_extract_epi32(low, 2)] += weights[2];
+    masses[_mm_extract_epi32(low, 3)] += weights[3];
+    masses[_mm_cvtsi128_si32(high)] += weights[4];
+    masses[_mm_extract_epi32(high, 1)] += weights[5];
+    masses[_mm_extract_epi32(high, 2)] += weights[6];
+    masses[_mm_extract_epi32(high, 3)] += weights[7];
+  }
+  weigh_scalar(x, end, size, max, masses);
+}
+
+CT2RS_AVX2 void collect_avx2(const float *x, size_t size, float threshold,
+                             std::vector<int32_t> &ids) {
+  const size_t end = size - size % 8;
+  const __m256 vthreshold = _mm256_set1_ps(threshold);
+  for (size_t i = 0; i < end; i += 8) {
+    auto mask = _mm256_movemask_ps(
+        _mm256_cmp_ps(_mm256_loadu_ps(x + i), vthreshold, _CMP_GE_OQ));
+    while (mask) {
+      ids.push_back(static_cast<int32_t>(i + __builtin_ctz(mask)));
+      mask &= mask - 1;
+    }
+  }
+  collect_scalar(x, end, size, threshold, ids);
+}
+
+#endif
+
+float scan(const float *x, size_t begin, size_t size, size_t k,
+           size_t capacity, float threshold, std::vector<int32_t> &ids) {
+#ifdef CT2RS_SAMPLING_AVX2
+  if (has_avx2()) {
+    return scan_avx2(x, begin, size, k, capacity, threshold, ids);
+  }
+#endif
+  return scan_scalar(x, begin, size, k, capacity, threshold, ids);
+}
+
+float row_max(const float *x, size_t size) {
+#ifdef CT2RS_SAMPLING_AVX2
+  if (has_avx2()) {
+    return max_avx2(x, size);
+  }
+#endif
+  return max_scalar(x, 0, size, -std::numeric_limits<float>::infinity());
+}
+
+// Multiplies the logits by the given scale, and returns their maximum.
+float scale_max(float *x, size_t size, float scale) {
+  if (scale == 1) {
+    return row_max(x, size);
+  }
+#ifdef CT2RS_SAMPLING_AVX2
+  if (has_avx2()) {
+    return scale_max_avx2(x, size, scale);
+  }
+#endif
+  return scale_max_scalar(x, 0, size, scale,
+                          -std::numeric_limits<float>::infinity());
+}
+
+void weigh(const float *x, size_t size, float max, float *masses) {
+#ifdef CT2RS_SAMPLING_AVX2
+  if (has_avx2()) {
+    weigh_avx2(x, size, max, masses);
+    return;
+  }
+#endif
+  weigh_scalar(x, 0, size, max, masses);
+}
+
+// Collects the ids of the logits in the bins up to the given one, and some of
+// the next bin, whose logits are sorted after them.
+void collect(const float *x, size_t size, float max, uint32_t last,
+             std::vector<int32_t> &ids) {
+  const float threshold =
+      last < CandidateSelector::num_bins - 1
+          ? max - (last + 2) / CandidateSelector::bins_per_nat
+          : -std::numeric_limits<float>::infinity();
+#ifdef CT2RS_SAMPLING_AVX2
+  if (has_avx2()) {
+    collect_avx2(x, size, threshold, ids);
+    return;
+  }
+#endif
+  collect_scalar(x, 0, size, threshold, ids);
+}
+
+} // namespace
+
+void CandidateSelector::top_k(const float *logits, size_t size, size_t k) {
+  selected_ids.clear();
+  selected_probs.clear();
+  k = std::min(k, size);
+  if (k == 0) {
+    return;
+  }
+
+  for (size_t i = 0; i < k; ++i) {
+    selected_ids.push_back(static_cast<int32_t>(i));
+  }
+  const float threshold = keep_largest(logits, k, selected_ids);
+  scan(logits, k, size, k, k + std::max<size_t>(k, 64), threshold,
+       selected_ids);
+  keep_largest(logits, k, selected_ids);
+  std::sort(selected_ids.begin(), selected_ids.end(), Greater{logits});
+
+  const float max = logits[selected_ids[0]];
+  float total = 0;
+  for (const auto id : selected_ids) {
+    selected_probs.push_back(std::exp(logits[id] - max));
+    total += selected_probs.back();
+  }
+  for (auto &prob : selected_probs) {
+    prob /= total;
+  }
+}
+
+void CandidateSelector::top_p(const float *logits, size_t size, float p) {
+  selected_ids.clear();
+  selected_probs.clear();
+  if (size == 0) {
+    return;
+  }
+
+  const float max = row_max(logits, size);
+  masses.fill(0);
+  weigh(logits, size, max, masses.data());
+  double total = 0;
+  for (const auto mass : masses) {
+    total += mass;
+  }
+
+  // Every token of the bins above the one crossing p is in the nucleus.
+  const double target =
+      p < 1 ? p * total : std::numeric_limits<double>::infinity();
+  double cumulative = 0;
+  uint32_t last = 0;
+  for (; last < num_bins - 1 && cumulative + masses[last] < target; ++last) {
+    cumulative += masses[last];
+  }
+  collect(logits, size, max, last, selected_ids);
+
+  const auto above = [logits, max, last](int32_t id) {
+    return bin_of(logits[id], max) < last;
+  };
+  const auto boundary =
+      std::partition(selected_ids.begin(), selected_ids.end(), above);
+  std::sort(boundary, selected_ids.end(), Greater{logits});
+
+  float sum = 0;
+  for (auto it = selected_ids.begin(); it != boundary; ++it) {
+    selected_probs.push_back(std::exp(logits[*it] - max));
+    sum += selected_probs.back();
+  }
+  auto end = boundary;
+  for (; end != selected_ids.end() && cumulative < target; ++end) {
+    const float prob = std::exp(logits[*end] - max);
+    cumulative += prob;
+    selected_probs.push_back(prob);
+    sum += prob;
+  }
+  selected_ids.erase(end, selected_ids.end());
+
+  for (auto &prob : selected_probs) {
+    prob /= sum;
+  }
+}
+
+LogitsProcessor::LogitsProcessor(size_t vocabulary_size, LogitsOptions options)
+    : vocabulary_size(vocabulary_size), options(std::move(options)),
+      seen(vocabulary_size) {
+  if (this->options.unk_id >= 0 && !in_vocabulary(this->options.unk_id)) {
+    throw std::invalid_argument("unk_id is out of the vocabulary");
+  }
+  for (const auto &sequence : this->options.suppress_sequences) {
+    if (!std::all_of(sequence.begin(), sequence.end(),
+                     [this](int32_t id) { return in_vocabulary(id); })) {
+      throw std::invalid_argument(
+          "suppress_sequences has a token out of the vocabulary");
+    }
+  }
+}
+
+void LogitsProcessor::push(int32_t token) {
+  if (!in_vocabulary(token)) {
+    throw std::out_of_range("token is out of the vocabulary");
+  }
+  tokens.push_back(token);
+  if (!seen[token]) {
+    seen[token] = true;
+    distinct_tokens.push_back(token);
+  }
+  const size_t n = options.no_repeat_ngram_size;
+  if (n > 0 && tokens.size() >= n) {
+    const size_t start = tokens.size() - n;
+    ngrams[hash_prefix(start)].push_back(start);
+  }
+}
+
+float LogitsProcessor::apply(float *logits) const {
+  constexpr float banned = -std::numeric_limits<float>::infinity();
+
+  if (options.repetition_penalty != 1) {
+    for (const auto token : distinct_tokens) {
+      float &logit = logits[token];
+      logit = logit < 0 ? logit * options.repetition_penalty
+                        : logit / options.repetition_penalty;
+    }
+  }
+
+  // Bans the tokens following the earlier occurrences of the last n - 1
+  // tokens.
+  const size_t n = options.no_repeat_ngram_size;
+  if (n > 0 && tokens.size() + 1 >= n) {
+    const size_t prefix = tokens.size() + 1 - n;
+    const auto it = ngrams.find(hash_prefix(prefix));
+    if (it != ngrams.end()) {
+      for (const auto start : it->second) {
+        if (std::equal(tokens.begin() + start, tokens.begin() + start + n - 1,
+                       tokens.begin() + prefix)) {
+          logits[tokens[start + n - 1]] = banned;
+        }
+      }
+    }
+  }
+
+  if (options.unk_id >= 0) {
+    logits[options.unk_id] = banned;
+  }
+  for (const auto &sequence : options.suppress_sequences) {
+    if (sequence.empty() || sequence.size() > tokens.size() + 1) {
+      continue;
+    }
+    if (std::equal(sequence.begin(), sequence.end() - 1,
+                   tokens.end() - (sequence.size() - 1))) {
+      logits[sequence.back()] = banned;
+    }
+  }
+
+  return scale_max(logits, vocabulary_size, 1 / options.temperature);
+}
+
+bool LogitsProcessor::in_vocabulary(int32_t token) const {
+  return token >= 0 && static_cast<size_t>(token) < vocabulary_size;
+}
+
+// FNV-1a of the n - 1 tokens from the given position.
+uint64_t LogitsProcessor::hash_prefix(size_t start) const {
+  uint64_t hash = 0xcbf29ce484222325;
+  for (size_t i = start; i < start + options.no_repeat_ngram_size - 1; ++i) {
+    hash = (hash ^ static_cast<uint32_t>(tokens[i])) * 0x100000001b3;
+  }
+  return hash;
+}
+
+} // namespace bench
@@ -0,0 +1,247 @@
+// cache.rs
+//
+// Copyright (c) 2023 Junpei Kawamoto
+//
+// This software is released under the MIT License.
+//
+// http://opensource.org/licenses/mit-license.php
+
+//! Cache of the tokens of frequent inputs, e.g. product titles or UI labels.
+//!
+//! Tokens are cached per input and per whether special tokens are added, since translators add
+//! them and generators do not, so that a cache can be shared between both.
+//!
+//! The cache is split into shards, each of which is guarded by a read-write lock, so that hits
+//! from many threads only share read locks. A shard evicts with the CLOCK algorithm: a hit marks
+//! its entry, and an insertion into a full shard replaces the first unmarked entry from the clock
+//! hand, unmarking the entries it passes. Inputs seen once are thus evicted before hot ones,
+//! without moving entries on hits.
+//!
+//! ```no_run
+//! # use std::sync::Arc;
+//! # use ctranslate2::cache::EncodingCache;
+//! # use ctranslate2::config::{Config, Device};
+//! # use ctranslate2::Translator;
+//! # fn main() -> anyhow::Result<()> {
+//! let mut t = Translator::new("/path/to/model", Device::CPU, Config::default())?;
+//! let cache = Arc::new(EncodingCache::new(100_000, 256));
+//! t.set_encoding_cache(cache.clone());
+//!
+//! t.translate_batch(vec!["Add to cart"], vec![vec!["jpn_Jpan"]], &Default::default())?;
+//! println!("{} hits, {} misses", cache.hits(), cache.misses());
+//! # Ok(())
+//! # }
+//! ```
+
+use std::collections::hash_map::RandomState;
+use std::collections::HashMap;
+use std::hash::BuildHasher;
+use std::sync::atomic::{AtomicBool, Ordering};
+use std::sync::{Arc, RwLock};
+
+use anyhow::Result;
+
+use crate::metrics::Counter;
+
+/// Number of shards of a cache.
+const NUM_SHARDS: usize = 16;
+
+/// A bounded cache from inputs to their tokens, shared between threads.
+pub struct EncodingCache {
+    shards: Vec<RwLock<Shard>>,
+    hasher: RandomState,
+    capacity: usize,
+    max_input_len: usize,
+    hits: Counter,
+    misses: Counter,
+    evictions: Counter,
+}
+
+struct Shard {
+    /// Indices of the entries of each input, without and with special tokens.
+    map: HashMap<Arc<str>, [Option<usize>; 2]>,
+    entries: Vec<Entry>,
+    capacity: usize,
+    /// Clock hand, i.e. the next entry to be considered for eviction.
+    hand: usize,
+}
+
+struct Entry {
+    input: Arc<str>,
+    add_special_tokens: bool,
+    tokens: Arc<[String]>,
+    referenced: AtomicBool,
+}
+
+impl EncodingCache {
+    /// Creates a cache holding the tokens of up to about `capacity` inputs no longer than
+    /// `max_input_len` bytes. Longer inputs are encoded every time, so that rare long texts do
+    /// not evict hot short ones.
+    pub fn new(capacity: usize, max_input_len: usize) -> Self {
+        let capacity = capacity.max(1);
+        let num_shards = NUM_SHARDS.min(capacity);
+        let shard_capacity = capacity.div_ceil(num_shards);
+        Self {
+            shards: (0..num_shards)
+                .map(|_| {
+                    RwLock::new(Shard {
+                        map: HashMap::new(),
+                        entries: Vec::new(),
+                        capacity: shard_capacity,
+                        hand: 0,
+                    })
+                })
+                .collect(),
+            hasher: RandomState::new(),
+            capacity: shard_capacity * num_shards,
+            max_input_len,
+            hits: Counter::new(),
+            misses: Counter::new(),
+            evictions: Counter::new(),
+        }
+    }
+
+    /// Returns true if the tokens of the given input can be cached.
+    #[inline]
+    pub fn accepts(&self, input: &str) -> bool {
+        input.len() <= self.max_input_len
+    }
+
+    /// Returns the cached tokens of the given input encoded with or without special tokens, or
+    /// encodes it with `encode` and caches the result. The returned flag is true on a hit.
+    ///
+    /// Threads missing the same input at the same time may all encode it.
+    pub fn get_or_insert_with<F>(
+        &self,
+        input: &str,
+        add_special_tokens: bool,
+        encode: F,
+    ) -> Result<(Arc<[String]>, bool)>
+    where
+        F: FnOnce() -> Result<Vec<String>>,
+    {
+        let shard = &self.shards[self.hasher.hash_one(input) as usize % self.shards.len()];
+        if let Some(tokens) = shard.read().unwrap().get(input, add_special_tokens) {
+            self.hits.inc();
+            return Ok((tokens, true));
+        }
+        self.misses.inc();
+
+        let tokens: Arc<[String]> = encode()?.into();
+        if shard
+            .write()
+            .unwrap()
+            .insert(input, add_special_tokens, tokens.clone())
+        {
+            self.evictions.inc();
+        }
+        Ok((tokens, false))
+    }
+
+    /// Removes all entries.
+    pub fn clear(&self) {
+        for shard in &self.shards {
+            let mut shard = shard.write().unwrap();
+            shard.map.clear();
+            shard.entries.clear();
+            shard.hand = 0;
+        }
+    }
+
+    /// Returns the number of cached inputs.
+    pub fn len(&self) -> usize {
+        self.shards
+            .iter()
+            .map(|s| s.read().unwrap().entries.len())
+            .sum()
+    }
+
+    /// Returns true if no input is cached.
+    pub fn is_empty(&self) -> bool {
+        self.len() == 0
+    }
+
+    /// Returns the maximum number of cached inputs.
+    pub fn capacity(&self) -> usize {
+        self.capacity
+    }
+
+    /// Returns the maximum length of a cached input in bytes.
+    pub fn max_input_len(&self) -> usize {
+        self.max_input_len
+    }
+
+    /// Returns the number of lookups which found the input.
+    pub fn hits(&self) -> u64 {
+        self.hits.get()
+    }
+
+    /// Returns the number of lookups which encoded the input.
+    pub fn misses(&self) -> u64 {
+        self.misses.get()
+    }
+
+    /// Returns the number of inputs evicted to make room for others.
+    pub fn evictions(&self) -> u64 {
+        self.evictions.get()
+    }
+
+    /// Returns the ratio of lookups which found the input.
+    pub fn hit_ratio(&self) -> f64 {
+        let hits = self.hits();
+        let total = hits + self.misses();
+        if total == 0 {
+            0.
+        } else {
+            hits as f64 / total as f64
+        }
+    }
+}
+
+impl Shard {
+    fn get(&self, input: &str, add_special_tokens: bool) -> Option<Arc<[String]>> {
+        let entry = &self.entries[self.map.get(input)?[add_special_tokens as usize]?];
+        // Storing only when unmarked keeps the cache line shared between readers of a hot entry.
+        if !entry.referenced.load(Ordering::Relaxed) {
+            entry.referenced.store(true, Ordering::Relaxed);
+        }
+        Some(entry.tokens.clone())
+    }
+
+    /// Inserts an entry, and returns true if another one is evicted.
+    fn insert(&mut self, input: &str, add_special_tokens: bool, tokens: Arc<[String]>) -> bool {
+        let slot = add_special_tokens as usize;
+        let input: Arc<str> = match self.map.get_key_value(input) {
+            Some((_, indices)) if indices[slot].is_some() => return false,
+            Some((key, _)) => key.clone(),
+            None => input.into(),
+        };
+        let entry = Entry {
+            input: input.clone(),
+            add_special_tokens,
+            tokens,
+            referenced: AtomicBool::new(false),
+        };
+        if self.entries.len() < self.capacity {
+            self.map.entry(input).or_default()[slot] = Some(self.entries.len());
+            self.entries.push(entry);
+            return false;
+        }
+
+        while self.entries[self.hand]
+            .referenced
+            .swap(false, Ordering::Relaxed)
+        {
+            self.hand = (self.hand + 1) % self.entries.len();
+        }
+        let evicted = std::mem::replace(&mut self.entries[self.hand], entry);
+        let indices = self.map.get_mut(&evicted.input).unwrap();
+        indices[evicted.add_special_tokens as usize] = None;
+        if indices == &[None, None] {
+            self.map.remove(&evicted.input);
+        }
+        self.map.entry(input).or_default()[slot] = Some(self.hand);
+        self.hand = (self.hand + 1) % self.entries.len();
+        true
+    }
+}
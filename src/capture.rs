@@ -0,0 +1,204 @@
+// capture.rs
+//
+// Copyright (c) 2023 Junpei Kawamoto
+//
+// This software is released under the MIT License.
+//
+// http://opensource.org/licenses/mit-license.php
+
+//! Capture of slow requests for offline replay (requires the `capture` feature).
+//!
+//! When a request takes longer than the threshold, its exact tokens, options and timings are
+//! appended to a file in the JSON Lines format. Captured requests can be read back with
+//! [`read_captures`] and re-executed, e.g. by the `ctranslate2-example-replay` tool.
+//!
+//! ```no_run
+//! # use std::time::Duration;
+//! # use ctranslate2::capture::Capture;
+//! # use ctranslate2::config::{Config, Device};
+//! # use ctranslate2::translator::Translator;
+//! # fn main() -> anyhow::Result<()> {
+//! let mut t = Translator::new("/path/to/model", Device::CPU, Config::default())?;
+//! t.set_capture(Capture::new("slow.jsonl", Duration::from_millis(500))?);
+//! # Ok(())
+//! # }
+//! ```
+
+use std::fs::{File, OpenOptions};
+use std::io::{self, BufRead, BufReader, Write};
+use std::path::Path;
+use std::sync::{Arc, Mutex};
+use std::time::{Duration, SystemTime, UNIX_EPOCH};
+
+use anyhow::Result;
+use serde::{Deserialize, Serialize, Serializer};
+
+use crate::generator::GenerationOptions;
+use crate::metrics::BatchStats;
+use crate::translator::TranslationOptions;
+
+/// A sink of slow requests.
+pub struct Capture {
+    threshold: Duration,
+    file: Mutex<File>,
+}
+
+impl Capture {
+    /// Creates a capture which appends requests taking `threshold` or longer to the given file.
+    pub fn new<T: AsRef<Path>>(path: T, threshold: Duration) -> io::Result<Arc<Capture>> {
+        Ok(Arc::new(Capture {
+            threshold,
+            file: Mutex::new(OpenOptions::new().create(true).append(true).open(path)?),
+        }))
+    }
+
+    /// Returns the latency threshold.
+    pub fn threshold(&self) -> Duration {
+        self.threshold
+    }
+
+    pub(crate) fn record_translation<T, U, V>(
+        &self,
+        source: &[Vec<T>],
+        target_prefix: &[Vec<U>],
+        options: &TranslationOptions<V>,
+        elapsed: Duration,
+        batches: &[BatchStats],
+    ) -> Result<()>
+    where
+        T: AsRef<str>,
+        U: AsRef<str>,
+        V: AsRef<str>,
+    {
+        self.write(&CapturedRequest {
+            timestamp_ms: timestamp_ms(),
+            elapsed,
+            batches: batches.to_vec(),
+            input: CapturedInput::Translation {
+                source: to_owned_tokens(source),
+                target_prefix: to_owned_tokens(target_prefix),
+                options: serde_json::to_value(options)?,
+            },
+        })
+    }
+
+    pub(crate) fn record_generation<T, U, V>(
+        &self,
+        start_tokens: &[Vec<T>],
+        options: &GenerationOptions<U, V>,
+        elapsed: Duration,
+        batches: &[BatchStats],
+    ) -> Result<()>
+    where
+        T: AsRef<str>,
+        U: AsRef<str>,
+        V: AsRef<str>,
+    {
+        self.write(&CapturedRequest {
+            timestamp_ms: timestamp_ms(),
+            elapsed,
+            batches: batches.to_vec(),
+            input: CapturedInput::Generation {
+                start_tokens: to_owned_tokens(start_tokens),
+                options: serde_json::to_value(options)?,
+            },
+        })
+    }
+
+    fn write(&self, req: &CapturedRequest) -> Result<()> {
+        let mut line = serde_json::to_vec(req)?;
+        line.push(b'\n');
+        self.file.lock().unwrap().write_all(&line)?;
+        Ok(())
+    }
+}
+
+/// A captured request.
+#[derive(Debug, Serialize, Deserialize)]
+pub struct CapturedRequest {
+    /// Time when the request was captured in milliseconds since the UNIX epoch.
+    pub timestamp_ms: u64,
+    /// Duration of the request.
+    pub elapsed: Duration,
+    /// Statistics of the batches run for the request.
+    pub batches: Vec<BatchStats>,
+    /// Inputs of the request.
+    pub input: CapturedInput,
+}
+
+/// Inputs of a captured request.
+#[derive(Debug, Serialize, Deserialize)]
+#[serde(tag = "kind", rename_all = "snake_case")]
+pub enum CapturedInput {
+    Translation {
+        source: Vec<Vec<String>>,
+        target_prefix: Vec<Vec<String>>,
+        options: serde_json::Value,
+    },
+    Generation {
+        start_tokens: Vec<Vec<String>>,
+        options: serde_json::Value,
+    },
+}
+
+impl CapturedInput {
+    /// Returns the translation options if this is a translation request.
+    pub fn translation_options(&self) -> Result<Option<TranslationOptions<String>>> {
+        match self {
+            CapturedInput::Translation { options, .. } => {
+                Ok(Some(serde_json::from_value(options.clone())?))
+            }
+            _ => Ok(None),
+        }
+    }
+
+    /// Returns the generation options if this is a generation request.
+    pub fn generation_options(&self) -> Result<Option<GenerationOptions<String, String>>> {
+        match self {
+            CapturedInput::Generation { options, .. } => {
+                Ok(Some(serde_json::from_value(options.clone())?))
+            }
+            _ => Ok(None),
+        }
+    }
+}
+
+/// Reads the requests captured in the given file.
+pub fn read_captures<T: AsRef<Path>>(path: T) -> Result<Vec<CapturedRequest>> {
+    BufReader::new(File::open(path)?)
+        .lines()
+        .filter(|line| !matches!(line, Ok(l) if l.trim().is_empty()))
+        .map(|line| Ok(serde_json::from_str(&line?)?))
+        .collect()
+}
+
+pub(crate) fn serialize_strs<T, S>(v: &[T], serializer: S) -> Result<S::Ok, S::Error>
+where
+    T: AsRef<str>,
+    S: Serializer,
+{
+    serializer.collect_seq(v.iter().map(AsRef::as_ref))
+}
+
+pub(crate) fn serialize_tokens<T, S>(v: &[Vec<T>], serializer: S) -> Result<S::Ok, S::Error>
+where
+    T: AsRef<str>,
+    S: Serializer,
+{
+    serializer.collect_seq(
+        v.iter()
+            .map(|s| s.iter().map(AsRef::as_ref).collect::<Vec<_>>()),
+    )
+}
+
+fn to_owned_tokens<T: AsRef<str>>(src: &[Vec<T>]) -> Vec<Vec<String>> {
+    src.iter()
+        .map(|v| v.iter().map(|s| s.as_ref().to_string()).collect())
+        .collect()
+}
+
+fn timestamp_ms() -> u64 {
+    SystemTime::now()
+        .duration_since(UNIX_EPOCH)
+        .map_or(0, |d| d.as_millis() as u64)
+}
@@ -54,6 +54,7 @@ impl Default for Config {
 
 /// Whether max_batch_size is the number of “examples” or “tokens”.
 #[derive(Debug, Default)]
+#[cfg_attr(feature = "capture", derive(serde::Serialize, serde::Deserialize))]
 pub enum BatchType {
     #[default]
     Examples,
@@ -0,0 +1,457 @@
+// corpus.rs
+//
+// Copyright (c) 2023 Junpei Kawamoto
+//
+// This software is released under the MIT License.
+//
+// http://opensource.org/licenses/mit-license.php
+
+//! Pre-tokenized corpora, so that a corpus translated again with a new model is tokenized once.
+//!
+//! A corpus file stores the token ids of each sequence as `u32`, grouped into chunks of a fixed
+//! number of sequences which are optionally compressed with zstd. All integers are little-endian:
+//!
+//! | Offset | Size | Content                                                      |
+//! |--------|------|--------------------------------------------------------------|
+//! | 0      | 8    | Magic `CT2TOK\0\x01`                                         |
+//! | 8      | 4    | Flags; [`ZSTD`] if the chunks are compressed                 |
+//! | 12     | 4    | Number of sequences of each chunk but the last one           |
+//! | 16     | 8    | Number of sequences                                          |
+//! | 24     | 8    | Number of tokens                                             |
+//! | 32     | 8    | Offset of the chunk index                                    |
+//! | 40     | 8    | Fingerprint of the vocabulary the ids belong to              |
+//! | 64     |      | Chunks, each of which is `u32` lengths of its sequences followed by their `u32` ids |
+//!
+//! The chunk index at the end of the file is the `u64` offset of each chunk and of the end of the
+//! last one. The file is mapped into memory, so that uncompressed chunks are read in place and
+//! compressed ones are decompressed into a buffer reused across chunks.
+//!
+//! Ids are those of the tokenizer which converted the corpus. [`Vocabulary`] maps them back to the
+//! tokens passed to the model, and its fingerprint guards against reading a corpus with the
+//! tokenizer of another model.
+
+use std::fs::File;
+use std::io::{BufRead, Seek, SeekFrom, Write};
+use std::path::Path;
+
+use anyhow::{anyhow, bail, Result};
+use memmap2::Mmap;
+use tokenizers::Tokenizer;
+
+use crate::packed::PackedTokens;
+use crate::{TranslationOptions, Translator};
+
+/// Magic number at the start of a corpus.
+pub const MAGIC: [u8; 8] = *b"CT2TOK\0\x01";
+/// Flag of a corpus whose chunks are compressed with zstd.
+pub const ZSTD: u32 = 1;
+/// Default number of sequences of each chunk.
+pub const DEFAULT_CHUNK_SEQUENCES: usize = 4096;
+
+const HEADER_SIZE: usize = 64;
+
+/// Token table of a tokenizer, indexed by id.
+#[derive(Clone, Debug, Default, PartialEq, Eq)]
+pub struct Vocabulary {
+    data: String,
+    offsets: Vec<usize>,
+}
+
+impl Vocabulary {
+    /// Builds the table of the given tokenizer, including its added tokens.
+    pub fn from_tokenizer(tokenizer: &Tokenizer) -> Self {
+        let size = tokenizer.get_vocab_size(true);
+        let mut res = Self {
+            data: String::new(),
+            offsets: Vec::with_capacity(size + 1),
+        };
+        res.offsets.push(0);
+        for id in 0..size as u32 {
+            if let Some(token) = tokenizer.id_to_token(id) {
+                res.data.push_str(&token);
+            }
+            res.offsets.push(res.data.len());
+        }
+        res
+    }
+
+    /// Returns the number of ids.
+    pub fn len(&self) -> usize {
+        self.offsets.len().saturating_sub(1)
+    }
+
+    /// Returns true if there are no ids.
+    pub fn is_empty(&self) -> bool {
+        self.len() == 0
+    }
+
+    /// Returns the token of the given id, or `None` if the tokenizer has no such id.
+    pub fn get(&self, id: u32) -> Option<&str> {
+        let id = id as usize;
+        if id >= self.len() || self.offsets[id] == self.offsets[id + 1] {
+            return None;
+        }
+        Some(&self.data[self.offsets[id]..self.offsets[id + 1]])
+    }
+
+    /// Returns the FNV-1a hash of the tokens and their ids.
+    pub fn fingerprint(&self) -> u64 {
+        let mut hash = 0xcbf29ce484222325u64;
+        for id in 0..self.len() {
+            // 0xff never appears in UTF-8, so it separates the tokens.
+            let token = &self.data.as_bytes()[self.offsets[id]..self.offsets[id + 1]];
+            for &b in token.iter().chain(&[0xff]) {
+                hash = (hash ^ b as u64).wrapping_mul(0x100000001b3);
+            }
+        }
+        hash
+    }
+}
+
+/// Writes the sequences of a corpus.
+pub struct CorpusWriter<W: Write + Seek> {
+    out: W,
+    fingerprint: u64,
+    chunk_sequences: usize,
+    /// Compression level, or `None` to store the chunks as they are.
+    level: Option<i32>,
+    /// Lengths and ids of the current chunk.
+    lengths: Vec<u32>,
+    ids: Vec<u32>,
+    chunk: Vec<u8>,
+    index: Vec<u64>,
+    num_sequences: u64,
+    num_tokens: u64,
+}
+
+impl<W: Write + Seek> CorpusWriter<W> {
+    /// Starts a corpus of ids of the vocabulary with the given fingerprint, grouping
+    /// `chunk_sequences` sequences into each chunk, compressed with the given zstd level if any.
+    ///
+    /// The corpus is written from the start of the output, e.g. a newly created file.
+    pub fn new(
+        mut out: W,
+        fingerprint: u64,
+        chunk_sequences: usize,
+        level: Option<i32>,
+    ) -> Result<Self> {
+        let chunk_sequences = chunk_sequences.clamp(1, u32::MAX as usize);
+        out.rewind()?;
+        // The header is written by finish once the sizes are known.
+        out.write_all(&[0; HEADER_SIZE])?;
+        Ok(Self {
+            out,
+            fingerprint,
+            chunk_sequences,
+            level,
+            lengths: Vec::with_capacity(chunk_sequences),
+            ids: Vec::new(),
+            chunk: Vec::new(),
+            index: vec![HEADER_SIZE as u64],
+            num_sequences: 0,
+            num_tokens: 0,
+        })
+    }
+
+    /// Appends a sequence of ids.
+    pub fn push(&mut self, ids: &[u32]) -> Result<()> {
+        self.lengths.push(
+            ids.len()
+                .try_into()
+                .map_err(|_| anyhow!("sequence too long: {}", ids.len()))?,
+        );
+        self.ids.extend_from_slice(ids);
+        self.num_sequences += 1;
+        self.num_tokens += ids.len() as u64;
+        if self.lengths.len() == self.chunk_sequences {
+            self.flush_chunk()?;
+        }
+        Ok(())
+    }
+
+    fn flush_chunk(&mut self) -> Result<()> {
+        if self.lengths.is_empty() {
+            return Ok(());
+        }
+        self.chunk.clear();
+        for n in self.lengths.iter().chain(&self.ids) {
+            self.chunk.extend_from_slice(&n.to_le_bytes());
+        }
+        let size = match self.level {
+            Some(level) => {
+                let compressed = zstd::bulk::compress(&self.chunk, level)?;
+                self.out.write_all(&compressed)?;
+                compressed.len()
+            }
+            None => {
+                self.out.write_all(&self.chunk)?;
+                self.chunk.len()
+            }
+        };
+        self.index.push(self.index.last().unwrap() + size as u64);
+        self.lengths.clear();
+        self.ids.clear();
+        Ok(())
+    }
+
+    /// Writes the last chunk, the index, and the header, and returns the output.
+    pub fn finish(mut self) -> Result<W> {
+        self.flush_chunk()?;
+        let index_offset = *self.index.last().unwrap();
+        for offset in &self.index {
+            self.out.write_all(&offset.to_le_bytes())?;
+        }
+        let end = self.out.stream_position()?;
+
+        let mut header = [0; HEADER_SIZE];
+        header[..8].copy_from_slice(&MAGIC);
+        let flags = if self.level.is_some() { ZSTD } else { 0 };
+        header[8..12].copy_from_slice(&flags.to_le_bytes());
+        header[12..16].copy_from_slice(&(self.chunk_sequences as u32).to_le_bytes());
+        header[16..24].copy_from_slice(&self.num_sequences.to_le_bytes());
+        header[24..32].copy_from_slice(&self.num_tokens.to_le_bytes());
+        header[32..40].copy_from_slice(&index_offset.to_le_bytes());
+        header[40..48].copy_from_slice(&self.fingerprint.to_le_bytes());
+        self.out.rewind()?;
+        self.out.write_all(&header)?;
+        self.out.seek(SeekFrom::Start(end))?;
+        self.out.flush()?;
+        Ok(self.out)
+    }
+}
+
+/// Tokenizes each line of the given input and writes the ids to the given writer.
+///
+/// Special tokens are added as [`Translator::translate_batch`] does, so that translating the
+/// corpus gives the same results as translating the lines.
+pub fn pretokenize<R, W>(tokenizer: &Tokenizer, input: R, mut writer: CorpusWriter<W>) -> Result<W>
+where
+    R: BufRead,
+    W: Write + Seek,
+{
+    for line in input.lines() {
+        let encoding = tokenizer
+            .encode(line?, true)
+            .map_err(|err| anyhow!("failed to encode the given input: {err}"))?;
+        writer.push(encoding.get_ids())?;
+    }
+    writer.finish()
+}
+
+/// A corpus file mapped into memory.
+pub struct Corpus {
+    map: Mmap,
+    flags: u32,
+    chunk_sequences: usize,
+    num_sequences: usize,
+    num_tokens: usize,
+    index_offset: usize,
+    fingerprint: u64,
+}
+
+impl Corpus {
+    /// Maps the corpus at the given path.
+    ///
+    /// The file must not be modified while the corpus is open.
+    pub fn open<P: AsRef<Path>>(path: P) -> Result<Self> {
+        let file = File::open(path)?;
+        let map = unsafe { Mmap::map(&file)? };
+        if map.len() < HEADER_SIZE || map[..8] != MAGIC {
+            bail!("not a pre-tokenized corpus");
+        }
+        let u32_at = |i: usize| u32::from_le_bytes(map[i..i + 4].try_into().unwrap());
+        let u64_at = |i: usize| u64::from_le_bytes(map[i..i + 8].try_into().unwrap());
+        let res = Self {
+            flags: u32_at(8),
+            chunk_sequences: u32_at(12) as usize,
+            num_sequences: u64_at(16) as usize,
+            num_tokens: u64_at(24) as usize,
+            index_offset: u64_at(32) as usize,
+            fingerprint: u64_at(40),
+            map,
+        };
+        if res.flags & !ZSTD != 0 {
+            bail!("unsupported flags: {:#x}", res.flags);
+        }
+        if res.chunk_sequences == 0
+            || res.index_offset < HEADER_SIZE
+            || res.index_offset > res.map.len()
+            || (res.map.len() - res.index_offset) / 8 != res.num_chunks() + 1
+        {
+            bail!("corrupted corpus");
+        }
+        Ok(res)
+    }
+
+    /// Returns the number of sequences.
+    pub fn len(&self) -> usize {
+        self.num_sequences
+    }
+
+    /// Returns true if there are no sequences.
+    pub fn is_empty(&self) -> bool {
+        self.num_sequences == 0
+    }
+
+    /// Returns the total number of tokens.
+    pub fn num_tokens(&self) -> usize {
+        self.num_tokens
+    }
+
+    /// Returns the fingerprint of the vocabulary the ids belong to.
+    pub fn fingerprint(&self) -> u64 {
+        self.fingerprint
+    }
+
+    /// Returns true if the chunks are compressed.
+    pub fn is_compressed(&self) -> bool {
+        self.flags & ZSTD != 0
+    }
+
+    fn num_chunks(&self) -> usize {
+        self.num_sequences.div_ceil(self.chunk_sequences)
+    }
+
+    /// Calls `f` with the ids of each sequence in order, stopping at the first error.
+    pub fn try_for_each<F>(&self, mut f: F) -> Result<()>
+    where
+        F: FnMut(Ids<'_>) -> Result<()>,
+    {
+        let index = &self.map[self.index_offset..];
+        let offset = |i: usize| u64::from_le_bytes(index[8 * i..8 * i + 8].try_into().unwrap());
+        let mut buf = Vec::new();
+        for i in 0..self.num_chunks() {
+            let (start, end) = (offset(i) as usize, offset(i + 1) as usize);
+            if start > end || end > self.index_offset {
+                bail!("corrupted corpus");
+            }
+            let chunk = if self.is_compressed() {
+                buf.clear();
+                zstd::stream::copy_decode(&self.map[start..end], &mut buf)?;
+                &buf[..]
+            } else {
+                &self.map[start..end]
+            };
+
+            let n = self
+                .chunk_sequences
+                .min(self.num_sequences - i * self.chunk_sequences);
+            if chunk.len() < 4 * n {
+                bail!("corrupted corpus");
+            }
+            let (lengths, mut ids) = chunk.split_at(4 * n);
+            for len in lengths.chunks_exact(4) {
+                let len = 4 * u32::from_le_bytes(len.try_into().unwrap()) as usize;
+                if len > ids.len() {
+                    bail!("corrupted corpus");
+                }
+                let (seq, rest) = ids.split_at(len);
+                ids = rest;
+                f(Ids(seq.chunks_exact(4)))?;
+            }
+        }
+        Ok(())
+    }
+}
+
+/// Iterator over the ids of a sequence in a [`Corpus`].
+#[derive(Clone, Debug)]
+pub struct Ids<'a>(std::slice::ChunksExact<'a, u8>);
+
+impl Iterator for Ids<'_> {
+    type Item = u32;
+
+    fn next(&mut self) -> Option<Self::Item> {
+        Some(u32::from_le_bytes(self.0.next()?.try_into().unwrap()))
+    }
+
+    fn size_hint(&self) -> (usize, Option<usize>) {
+        self.0.size_hint()
+    }
+}
+
+impl ExactSizeIterator for Ids<'_> {}
+
+impl Translator {
+    /// Returns the token table of the tokenizer, whose fingerprint identifies the corpora it can
+    /// translate.
+    pub fn vocabulary(&self) -> Result<Vocabulary> {
+        let tokenizer = self
+            .tokenizer
+            .huggingface()
+            .ok_or_else(|| anyhow!("pre-tokenized corpora require a tokenizer.json"))?;
+        Ok(Vocabulary::from_tokenizer(tokenizer))
+    }
+
+    /// Translates a corpus pre-tokenized with the tokenizer of this translator, calling `f` with
+    /// each translation and its score in order.
+    ///
+    /// Sequences are translated `batch_size` at a time. Their ids are mapped to tokens packed into
+    /// buffers reused across batches, so that the corpus is neither tokenized again nor copied
+    /// into a string per token. `target_prefix` starts every translation, e.g. the target language
+    /// of NLLB.
+    #[cfg_attr(
+        feature = "tracing",
+        tracing::instrument(name = "translate_corpus", skip_all, fields(num_sequences = corpus.len()))
+    )]
+    pub fn translate_corpus<U, V, F>(
+        &self,
+        corpus: &Corpus,
+        target_prefix: &[U],
+        options: &TranslationOptions<V>,
+        batch_size: usize,
+        mut f: F,
+    ) -> Result<()>
+    where
+        U: AsRef<str>,
+        V: AsRef<str>,
+        F: FnMut(String, Option<f32>) -> Result<()>,
+    {
+        let vocabulary = self.vocabulary()?;
+        if vocabulary.fingerprint() != corpus.fingerprint() {
+            bail!("the corpus was tokenized with another vocabulary");
+        }
+        let batch_size = batch_size.max(1);
+        let mut tokens = PackedTokens::new();
+        let mut prefixes = PackedTokens::new();
+
+        let mut flush = |tokens: &mut PackedTokens, prefixes: &mut PackedTokens| -> Result<()> {
+            let translations = self
+                .translator
+                .translate_packed(tokens, prefixes, options)?;
+            if translations.tokens.len() != tokens.len() {
+                bail!("no results are returned");
+            }
+            for (i, hypothesis) in translations.tokens.iter().enumerate() {
+                let text = self.tokenizer.decode(
+                    hypothesis
+                        .skip(target_prefix.len())
+                        .map(str::to_string)
+                        .collect(),
+                )?;
+                f(text, translations.scores.get(i).copied())?;
+            }
+            tokens.clear();
+            prefixes.clear();
+            Ok(())
+        };
+
+        corpus.try_for_each(|ids| {
+            if let Some(id) = ids.clone().find(|&id| vocabulary.get(id).is_none()) {
+                bail!("unknown token id: {id}");
+            }
+            tokens.push(ids.map(|id| vocabulary.get(id).unwrap()));
+            if !target_prefix.is_empty() {
+                prefixes.push(target_prefix);
+            }
+            if tokens.len() == batch_size {
+                flush(&mut tokens, &mut prefixes)?;
+            }
+            Ok(())
+        })?;
+        if !tokens.is_empty() {
+            flush(&mut tokens, &mut prefixes)?;
+        }
+        Ok(())
+    }
+}
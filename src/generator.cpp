@@ -7,7 +7,12 @@
 // http://opensource.org/licenses/mit-license.php
 
 #include "ctranslate2/include/generator.h"
+#include "ctranslate2/include/batch_stats.h"
 #include "ctranslate2/include/convert.h"
+#include "ctranslate2/include/probes.h"
+#include "ctranslate2/include/step_callback.h"
+#include "ctranslate2/include/step_timer.h"
+#include "ctranslate2/include/trace.h"
 #include "ctranslate2/src/generator.rs.h"
 
 using rust::Str;
@@ -17,7 +22,10 @@ using std::vector;
 
 Vec<GenerationResult>
 Generator::generate_batch(Vec<GenVecStr> start_tokens,
-                          GenerationOptions options) const {
+                          GenerationOptions options, bool record_steps,
+                          bool has_callback, GenerationCallbackBox &callback,
+                          Vec<GenBatchStats> &stats,
+                          Vec<GenStepStats> &steps) const {
 
   ctranslate2::BatchType batch_type;
   switch (options.batch_type) {
@@ -29,39 +37,95 @@ Generator::generate_batch(Vec<GenVecStr> start_tokens,
     break;
   }
 
-  auto futures = this->impl->generate_batch_async(
-      from_rust(start_tokens),
-      ctranslate2::GenerationOptions{options.beam_size,
-                                     options.patience,
-                                     options.length_penalty,
-                                     options.repetition_penalty,
-                                     options.no_repeat_ngram_size,
-                                     options.disable_unk,
-                                     from_rust(options.suppress_sequences),
-                                     {},
-                                     options.return_end_token,
-                                     options.max_length,
-                                     options.min_length,
-                                     options.sampling_topk,
-                                     options.sampling_topp,
-                                     options.sampling_temperature,
-                                     options.num_hypotheses,
-                                     options.return_scores,
-                                     options.return_alternatives,
-                                     options.min_alternative_expansion_prob,
-                                     from_rust(options.static_prompt),
-                                     options.cache_static_prompt,
-                                     options.include_prompt_in_result,
-                                     nullptr},
-      options.max_batch_size, batch_type);
+  TraceContext context;
+  CT2RS_PROBE1(marshal_in__start, start_tokens.size());
+  TraceSpan marshal_in(context, TracePhase::MarshalIn, start_tokens);
+  auto examples = ctranslate2::load_examples({from_rust(start_tokens)});
+  const ctranslate2::GenerationOptions opts{
+      options.beam_size,
+      options.patience,
+      options.length_penalty,
+      options.repetition_penalty,
+      options.no_repeat_ngram_size,
+      options.disable_unk,
+      from_rust(options.suppress_sequences),
+      {},
+      options.return_end_token,
+      options.max_length,
+      options.min_length,
+      options.sampling_topk,
+      options.sampling_topp,
+      options.sampling_temperature,
+      options.num_hypotheses,
+      options.return_scores,
+      options.return_alternatives,
+      options.min_alternative_expansion_prob,
+      from_rust(options.static_prompt),
+      options.cache_static_prompt,
+      options.include_prompt_in_result,
+      nullptr};
+  marshal_in.close();
+  CT2RS_PROBE1(marshal_in__end, start_tokens.size());
 
+  const TraceSpan queue_wait(context, TracePhase::QueueWait, start_tokens);
+  // The results start with the prompt, the only stream of the examples, if
+  // include_prompt_in_result is set.
+  auto collector = std::make_shared<BatchStatsCollector<GenBatchStats>>(
+      options.include_prompt_in_result ? std::optional<size_t>(0)
+                                       : std::nullopt);
+  auto step_collector =
+      record_steps ? std::make_shared<StepStatsCollector<GenStepStats>>()
+                   : nullptr;
+  using Callback = StepCallback<GenerationCallbackBox, GenerationStepResult>;
+  auto step_callback =
+      has_callback ? std::make_shared<Callback>(callback) : nullptr;
+  auto futures = this->impl->post_examples<ctranslate2::GenerationResult>(
+      examples, options.max_batch_size, batch_type,
+      [opts, context, queue_wait, collector, step_collector,
+       step_callback](ctranslate2::models::SequenceGeneratorReplica &replica,
+                      const ctranslate2::Batch &batch) {
+        queue_wait.close();
+        const TraceSpan execute(context, TracePhase::Execute, batch);
+        StepStream<GenerationCallbackBox, GenerationStepResult> stream(
+            step_callback, batch);
+        StepTimer<GenStepStats> timer(step_collector, batch.examples.size());
+        auto res = collector->run(batch, [&] {
+          return replica.generate(batch.get_stream(0),
+                                  timer.attach(stream.attach(opts)));
+        });
+        timer.finish();
+        return res;
+      });
+
+  vector<ctranslate2::GenerationResult> batch_result;
+  try {
+    for (auto &future : futures) {
+      batch_result.push_back(future.get());
+    }
+  } catch (...) {
+    // Batches still running must not call the callback of a failed request.
+    if (step_callback) {
+      step_callback->close();
+    }
+    throw;
+  }
+  if (step_callback) {
+    step_callback->close();
+  }
+  collector->drain(stats);
+  if (step_collector) {
+    step_collector->drain(steps);
+  }
+
+  CT2RS_PROBE1(marshal_out__start, batch_result.size());
+  const TraceSpan marshal_out(context, TracePhase::MarshalOut, batch_result);
   Vec<GenerationResult> res;
-  for (auto &future : futures) {
-    const auto &r = future.get();
+  for (const auto &r : batch_result) {
     res.push_back(GenerationResult{to_rust<GenVecString>(r.sequences),
                                    to_rust<GenVecUSize>(r.sequences_ids),
                                    to_rust(r.scores)});
   }
+  CT2RS_PROBE1(marshal_out__end, res.size());
 
   return res;
 }
@@ -93,7 +157,7 @@ std::unique_ptr<Generator> new_generator(const Str model_path, const bool cuda,
     break;
   };
 
-  return std::make_unique<Generator>(std::make_shared<ctranslate2::Generator>(
+  return std::make_unique<Generator>(std::make_shared<GeneratorPool>(
       static_cast<string>(model_path),
       cuda ? ctranslate2::Device::CUDA : ctranslate2::Device::CPU, compute_type,
       from_rust(config.device_indices),
@@ -8,9 +8,16 @@
 
 //! Bindings for ctranslate2::Generator.
 
+use std::sync::Arc;
+use std::time::{Duration, Instant};
+
 use cxx::UniquePtr;
 
+#[cfg(feature = "capture")]
+use crate::capture::Capture;
 use crate::config::{BatchType, ComputeType, Config, Device};
+use crate::memory::{MemoryReport, VariableInfo};
+use crate::metrics::{BatchStats, HardwareCounters, Metrics, StepStats};
 
 #[cxx::bridge]
 mod ffi {
@@ -80,6 +87,50 @@ mod ffi {
         scores: Vec<f32>,
     }
 
+    struct GenBatchStats {
+        num_examples: usize,
+        num_tokens: usize,
+        max_length: usize,
+        num_output_tokens: usize,
+        max_output_length: usize,
+        queue_wait_us: u64,
+        execution_us: u64,
+        has_counters: bool,
+        cycles: u64,
+        instructions: u64,
+        llc_misses: u64,
+        dtlb_misses: u64,
+    }
+
+    struct GenStepStats {
+        num_tokens: usize,
+        ttft_us: u64,
+        tpot_us: u64,
+    }
+
+    struct GenVariableInfo {
+        name: String,
+        dtype: String,
+        shape: Vec<i64>,
+        bytes: usize,
+    }
+
+    struct GenerationStepResult {
+        step: usize,
+        batch_id: usize,
+        token_id: usize,
+        token: String,
+        has_log_prob: bool,
+        log_prob: f32,
+        is_last: bool,
+    }
+
+    extern "Rust" {
+        type GenerationCallbackBox<'a>;
+
+        fn execute(self: &mut GenerationCallbackBox, step: GenerationStepResult) -> bool;
+    }
+
     unsafe extern "C++" {
         include!("ctranslate2/include/generator.h");
 
@@ -95,13 +146,33 @@ mod ffi {
             &self,
             start_tokens: Vec<GenVecStr>,
             options: GenerationOptions,
+            record_steps: bool,
+            has_callback: bool,
+            callback: &mut GenerationCallbackBox,
+            stats: &mut Vec<GenBatchStats>,
+            steps: &mut Vec<GenStepStats>,
         ) -> Result<Vec<GenerationResult>>;
+
+        fn num_queued_batches(&self) -> usize;
+
+        fn num_active_batches(&self) -> usize;
+
+        fn num_replicas(&self) -> usize;
+
+        fn model_variables(&self) -> Vec<GenVariableInfo>;
     }
 }
 
+// ctranslate2::Generator queues requests to a pool of replicas and can be shared between threads.
+unsafe impl Send for ffi::Generator {}
+unsafe impl Sync for ffi::Generator {}
+
 /// A text translator.
 pub struct Generator {
     ptr: UniquePtr<ffi::Generator>,
+    metrics: Option<Arc<Metrics>>,
+    #[cfg(feature = "capture")]
+    capture: Option<Arc<Capture>>,
 }
 
 impl Generator {
@@ -133,9 +204,60 @@ impl Generator {
                     cpu_core_offset: config.cpu_core_offset,
                 },
             )?,
+            metrics: None,
+            #[cfg(feature = "capture")]
+            capture: None,
         })
     }
 
+    /// Records the metrics of this generator into the given metrics.
+    pub fn set_metrics(&mut self, metrics: Arc<Metrics>) {
+        self.metrics = Some(metrics);
+    }
+
+    /// Returns the metrics of this generator if set.
+    pub fn metrics(&self) -> Option<&Arc<Metrics>> {
+        self.metrics.as_ref()
+    }
+
+    /// Captures requests of this generator which are slower than the threshold of the given capture.
+    #[cfg(feature = "capture")]
+    pub fn set_capture(&mut self, capture: Arc<Capture>) {
+        self.capture = Some(capture);
+    }
+
+    /// Number of batches in the work queue.
+    pub fn num_queued_batches(&self) -> usize {
+        self.ptr.num_queued_batches()
+    }
+
+    /// Number of batches in the work queue or currently processed by a worker.
+    pub fn num_active_batches(&self) -> usize {
+        self.ptr.num_active_batches()
+    }
+
+    /// Number of parallel replicas.
+    pub fn num_replicas(&self) -> usize {
+        self.ptr.num_replicas()
+    }
+
+    /// Reports the memory used by the variables of the loaded model.
+    pub fn memory_report(&self) -> MemoryReport {
+        MemoryReport::new(
+            self.ptr
+                .model_variables()
+                .into_iter()
+                .map(|v| VariableInfo {
+                    name: v.name,
+                    dtype: v.dtype,
+                    shape: v.shape,
+                    bytes: v.bytes,
+                })
+                .collect(),
+            self.num_replicas(),
+        )
+    }
+
     /// Generates from a batch of start tokens.
     ///
     /// `start_tokens` are Batch of start tokens. If the decoder starts from a special start token
@@ -145,17 +267,179 @@ impl Generator {
         start_tokens: &[Vec<T>],
         options: &GenerationOptions<U, V>,
     ) -> anyhow::Result<Vec<GenerationResult>> {
-        Ok(self
-            .ptr
-            .generate_batch(vec_ffi_vecstr(start_tokens), options.to_ffi())?
-            .into_iter()
-            .map(GenerationResult::from)
-            .collect())
+        self.generate(start_tokens, options, None)
+    }
+
+    /// Generates from a batch of start tokens, calling `callback` with each generated token.
+    ///
+    /// The decoder calls the callback only in greedy search, i.e. `beam_size` is 1. It is called
+    /// by the threads of the replicas, one token at a time, and never after this method returns.
+    /// Returning `true` from the callback stops decoding the example of the token.
+    pub fn generate_batch_with_callback<T: AsRef<str>, U: AsRef<str>, V: AsRef<str>>(
+        &self,
+        start_tokens: &[Vec<T>],
+        options: &GenerationOptions<U, V>,
+        callback: &mut (dyn FnMut(GenerationStepResult) -> bool + Send),
+    ) -> anyhow::Result<Vec<GenerationResult>> {
+        self.generate(start_tokens, options, Some(callback))
+    }
+
+    #[cfg_attr(
+        feature = "tracing",
+        tracing::instrument(
+            name = "generate_batch",
+            skip_all,
+            fields(batch_size = start_tokens.len())
+        )
+    )]
+    fn generate<T: AsRef<str>, U: AsRef<str>, V: AsRef<str>>(
+        &self,
+        start_tokens: &[Vec<T>],
+        options: &GenerationOptions<U, V>,
+        callback: Option<&mut (dyn FnMut(GenerationStepResult) -> bool + Send)>,
+    ) -> anyhow::Result<Vec<GenerationResult>> {
+        let start = Instant::now();
+        if let Some(metrics) = &self.metrics {
+            metrics.requests.inc();
+            metrics
+                .queue_depth
+                .set(self.ptr.num_queued_batches() as u64);
+        }
+
+        // The decoder calls the step callback only in greedy search, and once per hypothesis, so
+        // tokens are timed only when each example has a single one.
+        let record_steps =
+            self.metrics.is_some() && options.beam_size == 1 && options.num_hypotheses == 1;
+        let mut stats = Vec::new();
+        let mut steps = Vec::new();
+        let res = match self.ptr.generate_batch(
+            vec_ffi_vecstr(start_tokens),
+            options.to_ffi(),
+            record_steps,
+            callback.is_some(),
+            &mut GenerationCallbackBox(callback),
+            &mut stats,
+            &mut steps,
+        ) {
+            Ok(res) => res
+                .into_iter()
+                .map(GenerationResult::from)
+                .collect::<Vec<_>>(),
+            Err(err) => {
+                if let Some(metrics) = &self.metrics {
+                    metrics.request_errors.inc();
+                }
+                return Err(err.into());
+            }
+        };
+
+        let elapsed = start.elapsed();
+        let stats = stats.into_iter().map(BatchStats::from).collect::<Vec<_>>();
+        if let Some(metrics) = &self.metrics {
+            metrics.examples.inc_by(start_tokens.len() as u64);
+            metrics
+                .input_tokens
+                .inc_by(start_tokens.iter().map(Vec::len).sum::<usize>() as u64);
+            metrics.output_tokens.inc_by(
+                res.iter()
+                    .flat_map(|r| r.sequences.iter().map(Vec::len))
+                    .sum::<usize>() as u64,
+            );
+            metrics.observe_batches(&stats);
+            metrics.observe_steps(&steps.into_iter().map(StepStats::from).collect::<Vec<_>>());
+            metrics.request_duration.observe_duration(elapsed);
+        }
+        #[cfg(feature = "capture")]
+        if let Some(capture) = &self.capture {
+            if elapsed >= capture.threshold() {
+                // A failure to capture must not fail the request itself.
+                let _ = capture.record_generation(start_tokens, options, elapsed, &stats);
+            }
+        }
+        Ok(res)
+    }
+}
+
+/// A token generated in greedy search, passed to the callback of
+/// [`Generator::generate_batch_with_callback`].
+#[derive(Debug, Clone)]
+pub struct GenerationStepResult {
+    /// Decoding step.
+    pub step: usize,
+    /// Index of the example in the request, i.e. in the prompts passed to the generator.
+    pub batch_id: usize,
+    /// ID of the generated token.
+    pub token_id: usize,
+    /// Generated token.
+    pub token: String,
+    /// Log probability of the token, if `return_scores` is enabled.
+    pub log_prob: Option<f32>,
+    /// Whether this is the last token of the example.
+    pub is_last: bool,
+}
+
+impl From<ffi::GenerationStepResult> for GenerationStepResult {
+    fn from(s: ffi::GenerationStepResult) -> Self {
+        Self {
+            step: s.step,
+            batch_id: s.batch_id,
+            token_id: s.token_id,
+            token: s.token,
+            log_prob: s.has_log_prob.then_some(s.log_prob),
+            is_last: s.is_last,
+        }
+    }
+}
+
+/// Callback passed to the C++ side, which calls it only if it is set.
+struct GenerationCallbackBox<'a>(Option<&'a mut (dyn FnMut(GenerationStepResult) -> bool + Send)>);
+
+impl GenerationCallbackBox<'_> {
+    fn execute(&mut self, step: ffi::GenerationStepResult) -> bool {
+        self.0.as_mut().is_some_and(|f| f(step.into()))
+    }
+}
+
+impl From<ffi::GenStepStats> for StepStats {
+    fn from(s: ffi::GenStepStats) -> Self {
+        Self {
+            num_tokens: s.num_tokens,
+            time_to_first_token: Duration::from_micros(s.ttft_us),
+            time_per_output_token: (s.num_tokens > 1).then(|| Duration::from_micros(s.tpot_us)),
+        }
+    }
+}
+
+impl From<ffi::GenBatchStats> for BatchStats {
+    fn from(s: ffi::GenBatchStats) -> Self {
+        Self {
+            num_examples: s.num_examples,
+            num_tokens: s.num_tokens,
+            max_length: s.max_length,
+            num_output_tokens: s.num_output_tokens,
+            max_output_length: s.max_output_length,
+            queue_wait: Duration::from_micros(s.queue_wait_us),
+            execution_time: Duration::from_micros(s.execution_us),
+            counters: s.has_counters.then_some(HardwareCounters {
+                cycles: s.cycles,
+                instructions: s.instructions,
+                llc_misses: s.llc_misses,
+                dtlb_misses: s.dtlb_misses,
+            }),
+        }
     }
 }
 
 /// The set of generation options.
 #[derive(Debug)]
+#[cfg_attr(
+    feature = "capture",
+    derive(serde::Serialize, serde::Deserialize),
+    serde(bound(
+        serialize = "",
+        deserialize = "T: serde::Deserialize<'de>, U: serde::Deserialize<'de>"
+    ))
+)]
 pub struct GenerationOptions<T: AsRef<str>, U: AsRef<str>> {
     /// Beam size to use for beam search (set 1 to run greedy search).
     pub beam_size: usize,
@@ -176,6 +460,10 @@ pub struct GenerationOptions<T: AsRef<str>, U: AsRef<str>> {
     /// Disable the generation of the unknown token.
     pub disable_unk: bool,
     /// Disable the generation of some sequences of tokens.
+    #[cfg_attr(
+        feature = "capture",
+        serde(serialize_with = "crate::capture::serialize_tokens")
+    )]
     pub suppress_sequences: Vec<Vec<T>>,
     // Stop the decoding on one of these tokens (defaults to the model EOS token).
     //std::variant<std::string, std::vector<std::string>, std::vector<size_t>> end_token;
@@ -201,15 +489,18 @@ pub struct GenerationOptions<T: AsRef<str>, U: AsRef<str>> {
     /// Minimum probability to expand an alternative.
     pub min_alternative_expansion_prob: f32,
     /// The static prompt will prefix all inputs for this model.
+    #[cfg_attr(
+        feature = "capture",
+        serde(serialize_with = "crate::capture::serialize_strs")
+    )]
     pub static_prompt: Vec<U>,
     /// Cache the model state after the static prompt and reuse it for future runs using
     /// the same static prompt.
     pub cache_static_prompt: bool,
     /// Include the input tokens in the generation result.
     pub include_prompt_in_result: bool,
-    // Function to call for each generated token in greedy search.
-    // Returns true indicate the current generation is considered finished thus can be stopped early.
-    //std::function<bool(GenerationStepResult)> callback = nullptr;
+    // Function to call for each generated token in greedy search, which is given to
+    // Generator::generate_batch_with_callback instead.
     /// The maximum batch size. If the number of inputs is greater than `max_batch_size`,
     /// the inputs are sorted by length and split by chunks of `max_batch_size` examples
     /// so that the number of padding positions is minimized.
@@ -0,0 +1,326 @@
+// kernels.cpp
+//
+// Copyright (c) 2023 Junpei Kawamoto
+//
+// This software is released under the MIT License.
+//
+// http://opensource.org/licenses/mit-license.php
+
+#include "ctranslate2/include/kernels.h"
+#include "ctranslate2/include/bench_sampling.h"
+
+#include <algorithm>
+#include <chrono>
+#include <ctranslate2/decoding_utils.h>
+#include <ctranslate2/devices.h>
+#include <ctranslate2/ops/ops.h>
+#include <ctranslate2/storage_view.h>
+#include <limits>
+#include <memory>
+#include <random>
+#include <stdexcept>
+#include <vector>
+
+using ctranslate2::Device;
+using ctranslate2::dim_t;
+using ctranslate2::StorageView;
+
+namespace {
+
+Device to_device(bool cuda) { return cuda ? Device::CUDA : Device::CPU; }
+
+ctranslate2::Shape shape(size_t rows, size_t cols) {
+  return {static_cast<dim_t>(rows), static_cast<dim_t>(cols)};
+}
+
+// Runs the given function once to warm up and returns the mean duration of
+// the following iterations in seconds.
+template <typename Func>
+double measure(Device device, size_t iterations, const Func &func) {
+  func();
+  ctranslate2::synchronize_stream(device);
+
+  const auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < iterations; ++i) {
+    func();
+  }
+  ctranslate2::synchronize_stream(device);
+  const std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  return elapsed.count() / static_cast<double>(std::max<size_t>(iterations, 1));
+}
+
+// Logits of a {rows, cols} batch drawn from a normal distribution. Their
+// softmax spreads over thousands of tokens of a large vocabulary, which makes
+// the nucleus of top-p sampling large.
+std::vector<float> random_logits(size_t rows, size_t cols) {
+  std::mt19937 generator(42);
+  std::normal_distribution<float> distribution(0.f, 3.f);
+  std::vector<float> logits(rows * cols);
+  for (auto &logit : logits) {
+    logit = distribution(generator);
+  }
+  return logits;
+}
+
+// Options enabled by the logits processing benchmark, in this order:
+// temperature, repetition_penalty, no_repeat_ngram_size, disable_unk, and
+// suppress_sequences of single tokens.
+bench::LogitsOptions benchmark_options(size_t num_options) {
+  bench::LogitsOptions options;
+  if (num_options > 0) {
+    options.temperature = 0.7f;
+  }
+  if (num_options > 1) {
+    options.repetition_penalty = 1.2f;
+  }
+  if (num_options > 2) {
+    options.no_repeat_ngram_size = 3;
+  }
+  if (num_options > 3) {
+    options.unk_id = 0;
+  }
+  if (num_options > 4) {
+    for (int32_t id = 1; id <= 16; ++id) {
+      options.suppress_sequences.push_back({id});
+    }
+  }
+  return options;
+}
+
+using Processors = std::vector<std::unique_ptr<ctranslate2::LogitsProcessor>>;
+
+// Logits processors of CTranslate2 enabled by the options, as the decoding
+// loop builds them from ctranslate2::GenerationOptions. disable_unk and the
+// temperature are not processors: the decoding loop disables the unknown token
+// and the sampler scales the logits.
+Processors make_processors(const bench::LogitsOptions &options) {
+  Processors processors;
+  if (options.repetition_penalty != 1) {
+    processors.emplace_back(std::make_unique<ctranslate2::RepetitionPenalty>(
+        options.repetition_penalty));
+  }
+  if (options.no_repeat_ngram_size > 0) {
+    processors.emplace_back(std::make_unique<ctranslate2::NoRepeatNgram>(
+        options.no_repeat_ngram_size));
+  }
+  if (!options.suppress_sequences.empty()) {
+    std::vector<std::vector<size_t>> sequences;
+    for (const auto &sequence : options.suppress_sequences) {
+      sequences.emplace_back(sequence.begin(), sequence.end());
+    }
+    processors.emplace_back(
+        std::make_unique<ctranslate2::SuppressSequences>(std::move(sequences)));
+  }
+  return processors;
+}
+
+// Processes the logits of a decoding step as CTranslate2 does: each processor
+// runs over the batch, the disabled tokens are set to the lowest value, and
+// the logits are scaled by the inverse of the temperature. The maximum of each
+// row, which the softmax of the sampler computes, is stored in max.
+void process_ctranslate2(StorageView &logits, const StorageView &sequences,
+                         const bench::LogitsOptions &options,
+                         const Processors &processors,
+                         std::vector<float> &max) {
+  const dim_t rows = logits.dim(0);
+  const dim_t cols = logits.dim(1);
+  const dim_t step = sequences.dim(1);
+  std::vector<dim_t> batch_offset(rows);
+  for (dim_t i = 0; i < rows; ++i) {
+    batch_offset[i] = i;
+  }
+
+  ctranslate2::DisableTokens disable_tokens(logits);
+  if (options.unk_id >= 0) {
+    for (dim_t i = 0; i < rows; ++i) {
+      disable_tokens.add(i, options.unk_id);
+    }
+  }
+  for (const auto &processor : processors) {
+    processor->apply(step, logits, disable_tokens, sequences, batch_offset,
+                     nullptr);
+  }
+  disable_tokens.apply();
+
+  if (options.temperature != 1) {
+    const ctranslate2::ops::Mul mul;
+    mul(logits, StorageView(1 / options.temperature), logits);
+  }
+  max.resize(rows);
+  for (dim_t i = 0; i < rows; ++i) {
+    const float *row = logits.data<float>() + i * cols;
+    max[i] = *std::max_element(row, row + cols);
+  }
+}
+
+// CTranslate2 disables tokens with the lowest float, which the temperature may
+// turn into -inf, whereas the fused processing uses -inf.
+bool same_logit(float a, float b) {
+  constexpr float lowest = std::numeric_limits<float>::lowest();
+  return a == b || (a <= lowest && b <= lowest);
+}
+
+} // namespace
+
+double bench_gemm(size_t m, size_t n, size_t k, bool int8, bool cuda,
+                  size_t iterations) {
+  const auto device = to_device(cuda);
+  const auto a_shape = shape(m, k);
+  // Weights are stored as {n, k} in the models, hence trans_b.
+  const auto b_shape = shape(n, k);
+  const ctranslate2::ops::Gemm gemm(1, 0, false, true);
+
+  if (int8) {
+    const StorageView a(a_shape, static_cast<int8_t>(1), device);
+    const StorageView b(b_shape, static_cast<int8_t>(1), device);
+    StorageView c(ctranslate2::DataType::INT32, device);
+    return measure(device, iterations, [&] { gemm(a, b, c); });
+  }
+  const StorageView a(a_shape, 1.f, device);
+  const StorageView b(b_shape, 1.f, device);
+  StorageView c(device);
+  return measure(device, iterations, [&] { gemm(a, b, c); });
+}
+
+double bench_softmax(size_t rows, size_t cols, bool cuda, size_t iterations) {
+  const auto device = to_device(cuda);
+  const StorageView x(shape(rows, cols), 1.f, device);
+  StorageView y(device);
+  const ctranslate2::ops::SoftMax softmax;
+  return measure(device, iterations, [&] { softmax(x, y); });
+}
+
+double bench_layer_norm(size_t rows, size_t cols, bool cuda,
+                        size_t iterations) {
+  const auto device = to_device(cuda);
+  const StorageView x(shape(rows, cols), 1.f, device);
+  const StorageView gamma({static_cast<dim_t>(cols)}, 1.f, device);
+  const StorageView beta({static_cast<dim_t>(cols)}, 0.f, device);
+  StorageView y(device);
+  const ctranslate2::ops::LayerNorm layer_norm;
+  return measure(device, iterations, [&] { layer_norm(beta, gamma, x, y); });
+}
+
+double bench_gather(size_t vocabulary_size, size_t dim, size_t num_ids,
+                    bool cuda, size_t iterations) {
+  const auto device = to_device(cuda);
+  const StorageView data(shape(vocabulary_size, dim), 1.f, device);
+  std::vector<int32_t> ids(num_ids);
+  for (size_t i = 0; i < num_ids; ++i) {
+    ids[i] = static_cast<int32_t>((i * 7919) % vocabulary_size);
+  }
+  const StorageView input({static_cast<dim_t>(num_ids)}, ids, device);
+  StorageView output(device);
+  const ctranslate2::ops::Gather gather;
+  return measure(device, iterations, [&] { gather(data, input, output); });
+}
+
+double bench_sampling_topk(size_t rows, size_t cols, size_t k, bool vectorized,
+                           size_t iterations) {
+  const auto logits = random_logits(rows, cols);
+  const StorageView x(shape(rows, cols), logits);
+  StorageView values(Device::CPU);
+  StorageView indices(ctranslate2::DataType::INT32, Device::CPU);
+  StorageView probs(Device::CPU);
+  // Random sampling selects the k best logits, and then takes their softmax.
+  const ctranslate2::ops::TopK topk(static_cast<dim_t>(k));
+  const ctranslate2::ops::SoftMax softmax;
+  if (!vectorized) {
+    return measure(Device::CPU, iterations, [&] {
+      topk(x, values, indices);
+      softmax(values, probs);
+    });
+  }
+
+  bench::CandidateSelector selector;
+  topk(x, values, indices);
+  for (size_t i = 0; i < rows; ++i) {
+    selector.top_k(logits.data() + i * cols, cols, k);
+    if (!std::equal(selector.ids().begin(), selector.ids().end(),
+                    indices.data<int32_t>() + i * k)) {
+      throw std::runtime_error("top-k selection differs from ops::TopK");
+    }
+  }
+  return measure(Device::CPU, iterations, [&] {
+    for (size_t i = 0; i < rows; ++i) {
+      selector.top_k(logits.data() + i * cols, cols, k);
+    }
+  });
+}
+
+double bench_sampling_topp(size_t rows, size_t cols, float p, bool vectorized,
+                           size_t iterations) {
+  const auto logits = random_logits(rows, cols);
+  if (vectorized) {
+    bench::CandidateSelector selector;
+    return measure(Device::CPU, iterations, [&] {
+      for (size_t i = 0; i < rows; ++i) {
+        selector.top_p(logits.data() + i * cols, cols, p);
+      }
+    });
+  }
+
+  const StorageView x(shape(rows, cols), logits);
+  StorageView masked(Device::CPU);
+  StorageView probs(Device::CPU);
+  // Random sampling masks the logits out of the nucleus, and then takes the
+  // softmax of the whole vocabulary.
+  const ctranslate2::ops::TopPMask topp_mask(p);
+  const ctranslate2::ops::SoftMax softmax;
+  return measure(Device::CPU, iterations, [&] {
+    topp_mask(x, masked);
+    softmax(masked, probs);
+  });
+}
+
+double bench_logits_processing(size_t rows, size_t cols, size_t history,
+                               size_t num_options, bool fused,
+                               size_t iterations) {
+  auto logits = random_logits(rows, cols);
+  const auto options = benchmark_options(num_options);
+  // Previous tokens drawn from a few hundred ids, so that some n-grams repeat.
+  std::mt19937 generator(7);
+  std::uniform_int_distribution<int32_t> distribution(
+      0, static_cast<int32_t>(std::min<size_t>(cols, 512) - 1));
+  std::vector<int32_t> tokens(rows * history);
+  std::vector<bench::LogitsProcessor> fused_processors;
+  fused_processors.reserve(rows);
+  for (size_t i = 0; i < rows; ++i) {
+    fused_processors.emplace_back(cols, options);
+    for (size_t j = 0; j < history; ++j) {
+      tokens[i * history + j] = distribution(generator);
+      fused_processors.back().push(tokens[i * history + j]);
+    }
+  }
+  const StorageView sequences(shape(rows, history), tokens);
+  const auto processors = make_processors(options);
+
+  StorageView expected(shape(rows, cols), logits);
+  std::vector<float> expected_max;
+  process_ctranslate2(expected, sequences, options, processors, expected_max);
+  std::vector<float> actual(logits);
+  for (size_t i = 0; i < rows; ++i) {
+    const float max = fused_processors[i].apply(actual.data() + i * cols);
+    if (!same_logit(max, expected_max[i]) ||
+        !std::equal(actual.begin() + i * cols, actual.begin() + (i + 1) * cols,
+                    expected.data<float>() + i * cols, same_logit)) {
+      throw std::runtime_error(
+          "fused logits processing differs from the processors");
+    }
+  }
+
+  // Both process the same logits in place at each iteration.
+  if (fused) {
+    return measure(Device::CPU, iterations, [&] {
+      for (size_t i = 0; i < rows; ++i) {
+        fused_processors[i].apply(logits.data() + i * cols);
+      }
+    });
+  }
+  StorageView x(shape(rows, cols), logits);
+  std::vector<float> max;
+  return measure(Device::CPU, iterations, [&] {
+    process_ctranslate2(x, sequences, options, processors, max);
+  });
+}
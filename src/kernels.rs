@@ -0,0 +1,202 @@
+// kernels.rs
+//
+// Copyright (c) 2023 Junpei Kawamoto
+//
+// This software is released under the MIT License.
+//
+// http://opensource.org/licenses/mit-license.php
+
+//! Microbenchmarks of the CTranslate2 primitives (requires the `kernels` feature).
+//!
+//! Each function runs an operator once to warm up and returns the mean duration of the following
+//! iterations. The operators run on the backend CTranslate2 was built with, see [`GEMM_BACKEND`];
+//! on CPU, the instruction set can be forced with the `CT2_FORCE_CPU_ISA` environment variable.
+
+use std::time::Duration;
+
+use anyhow::Result;
+
+use crate::config::Device;
+
+/// GEMM backend CTranslate2 was built with for CPU, e.g. `openblas` or `accelerate`.
+pub const GEMM_BACKEND: &str = env!("CT2RS_GEMM_BACKEND");
+
+#[cxx::bridge]
+mod ffi {
+    unsafe extern "C++" {
+        include!("ctranslate2/include/kernels.h");
+
+        fn bench_gemm(
+            m: usize,
+            n: usize,
+            k: usize,
+            int8: bool,
+            cuda: bool,
+            iterations: usize,
+        ) -> Result<f64>;
+
+        fn bench_softmax(rows: usize, cols: usize, cuda: bool, iterations: usize) -> Result<f64>;
+
+        fn bench_layer_norm(rows: usize, cols: usize, cuda: bool, iterations: usize)
+            -> Result<f64>;
+
+        fn bench_gather(
+            vocabulary_size: usize,
+            dim: usize,
+            num_ids: usize,
+            cuda: bool,
+            iterations: usize,
+        ) -> Result<f64>;
+
+        fn bench_sampling_topk(
+            rows: usize,
+            cols: usize,
+            k: usize,
+            vectorized: bool,
+            iterations: usize,
+        ) -> Result<f64>;
+
+        fn bench_sampling_topp(
+            rows: usize,
+            cols: usize,
+            p: f32,
+            vectorized: bool,
+            iterations: usize,
+        ) -> Result<f64>;
+
+        fn bench_logits_processing(
+            rows: usize,
+            cols: usize,
+            history: usize,
+            num_options: usize,
+            fused: bool,
+            iterations: usize,
+        ) -> Result<f64>;
+    }
+}
+
+/// Multiplies a `{m, k}` matrix by the transpose of a `{n, k}` matrix, the layout of the weights
+/// of a linear layer, in int8 or float32.
+pub fn gemm(
+    m: usize,
+    n: usize,
+    k: usize,
+    int8: bool,
+    device: Device,
+    iterations: usize,
+) -> Result<Duration> {
+    Ok(Duration::from_secs_f64(ffi::bench_gemm(
+        m,
+        n,
+        k,
+        int8,
+        is_cuda(device),
+        iterations,
+    )?))
+}
+
+/// Applies softmax to the rows of a `{rows, cols}` float32 matrix.
+pub fn softmax(rows: usize, cols: usize, device: Device, iterations: usize) -> Result<Duration> {
+    Ok(Duration::from_secs_f64(ffi::bench_softmax(
+        rows,
+        cols,
+        is_cuda(device),
+        iterations,
+    )?))
+}
+
+/// Applies layer normalization to the rows of a `{rows, cols}` float32 matrix.
+pub fn layer_norm(rows: usize, cols: usize, device: Device, iterations: usize) -> Result<Duration> {
+    Ok(Duration::from_secs_f64(ffi::bench_layer_norm(
+        rows,
+        cols,
+        is_cuda(device),
+        iterations,
+    )?))
+}
+
+/// Gathers `num_ids` rows of a `{vocabulary_size, dim}` float32 embedding table.
+pub fn gather(
+    vocabulary_size: usize,
+    dim: usize,
+    num_ids: usize,
+    device: Device,
+    iterations: usize,
+) -> Result<Duration> {
+    Ok(Duration::from_secs_f64(ffi::bench_gather(
+        vocabulary_size,
+        dim,
+        num_ids,
+        is_cuda(device),
+        iterations,
+    )?))
+}
+
+/// Selects the `k` largest logits of each row of a `{rows, cols}` float32 matrix on CPU and takes
+/// their softmax, as random sampling does at each step.
+///
+/// If `vectorized` is true, the logits are scanned against the k-th largest one seen so far instead
+/// of running `ops::TopK`. The selected tokens are checked to be the same before measuring.
+pub fn sampling_topk(
+    rows: usize,
+    cols: usize,
+    k: usize,
+    vectorized: bool,
+    iterations: usize,
+) -> Result<Duration> {
+    Ok(Duration::from_secs_f64(ffi::bench_sampling_topk(
+        rows, cols, k, vectorized, iterations,
+    )?))
+}
+
+/// Selects the nucleus of cumulative probability `p` of each row of a `{rows, cols}` float32 matrix
+/// on CPU and takes its softmax, as random sampling does at each step.
+///
+/// If `vectorized` is true, the threshold of the nucleus is searched over a histogram of the
+/// logits instead of sorting them with `ops::TopPMask`.
+pub fn sampling_topp(
+    rows: usize,
+    cols: usize,
+    p: f32,
+    vectorized: bool,
+    iterations: usize,
+) -> Result<Duration> {
+    Ok(Duration::from_secs_f64(ffi::bench_sampling_topp(
+        rows, cols, p, vectorized, iterations,
+    )?))
+}
+
+/// Processes the logits of each row of a `{rows, cols}` float32 matrix on CPU after `history`
+/// previous tokens, with the first `num_options` of `temperature`, `repetition_penalty`,
+/// `no_repeat_ngram_size`, `disable_unk`, and `suppress_sequences` enabled.
+///
+/// If `fused` is true, the options are applied to the affected tokens alone, followed by a single
+/// vectorized pass over the vocabulary. Otherwise, the logits processors of CTranslate2
+/// (`RepetitionPenalty`, `NoRepeatNgram`, and `SuppressSequences`) run with `DisableTokens`, and the
+/// logits are scaled by the temperature as the sampler does. The results are checked to be the
+/// same before measuring.
+pub fn logits_processing(
+    rows: usize,
+    cols: usize,
+    history: usize,
+    num_options: usize,
+    fused: bool,
+    iterations: usize,
+) -> Result<Duration> {
+    Ok(Duration::from_secs_f64(ffi::bench_logits_processing(
+        rows,
+        cols,
+        history,
+        num_options,
+        fused,
+        iterations,
+    )?))
+}
+
+#[inline]
+fn is_cuda(device: Device) -> bool {
+    match device {
+        Device::CPU => false,
+        Device::CUDA => true,
+    }
+}
@@ -10,37 +10,61 @@
 //!
 //! Please refer to the crate [ctranslate2-sample](https://github.com/jkawamoto/ctranslate2-rs/tree/main/examples) for the sample code.
 
+use std::ops::Deref;
 use std::path::Path;
+use std::sync::Arc;
 
 use anyhow::{anyhow, bail, Result};
-use tokenizers::{Decoder, EncodeInput, Tokenizer};
+use tokenizers::utils::parallelism::MaybeParallelIterator;
+use tokenizers::{Decoder, EncodeInput, Encoding, InputSequence, Tokenizer};
 
+use crate::cache::EncodingCache;
 use crate::config::{Config, Device};
 pub use crate::generator::GenerationOptions;
+use crate::metrics::Metrics;
 pub use crate::translator::TranslationOptions;
 
+#[cfg(feature = "arrow")]
+mod arrow;
+pub mod cache;
+#[cfg(feature = "capture")]
+pub mod capture;
 pub mod config;
+#[cfg(feature = "corpus")]
+pub mod corpus;
 pub mod generator;
+#[cfg(feature = "kernels")]
+pub mod kernels;
+pub mod memory;
+pub mod metrics;
+pub mod packed;
+#[cfg(feature = "profiling")]
+pub mod profiler;
+#[cfg(feature = "sentencepiece")]
+pub mod sentencepiece;
+#[cfg(feature = "tracing")]
+mod trace;
 pub mod translator;
+pub mod whisper;
 
 const TOKENIZER_FILENAME: &str = "tokenizer.json";
+/// Number of inputs from which a batch is encoded in parallel.
+const MIN_PARALLEL_INPUTS: usize = 128;
 
 /// A text translator with a tokenizer.
 pub struct Translator {
     translator: translator::Translator,
-    tokenizer: Tokenizer,
+    tokenizer: TextTokenizer,
+    cache: Option<Arc<EncodingCache>>,
 }
 
 impl Translator {
     /// Initializes the translator and tokenizer.
+    ///
+    /// The tokenizer is loaded from `tokenizer.json`, or with the `sentencepiece` feature, from the
+    /// SentencePiece models of the model directory if it has no `tokenizer.json`.
     pub fn new<T: AsRef<Path>>(path: T, device: Device, config: Config) -> Result<Translator> {
-        Translator::with_tokenizer(
-            &path,
-            device,
-            config,
-            Tokenizer::from_file(path.as_ref().join(TOKENIZER_FILENAME))
-                .map_err(|err| anyhow!("failed to load a tokenizer: {err}"))?,
-        )
+        Translator::build(&path, device, config, TextTokenizer::load(path.as_ref())?)
     }
 
     /// Initializes the translator and tokenizer.
@@ -49,6 +73,31 @@ impl Translator {
         device: Device,
         config: Config,
         tokenizer: Tokenizer,
+    ) -> Result<Translator> {
+        Translator::build(path, device, config, TextTokenizer::HuggingFace(tokenizer))
+    }
+
+    /// Initializes the translator with the given SentencePiece models.
+    #[cfg(feature = "sentencepiece")]
+    pub fn with_sentencepiece<T: AsRef<Path>>(
+        path: T,
+        device: Device,
+        config: Config,
+        sentencepiece: sentencepiece::SentencePiece,
+    ) -> Result<Translator> {
+        Translator::build(
+            path,
+            device,
+            config,
+            TextTokenizer::SentencePiece(sentencepiece),
+        )
+    }
+
+    fn build<T: AsRef<Path>>(
+        path: T,
+        device: Device,
+        config: Config,
+        tokenizer: TextTokenizer,
     ) -> Result<Translator> {
         Ok(Translator {
             translator: translator::Translator::new(
@@ -57,10 +106,35 @@ impl Translator {
                 config,
             )?,
             tokenizer,
+            cache: None,
         })
     }
 
+    /// Records the metrics of this translator into the given metrics.
+    pub fn set_metrics(&mut self, metrics: Arc<Metrics>) {
+        self.translator.set_metrics(metrics);
+    }
+
+    /// Looks up the tokens of each input in the given cache before encoding it. The cache can be
+    /// shared with other translators and generators using the same tokenizer; inputs are cached
+    /// separately with special tokens, which translators add, and without them.
+    pub fn set_encoding_cache(&mut self, cache: Arc<EncodingCache>) {
+        self.cache = Some(cache);
+    }
+
+    /// Returns the encoding cache of this translator if set.
+    pub fn encoding_cache(&self) -> Option<&Arc<EncodingCache>> {
+        self.cache.as_ref()
+    }
+
+    /// Captures requests of this translator which are slower than the threshold of the given capture.
+    #[cfg(feature = "capture")]
+    pub fn set_capture(&mut self, capture: Arc<capture::Capture>) {
+        self.translator.set_capture(capture);
+    }
+
     /// Translates a batch of strings.
+    #[cfg_attr(feature = "tracing", tracing::instrument(name = "translate", skip_all))]
     pub fn translate_batch<'a, T, U, V>(
         &self,
         sources: Vec<T>,
@@ -72,21 +146,28 @@ impl Translator {
         U: AsRef<str>,
         V: AsRef<str>,
     {
-        let tokens = sources
-            .into_iter()
-            .map(|s| {
-                self.tokenizer
-                    .encode(s, true)
-                    .map(|r| r.get_tokens().to_vec())
-                    .map_err(|err| anyhow!("failed to encode the given input: {err}"))
-            })
-            .collect::<Result<Vec<Vec<String>>>>()?;
-
-        let output = self
-            .translator
-            .translate_batch(&tokens, &target_prefixes, options)?;
-
-        let decoder = self.tokenizer.get_decoder().unwrap();
+        let tokens = encode(
+            &self.tokenizer,
+            self.cache.as_deref(),
+            self.translator.metrics(),
+            sources,
+            true,
+        )?;
+
+        let output =
+            self.translator
+                .translate_batch(&as_strs(&tokens), &target_prefixes, options)?;
+
+        #[cfg(feature = "tracing")]
+        let _span = tracing::info_span!(
+            "detokenize",
+            batch_size = output.len(),
+            num_tokens = output
+                .iter()
+                .map(|r| r.output().map_or(0, Vec::len))
+                .sum::<usize>()
+        )
+        .entered();
         let mut res = Vec::new();
         for (r, prefix) in output.into_iter().zip(target_prefixes) {
             let score = r.score();
@@ -94,9 +175,8 @@ impl Translator {
                 None => bail!("no results are returned"),
                 Some(h) => {
                     res.push((
-                        decoder
-                            .decode(h.into_iter().skip(prefix.len()).collect())
-                            .map_err(|err| anyhow!("failed to decode: {err}"))?,
+                        self.tokenizer
+                            .decode(h.into_iter().skip(prefix.len()).collect())?,
                         score,
                     ));
                 }
@@ -109,19 +189,17 @@ impl Translator {
 /// A text generator with a tokenizer.
 pub struct Generator {
     generator: generator::Generator,
-    tokenizer: Tokenizer,
+    tokenizer: TextTokenizer,
+    cache: Option<Arc<EncodingCache>>,
 }
 
 impl Generator {
     /// Initializes the generator and tokenizer.
+    ///
+    /// The tokenizer is loaded from `tokenizer.json`, or with the `sentencepiece` feature, from the
+    /// SentencePiece models of the model directory if it has no `tokenizer.json`.
     pub fn new<T: AsRef<Path>>(path: T, device: Device, config: Config) -> Result<Generator> {
-        Generator::with_tokenizer(
-            &path,
-            device,
-            config,
-            Tokenizer::from_file(path.as_ref().join(TOKENIZER_FILENAME))
-                .map_err(|err| anyhow!("failed to load a tokenizer: {err}"))?,
-        )
+        Generator::build(&path, device, config, TextTokenizer::load(path.as_ref())?)
     }
 
     /// Initializes the generator with the given tokenizer.
@@ -130,14 +208,64 @@ impl Generator {
         device: Device,
         config: Config,
         tokenizer: Tokenizer,
+    ) -> Result<Generator> {
+        Generator::build(path, device, config, TextTokenizer::HuggingFace(tokenizer))
+    }
+
+    /// Initializes the generator with the given SentencePiece model.
+    #[cfg(feature = "sentencepiece")]
+    pub fn with_sentencepiece<T: AsRef<Path>>(
+        path: T,
+        device: Device,
+        config: Config,
+        sentencepiece: sentencepiece::SentencePiece,
+    ) -> Result<Generator> {
+        Generator::build(
+            path,
+            device,
+            config,
+            TextTokenizer::SentencePiece(sentencepiece),
+        )
+    }
+
+    fn build<T: AsRef<Path>>(
+        path: T,
+        device: Device,
+        config: Config,
+        tokenizer: TextTokenizer,
     ) -> Result<Generator> {
         Ok(Generator {
             generator: generator::Generator::new(path.as_ref().to_str().unwrap(), device, config)?,
             tokenizer,
+            cache: None,
         })
     }
 
+    /// Records the metrics of this generator into the given metrics.
+    pub fn set_metrics(&mut self, metrics: Arc<Metrics>) {
+        self.generator.set_metrics(metrics);
+    }
+
+    /// Looks up the tokens of each prompt in the given cache before encoding it. The cache can be
+    /// shared with other translators and generators using the same tokenizer; prompts are cached
+    /// separately without special tokens, which generators do not add, and with them.
+    pub fn set_encoding_cache(&mut self, cache: Arc<EncodingCache>) {
+        self.cache = Some(cache);
+    }
+
+    /// Returns the encoding cache of this generator if set.
+    pub fn encoding_cache(&self) -> Option<&Arc<EncodingCache>> {
+        self.cache.as_ref()
+    }
+
+    /// Captures requests of this generator which are slower than the threshold of the given capture.
+    #[cfg(feature = "capture")]
+    pub fn set_capture(&mut self, capture: Arc<capture::Capture>) {
+        self.generator.set_capture(capture);
+    }
+
     /// Generate texts with the given prompts.
+    #[cfg_attr(feature = "tracing", tracing::instrument(name = "generate", skip_all))]
     pub fn generate_batch<'a, T, U, V>(
         &self,
         prompts: Vec<T>,
@@ -148,30 +276,291 @@ impl Generator {
         U: AsRef<str>,
         V: AsRef<str>,
     {
-        let tokens = prompts
-            .into_iter()
-            .map(|s| {
-                self.tokenizer
-                    .encode(s, false)
-                    .map(|r| r.get_tokens().to_vec())
-                    .map_err(|err| anyhow!("failed to encode the given input: {err}"))
-            })
-            .collect::<Result<Vec<Vec<String>>>>()?;
-
-        let output = self.generator.generate_batch(&tokens, options)?;
-
-        let decoder = self.tokenizer.get_decoder().unwrap();
+        let tokens = encode(
+            &self.tokenizer,
+            self.cache.as_deref(),
+            self.generator.metrics(),
+            prompts,
+            false,
+        )?;
+
+        let output = self.generator.generate_batch(&as_strs(&tokens), options)?;
+        self.decode(output)
+    }
+
+    /// Generate texts with the given prompts, calling `callback` with each generated token and
+    /// the text it appends to the output of its example.
+    ///
+    /// The text is empty while the token does not complete a character, e.g. a byte fallback
+    /// token. See [`generator::Generator::generate_batch_with_callback`] for when the callback
+    /// is called and how its return value is used.
+    #[cfg_attr(
+        feature = "tracing",
+        tracing::instrument(name = "generate_streaming", skip_all)
+    )]
+    pub fn generate_batch_with_callback<'a, T, U, V>(
+        &self,
+        prompts: Vec<T>,
+        options: &GenerationOptions<U, V>,
+        callback: &mut (dyn FnMut(&generator::GenerationStepResult, &str) -> bool + Send),
+    ) -> Result<Vec<(Vec<String>, Vec<f32>)>>
+    where
+        T: Into<EncodeInput<'a>>,
+        U: AsRef<str>,
+        V: AsRef<str>,
+    {
+        let tokens = encode(
+            &self.tokenizer,
+            self.cache.as_deref(),
+            self.generator.metrics(),
+            prompts,
+            false,
+        )?;
+
+        let tokenizer = &self.tokenizer;
+        let mut decoders = vec![StreamDecoder::default(); tokens.len()];
+        let output = self.generator.generate_batch_with_callback(
+            &as_strs(&tokens),
+            options,
+            &mut |step: generator::GenerationStepResult| {
+                let Some(decoder) = decoders.get_mut(step.batch_id) else {
+                    return false;
+                };
+                let piece = decoder.push(tokenizer, step.token.clone());
+                callback(&step, &piece)
+            },
+        )?;
+        self.decode(output)
+    }
+
+    /// Decodes the sequences of the given results.
+    fn decode(
+        &self,
+        output: Vec<generator::GenerationResult>,
+    ) -> Result<Vec<(Vec<String>, Vec<f32>)>> {
+        #[cfg(feature = "tracing")]
+        let _span = tracing::info_span!(
+            "detokenize",
+            batch_size = output.len(),
+            num_tokens = output
+                .iter()
+                .flat_map(|r| r.sequences.iter().map(Vec::len))
+                .sum::<usize>()
+        )
+        .entered();
         let mut res = Vec::new();
         for r in output.into_iter() {
             let sequence = r
                 .sequences
                 .into_iter()
-                .map(|seq| decoder.decode(seq))
-                .collect::<Result<Vec<_>, _>>()
-                .map_err(|err| anyhow!("failed to decode: {err}"))?;
+                .map(|seq| self.tokenizer.decode(seq))
+                .collect::<Result<Vec<_>>>()?;
             let scores = r.scores;
             res.push((sequence, scores))
         }
         Ok(res)
     }
 }
+
+/// Decodes the tokens generated for an example one at a time.
+///
+/// Only a trailing window of the tokens is decoded at each step: the tokens whose text was passed
+/// last, which are decoded again so that the spaces and merges the decoder applies at their
+/// boundary are kept, and the tokens that have not completed a character yet.
+#[derive(Clone, Default)]
+struct StreamDecoder {
+    /// Tokens of the window.
+    tokens: Vec<String>,
+    /// Number of tokens at the start of the window whose text has been passed.
+    read: usize,
+}
+
+impl StreamDecoder {
+    /// Appends a token and returns the text it adds, which is empty while the token does not
+    /// complete a character.
+    fn push(&mut self, tokenizer: &TextTokenizer, token: String) -> String {
+        self.tokens.push(token);
+        let prefix = tokenizer
+            .decode(self.tokens[..self.read].to_vec())
+            .unwrap_or_default();
+        let text = tokenizer.decode(self.tokens.clone()).unwrap_or_default();
+        match text.get(prefix.len()..) {
+            Some(piece) if !piece.is_empty() && !piece.ends_with('\u{fffd}') => {
+                let piece = piece.to_string();
+                self.tokens.drain(..self.read);
+                self.read = self.tokens.len();
+                piece
+            }
+            _ => String::new(),
+        }
+    }
+}
+
+/// Tokenizer of a translator or generator.
+enum TextTokenizer {
+    HuggingFace(Tokenizer),
+    #[cfg(feature = "sentencepiece")]
+    SentencePiece(sentencepiece::SentencePiece),
+}
+
+impl TextTokenizer {
+    /// Loads the tokenizer of the given model directory.
+    fn load(path: &Path) -> Result<Self> {
+        let file = path.join(TOKENIZER_FILENAME);
+        #[cfg(feature = "sentencepiece")]
+        if !file.exists() {
+            return Ok(Self::SentencePiece(sentencepiece::SentencePiece::from_dir(
+                path,
+            )?));
+        }
+        Ok(Self::HuggingFace(Tokenizer::from_file(file).map_err(
+            |err| anyhow!("failed to load a tokenizer: {err}"),
+        )?))
+    }
+
+    /// Returns the Hugging Face tokenizer if this is one.
+    #[cfg(feature = "corpus")]
+    fn huggingface(&self) -> Option<&Tokenizer> {
+        match self {
+            Self::HuggingFace(tokenizer) => Some(tokenizer),
+            #[cfg(feature = "sentencepiece")]
+            Self::SentencePiece(_) => None,
+        }
+    }
+
+    fn encode(&self, input: EncodeInput, add_special_tokens: bool) -> Result<Tokens> {
+        match self {
+            Self::HuggingFace(tokenizer) => tokenizer
+                .encode(input, add_special_tokens)
+                .map(Tokens::Encoded)
+                .map_err(|err| anyhow!("failed to encode the given input: {err}")),
+            #[cfg(feature = "sentencepiece")]
+            Self::SentencePiece(sp) => match input {
+                EncodeInput::Single(InputSequence::Raw(text)) => {
+                    sp.encode(&text, add_special_tokens).map(Tokens::Owned)
+                }
+                _ => bail!("SentencePiece encodes only single strings"),
+            },
+        }
+    }
+
+    fn decode(&self, tokens: Vec<String>) -> Result<String> {
+        match self {
+            Self::HuggingFace(tokenizer) => tokenizer
+                .get_decoder()
+                .ok_or_else(|| anyhow!("the tokenizer has no decoder"))?
+                .decode(tokens)
+                .map_err(|err| anyhow!("failed to decode: {err}")),
+            #[cfg(feature = "sentencepiece")]
+            Self::SentencePiece(sp) => sp.decode(&tokens),
+        }
+    }
+}
+
+/// Tokens of an input, shared with the encoding cache or owned by its encoding.
+enum Tokens {
+    Cached(Arc<[String]>),
+    Encoded(Encoding),
+    #[cfg(feature = "sentencepiece")]
+    Owned(Vec<String>),
+}
+
+impl Tokens {
+    fn into_vec(self) -> Vec<String> {
+        match self {
+            #[cfg(feature = "sentencepiece")]
+            Tokens::Owned(tokens) => tokens,
+            tokens => tokens.to_vec(),
+        }
+    }
+}
+
+impl Deref for Tokens {
+    type Target = [String];
+
+    fn deref(&self) -> &[String] {
+        match self {
+            Tokens::Cached(tokens) => tokens,
+            Tokens::Encoded(encoding) => encoding.get_tokens(),
+            #[cfg(feature = "sentencepiece")]
+            Tokens::Owned(tokens) => tokens,
+        }
+    }
+}
+
+/// Encodes the given inputs into tokens.
+#[cfg_attr(
+    feature = "tracing",
+    tracing::instrument(
+        name = "tokenize",
+        skip_all,
+        fields(batch_size = inputs.len(), num_tokens = tracing::field::Empty)
+    )
+)]
+fn encode<'a, T>(
+    tokenizer: &TextTokenizer,
+    cache: Option<&EncodingCache>,
+    metrics: Option<&Arc<Metrics>>,
+    inputs: Vec<T>,
+    add_special_tokens: bool,
+) -> Result<Vec<Tokens>>
+where
+    T: Into<EncodeInput<'a>>,
+{
+    let inputs = inputs
+        .into_iter()
+        .map(Into::into)
+        .collect::<Vec<EncodeInput>>();
+    // Inputs are looked up in the cache or encoded one at a time, so that the padding of
+    // tokenizer.json, which encode_batch applies, never reaches the model. Large batches run on
+    // the global thread pool of rayon, which the tokenizers share and TOKENIZERS_PARALLELISM
+    // controls.
+    let parallel = inputs.len() >= MIN_PARALLEL_INPUTS;
+    let tokens = inputs
+        .into_maybe_par_iter_cond(parallel)
+        .map(|s| encode_one(tokenizer, cache, metrics, s, add_special_tokens))
+        .collect::<Result<Vec<_>>>()?;
+
+    #[cfg(feature = "tracing")]
+    tracing::Span::current().record("num_tokens", tokens.iter().map(|t| t.len()).sum::<usize>());
+    Ok(tokens)
+}
+
+/// Encodes the given input into tokens, looking them up in the cache first if the input is a
+/// single string.
+fn encode_one(
+    tokenizer: &TextTokenizer,
+    cache: Option<&EncodingCache>,
+    metrics: Option<&Arc<Metrics>>,
+    input: EncodeInput,
+    add_special_tokens: bool,
+) -> Result<Tokens> {
+    let (cache, text) = match (cache, &input) {
+        (Some(cache), EncodeInput::Single(InputSequence::Raw(text))) if cache.accepts(text) => {
+            (cache, text)
+        }
+        _ => return tokenizer.encode(input, add_special_tokens),
+    };
+
+    let (tokens, hit) = cache.get_or_insert_with(text, add_special_tokens, || {
+        Ok(tokenizer
+            .encode(text.as_ref().into(), add_special_tokens)?
+            .into_vec())
+    })?;
+    if let Some(metrics) = metrics {
+        if hit {
+            metrics.encoding_cache_hits.inc();
+        } else {
+            metrics.encoding_cache_misses.inc();
+        }
+    }
+    Ok(Tokens::Cached(tokens))
+}
+
+/// Borrows the given tokens to pass them to the bridge.
+fn as_strs(tokens: &[Tokens]) -> Vec<Vec<&str>> {
+    tokens
+        .iter()
+        .map(|t| t.iter().map(String::as_str).collect())
+        .collect()
+}
@@ -0,0 +1,158 @@
+// memory.rs
+//
+// Copyright (c) 2023 Junpei Kawamoto
+//
+// This software is released under the MIT License.
+//
+// http://opensource.org/licenses/mit-license.php
+
+//! Memory breakdown of a loaded model.
+//!
+//! The report lists the variables of the model as loaded under the configured compute type, so
+//! it shows e.g. how much of a model the embeddings and the output projection take after
+//! quantization.
+//!
+//! ```no_run
+//! # use ctranslate2::config::{ComputeType, Config, Device};
+//! # use ctranslate2::translator::Translator;
+//! # fn main() -> anyhow::Result<()> {
+//! let t = Translator::new(
+//!     "/path/to/model",
+//!     Device::CPU,
+//!     Config {
+//!         compute_type: ComputeType::Int8,
+//!         ..Config::default()
+//!     },
+//! )?;
+//! println!("{}", t.memory_report());
+//! # Ok(())
+//! # }
+//! ```
+
+use std::collections::BTreeMap;
+use std::fmt::{Display, Formatter};
+
+/// A variable of a loaded model.
+#[derive(Debug, Clone)]
+pub struct VariableInfo {
+    /// Name of the variable, e.g. `decoder/layer_0/self_attention/linear_0/weight`.
+    pub name: String,
+    /// Data type of the variable, e.g. `int8` or `float32`.
+    pub dtype: String,
+    /// Shape of the variable.
+    pub shape: Vec<i64>,
+    /// Size of the variable in bytes, or 0 if it is an alias of a shared or tied weight counted
+    /// under another name.
+    pub bytes: usize,
+}
+
+impl VariableInfo {
+    /// Returns the layer the variable belongs to, i.e. the first two components of the name such
+    /// as `decoder/layer_0`, `decoder/embeddings` or `decoder/projection`.
+    pub fn layer(&self) -> &str {
+        match self.name.match_indices('/').nth(1) {
+            Some((i, _)) => &self.name[..i],
+            None => &self.name,
+        }
+    }
+}
+
+/// Memory used by a group of variables.
+#[derive(Debug, Clone, Default)]
+pub struct MemoryUsage {
+    /// Number of variables.
+    pub num_variables: usize,
+    /// Total size of the variables in bytes.
+    pub bytes: usize,
+}
+
+impl MemoryUsage {
+    fn add(&mut self, v: &VariableInfo) {
+        self.num_variables += 1;
+        self.bytes += v.bytes;
+    }
+}
+
+/// Memory breakdown of a loaded model.
+#[derive(Debug, Clone)]
+pub struct MemoryReport {
+    /// Variables of the model sorted by name.
+    pub variables: Vec<VariableInfo>,
+    /// Number of replicas. Replicas placed on the same device share the same variables.
+    pub num_replicas: usize,
+}
+
+impl MemoryReport {
+    pub(crate) fn new(mut variables: Vec<VariableInfo>, num_replicas: usize) -> Self {
+        variables.sort_by(|a, b| a.name.cmp(&b.name));
+        Self {
+            variables,
+            num_replicas,
+        }
+    }
+
+    /// Returns the memory used by each layer, sorted by name.
+    pub fn layers(&self) -> BTreeMap<&str, MemoryUsage> {
+        self.group_by(VariableInfo::layer)
+    }
+
+    /// Returns the memory used by each data type.
+    pub fn dtypes(&self) -> BTreeMap<&str, MemoryUsage> {
+        self.group_by(|v| v.dtype.as_str())
+    }
+
+    /// Returns the total size of the variables of one replica in bytes.
+    pub fn total_bytes(&self) -> usize {
+        self.variables.iter().map(|v| v.bytes).sum()
+    }
+
+    fn group_by<'a, F>(&'a self, key: F) -> BTreeMap<&'a str, MemoryUsage>
+    where
+        F: Fn(&'a VariableInfo) -> &'a str,
+    {
+        let mut res = BTreeMap::<&str, MemoryUsage>::new();
+        for v in &self.variables {
+            res.entry(key(v)).or_default().add(v);
+        }
+        res
+    }
+}
+
+impl Display for MemoryReport {
+    fn fmt(&self, f: &mut Formatter<'_>) -> std::fmt::Result {
+        let total = self.total_bytes();
+        write_table(f, "layer", self.layers(), total)?;
+        writeln!(f)?;
+        write_table(f, "dtype", self.dtypes(), total)?;
+        writeln!(f)?;
+        writeln!(f, "total per replica: {:.2} MiB", mib(total))?;
+        write!(f, "replicas: {}", self.num_replicas)
+    }
+}
+
+fn write_table(
+    f: &mut Formatter<'_>,
+    key: &str,
+    rows: BTreeMap<&str, MemoryUsage>,
+    total: usize,
+) -> std::fmt::Result {
+    writeln!(f, "{key:<40} {:>9} {:>12} {:>7}", "variables", "MiB", "%")?;
+    for (name, usage) in rows {
+        writeln!(
+            f,
+            "{name:<40} {:>9} {:>12.2} {:>6.1}%",
+            usage.num_variables,
+            mib(usage.bytes),
+            if total == 0 {
+                0.
+            } else {
+                usage.bytes as f64 * 100. / total as f64
+            }
+        )?;
+    }
+    Ok(())
+}
+
+fn mib(bytes: usize) -> f64 {
+    bytes as f64 / (1024. * 1024.)
+}
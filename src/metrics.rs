@@ -0,0 +1,762 @@
+// metrics.rs
+//
+// Copyright (c) 2023 Junpei Kawamoto
+//
+// This software is released under the MIT License.
+//
+// http://opensource.org/licenses/mit-license.php
+
+//! Metrics of translators and generators in the Prometheus text format.
+//!
+//! Metrics are recorded into per-thread shards of atomic counters and aggregated only when
+//! they are rendered, so recording never contends on a lock in the hot path.
+//!
+//! ```no_run
+//! # use ctranslate2::config::{Config, Device};
+//! # use ctranslate2::metrics::{self, Metrics};
+//! # use ctranslate2::Translator;
+//! # fn main() -> anyhow::Result<()> {
+//! let mut t = Translator::new("/path/to/model", Device::CPU, Config::default())?;
+//! t.set_metrics(Metrics::register("nllb"));
+//!
+//! // Serve the metrics at http://127.0.0.1:9090/metrics,
+//! metrics::serve("127.0.0.1:9090")?;
+//! // or render them to a string.
+//! println!("{}", metrics::render());
+//! # Ok(())
+//! # }
+//! ```
+
+use std::fmt::Write as _;
+use std::io::{BufRead, BufReader, ErrorKind, Read, Write};
+use std::net::{TcpListener, TcpStream, ToSocketAddrs};
+use std::sync::atomic::{AtomicU64, AtomicUsize, Ordering};
+use std::sync::{Arc, Mutex, OnceLock, Weak};
+use std::thread::{self, JoinHandle};
+use std::time::Duration;
+
+/// Number of shards of each metric. Threads are assigned to shards in a round-robin manner.
+const NUM_SHARDS: usize = 16;
+
+/// Bucket bounds of histograms measuring durations in seconds.
+const SECONDS_BUCKETS: &[f64] = &[
+    0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1., 2.5, 5., 10., 30.,
+];
+
+/// Bucket bounds of histograms measuring sizes.
+const SIZE_BUCKETS: &[f64] = &[
+    1., 2., 4., 8., 16., 32., 64., 128., 256., 512., 1024., 4096.,
+];
+
+/// Bucket bounds of histograms measuring numbers of tokens in a batch.
+const TOKENS_BUCKETS: &[f64] = &[
+    16., 64., 256., 1024., 2048., 4096., 8192., 16384., 32768., 65536.,
+];
+
+/// Bucket bounds of histograms measuring ratios.
+const RATIO_BUCKETS: &[f64] = &[0., 0.05, 0.1, 0.2, 0.3, 0.4, 0.5, 0.6, 0.7, 0.8, 0.9, 1.];
+
+#[inline]
+fn shard_index() -> usize {
+    static NEXT: AtomicUsize = AtomicUsize::new(0);
+    thread_local! {
+        static INDEX: usize = NEXT.fetch_add(1, Ordering::Relaxed) % NUM_SHARDS;
+    }
+    INDEX.with(|i| *i)
+}
+
+#[derive(Default)]
+#[repr(align(64))]
+struct Padded<T>(T);
+
+/// A monotonically increasing counter.
+pub struct Counter {
+    shards: [Padded<AtomicU64>; NUM_SHARDS],
+}
+
+impl Counter {
+    pub(crate) fn new() -> Self {
+        Self {
+            shards: Default::default(),
+        }
+    }
+
+    /// Increments the counter by the given value.
+    #[inline]
+    pub fn inc_by(&self, v: u64) {
+        self.shards[shard_index()].0.fetch_add(v, Ordering::Relaxed);
+    }
+
+    /// Increments the counter by one.
+    #[inline]
+    pub fn inc(&self) {
+        self.inc_by(1);
+    }
+
+    /// Returns the current value.
+    pub fn get(&self) -> u64 {
+        self.shards
+            .iter()
+            .map(|s| s.0.load(Ordering::Relaxed))
+            .sum()
+    }
+}
+
+/// A value which can go up and down.
+pub struct Gauge {
+    value: AtomicU64,
+}
+
+impl Gauge {
+    fn new() -> Self {
+        Self {
+            value: AtomicU64::new(0),
+        }
+    }
+
+    /// Sets the current value.
+    #[inline]
+    pub fn set(&self, v: u64) {
+        self.value.store(v, Ordering::Relaxed);
+    }
+
+    /// Returns the current value.
+    pub fn get(&self) -> u64 {
+        self.value.load(Ordering::Relaxed)
+    }
+}
+
+#[repr(align(64))]
+struct HistogramShard {
+    buckets: Vec<AtomicU64>,
+    count: AtomicU64,
+    sum: AtomicU64,
+}
+
+/// A histogram with fixed buckets.
+pub struct Histogram {
+    bounds: &'static [f64],
+    shards: Vec<HistogramShard>,
+}
+
+impl Histogram {
+    fn new(bounds: &'static [f64]) -> Self {
+        Self {
+            bounds,
+            shards: (0..NUM_SHARDS)
+                .map(|_| HistogramShard {
+                    buckets: (0..bounds.len()).map(|_| AtomicU64::new(0)).collect(),
+                    count: AtomicU64::new(0),
+                    sum: AtomicU64::new(0f64.to_bits()),
+                })
+                .collect(),
+        }
+    }
+
+    /// Records the given value.
+    #[inline]
+    pub fn observe(&self, v: f64) {
+        let shard = &self.shards[shard_index()];
+        let i = self.bounds.partition_point(|b| *b < v);
+        if i < self.bounds.len() {
+            shard.buckets[i].fetch_add(1, Ordering::Relaxed);
+        }
+        shard.count.fetch_add(1, Ordering::Relaxed);
+        // Only threads sharing this shard can race here, so the loop almost never retries.
+        let _ = shard
+            .sum
+            .fetch_update(Ordering::Relaxed, Ordering::Relaxed, |s| {
+                Some((f64::from_bits(s) + v).to_bits())
+            });
+    }
+
+    /// Records the given duration in seconds.
+    #[inline]
+    pub fn observe_duration(&self, d: Duration) {
+        self.observe(d.as_secs_f64());
+    }
+
+    /// Returns the number of recorded values.
+    pub fn count(&self) -> u64 {
+        self.shards
+            .iter()
+            .map(|s| s.count.load(Ordering::Relaxed))
+            .sum()
+    }
+
+    /// Returns the sum of recorded values.
+    pub fn sum(&self) -> f64 {
+        self.shards
+            .iter()
+            .map(|s| f64::from_bits(s.sum.load(Ordering::Relaxed)))
+            .sum()
+    }
+
+    /// Returns the cumulative count of each bucket, paired with its upper bound.
+    pub fn buckets(&self) -> Vec<(f64, u64)> {
+        let mut acc = 0;
+        self.bounds
+            .iter()
+            .enumerate()
+            .map(|(i, b)| {
+                acc += self
+                    .shards
+                    .iter()
+                    .map(|s| s.buckets[i].load(Ordering::Relaxed))
+                    .sum::<u64>();
+                (*b, acc)
+            })
+            .collect()
+    }
+}
+
+/// Statistics of a batch executed by a replica.
+#[derive(Debug, Clone)]
+#[cfg_attr(feature = "capture", derive(serde::Serialize, serde::Deserialize))]
+pub struct BatchStats {
+    /// Number of examples in the batch.
+    pub num_examples: usize,
+    /// Number of input tokens in the batch, excluding padding.
+    pub num_tokens: usize,
+    /// Length of the longest input in the batch.
+    pub max_length: usize,
+    /// Number of output tokens of the best hypotheses in the batch, excluding the target prefix
+    /// of translation and the prompt included in the results of generation.
+    #[cfg_attr(feature = "capture", serde(default))]
+    pub num_output_tokens: usize,
+    /// Length of the longest output in the batch, i.e. the number of decoding steps.
+    #[cfg_attr(feature = "capture", serde(default))]
+    pub max_output_length: usize,
+    /// Time between the submission of the request and the start of the batch.
+    pub queue_wait: Duration,
+    /// Time spent running the batch on the replica.
+    pub execution_time: Duration,
+    /// Hardware counters of the replica thread while running the batch. Available only when
+    /// the `perf-counters` feature is enabled and the host allows `perf_event_open`.
+    pub counters: Option<HardwareCounters>,
+}
+
+/// Token timings of an example generated in greedy search.
+#[derive(Debug, Clone)]
+pub struct StepStats {
+    /// Number of generated tokens.
+    pub num_tokens: usize,
+    /// Time between the submission of the request and the first generated token.
+    pub time_to_first_token: Duration,
+    /// Mean time between two consecutive tokens (None if only one token was generated).
+    pub time_per_output_token: Option<Duration>,
+}
+
+/// Hardware performance counters.
+///
+/// They count the replica thread which ran the batch, but not the worker threads it hands the
+/// operators to when `num_threads_per_replica` of the [`Config`](crate::config::Config) is more
+/// than 1, so they undercount multi-threaded batches.
+#[derive(Debug, Clone, Default)]
+#[cfg_attr(feature = "capture", derive(serde::Serialize, serde::Deserialize))]
+pub struct HardwareCounters {
+    /// CPU cycles.
+    pub cycles: u64,
+    /// Retired instructions.
+    pub instructions: u64,
+    /// Last level cache read misses (0 if not supported by the host).
+    pub llc_misses: u64,
+    /// Data TLB read misses (0 if not supported by the host).
+    pub dtlb_misses: u64,
+}
+
+impl HardwareCounters {
+    /// Returns the number of instructions per cycle.
+    pub fn ipc(&self) -> f64 {
+        if self.cycles == 0 {
+            0.
+        } else {
+            self.instructions as f64 / self.cycles as f64
+        }
+    }
+
+    /// Returns the number of last level cache misses per thousand instructions.
+    pub fn llc_mpki(&self) -> f64 {
+        if self.instructions == 0 {
+            0.
+        } else {
+            self.llc_misses as f64 * 1000. / self.instructions as f64
+        }
+    }
+}
+
+impl BatchStats {
+    /// Returns the number of input positions in the batch including padding.
+    pub fn padded_tokens(&self) -> usize {
+        self.num_examples * self.max_length
+    }
+
+    /// Returns the mean input length in the batch.
+    pub fn mean_length(&self) -> f64 {
+        ratio(self.num_tokens, self.num_examples)
+    }
+
+    /// Returns the ratio of padding positions in the batch.
+    pub fn padding_ratio(&self) -> f64 {
+        1. - ratio(self.num_tokens, self.padded_tokens()).min(1.)
+    }
+
+    /// Returns the mean output length in the batch.
+    pub fn mean_output_length(&self) -> f64 {
+        ratio(self.num_output_tokens, self.num_examples)
+    }
+
+    /// Returns the ratio of decoding positions spent on outputs which had already finished.
+    pub fn decode_padding_ratio(&self) -> f64 {
+        1. - ratio(
+            self.num_output_tokens,
+            self.num_examples * self.max_output_length,
+        )
+        .min(1.)
+    }
+}
+
+fn ratio(n: usize, d: usize) -> f64 {
+    if d == 0 {
+        0.
+    } else {
+        n as f64 / d as f64
+    }
+}
+
+/// Metrics of a model.
+pub struct Metrics {
+    model: String,
+    /// Number of requests.
+    pub requests: Counter,
+    /// Number of failed requests.
+    pub request_errors: Counter,
+    /// Number of examples.
+    pub examples: Counter,
+    /// Number of input tokens.
+    pub input_tokens: Counter,
+    /// Number of output tokens.
+    pub output_tokens: Counter,
+    /// Number of inputs whose tokens were found in the encoding cache.
+    pub encoding_cache_hits: Counter,
+    /// Number of inputs encoded after a lookup in the encoding cache.
+    pub encoding_cache_misses: Counter,
+    /// Number of batches waiting in the queue when the last request was submitted.
+    pub queue_depth: Gauge,
+    /// Duration of requests.
+    pub request_duration: Histogram,
+    /// Number of examples in each batch.
+    pub batch_size: Histogram,
+    /// Ratio of padding positions in each batch.
+    pub padding_ratio: Histogram,
+    /// Length of the longest input in each batch.
+    pub batch_max_length: Histogram,
+    /// Mean input length in each batch.
+    pub batch_mean_length: Histogram,
+    /// Number of input tokens in each batch, excluding padding.
+    pub batch_tokens: Histogram,
+    /// Number of input positions in each batch, including padding.
+    pub batch_padded_tokens: Histogram,
+    /// Number of decoding steps of each batch.
+    pub decode_steps: Histogram,
+    /// Mean output length in each batch.
+    pub batch_mean_output_length: Histogram,
+    /// Ratio of decoding positions spent on outputs which had already finished in each batch.
+    pub decode_padding_ratio: Histogram,
+    /// Time each batch waited in the queue.
+    pub queue_wait: Histogram,
+    /// Time each batch ran on a replica.
+    pub execution_time: Histogram,
+    /// Time to the first generated token of each example.
+    pub time_to_first_token: Histogram,
+    /// Mean time between two consecutive generated tokens of each example.
+    pub time_per_output_token: Histogram,
+    /// Number of batches sampled by hardware counters.
+    pub counted_batches: Counter,
+    /// CPU cycles of replica threads.
+    pub cycles: Counter,
+    /// Instructions retired by replica threads.
+    pub instructions: Counter,
+    /// Last level cache read misses of replica threads.
+    pub llc_misses: Counter,
+    /// Data TLB read misses of replica threads.
+    pub dtlb_misses: Counter,
+}
+
+impl Metrics {
+    /// Creates metrics of the given model and registers them so that they are included in
+    /// [`render`]. They are unregistered when the returned value is dropped.
+    pub fn register<T: AsRef<str>>(model: T) -> Arc<Metrics> {
+        let metrics = Arc::new(Metrics {
+            model: model.as_ref().to_string(),
+            requests: Counter::new(),
+            request_errors: Counter::new(),
+            examples: Counter::new(),
+            input_tokens: Counter::new(),
+            output_tokens: Counter::new(),
+            encoding_cache_hits: Counter::new(),
+            encoding_cache_misses: Counter::new(),
+            queue_depth: Gauge::new(),
+            request_duration: Histogram::new(SECONDS_BUCKETS),
+            batch_size: Histogram::new(SIZE_BUCKETS),
+            padding_ratio: Histogram::new(RATIO_BUCKETS),
+            batch_max_length: Histogram::new(SIZE_BUCKETS),
+            batch_mean_length: Histogram::new(SIZE_BUCKETS),
+            batch_tokens: Histogram::new(TOKENS_BUCKETS),
+            batch_padded_tokens: Histogram::new(TOKENS_BUCKETS),
+            decode_steps: Histogram::new(SIZE_BUCKETS),
+            batch_mean_output_length: Histogram::new(SIZE_BUCKETS),
+            decode_padding_ratio: Histogram::new(RATIO_BUCKETS),
+            queue_wait: Histogram::new(SECONDS_BUCKETS),
+            execution_time: Histogram::new(SECONDS_BUCKETS),
+            time_to_first_token: Histogram::new(SECONDS_BUCKETS),
+            time_per_output_token: Histogram::new(SECONDS_BUCKETS),
+            counted_batches: Counter::new(),
+            cycles: Counter::new(),
+            instructions: Counter::new(),
+            llc_misses: Counter::new(),
+            dtlb_misses: Counter::new(),
+        });
+        registry().lock().unwrap().push(Arc::downgrade(&metrics));
+        metrics
+    }
+
+    /// Returns the model name.
+    pub fn model(&self) -> &str {
+        &self.model
+    }
+
+    /// Records the statistics of the batches run for a request.
+    pub fn observe_batches(&self, stats: &[BatchStats]) {
+        for s in stats {
+            self.batch_size.observe(s.num_examples as f64);
+            self.padding_ratio.observe(s.padding_ratio());
+            self.batch_max_length.observe(s.max_length as f64);
+            self.batch_mean_length.observe(s.mean_length());
+            self.batch_tokens.observe(s.num_tokens as f64);
+            self.batch_padded_tokens.observe(s.padded_tokens() as f64);
+            self.decode_steps.observe(s.max_output_length as f64);
+            self.batch_mean_output_length
+                .observe(s.mean_output_length());
+            self.decode_padding_ratio.observe(s.decode_padding_ratio());
+            self.queue_wait.observe_duration(s.queue_wait);
+            self.execution_time.observe_duration(s.execution_time);
+            if let Some(c) = &s.counters {
+                self.counted_batches.inc();
+                self.cycles.inc_by(c.cycles);
+                self.instructions.inc_by(c.instructions);
+                self.llc_misses.inc_by(c.llc_misses);
+                self.dtlb_misses.inc_by(c.dtlb_misses);
+            }
+        }
+    }
+
+    /// Records the token timings of the examples of a request.
+    pub fn observe_steps(&self, stats: &[StepStats]) {
+        for s in stats {
+            self.time_to_first_token
+                .observe_duration(s.time_to_first_token);
+            if let Some(tpot) = s.time_per_output_token {
+                self.time_per_output_token.observe_duration(tpot);
+            }
+        }
+    }
+
+    /// Returns the hardware counters aggregated over all batches of this model.
+    pub fn hardware_counters(&self) -> HardwareCounters {
+        HardwareCounters {
+            cycles: self.cycles.get(),
+            instructions: self.instructions.get(),
+            llc_misses: self.llc_misses.get(),
+            dtlb_misses: self.dtlb_misses.get(),
+        }
+    }
+}
+
+enum Metric<'a> {
+    Counter(&'a Counter),
+    Gauge(&'a Gauge),
+    Histogram(&'a Histogram),
+}
+
+/// Name, help, type and accessor of a metric family.
+type Family = (
+    &'static str,
+    &'static str,
+    &'static str,
+    fn(&Metrics) -> Metric,
+);
+
+const FAMILIES: &[Family] = &[
+    (
+        "ctranslate2_requests_total",
+        "Number of requests.",
+        "counter",
+        |m| Metric::Counter(&m.requests),
+    ),
+    (
+        "ctranslate2_request_errors_total",
+        "Number of failed requests.",
+        "counter",
+        |m| Metric::Counter(&m.request_errors),
+    ),
+    (
+        "ctranslate2_examples_total",
+        "Number of examples.",
+        "counter",
+        |m| Metric::Counter(&m.examples),
+    ),
+    (
+        "ctranslate2_input_tokens_total",
+        "Number of input tokens.",
+        "counter",
+        |m| Metric::Counter(&m.input_tokens),
+    ),
+    (
+        "ctranslate2_output_tokens_total",
+        "Number of output tokens.",
+        "counter",
+        |m| Metric::Counter(&m.output_tokens),
+    ),
+    (
+        "ctranslate2_encoding_cache_hits_total",
+        "Number of inputs whose tokens were found in the encoding cache.",
+        "counter",
+        |m| Metric::Counter(&m.encoding_cache_hits),
+    ),
+    (
+        "ctranslate2_encoding_cache_misses_total",
+        "Number of inputs encoded after a lookup in the encoding cache.",
+        "counter",
+        |m| Metric::Counter(&m.encoding_cache_misses),
+    ),
+    (
+        "ctranslate2_queue_depth",
+        "Number of batches waiting in the queue when the last request was submitted.",
+        "gauge",
+        |m| Metric::Gauge(&m.queue_depth),
+    ),
+    (
+        "ctranslate2_request_duration_seconds",
+        "Duration of requests.",
+        "histogram",
+        |m| Metric::Histogram(&m.request_duration),
+    ),
+    (
+        "ctranslate2_batch_size",
+        "Number of examples in each batch.",
+        "histogram",
+        |m| Metric::Histogram(&m.batch_size),
+    ),
+    (
+        "ctranslate2_padding_ratio",
+        "Ratio of padding positions in each batch.",
+        "histogram",
+        |m| Metric::Histogram(&m.padding_ratio),
+    ),
+    (
+        "ctranslate2_batch_max_length",
+        "Length of the longest input in each batch.",
+        "histogram",
+        |m| Metric::Histogram(&m.batch_max_length),
+    ),
+    (
+        "ctranslate2_batch_mean_length",
+        "Mean input length in each batch.",
+        "histogram",
+        |m| Metric::Histogram(&m.batch_mean_length),
+    ),
+    (
+        "ctranslate2_batch_tokens",
+        "Number of input tokens in each batch, excluding padding.",
+        "histogram",
+        |m| Metric::Histogram(&m.batch_tokens),
+    ),
+    (
+        "ctranslate2_batch_padded_tokens",
+        "Number of input positions in each batch, including padding.",
+        "histogram",
+        |m| Metric::Histogram(&m.batch_padded_tokens),
+    ),
+    (
+        "ctranslate2_decode_steps",
+        "Number of decoding steps of each batch.",
+        "histogram",
+        |m| Metric::Histogram(&m.decode_steps),
+    ),
+    (
+        "ctranslate2_batch_mean_output_length",
+        "Mean output length in each batch.",
+        "histogram",
+        |m| Metric::Histogram(&m.batch_mean_output_length),
+    ),
+    (
+        "ctranslate2_decode_padding_ratio",
+        "Ratio of decoding positions spent on outputs which had already finished in each batch.",
+        "histogram",
+        |m| Metric::Histogram(&m.decode_padding_ratio),
+    ),
+    (
+        "ctranslate2_queue_wait_seconds",
+        "Time each batch waited in the queue.",
+        "histogram",
+        |m| Metric::Histogram(&m.queue_wait),
+    ),
+    (
+        "ctranslate2_execution_seconds",
+        "Time each batch ran on a replica.",
+        "histogram",
+        |m| Metric::Histogram(&m.execution_time),
+    ),
+    (
+        "ctranslate2_time_to_first_token_seconds",
+        "Time to the first generated token of each example.",
+        "histogram",
+        |m| Metric::Histogram(&m.time_to_first_token),
+    ),
+    (
+        "ctranslate2_time_per_output_token_seconds",
+        "Mean time between two consecutive generated tokens of each example.",
+        "histogram",
+        |m| Metric::Histogram(&m.time_per_output_token),
+    ),
+    (
+        "ctranslate2_counted_batches_total",
+        "Number of batches sampled by hardware counters.",
+        "counter",
+        |m| Metric::Counter(&m.counted_batches),
+    ),
+    (
+        "ctranslate2_cpu_cycles_total",
+        "CPU cycles of replica threads, excluding their intra-op worker threads.",
+        "counter",
+        |m| Metric::Counter(&m.cycles),
+    ),
+    (
+        "ctranslate2_instructions_total",
+        "Instructions retired by replica threads, excluding their intra-op worker threads.",
+        "counter",
+        |m| Metric::Counter(&m.instructions),
+    ),
+    (
+        "ctranslate2_llc_misses_total",
+        "Last level cache read misses of replica threads, excluding their intra-op worker threads.",
+        "counter",
+        |m| Metric::Counter(&m.llc_misses),
+    ),
+    (
+        "ctranslate2_dtlb_misses_total",
+        "Data TLB read misses of replica threads, excluding their intra-op worker threads.",
+        "counter",
+        |m| Metric::Counter(&m.dtlb_misses),
+    ),
+];
+
+fn registry() -> &'static Mutex<Vec<Weak<Metrics>>> {
+    static REGISTRY: OnceLock<Mutex<Vec<Weak<Metrics>>>> = OnceLock::new();
+    REGISTRY.get_or_init(Default::default)
+}
+
+/// Renders the metrics of all registered models in the Prometheus text format.
+pub fn render() -> String {
+    let models = {
+        let mut registry = registry().lock().unwrap();
+        registry.retain(|m| m.strong_count() > 0);
+        registry
+            .iter()
+            .filter_map(Weak::upgrade)
+            .collect::<Vec<_>>()
+    };
+
+    let mut res = String::new();
+    for (name, help, kind, get) in FAMILIES {
+        let _ = writeln!(res, "# HELP {name} {help}");
+        let _ = writeln!(res, "# TYPE {name} {kind}");
+        for m in &models {
+            let label = escape(&m.model);
+            match get(m) {
+                Metric::Counter(c) => {
+                    let _ = writeln!(res, "{name}{{model=\"{label}\"}} {}", c.get());
+                }
+                Metric::Gauge(g) => {
+                    let _ = writeln!(res, "{name}{{model=\"{label}\"}} {}", g.get());
+                }
+                Metric::Histogram(h) => {
+                    for (bound, count) in h.buckets() {
+                        let _ = writeln!(
+                            res,
+                            "{name}_bucket{{model=\"{label}\",le=\"{bound}\"}} {count}"
+                        );
+                    }
+                    let count = h.count();
+                    let _ = writeln!(
+                        res,
+                        "{name}_bucket{{model=\"{label}\",le=\"+Inf\"}} {count}"
+                    );
+                    let _ = writeln!(res, "{name}_sum{{model=\"{label}\"}} {}", h.sum());
+                    let _ = writeln!(res, "{name}_count{{model=\"{label}\"}} {count}");
+                }
+            }
+        }
+    }
+    res
+}
+
+/// Serves the metrics over HTTP on the given address in a background thread.
+///
+/// Every request is answered with the output of [`render`], so the metrics are available at
+/// any path, e.g. `/metrics`. Requests are answered one at a time, so a client that does not send
+/// its request head within [`REQUEST_TIMEOUT`], or sends one longer than [`MAX_REQUEST_HEAD`]
+/// bytes, is disconnected rather than blocking the others.
+pub fn serve<A: ToSocketAddrs>(addr: A) -> std::io::Result<JoinHandle<()>> {
+    let listener = TcpListener::bind(addr)?;
+    Ok(thread::spawn(move || {
+        for stream in listener.incoming().flatten() {
+            let _ = respond(stream);
+        }
+    }))
+}
+
+/// Time allowed to read a request and to write its response.
+pub const REQUEST_TIMEOUT: Duration = Duration::from_secs(5);
+
+/// Maximum size of a request head in bytes.
+pub const MAX_REQUEST_HEAD: u64 = 8192;
+
+fn respond(mut stream: TcpStream) -> std::io::Result<()> {
+    stream.set_read_timeout(Some(REQUEST_TIMEOUT))?;
+    stream.set_write_timeout(Some(REQUEST_TIMEOUT))?;
+
+    // Skip the request head, which ends with an empty line.
+    let mut reader = BufReader::new((&stream).take(MAX_REQUEST_HEAD));
+    let mut line = String::new();
+    loop {
+        line.clear();
+        if reader.read_line(&mut line)? == 0 {
+            return Err(std::io::Error::new(
+                ErrorKind::InvalidData,
+                "incomplete or too large request head",
+            ));
+        }
+        if line.ends_with('\n') && line.trim_end().is_empty() {
+            break;
+        }
+    }
+
+    let body = render();
+    write!(
+        stream,
+        "HTTP/1.1 200 OK\r\n\
+         Content-Type: text/plain; version=0.0.4\r\n\
+         Content-Length: {}\r\n\
+         Connection: close\r\n\r\n{body}",
+        body.len()
+    )
+}
+
+fn escape(label: &str) -> String {
+    label
+        .replace('\\', "\\\\")
+        .replace('"', "\\\"")
+        .replace('\n', "\\n")
+}
@@ -0,0 +1,158 @@
+// packed.rs
+//
+// Copyright (c) 2023 Junpei Kawamoto
+//
+// This software is released under the MIT License.
+//
+// http://opensource.org/licenses/mit-license.php
+
+//! Batches of token sequences packed into a few flat buffers.
+//!
+//! A `Vec<Vec<String>>` allocates for every token and every sequence. [`PackedTokens`] keeps the
+//! bytes of all tokens in one buffer, the byte length of each token in another, and the number of
+//! tokens of each sequence in a third, like the offsets and values of an Arrow string array, and
+//! passes them through the bridge as they are. Clearing a batch keeps its buffers, so that a
+//! batch reused across requests stops allocating once it has grown to the largest request.
+
+/// A batch of token sequences packed into flat buffers.
+#[derive(Clone, Debug, Default, PartialEq, Eq)]
+pub struct PackedTokens {
+    pub(crate) data: String,
+    pub(crate) token_lengths: Vec<usize>,
+    pub(crate) lengths: Vec<usize>,
+}
+
+impl PackedTokens {
+    /// Creates an empty batch.
+    pub fn new() -> Self {
+        Self::default()
+    }
+
+    /// Creates an empty batch with room for the given numbers of sequences, tokens, and bytes.
+    pub fn with_capacity(sequences: usize, tokens: usize, bytes: usize) -> Self {
+        Self {
+            data: String::with_capacity(bytes),
+            token_lengths: Vec::with_capacity(tokens),
+            lengths: Vec::with_capacity(sequences),
+        }
+    }
+
+    /// Appends a sequence of tokens.
+    pub fn push<I>(&mut self, tokens: I)
+    where
+        I: IntoIterator,
+        I::Item: AsRef<str>,
+    {
+        let start = self.token_lengths.len();
+        for token in tokens {
+            let token = token.as_ref();
+            self.data.push_str(token);
+            self.token_lengths.push(token.len());
+        }
+        self.lengths.push(self.token_lengths.len() - start);
+    }
+
+    /// Removes all sequences, keeping the allocated buffers.
+    pub fn clear(&mut self) {
+        self.data.clear();
+        self.token_lengths.clear();
+        self.lengths.clear();
+    }
+
+    /// Returns the number of sequences.
+    pub fn len(&self) -> usize {
+        self.lengths.len()
+    }
+
+    /// Returns true if there are no sequences.
+    pub fn is_empty(&self) -> bool {
+        self.lengths.is_empty()
+    }
+
+    /// Returns the total number of tokens.
+    pub fn num_tokens(&self) -> usize {
+        self.token_lengths.len()
+    }
+
+    /// Returns an iterator over the sequences.
+    pub fn iter(&self) -> Sequences<'_> {
+        Sequences {
+            data: &self.data,
+            token_lengths: &self.token_lengths,
+            lengths: self.lengths.iter(),
+        }
+    }
+}
+
+impl<'a> IntoIterator for &'a PackedTokens {
+    type Item = Sequence<'a>;
+    type IntoIter = Sequences<'a>;
+
+    fn into_iter(self) -> Self::IntoIter {
+        self.iter()
+    }
+}
+
+impl<T: AsRef<str>> FromIterator<Vec<T>> for PackedTokens {
+    fn from_iter<I: IntoIterator<Item = Vec<T>>>(iter: I) -> Self {
+        let mut res = Self::new();
+        for tokens in iter {
+            res.push(tokens);
+        }
+        res
+    }
+}
+
+/// Iterator over the sequences of a [`PackedTokens`].
+#[derive(Clone, Debug)]
+pub struct Sequences<'a> {
+    data: &'a str,
+    token_lengths: &'a [usize],
+    lengths: std::slice::Iter<'a, usize>,
+}
+
+impl<'a> Iterator for Sequences<'a> {
+    type Item = Sequence<'a>;
+
+    fn next(&mut self) -> Option<Self::Item> {
+        let n = *self.lengths.next()?;
+        let (token_lengths, rest) = self.token_lengths.split_at(n);
+        let len = token_lengths.iter().sum();
+        let (data, rest_data) = self.data.split_at(len);
+        self.token_lengths = rest;
+        self.data = rest_data;
+        Some(Sequence {
+            data,
+            token_lengths: token_lengths.iter(),
+        })
+    }
+
+    fn size_hint(&self) -> (usize, Option<usize>) {
+        self.lengths.size_hint()
+    }
+}
+
+impl ExactSizeIterator for Sequences<'_> {}
+
+/// Iterator over the tokens of a sequence in a [`PackedTokens`].
+#[derive(Clone, Debug)]
+pub struct Sequence<'a> {
+    data: &'a str,
+    token_lengths: std::slice::Iter<'a, usize>,
+}
+
+impl<'a> Iterator for Sequence<'a> {
+    type Item = &'a str;
+
+    fn next(&mut self) -> Option<Self::Item> {
+        let (token, rest) = self.data.split_at(*self.token_lengths.next()?);
+        self.data = rest;
+        Some(token)
+    }
+
+    fn size_hint(&self) -> (usize, Option<usize>) {
+        self.token_lengths.size_hint()
+    }
+}
+
+impl ExactSizeIterator for Sequence<'_> {}
@@ -0,0 +1,24 @@
+// profiler.cpp
+//
+// Copyright (c) 2023 Junpei Kawamoto
+//
+// This software is released under the MIT License.
+//
+// http://opensource.org/licenses/mit-license.php
+
+#include "ctranslate2/include/profiler.h"
+
+#include <ctranslate2/profiler.h>
+#include <sstream>
+
+void init_profiling(bool cuda, size_t num_threads) {
+  ctranslate2::init_profiling(cuda ? ctranslate2::Device::CUDA
+                                   : ctranslate2::Device::CPU,
+                              num_threads);
+}
+
+rust::String dump_profiling() {
+  std::ostringstream os;
+  ctranslate2::dump_profiling(os);
+  return rust::String(os.str());
+}
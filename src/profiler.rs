@@ -0,0 +1,45 @@
+// profiler.rs
+//
+// Copyright (c) 2023 Junpei Kawamoto
+//
+// This software is released under the MIT License.
+//
+// http://opensource.org/licenses/mit-license.php
+
+//! Bindings for the CTranslate2 profiler (requires the `profiling` feature).
+//!
+//! The `profiling` feature builds CTranslate2 with `ENABLE_PROFILING=ON`, which records the time
+//! spent in each operator. Profiling adds synchronization points and should not be enabled in
+//! production.
+
+use crate::config::Device;
+
+#[cxx::bridge]
+mod ffi {
+    unsafe extern "C++" {
+        include!("ctranslate2/include/profiler.h");
+
+        fn init_profiling(cuda: bool, num_threads: usize);
+
+        fn dump_profiling() -> String;
+    }
+}
+
+/// Starts profiling the operators run by `num_threads` threads on the given device.
+///
+/// `num_threads` should be the total number of threads running the models,
+/// i.e. the number of replicas times the number of threads per replica.
+pub fn init_profiling(device: Device, num_threads: usize) {
+    ffi::init_profiling(
+        match device {
+            Device::CPU => false,
+            Device::CUDA => true,
+        },
+        num_threads,
+    )
+}
+
+/// Stops profiling and returns the report of the time spent in each operator.
+pub fn dump_profiling() -> String {
+    ffi::dump_profiling()
+}
@@ -0,0 +1,134 @@
+// sentencepiece.rs
+//
+// Copyright (c) 2023 Junpei Kawamoto
+//
+// This software is released under the MIT License.
+//
+// http://opensource.org/licenses/mit-license.php
+
+//! Tokenization with SentencePiece models, for models shipped without a `tokenizer.json`.
+//!
+//! Translation models converted from OpenNMT or Marian usually ship a SentencePiece model for
+//! each side, `source.spm` and `target.spm`, while others share one model, e.g.
+//! `sentencepiece.bpe.model`. [`crate::Translator::new`] and [`crate::Generator::new`] load them
+//! when the model directory has no `tokenizer.json`.
+//!
+//! ```no_run
+//! # use ctranslate2::config::{Config, Device};
+//! # use ctranslate2::sentencepiece::SentencePiece;
+//! # use ctranslate2::Translator;
+//! # fn main() -> anyhow::Result<()> {
+//! // Marian models expect the end of sentence token after each input.
+//! let sp = SentencePiece::from_dir("/path/to/model")?.with_special_tokens(vec![], vec!["</s>"]);
+//! let t = Translator::with_sentencepiece("/path/to/model", Device::CPU, Config::default(), sp)?;
+//! # Ok(())
+//! # }
+//! ```
+
+use std::path::Path;
+
+use ::sentencepiece::SentencePieceProcessor;
+use anyhow::{anyhow, bail, Result};
+
+/// File names of a model shared by both sides, or of the source model, in order of preference.
+const SOURCE_FILENAMES: &[&str] = &[
+    "source.spm",
+    "sentencepiece.bpe.model",
+    "sentencepiece.model",
+    "spm.model",
+];
+/// File name of the target model.
+const TARGET_FILENAME: &str = "target.spm";
+
+/// SentencePiece models tokenizing inputs and detokenizing outputs.
+pub struct SentencePiece {
+    source: SentencePieceProcessor,
+    /// Model of the outputs if it differs from the source model.
+    target: Option<SentencePieceProcessor>,
+    prefix: Vec<String>,
+    suffix: Vec<String>,
+}
+
+impl SentencePiece {
+    /// Loads a model shared by inputs and outputs.
+    pub fn new<P: AsRef<Path>>(model: P) -> Result<Self> {
+        Ok(Self {
+            source: open(model)?,
+            target: None,
+            prefix: Vec::new(),
+            suffix: Vec::new(),
+        })
+    }
+
+    /// Loads a model tokenizing inputs and another detokenizing outputs.
+    pub fn with_target<P: AsRef<Path>, Q: AsRef<Path>>(source: P, target: Q) -> Result<Self> {
+        Ok(Self {
+            target: Some(open(target)?),
+            ..Self::new(source)?
+        })
+    }
+
+    /// Loads the models found in the given model directory.
+    pub fn from_dir<P: AsRef<Path>>(dir: P) -> Result<Self> {
+        let dir = dir.as_ref();
+        let Some(source) = SOURCE_FILENAMES
+            .iter()
+            .map(|name| dir.join(name))
+            .find(|path| path.exists())
+        else {
+            bail!(
+                "no tokenizer.json nor SentencePiece model in {}",
+                dir.display()
+            );
+        };
+        let target = dir.join(TARGET_FILENAME);
+        if target.exists() {
+            Self::with_target(source, target)
+        } else {
+            Self::new(source)
+        }
+    }
+
+    /// Adds the given tokens before and after each input encoded with special tokens, e.g. the
+    /// end of sentence token `</s>` which SentencePiece does not add.
+    pub fn with_special_tokens<T: Into<String>>(mut self, prefix: Vec<T>, suffix: Vec<T>) -> Self {
+        self.prefix = prefix.into_iter().map(Into::into).collect();
+        self.suffix = suffix.into_iter().map(Into::into).collect();
+        self
+    }
+
+    /// Encodes the given text into pieces of the source model.
+    pub fn encode(&self, text: &str, add_special_tokens: bool) -> Result<Vec<String>> {
+        let pieces = self
+            .source
+            .encode(text)
+            .map_err(|err| anyhow!("failed to encode the given input: {err}"))?;
+        if !add_special_tokens {
+            return Ok(pieces.into_iter().map(|p| p.piece).collect());
+        }
+        let mut res = Vec::with_capacity(self.prefix.len() + pieces.len() + self.suffix.len());
+        res.extend_from_slice(&self.prefix);
+        res.extend(pieces.into_iter().map(|p| p.piece));
+        res.extend_from_slice(&self.suffix);
+        Ok(res)
+    }
+
+    /// Decodes the given pieces of the target model.
+    pub fn decode<T: AsRef<str>>(&self, pieces: &[T]) -> Result<String> {
+        self.target
+            .as_ref()
+            .unwrap_or(&self.source)
+            .decode_pieces(pieces)
+            .map_err(|err| anyhow!("failed to decode: {err}"))
+    }
+}
+
+fn open<P: AsRef<Path>>(path: P) -> Result<SentencePieceProcessor> {
+    let path = path.as_ref();
+    SentencePieceProcessor::open(path).map_err(|err| {
+        anyhow!(
+            "failed to load a SentencePiece model {}: {err}",
+            path.display()
+        )
+    })
+}
@@ -0,0 +1,66 @@
+// trace.rs
+//
+// Copyright (c) 2023 Junpei Kawamoto
+//
+// This software is released under the MIT License.
+//
+// http://opensource.org/licenses/mit-license.php
+
+//! Spans emitted from the C++ bridge when the `tracing` feature is enabled.
+//!
+//! The C++ side captures the caller's current span before a batch is posted so that the spans
+//! opened on replica threads are attached to the caller's trace.
+
+#[cxx::bridge]
+mod ffi {
+    enum TracePhase {
+        MarshalIn,
+        QueueWait,
+        Execute,
+        MarshalOut,
+    }
+
+    extern "Rust" {
+        type SpanHandle;
+
+        fn current_span() -> Box<SpanHandle>;
+
+        fn new_span(
+            context: &SpanHandle,
+            phase: TracePhase,
+            batch_size: usize,
+            num_tokens: usize,
+        ) -> Box<SpanHandle>;
+    }
+}
+
+/// A span owned by the C++ side. The span is closed when the handle is dropped.
+pub struct SpanHandle(tracing::Span);
+
+fn current_span() -> Box<SpanHandle> {
+    Box::new(SpanHandle(tracing::Span::current()))
+}
+
+fn new_span(
+    context: &SpanHandle,
+    phase: ffi::TracePhase,
+    batch_size: usize,
+    num_tokens: usize,
+) -> Box<SpanHandle> {
+    let parent = &context.0;
+    Box::new(SpanHandle(match phase {
+        ffi::TracePhase::MarshalIn => {
+            tracing::info_span!(parent: parent, "marshal_in", batch_size, num_tokens)
+        }
+        ffi::TracePhase::QueueWait => {
+            tracing::info_span!(parent: parent, "queue_wait", batch_size, num_tokens)
+        }
+        ffi::TracePhase::Execute => {
+            tracing::info_span!(parent: parent, "execute", batch_size, num_tokens)
+        }
+        ffi::TracePhase::MarshalOut => {
+            tracing::info_span!(parent: parent, "marshal_out", batch_size, num_tokens)
+        }
+        _ => tracing::Span::none(),
+    }))
+}
@@ -7,7 +7,10 @@
 // http://opensource.org/licenses/mit-license.php
 
 #include "ctranslate2/include/translator.h"
+#include "ctranslate2/include/batch_stats.h"
 #include "ctranslate2/include/convert.h"
+#include "ctranslate2/include/probes.h"
+#include "ctranslate2/include/trace.h"
 #include "ctranslate2/src/translator.rs.h"
 
 using rust::Str;
@@ -16,9 +19,45 @@ using rust::Vec;
 using std::string;
 using std::vector;
 
-Vec<TranslationResult>
-Translator::translate_batch(Vec<VecStr> source, Vec<VecStr> target_prefix,
-                            TranslationOptions options) const {
+namespace {
+
+ctranslate2::TranslationOptions
+to_ctranslate2(const TranslationOptions &options) {
+  return ctranslate2::TranslationOptions{
+      options.beam_size,
+      options.patience,
+      options.length_penalty,
+      options.coverage_penalty,
+      options.repetition_penalty,
+      options.no_repeat_ngram_size,
+      options.disable_unk,
+      from_rust(options.suppress_sequences),
+      options.prefix_bias_beta,
+      {},
+      options.return_end_token,
+      options.max_input_length,
+      options.max_decoding_length,
+      options.min_decoding_length,
+      options.sampling_topk,
+      options.sampling_topp,
+      options.sampling_temperature,
+      options.use_vmap,
+      options.num_hypotheses,
+      options.return_scores,
+      options.return_attention,
+      options.return_alternatives,
+      options.min_alternative_expansion_prob,
+      options.replace_unknowns,
+      nullptr,
+  };
+}
+
+// Runs the examples of a request on the replicas and waits for their results.
+vector<ctranslate2::TranslationResult>
+run(TranslatorPool &pool, const TraceContext &context,
+    const TraceSpan &queue_wait, vector<ctranslate2::Example> examples,
+    const ctranslate2::TranslationOptions &opts,
+    const TranslationOptions &options, Vec<BatchStats> &stats) {
 
   ctranslate2::BatchType batch_type;
   switch (options.batch_type) {
@@ -30,36 +69,52 @@ Translator::translate_batch(Vec<VecStr> source, Vec<VecStr> target_prefix,
     break;
   }
 
-  const auto batch_result =
-      this->impl->translate_batch(from_rust(source), from_rust(target_prefix),
-                                  ctranslate2::TranslationOptions{
-                                      options.beam_size,
-                                      options.patience,
-                                      options.length_penalty,
-                                      options.coverage_penalty,
-                                      options.repetition_penalty,
-                                      options.no_repeat_ngram_size,
-                                      options.disable_unk,
-                                      from_rust(options.suppress_sequences),
-                                      options.prefix_bias_beta,
-                                      {},
-                                      options.return_end_token,
-                                      options.max_input_length,
-                                      options.max_decoding_length,
-                                      options.min_decoding_length,
-                                      options.sampling_topk,
-                                      options.sampling_topp,
-                                      options.sampling_temperature,
-                                      options.use_vmap,
-                                      options.num_hypotheses,
-                                      options.return_scores,
-                                      options.return_attention,
-                                      options.return_alternatives,
-                                      options.min_alternative_expansion_prob,
-                                      options.replace_unknowns,
-                                      nullptr,
-                                  },
-                                  options.max_batch_size, batch_type);
+  // The hypotheses start with the target prefix, the second stream of the
+  // examples.
+  auto collector = std::make_shared<BatchStatsCollector<BatchStats>>(1);
+  auto futures = pool.post_examples<ctranslate2::TranslationResult>(
+      examples, options.max_batch_size, batch_type,
+      [opts, context, queue_wait,
+       collector](ctranslate2::models::SequenceToSequenceReplica &replica,
+                  const ctranslate2::Batch &batch) {
+        queue_wait.close();
+        const TraceSpan execute(context, TracePhase::Execute, batch);
+        return collector->run(batch, [&] {
+          return replica.translate(batch.get_stream(0), batch.get_stream(1),
+                                   opts);
+        });
+      });
+
+  vector<ctranslate2::TranslationResult> batch_result;
+  for (auto &future : futures) {
+    batch_result.push_back(future.get());
+  }
+  collector->drain(stats);
+  return batch_result;
+}
+
+} // namespace
+
+Vec<TranslationResult>
+Translator::translate_batch(Vec<VecStr> source, Vec<VecStr> target_prefix,
+                            TranslationOptions options,
+                            Vec<BatchStats> &stats) const {
+
+  TraceContext context;
+  CT2RS_PROBE1(marshal_in__start, source.size());
+  TraceSpan marshal_in(context, TracePhase::MarshalIn, source);
+  auto examples =
+      ctranslate2::load_examples({from_rust(source), from_rust(target_prefix)});
+  const auto opts = to_ctranslate2(options);
+  marshal_in.close();
+  CT2RS_PROBE1(marshal_in__end, source.size());
+
+  const TraceSpan queue_wait(context, TracePhase::QueueWait, source);
+  const auto batch_result = run(*this->impl, context, queue_wait,
+                                std::move(examples), opts, options, stats);
+
+  CT2RS_PROBE1(marshal_out__start, batch_result.size());
+  const TraceSpan marshal_out(context, TracePhase::MarshalOut, batch_result);
   Vec<TranslationResult> res;
   for (const auto &item : batch_result) {
     res.push_back(TranslationResult{
@@ -67,6 +122,52 @@ Translator::translate_batch(Vec<VecStr> source, Vec<VecStr> target_prefix,
         //        to_rust(item.attention),
     });
   }
+  CT2RS_PROBE1(marshal_out__end, res.size());
+  return res;
+}
+
+PackedTranslations Translator::translate_packed(PackedTokens source,
+                                                PackedTokens target_prefix,
+                                                TranslationOptions options,
+                                                Vec<BatchStats> &stats) const {
+
+  TraceContext context;
+  const PackedSize size{source.lengths.size(), source.token_lengths.size()};
+  CT2RS_PROBE1(marshal_in__start, size.num_sequences);
+  TraceSpan marshal_in(context, TracePhase::MarshalIn, size);
+  auto examples = ctranslate2::load_examples(
+      {from_packed(source), from_packed(target_prefix)});
+  const auto opts = to_ctranslate2(options);
+  marshal_in.close();
+  CT2RS_PROBE1(marshal_in__end, size.num_sequences);
+
+  const TraceSpan queue_wait(context, TracePhase::QueueWait, size);
+  const auto batch_result = run(*this->impl, context, queue_wait,
+                                std::move(examples), opts, options, stats);
+
+  CT2RS_PROBE1(marshal_out__start, batch_result.size());
+  const TraceSpan marshal_out(context, TracePhase::MarshalOut, batch_result);
+  // The tokens are concatenated here and copied to Rust at once.
+  string data;
+  PackedTranslations res;
+  res.lengths.reserve(batch_result.size());
+  for (const auto &item : batch_result) {
+    if (item.hypotheses.empty()) {
+      res.lengths.push_back(0);
+    } else {
+      const auto &hypothesis = item.hypotheses[0];
+      res.lengths.push_back(hypothesis.size());
+      for (const auto &token : hypothesis) {
+        data += token;
+        res.token_lengths.push_back(token.size());
+      }
+    }
+    if (!item.scores.empty()) {
+      res.scores.push_back(item.scores[0]);
+    }
+  }
+  res.data = String(data);
+  CT2RS_PROBE1(marshal_out__end, batch_result.size());
   return res;
 }
 
@@ -98,7 +199,7 @@ std::unique_ptr<Translator> new_translator(const Str model_path,
     break;
   };
 
-  return std::make_unique<Translator>(std::make_shared<ctranslate2::Translator>(
+  return std::make_unique<Translator>(std::make_shared<TranslatorPool>(
       static_cast<string>(model_path),
       cuda ? ctranslate2::Device::CUDA : ctranslate2::Device::CPU, compute_type,
       from_rust(config.device_indices),
@@ -8,9 +8,17 @@
 
 //! Bindings for ctranslate2::Translator.
 
+use std::sync::Arc;
+use std::time::{Duration, Instant};
+
 use cxx::UniquePtr;
 
+#[cfg(feature = "capture")]
+use crate::capture::Capture;
 use crate::config::{BatchType, ComputeType, Config, Device};
+use crate::memory::{MemoryReport, VariableInfo};
+use crate::metrics::{BatchStats, HardwareCounters, Metrics};
+use crate::packed::PackedTokens;
 
 #[cxx::bridge]
 mod ffi {
@@ -75,12 +83,47 @@ mod ffi {
         batch_type: BatchType,
     }
 
+    struct PackedTokens<'a> {
+        data: &'a str,
+        token_lengths: &'a [usize],
+        lengths: &'a [usize],
+    }
+
+    struct PackedTranslations {
+        data: String,
+        token_lengths: Vec<usize>,
+        lengths: Vec<usize>,
+        scores: Vec<f32>,
+    }
+
     struct TranslationResult {
         hypotheses: Vec<VecString>,
         scores: Vec<f32>,
         // attention: Vec<Vec<Vec<f32>>>,
     }
 
+    struct BatchStats {
+        num_examples: usize,
+        num_tokens: usize,
+        max_length: usize,
+        num_output_tokens: usize,
+        max_output_length: usize,
+        queue_wait_us: u64,
+        execution_us: u64,
+        has_counters: bool,
+        cycles: u64,
+        instructions: u64,
+        llc_misses: u64,
+        dtlb_misses: u64,
+    }
+
+    struct VariableInfo {
+        name: String,
+        dtype: String,
+        shape: Vec<i64>,
+        bytes: usize,
+    }
+
     unsafe extern "C++" {
         include!("ctranslate2/include/translator.h");
 
@@ -97,12 +140,38 @@ mod ffi {
             source: Vec<VecStr>,
             target_prefix: Vec<VecStr>,
             options: TranslationOptions,
+            stats: &mut Vec<BatchStats>,
         ) -> Result<Vec<TranslationResult>>;
+
+        fn translate_packed(
+            self: &Translator,
+            source: PackedTokens,
+            target_prefix: PackedTokens,
+            options: TranslationOptions,
+            stats: &mut Vec<BatchStats>,
+        ) -> Result<PackedTranslations>;
+
+        fn num_queued_batches(self: &Translator) -> usize;
+
+        fn num_active_batches(self: &Translator) -> usize;
+
+        fn num_replicas(self: &Translator) -> usize;
+
+        fn model_variables(self: &Translator) -> Vec<VariableInfo>;
     }
 }
 
+// ctranslate2::Translator queues requests to a pool of replicas and can be shared between threads.
+unsafe impl Send for ffi::Translator {}
+unsafe impl Sync for ffi::Translator {}
+
 /// Options for translation.
 #[derive(Debug)]
+#[cfg_attr(
+    feature = "capture",
+    derive(serde::Serialize, serde::Deserialize),
+    serde(bound(serialize = "", deserialize = "T: serde::Deserialize<'de>"))
+)]
 pub struct TranslationOptions<T: AsRef<str>> {
     /// Beam size to use for beam search (set 1 to run greedy search).
     pub beam_size: usize,
@@ -123,6 +192,10 @@ pub struct TranslationOptions<T: AsRef<str>> {
     /// Disable the generation of the unknown token.
     pub disable_unk: bool,
     /// Disable the generation of some sequences of tokens.
+    #[cfg_attr(
+        feature = "capture",
+        serde(serialize_with = "crate::capture::serialize_tokens")
+    )]
     pub suppress_sequences: Vec<Vec<T>>,
     /// Biases decoding towards a given prefix, see <https://arxiv.org/abs/1912.03393> --section 4.2
     /// Only activates biased-decoding when beta is in range (0, 1) and SearchStrategy is set to BeamSearch.
@@ -244,6 +317,9 @@ impl<T: AsRef<str>> TranslationOptions<T> {
 /// A text translator.
 pub struct Translator {
     ptr: UniquePtr<ffi::Translator>,
+    metrics: Option<Arc<Metrics>>,
+    #[cfg(feature = "capture")]
+    capture: Option<Arc<Capture>>,
 }
 
 impl Translator {
@@ -276,10 +352,65 @@ impl Translator {
                     cpu_core_offset: config.cpu_core_offset,
                 },
             )?,
+            metrics: None,
+            #[cfg(feature = "capture")]
+            capture: None,
         })
     }
 
+    /// Records the metrics of this translator into the given metrics.
+    pub fn set_metrics(&mut self, metrics: Arc<Metrics>) {
+        self.metrics = Some(metrics);
+    }
+
+    /// Returns the metrics of this translator if set.
+    pub fn metrics(&self) -> Option<&Arc<Metrics>> {
+        self.metrics.as_ref()
+    }
+
+    /// Captures requests of this translator which are slower than the threshold of the given capture.
+    #[cfg(feature = "capture")]
+    pub fn set_capture(&mut self, capture: Arc<Capture>) {
+        self.capture = Some(capture);
+    }
+
+    /// Number of batches in the work queue.
+    pub fn num_queued_batches(&self) -> usize {
+        self.ptr.num_queued_batches()
+    }
+
+    /// Number of batches in the work queue or currently processed by a worker.
+    pub fn num_active_batches(&self) -> usize {
+        self.ptr.num_active_batches()
+    }
+
+    /// Number of parallel replicas.
+    pub fn num_replicas(&self) -> usize {
+        self.ptr.num_replicas()
+    }
+
+    /// Reports the memory used by the variables of the loaded model.
+    pub fn memory_report(&self) -> MemoryReport {
+        MemoryReport::new(
+            self.ptr
+                .model_variables()
+                .into_iter()
+                .map(|v| VariableInfo {
+                    name: v.name,
+                    dtype: v.dtype,
+                    shape: v.shape,
+                    bytes: v.bytes,
+                })
+                .collect(),
+            self.num_replicas(),
+        )
+    }
+
     /// Translates a batch of tokens.
+    #[cfg_attr(
+        feature = "tracing",
+        tracing::instrument(name = "translate_batch", skip_all, fields(batch_size = source.len()))
+    )]
     pub fn translate_batch<T, U, V>(
         &self,
         source: &[Vec<T>],
@@ -291,16 +422,158 @@ impl Translator {
         U: AsRef<str>,
         V: AsRef<str>,
     {
-        Ok(self
+        let start = self.start_request();
+        let mut stats = Vec::new();
+        let res = match self.ptr.translate_batch(
+            vec_ffi_vecstr(source),
+            vec_ffi_vecstr(target_prefix),
+            options.to_ffi(),
+            &mut stats,
+        ) {
+            Ok(res) => res
+                .into_iter()
+                .map(TranslationResult::from)
+                .collect::<Vec<_>>(),
+            Err(err) => return Err(self.fail_request(err.into())),
+        };
+
+        #[cfg_attr(not(feature = "capture"), allow(unused_variables))]
+        let (elapsed, stats) = self.finish_request(
+            start,
+            stats,
+            source.len(),
+            source.iter().map(Vec::len).sum(),
+            res.iter()
+                .flat_map(|r| r.hypotheses.iter().map(Vec::len))
+                .sum(),
+        );
+        #[cfg(feature = "capture")]
+        if let Some(capture) = &self.capture {
+            if elapsed >= capture.threshold() {
+                // A failure to capture must not fail the request itself.
+                let _ = capture.record_translation(source, target_prefix, options, elapsed, &stats);
+            }
+        }
+        Ok(res)
+    }
+
+    /// Translates a batch of packed tokens, returning the first hypothesis of each example.
+    ///
+    /// The tokens cross the bridge in their flat buffers in both directions, so that the cost of
+    /// passing a batch does not grow with the number of sequences. `target_prefix` is either empty
+    /// or has a sequence for each example of `source`.
+    #[cfg_attr(
+        feature = "tracing",
+        tracing::instrument(name = "translate_packed", skip_all, fields(batch_size = source.len()))
+    )]
+    pub fn translate_packed<V: AsRef<str>>(
+        &self,
+        source: &PackedTokens,
+        target_prefix: &PackedTokens,
+        options: &TranslationOptions<V>,
+    ) -> anyhow::Result<PackedTranslations> {
+        let start = self.start_request();
+        let mut stats = Vec::new();
+        let res = match self
             .ptr
-            .translate_batch(
-                vec_ffi_vecstr(source),
-                vec_ffi_vecstr(target_prefix),
+            .translate_packed(
+                ffi_packed(source),
+                ffi_packed(target_prefix),
                 options.to_ffi(),
-            )?
-            .into_iter()
-            .map(TranslationResult::from)
-            .collect())
+                &mut stats,
+            )
+            .map_err(anyhow::Error::from)
+            .and_then(PackedTranslations::try_from)
+        {
+            Ok(res) => res,
+            Err(err) => return Err(self.fail_request(err)),
+        };
+
+        #[cfg_attr(not(feature = "capture"), allow(unused_variables))]
+        let (elapsed, stats) = self.finish_request(
+            start,
+            stats,
+            source.len(),
+            source.num_tokens(),
+            res.tokens.num_tokens(),
+        );
+        #[cfg(feature = "capture")]
+        if let Some(capture) = &self.capture {
+            if elapsed >= capture.threshold() {
+                // Only slow requests are unpacked.
+                let source = source
+                    .iter()
+                    .map(Iterator::collect)
+                    .collect::<Vec<Vec<_>>>();
+                let target_prefix = target_prefix
+                    .iter()
+                    .map(Iterator::collect)
+                    .collect::<Vec<Vec<_>>>();
+                let _ =
+                    capture.record_translation(&source, &target_prefix, options, elapsed, &stats);
+            }
+        }
+        Ok(res)
+    }
+
+    /// Records the start of a request and returns its start time.
+    fn start_request(&self) -> Instant {
+        if let Some(metrics) = &self.metrics {
+            metrics.requests.inc();
+            metrics
+                .queue_depth
+                .set(self.ptr.num_queued_batches() as u64);
+        }
+        Instant::now()
+    }
+
+    /// Records a failed request and returns its error.
+    fn fail_request(&self, err: anyhow::Error) -> anyhow::Error {
+        if let Some(metrics) = &self.metrics {
+            metrics.request_errors.inc();
+        }
+        err
+    }
+
+    /// Records a completed request and returns its duration and the statistics of its batches.
+    fn finish_request(
+        &self,
+        start: Instant,
+        stats: Vec<ffi::BatchStats>,
+        num_examples: usize,
+        input_tokens: usize,
+        output_tokens: usize,
+    ) -> (Duration, Vec<BatchStats>) {
+        let elapsed = start.elapsed();
+        let stats = stats.into_iter().map(BatchStats::from).collect::<Vec<_>>();
+        if let Some(metrics) = &self.metrics {
+            metrics.examples.inc_by(num_examples as u64);
+            metrics.input_tokens.inc_by(input_tokens as u64);
+            metrics.output_tokens.inc_by(output_tokens as u64);
+            metrics.observe_batches(&stats);
+            metrics.request_duration.observe_duration(elapsed);
+        }
+        (elapsed, stats)
+    }
+}
+
+impl From<ffi::BatchStats> for BatchStats {
+    fn from(s: ffi::BatchStats) -> Self {
+        Self {
+            num_examples: s.num_examples,
+            num_tokens: s.num_tokens,
+            max_length: s.max_length,
+            num_output_tokens: s.num_output_tokens,
+            max_output_length: s.max_output_length,
+            queue_wait: Duration::from_micros(s.queue_wait_us),
+            execution_time: Duration::from_micros(s.execution_us),
+            counters: s.has_counters.then_some(HardwareCounters {
+                cycles: s.cycles,
+                instructions: s.instructions,
+                llc_misses: s.llc_misses,
+                dtlb_misses: s.dtlb_misses,
+            }),
+        }
     }
 }
 
@@ -344,6 +617,50 @@ impl TranslationResult {
     }
 }
 
+/// First hypotheses of a batch translated by [`Translator::translate_packed`].
+#[derive(Debug)]
+pub struct PackedTranslations {
+    /// First hypothesis of each example.
+    pub tokens: PackedTokens,
+    /// Score of each hypothesis (empty if return_scores was disabled).
+    pub scores: Vec<f32>,
+}
+
+impl TryFrom<ffi::PackedTranslations> for PackedTranslations {
+    type Error = anyhow::Error;
+
+    fn try_from(r: ffi::PackedTranslations) -> anyhow::Result<Self> {
+        // The bridge checks that the whole buffer is UTF-8, but not each token.
+        let mut end = 0;
+        for len in &r.token_lengths {
+            end += len;
+            if !r.data.is_char_boundary(end) {
+                anyhow::bail!("a token is not valid UTF-8");
+            }
+        }
+        if end != r.data.len() || r.lengths.iter().sum::<usize>() != r.token_lengths.len() {
+            anyhow::bail!("inconsistent packed tokens");
+        }
+        Ok(Self {
+            tokens: PackedTokens {
+                data: r.data,
+                token_lengths: r.token_lengths,
+                lengths: r.lengths,
+            },
+            scores: r.scores,
+        })
+    }
+}
+
+#[inline]
+fn ffi_packed(src: &PackedTokens) -> ffi::PackedTokens {
+    ffi::PackedTokens {
+        data: &src.data,
+        token_lengths: &src.token_lengths,
+        lengths: &src.lengths,
+    }
+}
+
 #[inline]
 fn vec_ffi_vecstr<T: AsRef<str>>(src: &[Vec<T>]) -> Vec<ffi::VecStr> {
     src.iter()
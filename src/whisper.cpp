@@ -0,0 +1,125 @@
+// whisper.cpp
+//
+// Copyright (c) 2023 Junpei Kawamoto
+//
+// This software is released under the MIT License.
+//
+// http://opensource.org/licenses/mit-license.php
+
+#include "ctranslate2/include/whisper.h"
+#include "ctranslate2/include/convert.h"
+#include "ctranslate2/src/whisper.rs.h"
+
+using rust::Slice;
+using rust::Str;
+using rust::Vec;
+using std::string;
+using std::vector;
+
+bool Whisper::is_multilingual() const { return this->impl->is_multilingual(); }
+
+size_t Whisper::n_mels() const { return this->impl->n_mels(); }
+
+std::unique_ptr<WhisperFeatures>
+Whisper::encode(Slice<const float> features, Slice<const size_t> shape) const {
+  ctranslate2::Shape dims;
+  for (const auto &d : shape) {
+    dims.push_back(static_cast<ctranslate2::dim_t>(d));
+  }
+
+  // The encoder output stays on the device unless it may be consumed by a
+  // replica placed on another device.
+  return std::make_unique<WhisperFeatures>(
+      this->impl
+          ->encode(ctranslate2::StorageView(
+                       std::move(dims),
+                       vector<float>(features.begin(), features.end())),
+                   this->encode_to_cpu)
+          .get());
+}
+
+Vec<WhisperVecLanguage>
+Whisper::detect_language(const WhisperFeatures &features) const {
+  auto futures = this->impl->detect_language(features.get());
+
+  Vec<WhisperVecLanguage> res;
+  for (auto &future : futures) {
+    Vec<WhisperLanguage> languages;
+    for (const auto &item : future.get()) {
+      languages.push_back(WhisperLanguage{to_rust(item.first), item.second});
+    }
+    res.push_back(WhisperVecLanguage{std::move(languages)});
+  }
+  return res;
+}
+
+Vec<WhisperGenerationResult>
+Whisper::generate(const WhisperFeatures &features, Vec<WhisperVecStr> prompts,
+                  WhisperOptions options) const {
+
+  ctranslate2::models::WhisperOptions opts;
+  opts.beam_size = options.beam_size;
+  opts.patience = options.patience;
+  opts.length_penalty = options.length_penalty;
+  opts.repetition_penalty = options.repetition_penalty;
+  opts.no_repeat_ngram_size = options.no_repeat_ngram_size;
+  opts.max_length = options.max_length;
+  opts.sampling_topk = options.sampling_topk;
+  opts.sampling_temperature = options.sampling_temperature;
+  opts.num_hypotheses = options.num_hypotheses;
+  opts.return_scores = options.return_scores;
+  opts.return_no_speech_prob = options.return_no_speech_prob;
+  opts.max_initial_timestamp_index = options.max_initial_timestamp_index;
+  opts.suppress_blank = options.suppress_blank;
+  opts.suppress_tokens = from_rust(options.suppress_tokens);
+
+  auto futures = this->impl->generate(features.get(), from_rust(prompts), opts);
+
+  Vec<WhisperGenerationResult> res;
+  for (auto &future : futures) {
+    const auto &r = future.get();
+    res.push_back(WhisperGenerationResult{
+        to_rust<WhisperVecString>(r.sequences),
+        to_rust<WhisperVecUSize>(r.sequences_ids), to_rust(r.scores),
+        r.no_speech_prob});
+  }
+  return res;
+}
+
+std::unique_ptr<Whisper> new_whisper(const Str model_path, const bool cuda,
+                                     const WhisperConfig config) {
+  ctranslate2::ComputeType compute_type;
+  switch (config.compute_type) {
+  case WhisperComputeType::Default:
+    compute_type = ctranslate2::ComputeType::DEFAULT;
+    break;
+  case WhisperComputeType::Auto:
+    compute_type = ctranslate2::ComputeType::AUTO;
+    break;
+  case WhisperComputeType::Float32:
+    compute_type = ctranslate2::ComputeType::FLOAT32;
+    break;
+  case WhisperComputeType::Int8:
+    compute_type = ctranslate2::ComputeType::INT8;
+    break;
+  case WhisperComputeType::Int8Float16:
+    compute_type = ctranslate2::ComputeType::INT8_FLOAT16;
+    break;
+  case WhisperComputeType::Int16:
+    compute_type = ctranslate2::ComputeType::INT16;
+    break;
+  case WhisperComputeType::Float16:
+    compute_type = ctranslate2::ComputeType::FLOAT16;
+    break;
+  };
+
+  return std::make_unique<Whisper>(
+      std::make_shared<ctranslate2::models::Whisper>(
+          static_cast<string>(model_path),
+          cuda ? ctranslate2::Device::CUDA : ctranslate2::Device::CPU,
+          compute_type, from_rust(config.device_indices),
+          ctranslate2::ReplicaPoolConfig{config.num_threads_per_replica,
+                                         config.max_queued_batches,
+                                         config.cpu_core_offset}),
+      cuda && config.device_indices.size() > 1);
+}
@@ -0,0 +1,367 @@
+// whisper.rs
+//
+// Copyright (c) 2023 Junpei Kawamoto
+//
+// This software is released under the MIT License.
+//
+// http://opensource.org/licenses/mit-license.php
+
+//! Bindings for ctranslate2::models::Whisper.
+//!
+//! Mel features are encoded once by [`Whisper::encode`], and the returned [`EncoderOutput`] can
+//! be passed to both [`Whisper::detect_language`] and [`Whisper::generate`] so that language
+//! detection does not run a second encoder pass:
+//!
+//! ```no_run
+//! # use ctranslate2::config::{Config, Device};
+//! # use ctranslate2::whisper::{Whisper, WhisperOptions};
+//! # fn main() -> anyhow::Result<()> {
+//! # let (mel, batch_size, chunk_length) = (vec![0f32; 0], 0, 3000);
+//! let whisper = Whisper::new("/path/to/whisper-model", Device::CPU, Config::default())?;
+//! let features = whisper.encode(&mel, [batch_size, whisper.n_mels(), chunk_length])?;
+//!
+//! let prompts = whisper
+//!     .detect_language(&features)?
+//!     .into_iter()
+//!     .map(|languages| {
+//!         vec![
+//!             "<|startoftranscript|>".to_string(),
+//!             languages[0].0.clone(),
+//!             "<|transcribe|>".to_string(),
+//!             "<|notimestamps|>".to_string(),
+//!         ]
+//!     })
+//!     .collect::<Vec<_>>();
+//! let res = whisper.generate(&features, &prompts, &WhisperOptions::default())?;
+//! # Ok(())
+//! # }
+//! ```
+
+use cxx::UniquePtr;
+
+use crate::config::{ComputeType, Config, Device};
+
+#[cxx::bridge]
+mod ffi {
+    struct WhisperVecStr<'a> {
+        v: Vec<&'a str>,
+    }
+
+    struct WhisperVecString {
+        v: Vec<String>,
+    }
+
+    struct WhisperVecUSize {
+        v: Vec<usize>,
+    }
+
+    enum WhisperComputeType {
+        Default,
+        Auto,
+        Float32,
+        Int8,
+        Int8Float16,
+        Int16,
+        Float16,
+    }
+
+    struct WhisperConfig {
+        compute_type: WhisperComputeType,
+        device_indices: Vec<i32>,
+        num_threads_per_replica: usize,
+        max_queued_batches: i64,
+        cpu_core_offset: i32,
+    }
+
+    struct WhisperOptions {
+        beam_size: usize,
+        patience: f32,
+        length_penalty: f32,
+        repetition_penalty: f32,
+        no_repeat_ngram_size: usize,
+        max_length: usize,
+        sampling_topk: usize,
+        sampling_temperature: f32,
+        num_hypotheses: usize,
+        return_scores: bool,
+        return_no_speech_prob: bool,
+        max_initial_timestamp_index: usize,
+        suppress_blank: bool,
+        suppress_tokens: Vec<i32>,
+    }
+
+    struct WhisperGenerationResult {
+        sequences: Vec<WhisperVecString>,
+        sequences_ids: Vec<WhisperVecUSize>,
+        scores: Vec<f32>,
+        no_speech_prob: f32,
+    }
+
+    struct WhisperLanguage {
+        language: String,
+        probability: f32,
+    }
+
+    struct WhisperVecLanguage {
+        v: Vec<WhisperLanguage>,
+    }
+
+    unsafe extern "C++" {
+        include!("ctranslate2/include/whisper.h");
+
+        type Whisper;
+        type WhisperFeatures;
+
+        fn new_whisper(
+            model_path: &str,
+            cuda: bool,
+            config: WhisperConfig,
+        ) -> Result<UniquePtr<Whisper>>;
+
+        fn is_multilingual(self: &Whisper) -> bool;
+
+        fn n_mels(self: &Whisper) -> usize;
+
+        fn encode(
+            self: &Whisper,
+            features: &[f32],
+            shape: &[usize],
+        ) -> Result<UniquePtr<WhisperFeatures>>;
+
+        fn detect_language(
+            self: &Whisper,
+            features: &WhisperFeatures,
+        ) -> Result<Vec<WhisperVecLanguage>>;
+
+        fn generate(
+            self: &Whisper,
+            features: &WhisperFeatures,
+            prompts: Vec<WhisperVecStr>,
+            options: WhisperOptions,
+        ) -> Result<Vec<WhisperGenerationResult>>;
+    }
+}
+
+/// A speech recognizer based on Whisper.
+pub struct Whisper {
+    ptr: UniquePtr<ffi::Whisper>,
+}
+
+impl Whisper {
+    /// Initializes the Whisper model.
+    pub fn new<T: AsRef<str>>(
+        model_path: T,
+        device: Device,
+        config: Config,
+    ) -> anyhow::Result<Whisper> {
+        Ok(Whisper {
+            ptr: ffi::new_whisper(
+                model_path.as_ref(),
+                match device {
+                    Device::CPU => false,
+                    Device::CUDA => true,
+                },
+                ffi::WhisperConfig {
+                    compute_type: match config.compute_type {
+                        ComputeType::Default => ffi::WhisperComputeType::Default,
+                        ComputeType::Auto => ffi::WhisperComputeType::Auto,
+                        ComputeType::Float32 => ffi::WhisperComputeType::Float32,
+                        ComputeType::Int8 => ffi::WhisperComputeType::Int8,
+                        ComputeType::Int8Float16 => ffi::WhisperComputeType::Int8Float16,
+                        ComputeType::Int16 => ffi::WhisperComputeType::Int16,
+                        ComputeType::Float16 => ffi::WhisperComputeType::Float16,
+                    },
+                    device_indices: config.device_indices,
+                    num_threads_per_replica: config.num_threads_per_replica,
+                    max_queued_batches: config.max_queued_batches,
+                    cpu_core_offset: config.cpu_core_offset,
+                },
+            )?,
+        })
+    }
+
+    /// Returns true if the model is multilingual.
+    pub fn is_multilingual(&self) -> bool {
+        self.ptr.is_multilingual()
+    }
+
+    /// Returns the number of mels expected by the model.
+    pub fn n_mels(&self) -> usize {
+        self.ptr.n_mels()
+    }
+
+    /// Encodes a batch of log-Mel spectrograms.
+    ///
+    /// `features` is a row-major buffer with the shape `[batch_size, n_mels, chunk_length]`.
+    /// Pass many files at once to run the encoder over them as a single batch.
+    pub fn encode(&self, features: &[f32], shape: [usize; 3]) -> anyhow::Result<EncoderOutput> {
+        Ok(EncoderOutput {
+            ptr: self.ptr.encode(features, &shape)?,
+        })
+    }
+
+    /// Returns the probability of each language for each example in the batch, sorted by
+    /// decreasing probability.
+    pub fn detect_language(
+        &self,
+        features: &EncoderOutput,
+    ) -> anyhow::Result<Vec<Vec<(String, f32)>>> {
+        Ok(self
+            .ptr
+            .detect_language(&features.ptr)?
+            .into_iter()
+            .map(|r| {
+                r.v.into_iter()
+                    .map(|l| (l.language, l.probability))
+                    .collect()
+            })
+            .collect())
+    }
+
+    /// Transcribes a batch of encoded features.
+    ///
+    /// `prompts` are the batch of prompts that start the decoding, e.g.
+    /// `["<|startoftranscript|>", "<|en|>", "<|transcribe|>"]`.
+    pub fn generate<T: AsRef<str>>(
+        &self,
+        features: &EncoderOutput,
+        prompts: &[Vec<T>],
+        options: &WhisperOptions,
+    ) -> anyhow::Result<Vec<WhisperGenerationResult>> {
+        Ok(self
+            .ptr
+            .generate(&features.ptr, vec_ffi_vecstr(prompts), options.to_ffi())?
+            .into_iter()
+            .map(WhisperGenerationResult::from)
+            .collect())
+    }
+}
+
+/// Encoder output shared between [`Whisper::detect_language`] and [`Whisper::generate`].
+pub struct EncoderOutput {
+    ptr: UniquePtr<ffi::WhisperFeatures>,
+}
+
+/// The set of options for Whisper generation.
+#[derive(Debug)]
+pub struct WhisperOptions {
+    /// Beam size to use for beam search (set 1 to run greedy search).
+    pub beam_size: usize,
+    /// Beam search patience factor, as described in <https://arxiv.org/abs/2204.05424>.
+    /// The decoding will continue until beam_size*patience hypotheses are finished.
+    pub patience: f32,
+    /// Exponential penalty applied to the length during beam search.
+    pub length_penalty: f32,
+    /// Penalty applied to the score of previously generated tokens, as described in
+    /// <https://arxiv.org/abs/1909.05858> (set > 1 to penalize).
+    pub repetition_penalty: f32,
+    /// Prevent repetitions of ngrams with this size (set 0 to disable).
+    pub no_repeat_ngram_size: usize,
+    /// Maximum generation length.
+    pub max_length: usize,
+    /// Randomly sample from the top K candidates (set 0 to sample from the full distribution).
+    pub sampling_topk: usize,
+    /// High temperature increase randomness.
+    pub sampling_temperature: f32,
+    /// Number of hypotheses to include in the result.
+    pub num_hypotheses: usize,
+    /// Include scores in the result.
+    pub return_scores: bool,
+    /// Include the probability of the no speech token in the result.
+    pub return_no_speech_prob: bool,
+    /// Maximum index of the first predicted timestamp.
+    pub max_initial_timestamp_index: usize,
+    /// Suppress blank outputs at the beginning of the sampling.
+    pub suppress_blank: bool,
+    /// List of token IDs to suppress.
+    /// -1 will suppress a default set of symbols as defined in the model config.json file.
+    pub suppress_tokens: Vec<i32>,
+}
+
+impl Default for WhisperOptions {
+    fn default() -> Self {
+        Self {
+            beam_size: 5,
+            patience: 1.,
+            length_penalty: 1.,
+            repetition_penalty: 1.,
+            no_repeat_ngram_size: 0,
+            max_length: 448,
+            sampling_topk: 1,
+            sampling_temperature: 1.,
+            num_hypotheses: 1,
+            return_scores: false,
+            return_no_speech_prob: false,
+            max_initial_timestamp_index: 50,
+            suppress_blank: true,
+            suppress_tokens: vec![-1],
+        }
+    }
+}
+
+impl WhisperOptions {
+    #[inline]
+    fn to_ffi(&self) -> ffi::WhisperOptions {
+        ffi::WhisperOptions {
+            beam_size: self.beam_size,
+            patience: self.patience,
+            length_penalty: self.length_penalty,
+            repetition_penalty: self.repetition_penalty,
+            no_repeat_ngram_size: self.no_repeat_ngram_size,
+            max_length: self.max_length,
+            sampling_topk: self.sampling_topk,
+            sampling_temperature: self.sampling_temperature,
+            num_hypotheses: self.num_hypotheses,
+            return_scores: self.return_scores,
+            return_no_speech_prob: self.return_no_speech_prob,
+            max_initial_timestamp_index: self.max_initial_timestamp_index,
+            suppress_blank: self.suppress_blank,
+            suppress_tokens: self.suppress_tokens.clone(),
+        }
+    }
+}
+
+/// A Whisper generation result.
+#[derive(Debug)]
+pub struct WhisperGenerationResult {
+    /// Generated sequences of tokens.
+    pub sequences: Vec<Vec<String>>,
+    /// Generated sequences of token IDs.
+    pub sequences_ids: Vec<Vec<usize>>,
+    /// Score of each sequence (empty if `return_scores` was disabled).
+    pub scores: Vec<f32>,
+    /// Probability of the no speech token (0 if `return_no_speech_prob` was disabled).
+    pub no_speech_prob: f32,
+}
+
+impl From<ffi::WhisperGenerationResult> for WhisperGenerationResult {
+    fn from(res: ffi::WhisperGenerationResult) -> Self {
+        Self {
+            sequences: res.sequences.into_iter().map(|c| c.v).collect(),
+            sequences_ids: res.sequences_ids.into_iter().map(|c| c.v).collect(),
+            scores: res.scores,
+            no_speech_prob: res.no_speech_prob,
+        }
+    }
+}
+
+impl WhisperGenerationResult {
+    /// Returns the number of sequences.
+    pub fn num_sequences(&self) -> usize {
+        self.sequences.len()
+    }
+
+    /// Returns true if this result has scores.
+    pub fn has_scores(&self) -> bool {
+        !self.scores.is_empty()
+    }
+}
+
+#[inline]
+fn vec_ffi_vecstr<T: AsRef<str>>(src: &[Vec<T>]) -> Vec<ffi::WhisperVecStr> {
+    src.iter()
+        .map(|v| ffi::WhisperVecStr {
+            v: v.iter().map(|s| s.as_ref()).collect(),
+        })
+        .collect()
+}